@@ -25,6 +25,7 @@
 #include "level.hpp"
 #include "preferences.hpp"
 #include "stats.hpp"
+#include "thread.hpp"
 #include "variant.hpp"
 
 #if defined(_WINDOWS)
@@ -104,7 +105,8 @@ fatal_assert_failure_exception::fatal_assert_failure_exception(const std::string
 }
 
 namespace {
-	int throw_validation_failure = 0;
+	//a thread recovering from asserts doesn't make others recover.
+	THREAD_LOCAL int throw_validation_failure = 0;
 	int throw_fatal = 0;
 }
 
@@ -16,6 +16,7 @@
 */
 #include "asserts.hpp"
 #include "b2d_ffl.hpp"
+#include "gl_state.hpp"
 #include "graphics.hpp"			// -- needed for debug functions
 #include "json_parser.hpp"
 #include "level.hpp"
@@ -1517,7 +1518,7 @@ namespace box2d
 		}
 #if defined(USE_SHADERS)
 		glEnable(GL_BLEND);
-		glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glColor4f(color.r *0.5f, color.g*0.5f, color.b*0.5f, 0.5f);
 		gles2::manager gles2_manager(gles2::get_simple_shader());
 		gles2::active_shader()->shader()->vertex_array(2, GL_FLOAT, 0, 0, &varray.front());
@@ -1529,7 +1530,7 @@ namespace box2d
 		glColor4ub(255, 255, 255, 255);
 #else
 		glEnable(GL_BLEND);
-		glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glDisable(GL_TEXTURE_2D);
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 		glLineWidth(1.0f);
@@ -1594,7 +1595,7 @@ namespace box2d
 		}
 #if defined(USE_SHADERS)
 		glEnable(GL_BLEND);
-		glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glColor4f(color.r *0.5f, color.g*0.5f, color.b*0.5f, 0.5f);
 		gles2::manager gles2_manager(gles2::get_simple_shader());
 		gles2::active_shader()->shader()->vertex_array(2, GL_FLOAT, 0, 0, &varray.front());
@@ -1615,7 +1616,7 @@ namespace box2d
 		glColor4ub(255, 255, 255, 255);
 #else
 		glEnable(GL_BLEND);
-		glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glDisable(GL_TEXTURE_2D);
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 		glLineWidth(1.0f);
@@ -44,7 +44,7 @@ std::map<int, task> task_map;
 void run_task(boost::function<void()> job, int task_id)
 {
 	job();
-	threading::lock(*completed_tasks_mutex);
+	threading::lock lck(*completed_tasks_mutex);
 	completed_tasks.push_back(task_id);
 }
 
@@ -77,7 +77,7 @@ void pump()
 {
 	std::vector<int> completed;
 	{
-		threading::lock(*completed_tasks_mutex);
+		threading::lock lck(*completed_tasks_mutex);
 		completed.swap(completed_tasks);
 	}
 
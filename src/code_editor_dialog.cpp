@@ -35,6 +35,7 @@
 #include "formula_function_registry.hpp"
 #include "formula_object.hpp"
 #include "frame.hpp"
+#include "gl_state.hpp"
 #include "image_widget.hpp"
 #include "json_parser.hpp"
 #include "label.hpp"
@@ -1172,14 +1173,14 @@ COMMAND_LINE_UTILITY(codeedit)
 	glViewport(0, 0, 600, 600);
 	glEnable(GL_BLEND);
 	glEnable(GL_TEXTURE_2D);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 #else
 	glShadeModel(GL_SMOOTH);
 	glEnable(GL_BLEND);
 	glEnable(GL_TEXTURE_2D);
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 #endif
 
 	const font::manager font_manager;
@@ -17,25 +17,73 @@
 #ifndef CONCURRENT_CACHE_HPP_INCLUDED
 #define CONCURRENT_CACHE_HPP_INCLUDED
 
+#include <algorithm>
+#include <list>
 #include <map>
+#include <ostream>
 #include <vector>
 
+#include <boost/function.hpp>
+
 #include "thread.hpp"
 
+//an amount of memory which one or more caches share. 'limit' is the
+//most bytes the caches should use, or 0 for no limit. It's fixed once the
+//budget is made, so it can be read from any thread without the lock.
+class cache_budget
+{
+public:
+	explicit cache_budget(size_t limit) : limit_(limit), used_(0)
+	{}
+
+	size_t limit() const { return limit_; }
+
+	size_t used() const { threading::lock l(mutex_); return used_; }
+	void add(size_t bytes) { threading::lock l(mutex_); used_ += bytes; }
+	void remove(size_t bytes) { threading::lock l(mutex_); used_ -= bytes; }
+
+	bool exceeds(size_t target) const { threading::lock l(mutex_); return used_ > target; }
+private:
+	const size_t limit_;
+	size_t used_;
+	mutable threading::mutex mutex_;
+};
+
 template<typename Key, typename Value>
 class concurrent_cache
 {
 public:
 	typedef std::map<Key, Value> map_type;
+
+	concurrent_cache() : budget_(NULL), bytes_(0), hits_(0), misses_(0), evictions_(0)
+	{}
+
+	//makes entries which are put with a size count against the budget.
+	//When it's exceeded, the least recently used entries which
+	//'evictable' allows to go are dropped until it's met again.
+	void set_budget(cache_budget* budget, boost::function<bool(const Value&)> evictable) {
+		threading::lock l(mutex_);
+		budget_ = budget;
+		evictable_ = evictable;
+	}
+
 	size_t size() const { threading::lock l(mutex_); return map_.size(); }
-	const Value& get(const Key& key) {
+	Value get(const Key& key) {
 		threading::lock l(mutex_);
 		typename map_type::const_iterator itor = map_.find(key);
 		if(itor != map_.end()) {
+			++hits_;
+			if(budget_) {
+				typename usage_map::iterator u = usage_.find(key);
+				if(u != usage_.end()) {
+					lru_.splice(lru_.end(), lru_, u->second.lru);
+				}
+			}
+
 			return itor->second;
 		} else {
-			static const Value empty_result = Value();
-			return empty_result;
+			++misses_;
+			return Value();
 		}
 	}
 
@@ -44,9 +92,37 @@ public:
 		map_[key] = value;
 	}
 
+	void put(const Key& key, const Value& value, size_t bytes) {
+		threading::lock l(mutex_);
+		map_[key] = value;
+		if(budget_ == NULL) {
+			return;
+		}
+
+		typename usage_map::iterator itor = usage_.find(key);
+		if(itor == usage_.end()) {
+			itor = usage_.insert(std::pair<Key, usage>(key, usage(lru_.insert(lru_.end(), key)))).first;
+		} else {
+			lru_.splice(lru_.end(), lru_, itor->second.lru);
+		}
+
+		usage& u = itor->second;
+		budget_->remove(u.bytes);
+		budget_->add(bytes);
+		bytes_ += bytes - u.bytes;
+		u.bytes = bytes;
+
+		if(budget_->limit() && budget_->exceeds(budget_->limit())) {
+			//go some way under the limit, so we don't have to do this
+			//again on the next put.
+			evict(budget_->limit() - budget_->limit()/8);
+		}
+	}
+
 	void erase(const Key& key) {
 		threading::lock l(mutex_);
 		map_.erase(key);
+		forget_usage(key);
 	}
 
 	int count(const Key& key) const {
@@ -57,6 +133,28 @@ public:
 	void clear() {
 		threading::lock l(mutex_);
 		map_.clear();
+		if(budget_) {
+			budget_->remove(bytes_);
+		}
+
+		usage_.clear();
+		lru_.clear();
+		bytes_ = 0;
+	}
+
+	//drops all the entries 'evictable' allows to go.
+	void evict_unused() {
+		threading::lock l(mutex_);
+		typename map_type::iterator i = map_.begin();
+		while(i != map_.end()) {
+			if(evictable_ && evictable_(i->second)) {
+				forget_usage(i->first);
+				map_.erase(i++);
+				++evictions_;
+			} else {
+				++i;
+			}
+		}
 	}
 
 	std::vector<Key> get_keys() {
@@ -69,6 +167,11 @@ public:
 		return result;
 	}
 
+	size_t bytes() const { threading::lock l(mutex_); return bytes_; }
+	int hits() const { threading::lock l(mutex_); return hits_; }
+	int misses() const { threading::lock l(mutex_); return misses_; }
+	int evictions() const { threading::lock l(mutex_); return evictions_; }
+
 	struct lock : public threading::lock {
 		explicit lock(concurrent_cache& cache) : threading::lock(cache.mutex_), cache_(cache) {
 		}
@@ -80,8 +183,64 @@ public:
 	};
 
 private:
+	//the keys of the entries with a size, least recently used first.
+	typedef std::list<Key> lru_list;
+
+	struct usage {
+		explicit usage(typename lru_list::iterator lru) : bytes(0), lru(lru)
+		{}
+		size_t bytes;
+		typename lru_list::iterator lru;
+	};
+
+	typedef std::map<Key, usage> usage_map;
+
+	void forget_usage(const Key& key) {
+		typename usage_map::iterator u = usage_.find(key);
+		if(u != usage_.end()) {
+			budget_->remove(u->second.bytes);
+			bytes_ -= u->second.bytes;
+			lru_.erase(u->second.lru);
+			usage_.erase(u);
+		}
+	}
+
+	//drops the least recently used entries until the budget's use is
+	//down to 'target', or there are none left which may go.
+	void evict(size_t target) {
+		typename lru_list::iterator k = lru_.begin();
+		while(k != lru_.end() && budget_->exceeds(target)) {
+			//forget_usage() removes the key from the list.
+			const Key key = *k++;
+			typename map_type::iterator i = map_.find(key);
+			if(i != map_.end()) {
+				if(evictable_ && !evictable_(i->second)) {
+					continue;
+				}
+
+				map_.erase(i);
+				++evictions_;
+			}
+
+			forget_usage(key);
+		}
+	}
+
 	map_type map_;
+	usage_map usage_;
+	lru_list lru_;
 	mutable threading::mutex mutex_;
+
+	cache_budget* budget_;
+	boost::function<bool(const Value&)> evictable_;
+	size_t bytes_;
+	int hits_, misses_, evictions_;
 };
 
+template<typename Key, typename Value>
+void write_cache_stats(std::ostream& s, const char* name, const concurrent_cache<Key, Value>& cache)
+{
+	s << name << " cache: " << cache.size() << " entries; " << cache.bytes()/1024 << "KB; " << cache.hits() << " hits; " << cache.misses() << " misses; " << cache.evictions() << " evictions\n";
+}
+
 #endif
@@ -36,7 +36,9 @@ uint32_t htonl(uint32_t nl)
 #include <boost/cstdint.hpp>
 
 #include <stdio.h>
+#include <string.h>
 
+#include <algorithm>
 #include <stack>
 #include <vector>
 
@@ -49,6 +51,8 @@ uint32_t htonl(uint32_t nl)
 #include "multiplayer.hpp"
 #include "preferences.hpp"
 #include "iphone_controls.hpp"
+#include "random.hpp"
+#include "unit_test.hpp"
 #include "variant.hpp"
 #if !SDL_VERSION_ATLEAST(2, 0, 0)
 #include "key.hpp"
@@ -87,6 +91,9 @@ int32_t highest_confirmed[MAX_PLAYERS];
 //for each player, the highest confirmed cycle of ours that they have
 int32_t remote_highest_confirmed[MAX_PLAYERS];
 
+//for each player, the highest cycle of ours we have sent them
+int32_t highest_sent[MAX_PLAYERS];
+
 std::map<int, int> our_checksums;
 
 int starting_cycles;
@@ -97,6 +104,17 @@ int delay;
 
 int first_invalid_cycle_var = -1;
 
+//the random seed when the level's first cycle started, which a replay
+//needs to play out the same way.
+unsigned int starting_seed;
+bool level_started;
+
+//the replay being played, if any.
+std::vector<ControlFrame> replay_frames;
+int replay_frame;
+unsigned int replay_seed;
+int replay_checksum_;
+
 key_type sdlk[NUM_CONTROLS] = {
 	SDLK_UP,
 	SDLK_DOWN,
@@ -205,6 +223,7 @@ void new_level(int level_starting_cycles, int level_nplayers, int level_local_pl
 {
 	std::cerr << "SET STARTING CYCLES: " << level_starting_cycles << "\n";
 	starting_cycles = level_starting_cycles;
+	level_started = false;
 	nplayers = level_nplayers;
 	local_player = level_local_player;
 	foreach(std::vector<ControlFrame>& v, controls) {
@@ -218,8 +237,25 @@ void new_level(int level_starting_cycles, int level_nplayers, int level_local_pl
 	foreach(int32_t& highest, remote_highest_confirmed) {
 		highest = 0;
 	}
+
+	foreach(int32_t& highest, highest_sent) {
+		highest = -1;
+	}
 }
 
+void start_cycle()
+{
+	if(level_started) {
+		return;
+	}
+
+	level_started = true;
+	if(replay_frame == 0 && replay_frames.empty() == false) {
+		rng::set_seed(replay_seed);
+	}
+
+	starting_seed = rng::get_seed();
+}
 
 local_controls_lock::local_controls_lock(unsigned char state)
 {
@@ -287,12 +323,17 @@ void read_local_controls()
 		return;
 	}
 
-	if(preferences::no_iphone_controls() == false && level::current().allow_touch_controls() == true) {
+	//controls can be read without a level, as when testing replays.
+	const bool touch_controls = preferences::no_iphone_controls() == false && level::current_ptr() && level::current_ptr()->allow_touch_controls();
+	if(touch_controls) {
 		iphone_controls::read_controls();
 	}
 
 	ControlFrame state;
-	if(local_control_locks.empty()) {
+	if(replay_frame < replay_frames.size()) {
+		//the replay's controls take the place of our own.
+		state = replay_frames[replay_frame++];
+	} else if(local_control_locks.empty()) {
 #if !defined(__ANDROID__)
 		bool ignore_keypresses = false;
 #if SDL_VERSION_ATLEAST(2, 0, 0)
@@ -323,7 +364,7 @@ void read_local_controls()
 		}
 #endif
 
-		if(preferences::no_iphone_controls() == false && level::current().allow_touch_controls() == true) {
+		if(touch_controls) {
 			if(iphone_controls::up()) { state.keys |= (1 << CONTROL_UP);}
 			if(iphone_controls::down()) { state.keys |= (1 << CONTROL_DOWN);}
 			if(iphone_controls::left()) { state.keys |= (1 << CONTROL_LEFT);}
@@ -411,17 +452,112 @@ void set_delay(int value)
 	delay = value;
 }
 
+namespace {
+//the most cycles a control packet repeats. Every packet repeats all the
+//cycles the player it's for hasn't acknowledged, so that lost packets
+//don't matter; this bounds how far back that goes. 0 means no bound.
+PREF_INT(control_redundancy_window, 0);
+
+//controls are written as runs of identical frames: a byte with the length
+//of the run, the keys, and the user data followed by a null. The controls
+//are nearly always the same as the cycle before, so what a packet costs
+//depends on how often they changed rather than on how many cycles it
+//repeats.
+void write_frames(std::vector<char>& v, const std::vector<ControlFrame>& frames, int begin, int end)
+{
+	while(begin != end) {
+		int run_end = begin + 1;
+		while(run_end != end && run_end - begin < 255 && frames[run_end] == frames[begin]) {
+			++run_end;
+		}
+
+		v.push_back(static_cast<char>(run_end - begin));
+		v.push_back(frames[begin].keys);
+		const char* user = frames[begin].user.c_str();
+		v.insert(v.end(), user, user + frames[begin].user.size()+1);
+		begin = run_end;
+	}
+}
+
+//reads 'nframes' frames written by write_frames(), returning false if the
+//buffer doesn't hold them.
+bool read_frames(const char*& buf, const char* end_buf, int nframes, std::vector<ControlFrame>* frames)
+{
+	const int target = frames->size() + nframes;
+	while(frames->size() < target) {
+		if(end_buf - buf < 3) {
+			return false;
+		}
+
+		const int run = static_cast<unsigned char>(*buf++);
+		ControlFrame state;
+		state.keys = *buf++;
+
+		const char* user_end = static_cast<const char*>(memchr(buf, 0, end_buf - buf));
+		if(run == 0 || user_end == NULL || frames->size() + run > target) {
+			return false;
+		}
+
+		state.user.assign(buf, user_end);
+		buf = user_end + 1;
+		frames->insert(frames->end(), run, state);
+	}
+
+	return true;
+}
+
+void write_int32(std::vector<char>& v, int32_t n)
+{
+	n = htonl(n);
+	v.resize(v.size() + 4);
+	memcpy(&v[v.size()-4], &n, 4);
+}
+
+int32_t read_int32(const char*& buf)
+{
+	int32_t n;
+	memcpy(&n, buf, 4);
+	buf += 4;
+	return ntohl(n);
+}
+
+//traffic in the current second and the one before it.
+struct traffic_stats {
+	traffic_stats() : bytes_sent(0), bytes_received(0), cycles_resent(0)
+	{}
+	int bytes_sent, bytes_received, cycles_resent;
+};
+
+traffic_stats this_second_traffic, last_second_traffic;
+int traffic_second = -1;
+
+traffic_stats& current_traffic()
+{
+	const int second = SDL_GetTicks()/1000;
+	if(second != traffic_second) {
+		last_second_traffic = second == traffic_second+1 ? this_second_traffic : traffic_stats();
+		this_second_traffic = traffic_stats();
+		traffic_second = second;
+	}
+
+	return this_second_traffic;
+}
+}
+
 void read_control_packet(const char* buf, size_t len)
 {
 	++npackets_received;
+	current_traffic().bytes_received += len;
 
-	if(len < 13) {
+	const char* end_buf = buf + len;
+
+	//our slot, cycle, checksum, an acknowledgement for each player and
+	//the number of cycles.
+	if(len < 13 + 4*nplayers) {
 		fprintf(stderr, "ERROR: CONTROL PACKET TOO SHORT: %d\n", (int)len);
 		return;
 	}
 
-	const char* end_buf = buf + len;
-
 	int slot = *buf++;
 
 	if(slot < 0 || slot >= nplayers) {
@@ -434,20 +570,14 @@ void read_control_packet(const char* buf, size_t len)
 		return;
 	}
 
-	int32_t current_cycle;
-	memcpy(&current_cycle, buf, 4);
-	current_cycle = ntohl(current_cycle);
-	buf += 4;
+	const int32_t current_cycle = read_int32(buf);
 
 	if(current_cycle < highest_confirmed[slot]) {
 		fprintf(stderr, "DISCARDING PACKET -- OUT OF ORDER: %d < %d\n", current_cycle, highest_confirmed[slot]);
 		return;
 	}
 
-	int32_t checksum;
-	memcpy(&checksum, buf, 4);
-	checksum = ntohl(checksum);
-	buf += 4;
+	const int32_t checksum = read_int32(buf);
 
 	if(checksum && our_checksums[current_cycle-1]) {
 		if(checksum == our_checksums[current_cycle-1]) {
@@ -458,61 +588,39 @@ void read_control_packet(const char* buf, size_t len)
 
 	}
 
-	int32_t highest_cycle;
-	memcpy(&highest_cycle, buf, 4);
-	highest_cycle = ntohl(highest_cycle);
-	buf += 4;
-
-	if(highest_cycle > remote_highest_confirmed[slot]) {
-		remote_highest_confirmed[slot] = highest_cycle;
+	//how far the sender has our controls, which is all of their
+	//acknowledgements we care about.
+	for(int n = 0; n != nplayers; ++n) {
+		const int32_t highest_cycle = read_int32(buf);
+		if(n == local_player && highest_cycle > remote_highest_confirmed[slot]) {
+			remote_highest_confirmed[slot] = highest_cycle;
+		}
 	}
 
-	int32_t ncycles;
-	memcpy(&ncycles, buf, 4);
-	ncycles = ntohl(ncycles);
-	buf += 4;
+	const int32_t ncycles = read_int32(buf);
 
-	if(*(end_buf-1) != 0) {
-		fprintf(stderr, "bad packet, no null terminator\n");
+	if(ncycles <= 0) {
+		fprintf(stderr, "bad packet, no cycles\n");
 		return;
 	}
 
-	int start_cycle = 1 + current_cycle - ncycles;
-
-	//if we already have data up to this point, don't reprocess it.
-	if(start_cycle < highest_confirmed[slot]) {
-		int diff = highest_confirmed[slot] - start_cycle;
-		ncycles -= diff;
-
-		for(int n = 0; n != diff && buf != end_buf; ++n) {
-			++buf;
-			if(buf == end_buf) {
-				fprintf(stderr, "bad packet, incorrect null termination\n");
-				return;
-			}
-			buf += strlen(buf)+1;
-		}
-
-		start_cycle = highest_confirmed[slot];
+	//a packet only repeats the last control_redundancy_window cycles, so
+	//if we've missed more than that there is a gap. The cycles in it keep
+	//the controls we predicted for them.
+	const int start_cycle = 1 + current_cycle - ncycles;
+	if(start_cycle > highest_confirmed[slot] + 1) {
+		fprintf(stderr, "cycles %d-%d leave a gap after %d\n", start_cycle, current_cycle, highest_confirmed[slot]);
 	}
 
-	for(int cycle = start_cycle; cycle <= current_cycle; ++cycle) {
-		if(buf == end_buf) {
-			fprintf(stderr, "bad packet, incorrect number of null terminators\n");
-			return;
-		}
-		ControlFrame state;
-		state.keys = *buf;
-
-		++buf;
-		if(buf == end_buf) {
-			fprintf(stderr, "bad packet, incorrect number of null terminators\n");
-			return;
-		}
-
-		state.user = buf;
-		buf += state.user.size()+1;
+	std::vector<ControlFrame> frames;
+	if(!read_frames(buf, end_buf, ncycles, &frames) || buf != end_buf) {
+		fprintf(stderr, "bad packet, frames don't match the number of cycles\n");
+		return;
+	}
 
+	//if we already have data up to this point, don't reprocess it.
+	for(int cycle = std::max<int>(start_cycle, highest_confirmed[slot]); cycle <= current_cycle; ++cycle) {
+		const ControlFrame& state = frames[cycle - start_cycle];
 		if(cycle < controls[slot].size()) {
 			if(controls[slot][cycle] != state) {
 				fprintf(stderr, "RECEIVED CORRECTION\n");
@@ -542,57 +650,93 @@ void read_control_packet(const char* buf, size_t len)
 	//mark our highest confirmed cycle for this player
 	highest_confirmed[slot] = current_cycle;
 
-	assert(buf == end_buf);
-
 	++ngood_packets;
 }
 
-void write_control_packet(std::vector<char>& v)
+void write_control_packet(std::vector<char>& v, int player)
 {
 	if(local_player < 0 || local_player >= nplayers) {
 		fprintf(stderr, "NO VALID LOCAL PLAYER\n");
 		return;
 	}
 
+	ASSERT_LOG(player >= 0 && player < nplayers && player != local_player, "Bad player to write a control packet for: " << player);
+
+	const std::vector<ControlFrame>& frames = controls[local_player];
+
+	//the cycles the player hasn't acknowledged, always through the newest
+	//one, going back at most control_redundancy_window cycles.
+	const int end = frames.size();
+	int begin = std::max<int>(0, std::min<int>(remote_highest_confirmed[player], end-1));
+	if(g_control_redundancy_window > 0) {
+		begin = std::max<int>(begin, end - g_control_redundancy_window);
+	}
+
+	const size_t start_size = v.size();
+
 	//write our slot to the packet
 	v.push_back(local_player);
 
-	//write our current cycle
-	int32_t current_cycle = controls[local_player].size()-1;
-	int32_t current_cycle_net = htonl(current_cycle);
-	v.resize(v.size() + 4);
-	memcpy(&v[v.size()-4], &current_cycle_net, 4);
+	//write the last cycle in the packet
+	const int32_t current_cycle = end-1;
+	write_int32(v, current_cycle);
 
 	//write our checksum of game state
-	int32_t checksum = our_checksums[current_cycle-1];
-	int32_t checksum_net = htonl(checksum);
-	v.resize(v.size() + 4);
-	memcpy(&v[v.size()-4], &checksum_net, 4);
+	write_int32(v, our_checksums[current_cycle-1]);
 
-	//write our highest confirmed cycle
-	int32_t highest_cycle = htonl(our_highest_confirmed());
-	v.resize(v.size() + 4);
-	memcpy(&v[v.size()-4], &highest_cycle, 4);
+	//write how far we have each player's controls
+	for(int n = 0; n != nplayers; ++n) {
+		write_int32(v, highest_confirmed[n]);
+	}
+
+	write_int32(v, end - begin);
+	write_frames(v, frames, begin, end);
 
-	int32_t ncycles_to_write = 1+current_cycle - their_highest_confirmed();
+	last_packet_size_ = end - begin;
 
-	last_packet_size_ = ncycles_to_write;
-	if(ncycles_to_write > controls[local_player].size()) {
-		ncycles_to_write = controls[local_player].size();
+	traffic_stats& traffic = current_traffic();
+	traffic.bytes_sent += v.size() - start_size;
+	if(highest_sent[player] >= begin) {
+		traffic.cycles_resent += std::min<int>(highest_sent[player], end-1) - begin + 1;
 	}
 
-	int32_t ncycles_to_write_net = htonl(ncycles_to_write);
-	v.resize(v.size() + 4);
-	memcpy(&v[v.size()-4], &ncycles_to_write_net, 4);
+	highest_sent[player] = std::max<int>(highest_sent[player], end-1);
 
-	for(int n = 0; n != ncycles_to_write; ++n) {
-		const int index = (controls[local_player].size() - ncycles_to_write) + n;
-		v.push_back(controls[local_player][index].keys);
-		const char* user = controls[local_player][index].user.c_str();
-		v.insert(v.end(), user, user + controls[local_player][index].user.size()+1);
-	}
+	fprintf(stderr, "WRITE CONTROL PACKET: %d\n", (int)(v.size() - start_size));
+}
+
+void write_replay(std::vector<char>& v, int checksum)
+{
+	ASSERT_LOG(local_player >= 0 && local_player < nplayers, "No local player to write a replay for");
+
+	write_int32(v, starting_seed);
+	write_int32(v, checksum);
+	write_int32(v, controls[local_player].size());
+	write_frames(v, controls[local_player], 0, controls[local_player].size());
+}
+
+void play_replay(const char* buf, size_t len)
+{
+	const char* end_buf = buf + len;
+	ASSERT_LOG(len >= 12, "Bad replay: " << len << " bytes");
+
+	replay_seed = read_int32(buf);
+	replay_checksum_ = read_int32(buf);
+	const int32_t ncycles = read_int32(buf);
 
-	fprintf(stderr, "WRITE CONTROL PACKET: %d\n", (int)v.size());
+	replay_frames.clear();
+	replay_frame = 0;
+	ASSERT_LOG(read_frames(buf, end_buf, ncycles, &replay_frames) && buf == end_buf, "Bad replay: its controls don't match its " << ncycles << " cycles");
+}
+
+int replay_cycles_remaining()
+{
+	return replay_frames.size() - replay_frame;
+}
+
+int replay_checksum()
+{
+	return replay_checksum_;
 }
 
 const variant& user_ctrl_output()
@@ -607,7 +751,13 @@ void set_user_ctrl_output(const variant& v)
 
 int first_invalid_cycle()
 {
-	return first_invalid_cycle_var;
+	if(first_invalid_cycle_var == -1) {
+		return -1;
+	}
+
+	//the controls for a cycle are used starting_cycles + delay cycles
+	//later, by the cycle after the one to go back to.
+	return first_invalid_cycle_var + starting_cycles + delay;
 }
 
 void mark_valid()
@@ -644,6 +794,24 @@ int last_packet_size()
 	return last_packet_size_;
 }
 
+int bytes_sent_per_second()
+{
+	current_traffic();
+	return last_second_traffic.bytes_sent;
+}
+
+int bytes_received_per_second()
+{
+	current_traffic();
+	return last_second_traffic.bytes_received;
+}
+
+int cycles_resent_per_second()
+{
+	current_traffic();
+	return last_second_traffic.cycles_resent;
+}
+
 void set_checksum(int cycle, int sum)
 {
 	our_checksums[cycle] = sum;
@@ -687,4 +855,175 @@ key_type get_keycode(CONTROL_ITEM item)
 	}
 	return SDLK_UNKNOWN;
 }
+
+UNIT_TEST(control_frames_rle)
+{
+	std::vector<ControlFrame> frames(300);
+	for(int n = 0; n != frames.size(); ++n) {
+		frames[n].keys = 1;
+	}
+
+	ControlFrame single;
+	single.keys = 2;
+	frames.push_back(single);
+	single.user = "x";
+	frames.push_back(single);
+	frames.resize(frames.size() + 5);
+
+	//runs of 255 and 45, two single frames, and a run of 5.
+	std::vector<char> v;
+	write_frames(v, frames, 0, frames.size());
+	CHECK_EQ(v.size(), 16);
+
+	const char* buf = &v[0];
+	std::vector<ControlFrame> result;
+	CHECK_EQ(read_frames(buf, &v[0] + v.size(), frames.size(), &result), true);
+	CHECK_EQ(buf - &v[0], v.size());
+	CHECK_EQ(result.size(), frames.size());
+	for(int n = 0; n != frames.size(); ++n) {
+		CHECK_EQ(result[n] == frames[n], true);
+	}
+
+	//more frames than the buffer holds.
+	buf = &v[0];
+	result.clear();
+	CHECK_EQ(read_frames(buf, &v[0] + v.size(), frames.size() + 1, &result), false);
+
+	//a run longer than the frames asked for.
+	std::vector<char> corrupt = v;
+	corrupt[corrupt.size() - 3] = 6;
+	buf = &corrupt[0];
+	result.clear();
+	CHECK_EQ(read_frames(buf, &corrupt[0] + corrupt.size(), frames.size(), &result), false);
+
+	//a run of no frames.
+	corrupt = v;
+	corrupt[0] = 0;
+	buf = &corrupt[0];
+	result.clear();
+	CHECK_EQ(read_frames(buf, &corrupt[0] + corrupt.size(), frames.size(), &result), false);
+}
+
+namespace {
+//keeps the controls, replay and rng state a test changes.
+class replay_test_scope {
+public:
+	replay_test_scope()
+	  : old_nplayers_(nplayers), old_local_player_(local_player), old_delay_(delay),
+	    old_starting_seed_(starting_seed), old_seed_(rng::get_seed()), old_level_started_(level_started),
+	    old_replay_frames_(replay_frames), old_replay_frame_(replay_frame),
+	    old_replay_seed_(replay_seed), old_replay_checksum_(replay_checksum_)
+	{
+		replay_frames.clear();
+		replay_frame = 0;
+		delay = 0;
+	}
+
+	~replay_test_scope() {
+		nplayers = old_nplayers_;
+		local_player = old_local_player_;
+		delay = old_delay_;
+		starting_seed = old_starting_seed_;
+		rng::set_seed(old_seed_);
+		level_started = old_level_started_;
+		replay_frames = old_replay_frames_;
+		replay_frame = old_replay_frame_;
+		replay_seed = old_replay_seed_;
+		replay_checksum_ = old_replay_checksum_;
+	}
+private:
+	const control_backup_scope controls_;
+	int old_nplayers_, old_local_player_, old_delay_;
+	unsigned int old_starting_seed_, old_seed_;
+	bool old_level_started_;
+	std::vector<ControlFrame> old_replay_frames_;
+	int old_replay_frame_;
+	unsigned int old_replay_seed_;
+	int old_replay_checksum_;
+};
+
+//stands in for a level, whose state depends on the controls and the rng.
+//Returns its checksum after the given number of cycles.
+int play_test_cycles(int ncycles, bool record)
+{
+	int checksum = 0;
+	for(int cycle = 0; cycle != ncycles; ++cycle) {
+		start_cycle();
+		if(record) {
+			const local_controls_lock lock((cycle/7)%16);
+			read_local_controls();
+		} else {
+			read_local_controls();
+		}
+
+		bool keys[NUM_CONTROLS];
+		get_control_status(cycle+1, local_player, keys);
+		for(int n = 0; n != NUM_CONTROLS; ++n) {
+			checksum = checksum*31 + keys[n];
+		}
+
+		checksum += rng::generate()%1000;
+	}
+
+	return checksum;
+}
+}
+
+UNIT_TEST(replay_round_trip)
+{
+	const replay_test_scope scope;
+	nplayers = 1;
+	local_player = 0;
+	starting_seed = 12345;
+	controls[0].resize(100);
+	for(int n = 0; n != controls[0].size(); ++n) {
+		controls[0][n].keys = (n/10)%4;
+		controls[0][n].user = n == 50 ? "jump" : "";
+	}
+
+	std::vector<char> v;
+	write_replay(v, 777);
+	play_replay(&v[0], v.size());
+
+	CHECK_EQ(replay_checksum(), 777);
+	CHECK_EQ(replay_cycles_remaining(), controls[0].size());
+	for(int n = 0; n != controls[0].size(); ++n) {
+		CHECK_EQ(replay_frames[n] == controls[0][n], true);
+	}
+
+	//the seed is restored right before the first cycle.
+	level_started = false;
+	start_cycle();
+	CHECK_EQ(rng::get_seed(), 12345);
+
+	//playing the replay records its frames as our controls, which must
+	//write the same replay back out.
+	controls[0] = replay_frames;
+	std::vector<char> replayed;
+	write_replay(replayed, replay_checksum());
+	CHECK_EQ(replayed == v, true);
+}
+
+UNIT_TEST(replay_plays_back_to_same_checksum)
+{
+	const replay_test_scope scope;
+	rng::set_seed(4321);
+	new_level(0, 1, 0);
+
+	//loading the level may use the rng, differently each time.
+	rng::generate();
+	const int checksum = play_test_cycles(200, true);
+
+	std::vector<char> v;
+	write_replay(v, checksum);
+
+	rng::set_seed(99);
+	new_level(0, 1, 0);
+	play_replay(&v[0], v.size());
+	rng::generate();
+	rng::generate();
+
+	CHECK_EQ(play_test_cycles(replay_cycles_remaining(), false), replay_checksum());
+	CHECK_EQ(replay_cycles_remaining(), 0);
+}
 }
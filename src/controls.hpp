@@ -50,6 +50,11 @@ key_type get_keycode(CONTROL_ITEM item);
 
 void new_level(int starting_cycle, int nplayers, int local_player);
 
+//called before each cycle of the level is processed. Before the first
+//one, the random seed is recorded for a replay, or the seed of the replay
+//being played is restored, so both start from the same point.
+void start_cycle();
+
 //an object which can lock controls into a specific state for the duration
 //of its scope.
 class local_controls_lock {
@@ -84,11 +89,31 @@ void get_control_status(int cycle, int player, bool* output, const std::string**
 void set_delay(int delay);
 
 void read_control_packet(const char* buf, size_t len);
-void write_control_packet(std::vector<char>& v);
+
+//writes a packet for the given remote player with the local player's
+//controls that they haven't acknowledged.
+void write_control_packet(std::vector<char>& v, int player);
+
+//a replay is the random seed the level's first cycle started with, the
+//level's checksum at the end of the recording, and all of the local
+//player's controls since then, encoded as in control packets.
+void write_replay(std::vector<char>& v, int checksum);
+
+//plays back a replay: the local player's controls come from it instead of
+//from the keyboard until it runs out. Must be called before the level's
+//first cycle.
+void play_replay(const char* buf, size_t len);
+int replay_cycles_remaining();
+
+//the checksum the level had when the replay being played was recorded,
+//which it should have again once the replay runs out.
+int replay_checksum();
 
 const variant& user_ctrl_output();
 void set_user_ctrl_output(const variant& v);
 
+//the level cycle to go back to when controls we guessed for a remote
+//player were corrected, or -1 if none were.
 int first_invalid_cycle();
 void mark_valid();
 
@@ -100,6 +125,11 @@ int cycles_behind();
 int their_highest_confirmed();
 int last_packet_size();
 
+//network traffic in the last second.
+int bytes_sent_per_second();
+int bytes_received_per_second();
+int cycles_resent_per_second();
+
 void set_checksum(int cycle, int sum);
 
 void debug_dump_controls();
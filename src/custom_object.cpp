@@ -43,6 +43,7 @@
 #include "formula_object.hpp"
 #include "formula_profiler.hpp"
 #include "geometry.hpp"
+#include "gl_state.hpp"
 #include "graphical_font.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
@@ -59,6 +60,7 @@
 #include "unit_test.hpp"
 #include "utils.hpp"
 #include "sound.hpp"
+#include "thread.hpp"
 #include "widget_factory.hpp"
 
 class active_property_scope {
@@ -158,16 +160,22 @@ custom_object::custom_object(variant node)
 	always_active_(node["always_active"].as_bool(false)),
 	activation_border_(node["activation_border"].as_int(type_->activation_border())),
 	last_cycle_active_(0),
-	parent_pivot_(node["pivot"].as_string_default()),
 	parent_prev_x_(INT_MIN), parent_prev_y_(INT_MIN), parent_prev_facing_(true),
 	swallow_mouse_event_(false),
-	currently_handling_die_event_(0),
+	currently_handling_die_event_(0), process_speculation_(-1),
 	use_absolute_screen_coordinates_(node["use_absolute_screen_coordinates"].as_bool(type_->use_absolute_screen_coordinates())),
 	vertex_location_(-1), texcoord_location_(-1),
-	paused_(false), model_(glm::mat4(1.0f))
+	paused_(false)
 {
-	properties_requiring_dynamic_initialization_ = type_->properties_requiring_dynamic_initialization();
-	properties_requiring_dynamic_initialization_.insert(properties_requiring_dynamic_initialization_.end(), type_->properties_requiring_initialization().begin(), type_->properties_requiring_initialization().end());
+	if(node.has_key("pivot")) {
+		cold().parent_pivot = node["pivot"].as_string();
+	}
+
+	if(type_->properties_requiring_dynamic_initialization().empty() == false || type_->properties_requiring_initialization().empty() == false) {
+		std::vector<int>& props = cold().properties_requiring_dynamic_initialization;
+		props = type_->properties_requiring_dynamic_initialization();
+		props.insert(props.end(), type_->properties_requiring_initialization().begin(), type_->properties_requiring_initialization().end());
+	}
 
 	vars_->disallow_new_keys(type_->is_strict());
 	tmp_vars_->disallow_new_keys(type_->is_strict());
@@ -366,13 +374,13 @@ custom_object::custom_object(variant node)
 		foreach(variant light_node, node["lights"].as_list()) {
 			light_ptr new_light(light::create_light(*this, light_node));
 			if(new_light) {
-				lights_.push_back(new_light);
+				cold().lights.push_back(new_light);
 			}
 		}
 	}
 
 	if(node.has_key("parent")) {
-		parent_loading_.serialize_from_string(node["parent"].as_string());
+		cold().parent_loading.serialize_from_string(node["parent"].as_string());
 	}
 
 	if(node.has_key("platform_offsets")) {
@@ -445,8 +453,6 @@ custom_object::custom_object(const std::string& type, int x, int y, bool face_ri
 	has_feet_(type_->has_feet()),
 	invincible_(0),
 	sound_volume_(128),
-	vars_(new game_logic::formula_variable_storage(type_->variables())),
-	tmp_vars_(new game_logic::formula_variable_storage(type_->tmp_variables())),
 	tags_(new game_logic::map_formula_callable(type_->tags())),
 	active_property_(-1),
 	last_hit_by_anim_(0),
@@ -458,11 +464,16 @@ custom_object::custom_object(const std::string& type, int x, int y, bool face_ri
 	parent_prev_x_(INT_MIN), parent_prev_y_(INT_MIN), parent_prev_facing_(true),
 	swallow_mouse_event_(false),
 	min_difficulty_(-1), max_difficulty_(-1),
-	currently_handling_die_event_(0),
+	currently_handling_die_event_(0), process_speculation_(-1),
 	use_absolute_screen_coordinates_(type_->use_absolute_screen_coordinates()),
 	vertex_location_(-1), texcoord_location_(-1),
-	paused_(false), model_(glm::mat4(1.0f))
+	paused_(false)
 {
+	if(!take_pooled_storage()) {
+		vars_.reset(new game_logic::formula_variable_storage(type_->variables()));
+		tmp_vars_.reset(new game_logic::formula_variable_storage(type_->tmp_variables()));
+	}
+
 	vars_->disallow_new_keys(type_->is_strict());
 	tmp_vars_->disallow_new_keys(type_->is_strict());
 
@@ -575,7 +586,6 @@ custom_object::custom_object(const custom_object& o) :
 	clip_area_(o.clip_area_ ? new rect(*o.clip_area_) : NULL),
 	activation_border_(o.activation_border_),
 	can_interact_with_(o.can_interact_with_),
-	particle_systems_(o.particle_systems_),
 	text_(o.text_),
 	driver_(o.driver_),
 	blur_(o.blur_),
@@ -585,20 +595,25 @@ custom_object::custom_object(const custom_object& o) :
 	always_active_(o.always_active_),
 	last_cycle_active_(0),
 	parent_(o.parent_),
-	parent_pivot_(o.parent_pivot_),
 	parent_prev_x_(o.parent_prev_x_),
 	parent_prev_y_(o.parent_prev_y_),
 	parent_prev_facing_(o.parent_prev_facing_),
 	min_difficulty_(o.min_difficulty_),
 	max_difficulty_(o.max_difficulty_),
-	custom_draw_(o.custom_draw_),
 	platform_offsets_(o.platform_offsets_),
 	swallow_mouse_event_(false),
-	currently_handling_die_event_(0),
+	currently_handling_die_event_(0), process_speculation_(-1),
 	vertex_location_(o.vertex_location_), texcoord_location_(o.texcoord_location_),
-	widgets_(o.widgets_),
-	paused_(o.paused_), model_(glm::mat4(1.0f))
+	paused_(o.paused_)
 {
+	if(o.cold_) {
+		cold_data& c = cold();
+		c.particle_systems = o.cold_->particle_systems;
+		c.parent_pivot = o.cold_->parent_pivot;
+		c.custom_draw = o.cold_->custom_draw;
+		c.widgets = o.cold_->widgets;
+	}
+
 	vars_->disallow_new_keys(type_->is_strict());
 	tmp_vars_->disallow_new_keys(type_->is_strict());
 
@@ -631,10 +646,121 @@ custom_object::custom_object(const custom_object& o) :
 
 custom_object::~custom_object()
 {
+	if(game_logic::gc_node_destroyed) {
+		game_logic::gc_node_destroyed(this);
+	}
+
 	get_all().erase(this);
 	get_all(base_type_->id()).erase(this);
 
 	sound::stop_looped_sounds(this);
+
+	release_pooled_storage();
+}
+
+namespace {
+PREF_INT(object_pool_size, -1);
+
+int instance_pool_size(const custom_object_type& type)
+{
+	return g_object_pool_size >= 0 ? g_object_pool_size : type.pool_size();
+}
+
+//memory of destroyed objects, kept for new ones while any type pools.
+std::vector<void*> free_object_blocks;
+int free_object_blocks_limit = 0;
+
+//objects are also made and destroyed by level-preload threads, so this
+//guards free_object_blocks and the types' instance pools.
+threading::mutex object_pool_mutex;
+}
+
+void* custom_object::operator new(size_t size)
+{
+	threading::lock lck(object_pool_mutex);
+	if(size == sizeof(custom_object) && !free_object_blocks.empty()) {
+		void* result = free_object_blocks.back();
+		free_object_blocks.pop_back();
+		return result;
+	}
+
+	return ::operator new(size);
+}
+
+void custom_object::operator delete(void* p, size_t size)
+{
+	threading::lock lck(object_pool_mutex);
+	if(size == sizeof(custom_object) && free_object_blocks.size() < free_object_blocks_limit) {
+		free_object_blocks.push_back(p);
+		return;
+	}
+
+	::operator delete(p);
+}
+
+bool custom_object::take_pooled_storage()
+{
+	threading::lock lck(object_pool_mutex);
+	std::vector<custom_object_type::pooled_storage>& pool = type_->instance_pool();
+	while(!pool.empty()) {
+		custom_object_type::pooled_storage& storage = pool.back();
+		const bool usable = storage.vars->reset_values(type_->variables()) && storage.tmp_vars->reset_values(type_->tmp_variables());
+		if(usable) {
+			vars_.swap(storage.vars);
+			tmp_vars_.swap(storage.tmp_vars);
+			property_data_.swap(storage.property_data);
+		}
+
+		pool.pop_back();
+		if(usable) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void custom_object::release_pooled_storage()
+{
+	//variations have their own variables, and storage anything else still
+	//refers to can't be reused.
+	const int pool_size = instance_pool_size(*base_type_);
+	if(pool_size <= 0 || type_ != base_type_ || !vars_ || !tmp_vars_ || vars_->refcount() != 1 || tmp_vars_->refcount() != 1) {
+		return;
+	}
+
+	{
+		threading::lock lck(object_pool_mutex);
+		free_object_blocks_limit = std::max<int>(free_object_blocks_limit, pool_size);
+
+		if(base_type_->instance_pool().size() >= pool_size) {
+			return;
+		}
+	}
+
+	//releasing the values may destroy other objects, which may be pooled
+	//in turn, so the pool is only touched once they're gone.
+	foreach(variant& v, vars_->values()) {
+		v = variant();
+	}
+
+	foreach(variant& v, tmp_vars_->values()) {
+		v = variant();
+	}
+
+	property_data_.clear();
+
+	threading::lock lck(object_pool_mutex);
+	std::vector<custom_object_type::pooled_storage>& pool = base_type_->instance_pool();
+	if(pool.size() >= pool_size) {
+		return;
+	}
+
+	pool.resize(pool.size()+1);
+	custom_object_type::pooled_storage& storage = pool.back();
+	storage.vars.swap(vars_);
+	storage.tmp_vars.swap(tmp_vars_);
+	storage.property_data.swap(property_data_);
 }
 
 void custom_object::validate_properties()
@@ -670,12 +796,12 @@ bool custom_object::is_a(const std::string& type) const
 
 void custom_object::finish_loading(level* lvl)
 {
-	if(parent_loading_.is_null() == false) {
-		entity_ptr p = parent_loading_.try_convert<entity>();
+	if(cold_ && cold_->parent_loading.is_null() == false) {
+		entity_ptr p = cold_->parent_loading.try_convert<entity>();
 		if(p) {
 			parent_ = p;
 		}
-		parent_loading_ = variant();
+		cold_->parent_loading = variant();
 	}
 #if defined(USE_SHADERS)
 	if(shader_) { shader_->init(this); }
@@ -970,9 +1096,9 @@ variant custom_object::write() const
 		res.add("clip_area", clip_area_->write());
 	}
 
-	if(!particle_systems_.empty()) {
+	if(cold_ && !cold_->particle_systems.empty()) {
 		std::string systems;
-		for(std::map<std::string, particle_system_ptr>::const_iterator i = particle_systems_.begin(); i != particle_systems_.end(); ++i) {
+		for(std::map<std::string, particle_system_ptr>::const_iterator i = cold_->particle_systems.begin(); i != cold_->particle_systems.end(); ++i) {
 			if(i->second->should_save() == false) {
 				continue;
 			}
@@ -989,7 +1115,7 @@ variant custom_object::write() const
 		}
 	}
 
-	foreach(const light_ptr& p, lights_) {
+	foreach(const light_ptr& p, lights()) {
 		res.add("lights", p->write());
 	}
 
@@ -999,8 +1125,8 @@ variant custom_object::write() const
 		res.add("parent", str);
 	}
 
-	if(parent_pivot_.empty() == false) {
-		res.add("pivot", parent_pivot_);
+	if(cold_ && cold_->parent_pivot.empty() == false) {
+		res.add("pivot", cold_->parent_pivot);
 	}
 
 	if(min_difficulty_ != -1) {
@@ -1059,14 +1185,16 @@ void custom_object::draw_later(int xx, int yy) const
 		adjusted_draw_position_.x = xx;
 		adjusted_draw_position_.y = yy;
 	}
-	glPushMatrix();
-	glTranslatef(GLfloat(x()), GLfloat(y()), 0.0);
-	foreach(const gui::widget_ptr& w, widgets_) {
-		if(w->zorder() >= widget_zorder_draw_later_threshold) {
-			w->draw();
+	if(cold_) {
+		glPushMatrix();
+		glTranslatef(GLfloat(x()), GLfloat(y()), 0.0);
+		foreach(const gui::widget_ptr& w, cold_->widgets) {
+			if(w->zorder() >= widget_zorder_draw_later_threshold) {
+				w->draw();
+			}
 		}
+		glPopMatrix();
 	}
-	glPopMatrix();
 
 	if(use_absolute_screen_coordinates_) {
 		glPopMatrix();
@@ -1087,7 +1215,7 @@ void custom_object::draw(int xx, int yy) const
 	}
 
 	if(type_->blend_mode()) {
-		glBlendFunc(type_->blend_mode()->sfactor, type_->blend_mode()->dfactor);
+		gl_state::blend_func(type_->blend_mode()->sfactor, type_->blend_mode()->dfactor);
 	}
 
 #if defined(USE_SHADERS)
@@ -1133,7 +1261,7 @@ void custom_object::draw(int xx, int yy) const
 	} else if(truez()) {
 		ASSERT_LOG(shader_ != NULL, "No shader found in the object, to use truez a shader must be given.");
 		//XXX All this is a big hack till I fix up frames/objects to use shaders differently
-		glUseProgram(shader_->shader()->get());
+		gl_state::use_program(shader_->shader()->get());
 		if(vertex_location_ == -1) {
 			vertex_location_ = shader_->shader()->get_attribute("a_position");
 		}
@@ -1149,7 +1277,7 @@ void custom_object::draw(int xx, int yy) const
 			flip = flip * glm::rotate(glm::mat4(1.0f), 180.0f, glm::vec3(1.0f,0.0f,0.0f));
 		}
 		GLfloat scale = draw_scale_ ? GLfloat(draw_scale_->as_float()) : 1.0f;
-		glm::mat4 model = model_ * glm::translate(glm::mat4(1.0f), glm::vec3(tx(),ty(),tz()))
+		glm::mat4 model = glm::make_mat4(this->model()) * glm::translate(glm::mat4(1.0f), glm::vec3(tx(),ty(),tz()))
 			* glm::rotate(glm::mat4(1.0f), GLfloat(rotate_x_.as_float()), glm::vec3(1.0f,0.0f,0.0f)) 
 			* glm::rotate(glm::mat4(1.0f), GLfloat(rotate_y_.as_float()), glm::vec3(0.0f,1.0f,0.0f)) 
 			* glm::rotate(glm::mat4(1.0f), GLfloat(rotate_z_.as_float()), glm::vec3(0.0f,0.0f,1.0f)) 
@@ -1160,13 +1288,13 @@ void custom_object::draw(int xx, int yy) const
 		glUniformMatrix4fv(shader_->shader()->mvp_matrix_uniform(), 1, GL_FALSE, glm::value_ptr(mvp));
 
 		frame_->draw3(time_in_frame_, vertex_location_, texcoord_location_);
-		glUseProgram(active->shader()->get());
+		gl_state::use_program(active->shader()->get());
 #endif
-	} else if(custom_draw_xy_.size() >= 6 &&
-	          custom_draw_xy_.size() == custom_draw_uv_.size()) {
-		frame_->draw_custom(draw_x-draw_x%2, draw_y-draw_y%2, &custom_draw_xy_[0], &custom_draw_uv_[0], custom_draw_xy_.size()/2, face_right(), upside_down(), time_in_frame_, GLfloat(rotate_z_.as_float()), cycle_);
-	} else if(custom_draw_.get() != NULL) {
-		frame_->draw_custom(draw_x-draw_x%2, draw_y-draw_y%2, *custom_draw_, draw_area_.get(), face_right(), upside_down(), time_in_frame_, GLfloat(rotate_z_.as_float()));
+	} else if(cold_ && cold_->custom_draw_xy.size() >= 6 &&
+	          cold_->custom_draw_xy.size() == cold_->custom_draw_uv.size()) {
+		frame_->draw_custom(draw_x-draw_x%2, draw_y-draw_y%2, &cold_->custom_draw_xy[0], &cold_->custom_draw_uv[0], cold_->custom_draw_xy.size()/2, face_right(), upside_down(), time_in_frame_, GLfloat(rotate_z_.as_float()), cycle_);
+	} else if(cold_ && cold_->custom_draw.get() != NULL) {
+		frame_->draw_custom(draw_x-draw_x%2, draw_y-draw_y%2, *cold_->custom_draw, draw_area_.get(), face_right(), upside_down(), time_in_frame_, GLfloat(rotate_z_.as_float()));
 	} else if(draw_scale_) {
 		frame_->draw(draw_x-draw_x%2, draw_y-draw_y%2, face_right(), upside_down(), time_in_frame_, GLfloat(rotate_z_.as_float()), GLfloat(draw_scale_->as_float()));
 	} else if(!draw_area_.get()) {
@@ -1181,7 +1309,7 @@ void custom_object::draw(int xx, int yy) const
 
 	if(draw_color_) {
 		if(!draw_color_->fits_in_color()) {
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+			gl_state::blend_func(GL_SRC_ALPHA, GL_ONE);
 			graphics::color_transform transform = *draw_color_;
 			while(!transform.fits_in_color()) {
 				transform = transform - transform.to_color();
@@ -1189,7 +1317,7 @@ void custom_object::draw(int xx, int yy) const
 				frame_->draw(draw_x-draw_x%2, draw_y-draw_y%2, face_right(), upside_down(), time_in_frame_, GLfloat(rotate_z_.as_float()));
 			}
 
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		}
 
 		glColor4ub(255, 255, 255, 255);
@@ -1204,29 +1332,33 @@ void custom_object::draw(int xx, int yy) const
 	}
 
 #if defined(USE_SHADERS)
-	foreach(const graphics::draw_primitive_ptr& p, draw_primitives_) {
-		p->draw();
+	if(cold_) {
+		foreach(const graphics::draw_primitive_ptr& p, cold_->draw_primitives) {
+			p->draw();
+		}
 	}
 #endif
 
 	draw_debug_rects();
 
-	glPushMatrix();
-	glTranslatef(GLfloat(x()), GLfloat(y()), 0.0);
-	foreach(const gui::widget_ptr& w, widgets_) {
-		if(w->zorder() < widget_zorder_draw_later_threshold) {
-			if(w->draw_with_object_shader()) {
-				w->draw();
+	if(cold_) {
+		glPushMatrix();
+		glTranslatef(GLfloat(x()), GLfloat(y()), 0.0);
+		foreach(const gui::widget_ptr& w, cold_->widgets) {
+			if(w->zorder() < widget_zorder_draw_later_threshold) {
+				if(w->draw_with_object_shader()) {
+					w->draw();
+				}
 			}
 		}
-	}
-	foreach(const gui::vector_text_ptr& txt, vector_text_) {
-		txt->draw();
-	}
-	glPopMatrix();
+		foreach(const gui::vector_text_ptr& txt, cold_->vector_text) {
+			txt->draw();
+		}
+		glPopMatrix();
 
-	for(std::map<std::string, particle_system_ptr>::const_iterator i = particle_systems_.begin(); i != particle_systems_.end(); ++i) {
-		i->second->draw(rect(last_draw_position().x/100, last_draw_position().y/100, graphics::screen_width(), graphics::screen_height()), *this);
+		for(std::map<std::string, particle_system_ptr>::const_iterator i = cold_->particle_systems.begin(); i != cold_->particle_systems.end(); ++i) {
+			i->second->draw(rect(last_draw_position().x/100, last_draw_position().y/100, graphics::screen_width(), graphics::screen_height()), *this);
+		}
 	}
 
 	if(text_ && text_->font && text_->alpha) {
@@ -1321,23 +1453,25 @@ void custom_object::draw(int xx, int yy) const
 	}
 #endif
 
-	glPushMatrix();
-	glTranslatef(GLfloat(x()&~1), GLfloat(y()&~1), 0.0);
-	foreach(const gui::widget_ptr& w, widgets_) {
-		if(w->zorder() < widget_zorder_draw_later_threshold) {
-			if(w->draw_with_object_shader() == false) {
-				w->draw();
+	if(cold_) {
+		glPushMatrix();
+		glTranslatef(GLfloat(x()&~1), GLfloat(y()&~1), 0.0);
+		foreach(const gui::widget_ptr& w, cold_->widgets) {
+			if(w->zorder() < widget_zorder_draw_later_threshold) {
+				if(w->draw_with_object_shader() == false) {
+					w->draw();
+				}
 			}
 		}
+		glPopMatrix();
 	}
-	glPopMatrix();
 
 	if(use_absolute_screen_coordinates_) {
 		glPopMatrix();
 	}
 
 	if(type_->blend_mode()) {
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	}
 }
 
@@ -1368,7 +1502,7 @@ void custom_object::create_object()
 
 void custom_object::check_initialized()
 {
-	ASSERT_LOG(properties_requiring_dynamic_initialization_.empty(), "Object property " << debug_description() << "." << type_->slot_properties()[properties_requiring_dynamic_initialization_.front()].id << " not initialized");
+	ASSERT_LOG(!cold_ || cold_->properties_requiring_dynamic_initialization.empty(), "Object property " << debug_description() << "." << type_->slot_properties()[cold_->properties_requiring_dynamic_initialization.front()].id << " not initialized");
 
 	validate_properties();
 }
@@ -1430,7 +1564,7 @@ void custom_object::process(level& lvl)
 			move_centipixels(move_x*100, move_y*100);
 
 			if(parent_facing != parent_prev_facing_) {
-				const point pos_before_turn = parent_->pivot(parent_pivot_);
+				const point pos_before_turn = parent_->pivot(parent_pivot());
 	
 				const int relative_x = pos.x - pos_before_turn.x;
 	
@@ -2147,8 +2281,10 @@ void custom_object::process(level& lvl)
 		}
 	}
 
-	foreach(const gui::widget_ptr& w, widgets_) {
-		w->process();
+	if(cold_) {
+		foreach(const gui::widget_ptr& w, cold_->widgets) {
+			w->process();
+		}
 	}
 
 	static_process(lvl);
@@ -2156,27 +2292,35 @@ void custom_object::process(level& lvl)
 
 void custom_object::static_process(level& lvl)
 {
-	handle_event(OBJECT_EVENT_PROCESS);
-	handle_event(frame_->process_event_id());
+	if(handles_event(OBJECT_EVENT_PROCESS)) {
+		handle_event(OBJECT_EVENT_PROCESS);
+	}
 
-	if(type_->timer_frequency() > 0 && (cycle_%type_->timer_frequency()) == 0) {
-		static const std::string TimerStr = "timer";
+	if(handles_event(frame_->process_event_id())) {
+		handle_event(frame_->process_event_id());
+	}
+
+	if(type_->timer_frequency() > 0 && (cycle_%type_->timer_frequency()) == 0 && handles_event(OBJECT_EVENT_TIMER)) {
 		handle_event(OBJECT_EVENT_TIMER);
 	}
 
-	for(std::map<std::string, particle_system_ptr>::iterator i = particle_systems_.begin(); i != particle_systems_.end(); ) {
-		i->second->process(*this);
-		if(i->second->is_destroyed()) {
-			particle_systems_.erase(i++);
-		} else {
-			++i;
+	if(cold_) {
+		for(std::map<std::string, particle_system_ptr>::iterator i = cold_->particle_systems.begin(); i != cold_->particle_systems.end(); ) {
+			i->second->process(*this);
+			if(i->second->is_destroyed()) {
+				cold_->particle_systems.erase(i++);
+			} else {
+				++i;
+			}
 		}
 	}
 
 	set_driver_position();
 
-	foreach(const light_ptr& p, lights_) {
-		p->process();
+	if(cold_) {
+		foreach(const light_ptr& p, cold_->lights) {
+			p->process();
+		}
 	}
 }
 
@@ -2427,63 +2571,384 @@ void custom_object::init()
 {
 }
 
-void custom_object::run_garbage_collection()
+namespace {
+//how many objects each slice of an incremental collection scans or
+//collects. Slices are measured in objects rather than time so that when
+//garbage is released doesn't depend on how fast the machine is.
+PREF_INT(gc_slice_objects, 256);
+
+using game_logic::formula_callable;
+using game_logic::formula_callable_suspended_ptr;
+
+//the references a callable holds directly.
+std::vector<formula_callable_suspended_ptr> get_gc_references(const formula_callable* node)
 {
-	const int starting_ticks = SDL_GetTicks();
+	game_logic::formula_callable_visitor visitor(true);
+	const_cast<formula_callable*>(node)->perform_visit_values(visitor);
+	return visitor.pointers();
+}
 
-	std::cerr << "RUNNING GARBAGE COLLECTION FOR " << get_all().size() << " OBJECTS...\n";
+//custom objects and formula objects tell the collector when they're
+//destroyed. Any other callable found on the way, such as a map or a
+//closure's callable kept in a variable, is held by the collector until the
+//collection finishes, so that cycles through them are found too.
+bool is_gc_node(const formula_callable* node)
+{
+	return dynamic_cast<const custom_object*>(node) != NULL || dynamic_cast<const game_logic::formula_object*>(node) != NULL;
+}
+
+//Finds reference cycles which are unreachable from anywhere else, by
+//trial deletion: references from objects to each other are counted, and
+//objects with more references than that are referred to from outside.
+//Anything those objects reach is live, and the rest is garbage.
+//
+//The graph is scanned from all custom objects, a node at a time. The
+//collector holds no references to objects, so a collection spread over
+//several frames doesn't keep them alive; objects destroyed meanwhile are
+//dropped from the graph as they go. Each group of connected garbage is
+//counted again right before its references are broken, and is left alone
+//if anything else has come to refer to it.
+class cycle_collector
+{
+public:
+	cycle_collector() : state_(IDLE)
+	{}
+
+	bool running() const { return state_ != IDLE; }
+
+	void start() {
+		clear();
+		foreach(custom_object* obj, custom_object::get_all()) {
+			//objects still being constructed or destroyed have no references.
+			if(obj->refcount() > 0) {
+				add_node(obj);
+			}
+		}
+
+		game_logic::gc_node_destroyed = node_destroyed;
+		state_ = SCANNING;
+		next_ = 0;
+		nslices_ = 0;
+		max_pause_ = 0;
+		total_pause_ = 0;
+		nreclaimed_ = 0;
+	}
 
-	std::vector<entity_ptr> references;
-	foreach(custom_object* obj, get_all()) {
-		references.push_back(entity_ptr(obj));
+	//scans from a callable that isn't a custom object as well.
+	void add_root(const formula_callable* node) {
+		add_node(node);
 	}
 
-	std::set<const void*> safe;
-	std::vector<gc_object_reference> refs;
+	//scans or collects up to the given number of objects, and at least one.
+	void step(int max_objects) {
+		const int start_ticks = SDL_GetTicks();
+		formula_profiler::instrument instrumentation("GC");
+		int nobjects = 0;
+		do {
+			if(state_ == SCANNING) {
+				if(next_ == nodes_.size()) {
+					mark();
+				} else {
+					scan(next_++);
+					++nobjects;
+				}
+			} else if(state_ == COLLECTING) {
+				if(next_ == components_.size()) {
+					finish();
+				} else {
+					nobjects += components_[next_].size();
+					collect(components_[next_++]);
+				}
+			}
+		} while(state_ != IDLE && nobjects < max_objects);
+
+		const int pause = SDL_GetTicks() - start_ticks;
+		++nslices_;
+		total_pause_ += pause;
+		max_pause_ = std::max(max_pause_, pause);
 
-	foreach(custom_object* obj, get_all()) {
-		obj->extract_gc_object_references(refs);
+		if(state_ == IDLE) {
+			formula_profiler::record_garbage_collection(total_pause_, max_pause_, nreclaimed_);
+		}
 	}
-	
-	for(int pass = 1;; ++pass) {
-		const int starting_safe = safe.size();
-		foreach(custom_object* obj, get_all()) {
-			if(obj->refcount() > 1) {
-				safe.insert(obj);
+
+private:
+	enum STATE { IDLE, SCANNING, COLLECTING };
+
+	struct edge {
+		const void* address;
+		int target;
+	};
+
+	static void node_destroyed(const formula_callable* node);
+
+	int add_node(const formula_callable* node) {
+		std::map<const formula_callable*, int>::const_iterator i = index_.find(node);
+		if(i != index_.end()) {
+			return i->second;
+		}
+
+		const int result = nodes_.size();
+		index_[node] = result;
+		nodes_.push_back(node);
+		edges_.resize(nodes_.size());
+		if(is_gc_node(node)) {
+			held_.push_back(0);
+		} else {
+			held_.push_back(1);
+			holds_.push_back(boost::intrusive_ptr<const formula_callable>(node));
+		}
+		return result;
+	}
+
+	void scan(int n) {
+		if(nodes_[n] == NULL) {
+			return;
+		}
+
+		foreach(const formula_callable_suspended_ptr& ref, get_gc_references(nodes_[n])) {
+			if(ref->value()) {
+				edge e = { ref->ref_address(), add_node(ref->value()) };
+				edges_[n].push_back(e);
 			}
 		}
+	}
 
-		if(starting_safe == safe.size()) {
-			break;
+	void mark() {
+		std::vector<int> internal(nodes_.size());
+		std::set<const void*> seen;
+		for(int n = 0; n != nodes_.size(); ++n) {
+			//the references of destroyed nodes are gone.
+			if(nodes_[n] == NULL) {
+				continue;
+			}
+
+			foreach(const edge& e, edges_[n]) {
+				if(seen.insert(e.address).second) {
+					++internal[e.target];
+				}
+			}
+		}
+
+		std::vector<bool> live(nodes_.size());
+		std::vector<int> queue;
+		for(int n = 0; n != nodes_.size(); ++n) {
+			if(nodes_[n] == NULL) {
+				live[n] = true;
+			} else if(nodes_[n]->refcount() > internal[n] + held_[n]) {
+				live[n] = true;
+				queue.push_back(n);
+			}
 		}
 
-		std::cerr << "PASS " << pass << ": " << safe.size() << " OBJECTS SAFE\n";
+		while(!queue.empty()) {
+			const int n = queue.back();
+			queue.pop_back();
+			foreach(const edge& e, edges_[n]) {
+				if(!live[e.target]) {
+					live[e.target] = true;
+					queue.push_back(e.target);
+				}
+			}
+		}
 
-		foreach(gc_object_reference& ref, refs) {
-			if(ref.owner == NULL) {
+		//group the garbage into connected components.
+		std::vector<int> component(nodes_.size(), -1);
+		for(int n = 0; n != nodes_.size(); ++n) {
+			if(live[n] || component[n] != -1) {
 				continue;
 			}
 
-			if(safe.count(ref.owner)) {
-				restore_gc_object_reference(ref);
-				ref.owner = NULL;
+			components_.push_back(std::vector<int>());
+			std::vector<int>& members = components_.back();
+			component[n] = components_.size() - 1;
+			members.push_back(n);
+			for(int m = 0; m != members.size(); ++m) {
+				foreach(const edge& e, edges_[members[m]]) {
+					if(!live[e.target] && component[e.target] == -1) {
+						component[e.target] = component[n];
+						members.push_back(e.target);
+					}
+				}
 			}
 		}
+
+		//references to garbage from other garbage can point either way.
+		for(int n = 0; n != nodes_.size(); ++n) {
+			if(live[n]) {
+				continue;
+			}
+
+			foreach(const edge& e, edges_[n]) {
+				if(component[e.target] != component[n]) {
+					merge_components(component, component[n], component[e.target]);
+				}
+			}
+		}
+
+		components_.erase(std::remove(components_.begin(), components_.end(), std::vector<int>()), components_.end());
+
+		nscanned_ = nodes_.size();
+		edges_.clear();
+		state_ = COLLECTING;
+		next_ = 0;
 	}
 
-	foreach(gc_object_reference& ref, refs) {
-		if(ref.owner == NULL || !ref.visitor) {
-			continue;
+	void merge_components(std::vector<int>& component, int a, int b) {
+		foreach(int n, components_[b]) {
+			component[n] = a;
+		}
+
+		components_[a].insert(components_[a].end(), components_[b].begin(), components_[b].end());
+		components_[b].clear();
+	}
+
+	void collect(const std::vector<int>& members) {
+		std::map<const formula_callable*, int> internal;
+		foreach(int n, members) {
+			if(nodes_[n] == NULL) {
+				//part of the group has gone already.
+				return;
+			}
+
+			//our own reference to a held callable counts as internal.
+			internal[nodes_[n]] = held_[n];
+		}
+
+		std::vector<formula_callable_suspended_ptr> refs;
+		std::set<const void*> seen;
+		foreach(int n, members) {
+			foreach(const formula_callable_suspended_ptr& ref, get_gc_references(nodes_[n])) {
+				std::map<const formula_callable*, int>::iterator i = internal.find(ref->value());
+				if(i != internal.end() && seen.insert(ref->ref_address()).second) {
+					++i->second;
+					refs.push_back(ref);
+				}
+			}
 		}
 
-		foreach(game_logic::formula_callable_suspended_ptr ptr, ref.visitor->pointers()) {
-			if(safe.count(ptr->value())) {
-				ptr->restore_ref();
+		for(std::map<const formula_callable*, int>::const_iterator i = internal.begin(); i != internal.end(); ++i) {
+			if(i->first->refcount() != i->second) {
+				//something outside has got hold of the group since it was scanned.
+				return;
 			}
 		}
+
+		//breaking the references destroys the group, so keep it until
+		//they're all broken.
+		std::vector<boost::intrusive_ptr<const formula_callable> > group;
+		foreach(int n, members) {
+			group.push_back(boost::intrusive_ptr<const formula_callable>(nodes_[n]));
+		}
+
+		foreach(const formula_callable_suspended_ptr& ref, refs) {
+			ref->destroy_ref();
+		}
+
+		nreclaimed_ += members.size();
+	}
+
+	void finish() {
+		clear();
+		state_ = IDLE;
+	}
+
+	void clear() {
+		game_logic::gc_node_destroyed = NULL;
+		nodes_.clear();
+		index_.clear();
+		edges_.clear();
+		components_.clear();
+		held_.clear();
+		holds_.clear();
 	}
 
-	std::cerr << "RAN GARBAGE COLLECTION IN " << (SDL_GetTicks() - starting_ticks) << "ms. Releasing " << (get_all().size() - safe.size()) << "/" << get_all().size() << " OBJECTS\n";
+	STATE state_;
+	std::vector<const formula_callable*> nodes_;
+	std::map<const formula_callable*, int> index_;
+
+	//for each node, whether it's a callable we hold rather than an object.
+	std::vector<int> held_;
+	std::vector<boost::intrusive_ptr<const formula_callable> > holds_;
+	std::vector<std::vector<edge> > edges_;
+	std::vector<std::vector<int> > components_;
+	int next_;
+
+	int nslices_, max_pause_, total_pause_, nreclaimed_, nscanned_;
+};
+
+cycle_collector& get_cycle_collector()
+{
+	static cycle_collector* collector = new cycle_collector;
+	return *collector;
+}
+
+void cycle_collector::node_destroyed(const formula_callable* node)
+{
+	cycle_collector& collector = get_cycle_collector();
+	std::map<const formula_callable*, int>::iterator i = collector.index_.find(node);
+	if(i != collector.index_.end()) {
+		collector.nodes_[i->second] = NULL;
+		collector.index_.erase(i);
+	}
+}
+}
+
+void custom_object::run_garbage_collection()
+{
+	get_cycle_collector().start();
+	finish_garbage_collection();
+}
+
+void custom_object::start_garbage_collection()
+{
+	get_cycle_collector().start();
+}
+
+void custom_object::process_garbage_collection()
+{
+	if(get_cycle_collector().running()) {
+		get_cycle_collector().step(g_gc_slice_objects);
+	}
+}
+
+void custom_object::finish_garbage_collection()
+{
+	while(get_cycle_collector().running()) {
+		get_cycle_collector().step(INT_MAX);
+	}
+}
+
+namespace {
+struct gc_test_callable : public game_logic::map_formula_callable {
+	explicit gc_test_callable(bool* destroyed) : destroyed_(destroyed)
+	{}
+	~gc_test_callable() { *destroyed_ = true; }
+	bool* destroyed_;
+};
+}
+
+UNIT_TEST(garbage_collect_cycle_through_map)
+{
+	json::set_file_contents("data/classes/gc_cycle_test.cfg", "{ properties: { link: { type: 'any', variable: true } } }");
+
+	//a -> map -> b -> a, where the map is only held in a's variable.
+	bool destroyed = false;
+	boost::intrusive_ptr<game_logic::formula_object> a = game_logic::formula_object::create("gc_cycle_test");
+	boost::intrusive_ptr<game_logic::formula_object> b = game_logic::formula_object::create("gc_cycle_test");
+	gc_test_callable* m = new gc_test_callable(&destroyed);
+	a->mutate_value("link", variant(m));
+	m->add("link", variant(b.get()));
+	b->mutate_value("link", variant(a.get()));
+
+	const game_logic::formula_callable* root = a.get();
+	a.reset();
+	b.reset();
+
+	get_cycle_collector().start();
+	get_cycle_collector().add_root(root);
+	custom_object::finish_garbage_collection();
+	CHECK_EQ(destroyed, true);
 }
 
 void custom_object::being_removed()
@@ -2670,7 +3135,7 @@ variant custom_object::get_value_by_slot(int slot) const
 		return variant(&children);
 	}
 	case CUSTOM_OBJECT_PARENT:            return variant(parent_.get());
-	case CUSTOM_OBJECT_PIVOT:             return variant(parent_pivot_);
+	case CUSTOM_OBJECT_PIVOT:             return variant(parent_pivot());
 	case CUSTOM_OBJECT_PREVIOUS_Y:        return variant(previous_y_);
 	case CUSTOM_OBJECT_X1:                return variant(solid_rect().x());
 	case CUSTOM_OBJECT_X2:                return variant(solid_rect().w() ? solid_rect().x2() : x() + current_frame().width());
@@ -2902,7 +3367,7 @@ variant custom_object::get_value_by_slot(int slot) const
 
 	case CUSTOM_OBJECT_LIGHTS: {
 		std::vector<variant> result;
-		foreach(const light_ptr& p, lights_) {
+		foreach(const light_ptr& p, lights()) {
 			result.push_back(variant(p.get()));
 		}
 
@@ -2942,10 +3407,13 @@ variant custom_object::get_value_by_slot(int slot) const
 	case CUSTOM_OBJECT_HAS_FEET: return variant::from_bool(has_feet_);
 
 	case CUSTOM_OBJECT_UV_ARRAY: {
+		//reading mustn't allocate the cold data.
 		std::vector<variant> result;
-		result.reserve(custom_draw_uv_.size());
-		foreach(GLfloat f, custom_draw_uv_) {
-			result.push_back(variant(decimal(f)));
+		if(cold_) {
+			result.reserve(cold_->custom_draw_uv.size());
+			foreach(GLfloat f, cold_->custom_draw_uv) {
+				result.push_back(variant(decimal(f)));
+			}
 		}
 
 		return variant(&result);
@@ -2953,9 +3421,11 @@ variant custom_object::get_value_by_slot(int slot) const
 
 	case CUSTOM_OBJECT_XY_ARRAY: {
 		std::vector<variant> result;
-		result.reserve(custom_draw_xy_.size());
-		foreach(GLfloat f, custom_draw_xy_) {
-			result.push_back(variant(decimal(f)));
+		if(cold_) {
+			result.reserve(cold_->custom_draw_xy.size());
+			foreach(GLfloat f, cold_->custom_draw_xy) {
+				result.push_back(variant(decimal(f)));
+			}
 		}
 
 		return variant(&result);
@@ -2990,8 +3460,10 @@ variant custom_object::get_value_by_slot(int slot) const
 
 	case CUSTOM_OBJECT_TEXTV: {
 		std::vector<variant> v;
-		foreach(const gui::vector_text_ptr& vt, vector_text_) {
-			v.push_back(variant(vt.get()));
+		if(cold_) {
+			foreach(const gui::vector_text_ptr& vt, cold_->vector_text) {
+				v.push_back(variant(vt.get()));
+			}
 		}
 		return(variant(&v));
 	}
@@ -3022,8 +3494,10 @@ variant custom_object::get_value_by_slot(int slot) const
 	case CUSTOM_OBJECT_DRAW_PRIMITIVES: {
 #if defined(USE_SHADERS)
 		std::vector<variant> v;
-		foreach(boost::intrusive_ptr<graphics::draw_primitive> p, draw_primitives_) {
-			v.push_back(variant(p.get()));
+		if(cold_) {
+			foreach(boost::intrusive_ptr<graphics::draw_primitive> p, cold_->draw_primitives) {
+				v.push_back(variant(p.get()));
+			}
 		}
 
 		return variant(&v);
@@ -3063,7 +3537,7 @@ variant custom_object::get_value_by_slot(int slot) const
 		if(slot >= type_->slot_properties_base() && (size_t(slot - type_->slot_properties_base()) < type_->slot_properties().size())) {
 			const custom_object_type::property_entry& e = type_->slot_properties()[slot - type_->slot_properties_base()];
 			if(e.getter) {
-				if(std::find(properties_requiring_dynamic_initialization_.begin(), properties_requiring_dynamic_initialization_.end(), e.storage_slot) != properties_requiring_dynamic_initialization_.end()) {
+				if(cold_ && std::find(cold_->properties_requiring_dynamic_initialization.begin(), cold_->properties_requiring_dynamic_initialization.end(), e.storage_slot) != cold_->properties_requiring_dynamic_initialization.end()) {
 					ASSERT_LOG(false, "Read of uninitialized property " << debug_description() << "." << e.id);
 				}
 				active_property_scope scope(*this, e.storage_slot);
@@ -3139,9 +3613,11 @@ variant custom_object::get_value(const std::string& key) const
 		return i->second;
 	}
 
-	std::map<std::string, particle_system_ptr>::const_iterator particle_itor = particle_systems_.find(key);
-	if(particle_itor != particle_systems_.end()) {
-		return variant(particle_itor->second.get());
+	if(cold_) {
+		std::map<std::string, particle_system_ptr>::const_iterator particle_itor = cold_->particle_systems.find(key);
+		if(particle_itor != cold_->particle_systems.end()) {
+			return variant(particle_itor->second.get());
+		}
 	}
 
 	if(backup_callable_stack_.empty() == false && backup_callable_stack_.top()) {
@@ -3168,6 +3644,8 @@ void custom_object::get_inputs(std::vector<game_logic::formula_input>* inputs) c
 
 void custom_object::set_value(const std::string& key, const variant& value)
 {
+	wake_if_dormant();
+
 	const int slot = custom_object_callable::get_key_slot(key);
 	if(slot != -1) {
 		set_value_by_slot(slot, value);
@@ -3358,6 +3836,7 @@ void custom_object::set_value(const std::string& key, const variant& value)
 		} else {
 			type_ = base_type_->get_variation(current_variation_);
 		}
+		event_handlers_changed();
 
 		calculate_solid_rect();
 
@@ -3434,6 +3913,7 @@ void custom_object::set_value(const std::string& key, const variant& value)
 
 			get_all(base_type_->id()).erase(this);
 			base_type_ = type_ = p;
+			event_handlers_changed();
 			get_all(base_type_->id()).insert(this);
 			has_feet_ = type_->has_feet();
 			vars_.reset(new game_logic::formula_variable_storage(type_->variables())),
@@ -3485,6 +3965,8 @@ void custom_object::set_value(const std::string& key, const variant& value)
 
 void custom_object::set_value_by_slot(int slot, const variant& value)
 {
+	wake_if_dormant();
+
 	switch(slot) {
 	case CUSTOM_OBJECT_DATA: {
 		ASSERT_LOG(active_property_ >= 0, "Illegal access of 'data' in object when not in writable property");
@@ -3500,6 +3982,7 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 
 			get_all(base_type_->id()).erase(this);
 			base_type_ = type_ = p;
+			event_handlers_changed();
 			get_all(base_type_->id()).insert(this);
 			has_feet_ = type_->has_feet();
 			vars_.reset(new game_logic::formula_variable_storage(type_->variables())),
@@ -3647,7 +4130,7 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 
 	case CUSTOM_OBJECT_PARENT: {
 		entity_ptr e(value.try_convert<entity>());
-		set_parent(e, parent_pivot_);
+		set_parent(e, parent_pivot());
 		break;
 	}
 
@@ -4034,6 +4517,7 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 		} else {
 			type_ = base_type_->get_variation(current_variation_);
 		}
+		event_handlers_changed();
 
 		calculate_solid_rect();
 		handle_event("set_variations");
@@ -4079,11 +4563,11 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 	}
 
 	case CUSTOM_OBJECT_LIGHTS: {
-		lights_.clear();
+		cold().lights.clear();
 		for(int n = 0; n != value.num_elements(); ++n) {
 			light* p = value[n].try_convert<light>();
 			if(p) {
-				lights_.push_back(light_ptr(p));
+				cold().lights.push_back(light_ptr(p));
 			}
 		}
 		break;
@@ -4283,12 +4767,12 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 
 	case CUSTOM_OBJECT_CUSTOM_DRAW: {
 		if(value.is_null()) {
-			custom_draw_.reset();
+			cold().custom_draw.reset();
 		}
 
 		std::vector<frame::CustomPoint>* v = new std::vector<frame::CustomPoint>;
 
-		custom_draw_.reset(v);
+		cold().custom_draw.reset(v);
 
 		std::vector<GLfloat> positions;
 
@@ -4330,11 +4814,11 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 
 	case CUSTOM_OBJECT_UV_ARRAY: {
 		if(value.is_null()) {
-			custom_draw_uv_.clear();
+			cold().custom_draw_uv.clear();
 		} else {
-			custom_draw_uv_.clear();
+			cold().custom_draw_uv.clear();
 			foreach(const variant& v, value.as_list()) {
-				custom_draw_uv_.push_back(v.as_decimal().as_float());
+				cold().custom_draw_uv.push_back(v.as_decimal().as_float());
 			}
 		}
 
@@ -4343,11 +4827,11 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 
 	case CUSTOM_OBJECT_XY_ARRAY: {
 		if(value.is_null()) {
-			custom_draw_xy_.clear();
+			cold().custom_draw_xy.clear();
 		} else {
-			custom_draw_xy_.clear();
+			cold().custom_draw_xy.clear();
 			foreach(const variant& v, value.as_list()) {
-				custom_draw_xy_.push_back(v.as_decimal().as_float());
+				cold().custom_draw_xy.push_back(v.as_decimal().as_float());
 			}
 		}
 
@@ -4360,8 +4844,8 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 		const int xdim = items[0].as_int() + 2;
 		const int ydim = items[1].as_int() + 2;
 
-		custom_draw_xy_.clear();
-		custom_draw_uv_.clear();
+		cold().custom_draw_xy.clear();
+		cold().custom_draw_uv.clear();
 
 		for(int ypos = 0; ypos < ydim-1; ++ypos) {
 			const GLfloat y = GLfloat(ypos)/GLfloat(ydim-1);
@@ -4370,36 +4854,36 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 				const GLfloat x = GLfloat(xpos)/GLfloat(xdim-1);
 
 				if(xpos == 0 && ypos > 0) {
-					custom_draw_uv_.push_back(x);
-					custom_draw_uv_.push_back(y);
+					cold().custom_draw_uv.push_back(x);
+					cold().custom_draw_uv.push_back(y);
 				}
 
-				custom_draw_uv_.push_back(x);
-				custom_draw_uv_.push_back(y);
-				custom_draw_uv_.push_back(x);
-				custom_draw_uv_.push_back(y2);
+				cold().custom_draw_uv.push_back(x);
+				cold().custom_draw_uv.push_back(y);
+				cold().custom_draw_uv.push_back(x);
+				cold().custom_draw_uv.push_back(y2);
 
 				if(xpos == xdim-1 && ypos != ydim-2) {
-					custom_draw_uv_.push_back(x);
-					custom_draw_uv_.push_back(y2);
+					cold().custom_draw_uv.push_back(x);
+					cold().custom_draw_uv.push_back(y2);
 				}
 			}
 		}
 
-		custom_draw_xy_ = custom_draw_uv_;
+		cold().custom_draw_xy = cold().custom_draw_uv;
 		break;
 	}
 
 	case CUSTOM_OBJECT_DRAW_PRIMITIVES: {
 #if defined(USE_SHADERS)
-		draw_primitives_.clear();
+		cold().draw_primitives.clear();
 		for(int n = 0; n != value.num_elements(); ++n) {
 			if(value[n].is_callable()) {
 				boost::intrusive_ptr<graphics::draw_primitive> obj(value[n].try_convert<graphics::draw_primitive>());
 				ASSERT_LOG(obj.get() != NULL, "BAD OBJECT PASSED WHEN SETTING draw_primitives");
-				draw_primitives_.push_back(obj);
+				cold().draw_primitives.push_back(obj);
 			} else if(!value[n].is_null()) {
-				draw_primitives_.push_back(graphics::draw_primitive::create(value[n]));
+				cold().draw_primitives.push_back(graphics::draw_primitive::create(value[n]));
 			}
 		}
 		break;
@@ -4427,10 +4911,11 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 				ASSERT_LOG(false, "Attempt to set const property: " << debug_description() << "." << e.id);
 			}
 
-			if(!properties_requiring_dynamic_initialization_.empty()) {
-				std::vector<int>::iterator itor = std::find(properties_requiring_dynamic_initialization_.begin(), properties_requiring_dynamic_initialization_.end(), e.storage_slot);
-				if(itor != properties_requiring_dynamic_initialization_.end()) {
-					properties_requiring_dynamic_initialization_.erase(itor);
+			if(cold_ && !cold_->properties_requiring_dynamic_initialization.empty()) {
+				std::vector<int>& props = cold_->properties_requiring_dynamic_initialization;
+				std::vector<int>::iterator itor = std::find(props.begin(), props.end(), e.storage_slot);
+				if(itor != props.end()) {
+					props.erase(itor);
 				}
 			}
 		}
@@ -4626,6 +5111,33 @@ bool custom_object::is_active(const rect& screen_area) const
 	return false;
 }
 
+bool custom_object::get_activation_bounds(rect* bounds) const
+{
+	//these mirror the tests in is_active().
+	if(controls::num_players() > 1 || always_active() || type_->goes_inactive_only_when_standing() || text_) {
+		return false;
+	}
+
+	if(activation_area_) {
+		*bounds = *activation_area_;
+		return true;
+	}
+
+	const rect& area = frame_rect();
+	if(draw_area_) {
+		*bounds = rect(area.x(), area.y(), draw_area_->w()*2, draw_area_->h()*2);
+		return true;
+	}
+
+	if(parallax_scale_millis_.get() != NULL && (parallax_scale_millis_->first != 1000 || parallax_scale_millis_->second != 1000)) {
+		return false;
+	}
+
+	const int border = activation_border_;
+	*bounds = rect(area.x() - border, area.y() - border, area.w() + border*2, area.h() + border*2);
+	return true;
+}
+
 bool custom_object::move_to_standing(level& lvl, int max_displace)
 {
 	int start_y = y();
@@ -4728,9 +5240,9 @@ namespace {
 using game_logic::formula_callable;
 
 class backup_callable_stack_scope {
-	std::stack<const formula_callable*>* stack_;
+	std::stack<const formula_callable*, std::vector<const formula_callable*> >* stack_;
 public:
-	backup_callable_stack_scope(std::stack<const formula_callable*>* s, const formula_callable* item) : stack_(s) {
+	backup_callable_stack_scope(std::stack<const formula_callable*, std::vector<const formula_callable*> >* s, const formula_callable* item) : stack_(s) {
 		stack_->push(item);
 	}
 
@@ -4754,8 +5266,201 @@ void run_expression_for_edit_and_continue(boost::function<bool()> fn, bool* succ
 }
 }
 
+namespace {
+PREF_INT(parallel_process_threads, 0);
+
+//fewer objects than this aren't worth starting threads for.
+const int MinParallelProcessObjects = 32;
+
+//the callable an on_process handler is evaluated with on a worker thread.
+//It passes queries on to the object and records the values they gave.
+class process_read_recorder : public game_logic::formula_callable
+{
+public:
+	process_read_recorder(const custom_object& obj, std::vector<std::pair<int, variant> >* reads)
+	  : obj_(obj), reads_(reads)
+	{}
+private:
+	variant get_value(const std::string& key) const {
+		return obj_.query_value(key);
+	}
+
+	variant get_value_by_slot(int slot) const {
+		const variant result = obj_.query_value_by_slot(slot);
+		reads_->push_back(std::pair<int, variant>(slot, result));
+		return result;
+	}
+
+	const custom_object& obj_;
+	std::vector<std::pair<int, variant> >* reads_;
+};
+
+struct process_speculation {
+	custom_object* obj;
+	const game_logic::formula* handler;
+	std::vector<std::pair<int, variant> > reads;
+	variant result;
+	bool ready;
+};
+
+std::vector<process_speculation> process_speculations;
+
+int nspeculations_used = 0, nspeculations_discarded = 0;
+int speculation_work_ms = 0, speculation_wait_ms = 0;
+
+void speculate_process_range(process_speculation* begin, process_speculation* end, int* elapsed)
+{
+	//objects only change between processing steps on the main thread, which
+	//waits for the speculation, so the handlers see the same objects from
+	//every thread. Errors are left for the serial evaluation to report.
+	const suspend_call_stack_scope call_stack_scope;
+	const assert_recover_scope recover_scope;
+
+	const int start = SDL_GetTicks();
+	for(; begin != end; ++begin) {
+		try {
+			const process_read_recorder recorder(*begin->obj, &begin->reads);
+			begin->result = begin->handler->expr()->evaluate(recorder);
+			begin->ready = true;
+		} catch(...) {
+			//leave it for the serial evaluation to report.
+			begin->reads.clear();
+			begin->ready = false;
+		}
+	}
+
+	*elapsed = SDL_GetTicks() - start;
+}
+}
+
+void custom_object::speculate_process_events(const std::vector<entity_ptr>& chars)
+{
+	clear_process_speculations();
+	if(g_parallel_process_threads <= 0) {
+		return;
+	}
+
+	foreach(const entity_ptr& e, chars) {
+		custom_object* obj = dynamic_cast<custom_object*>(e.get());
+		if(obj == NULL || !obj->type_->parallel_process() || obj->paused_ || obj->destroyed() || obj->sleeping_until() || obj->is_human()) {
+			continue;
+		}
+
+		if(size_t(OBJECT_EVENT_PROCESS) < obj->event_handlers_.size() && obj->event_handlers_[OBJECT_EVENT_PROCESS]) {
+			continue;
+		}
+
+		process_speculation s = { obj, obj->type_->get_event_handler(OBJECT_EVENT_PROCESS).get() };
+		s.ready = false;
+		obj->process_speculation_ = process_speculations.size();
+		process_speculations.push_back(s);
+	}
+
+	const int nthreads = std::min<int>(g_parallel_process_threads, process_speculations.size()/MinParallelProcessObjects);
+	if(nthreads < 1) {
+		clear_process_speculations();
+		return;
+	}
+
+	const int start = SDL_GetTicks();
+
+	process_speculation* base = &process_speculations[0];
+	const int nspeculations = process_speculations.size();
+	std::vector<int> elapsed(nthreads+1);
+	{
+		std::vector<boost::shared_ptr<threading::thread> > threads;
+		for(int n = 1; n <= nthreads; ++n) {
+			boost::function<void()> fn = boost::bind(speculate_process_range, base + (nspeculations*n)/(nthreads+1), base + (nspeculations*(n+1))/(nthreads+1), &elapsed[n]);
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+			threads.push_back(boost::shared_ptr<threading::thread>(new threading::thread("process", fn)));
+#else
+			threads.push_back(boost::shared_ptr<threading::thread>(new threading::thread(fn)));
+#endif
+		}
+
+		speculate_process_range(base, base + nspeculations/(nthreads+1), &elapsed[0]);
+		foreach(boost::shared_ptr<threading::thread>& t, threads) {
+			t->join();
+		}
+	}
+
+	foreach(int ms, elapsed) {
+		speculation_work_ms += ms;
+	}
+
+	speculation_wait_ms += SDL_GetTicks() - start;
+}
+
+void custom_object::clear_process_speculations()
+{
+	foreach(process_speculation& s, process_speculations) {
+		if(s.obj->process_speculation_ != -1) {
+			s.obj->process_speculation_ = -1;
+			++nspeculations_discarded;
+		}
+	}
+
+	process_speculations.clear();
+}
+
+std::string custom_object::summarize_process_speculation()
+{
+	std::ostringstream s;
+	if(nspeculations_used || nspeculations_discarded) {
+		s << "parallel process: " << nspeculations_used << " used, " << nspeculations_discarded << " discarded, " << speculation_work_ms << "ms of work in " << speculation_wait_ms << "ms";
+	}
+
+	nspeculations_used = nspeculations_discarded = 0;
+	speculation_work_ms = speculation_wait_ms = 0;
+	return s.str();
+}
+
+bool custom_object::take_process_speculation(const game_logic::formula* handler, variant* result)
+{
+	process_speculation& s = process_speculations[process_speculation_];
+	process_speculation_ = -1;
+
+	//the handler only computes with what it read, so if that's all the
+	//same, so is the result.
+	bool valid = s.ready && s.handler == handler;
+	for(int n = 0; valid && n != s.reads.size(); ++n) {
+		valid = query_value_by_slot(s.reads[n].first) == s.reads[n].second;
+	}
+
+	if(valid) {
+		*result = s.result;
+		++nspeculations_used;
+	} else {
+		++nspeculations_discarded;
+	}
+
+	s.result = variant();
+	s.reads.clear();
+	return valid;
+}
+
+bool custom_object::handles_event(int event) const
+{
+	if(size_t(event) < event_handlers_.size() && event_handlers_[event] || type_->has_event_handler(event)) {
+		return true;
+	}
+
+#ifndef NO_EDITOR
+	//every event is passed on to an 'any' handler.
+	if(event != OBJECT_EVENT_ANY && (event_handlers_.empty() == false && event_handlers_[OBJECT_EVENT_ANY] || type_->has_event_handler(OBJECT_EVENT_ANY))) {
+		return true;
+	}
+#endif
+
+	return false;
+}
+
 bool custom_object::handle_event(int event, const formula_callable* context)
 {
+	if(!handles_event(event)) {
+		return false;
+	}
+
 	if(preferences::edit_and_continue()) {
 		try {
 			const_custom_object_type_ptr type_back = type_;
@@ -4826,6 +5531,16 @@ bool custom_object::handle_event_internal(int event, const formula_callable* con
 		return false;
 	}
 
+	if(size_t(event) >= events_dispatched_this_frame.size()) {
+		events_dispatched_this_frame.resize(event+1);
+	}
+
+	++events_dispatched_this_frame[event];
+
+	if(sleeping_until() && event != OBJECT_EVENT_DRAW) {
+		set_sleeping_until(0);
+	}
+
 	swallow_mouse_event_ = false;
 	backup_callable_stack_scope callable_scope(&backup_callable_stack_, context);
 
@@ -4843,7 +5558,9 @@ bool custom_object::handle_event_internal(int event, const formula_callable* con
 		
 		try {
 			formula_profiler::instrument instrumentation("FFL");
-			var = handler->execute(*this);
+			if(process_speculation_ == -1 || event != OBJECT_EVENT_PROCESS || !take_process_speculation(handler, &var)) {
+				var = handler->execute(*this);
+			}
 		} catch(validation_failure_exception& e) {
 #ifndef DISABLE_FORMULA_PROFILER
 			event_call_stack.pop_back();
@@ -5020,6 +5737,7 @@ void custom_object::set_event_handler(int key, game_logic::const_formula_ptr f)
 	}
 
 	event_handlers_[key] = f;
+	event_handlers_changed();
 }
 
 bool custom_object::can_interact_with() const
@@ -5113,103 +5831,50 @@ void custom_object::cleanup_references()
 	}
 }
 
-void custom_object::extract_gc_object_references(std::vector<gc_object_reference>& v)
+void custom_object::visit_values(game_logic::formula_callable_visitor& visitor)
 {
-	extract_gc_object_references(last_hit_by_, v);
-	extract_gc_object_references(standing_on_, v);
-	extract_gc_object_references(parent_, v);
-	foreach(variant& var, vars_->values()) {
-		extract_gc_object_references(var, v);
-	}
-
-	foreach(variant& var, tmp_vars_->values()) {
-		extract_gc_object_references(var, v);
+	if(last_hit_by_) {
+		visitor.visit(&last_hit_by_);
 	}
 
-	foreach(variant& var, property_data_) {
-		extract_gc_object_references(var, v);
+	if(standing_on_) {
+		visitor.visit(&standing_on_);
 	}
 
-	gc_object_reference visitor;
-	visitor.owner = this;
-	visitor.target = NULL;
-	visitor.from_variant = NULL;
-	visitor.visitor.reset(new game_logic::formula_callable_visitor);
-	foreach(gui::widget_ptr w, widgets_) {
-		w->perform_visit_values(*visitor.visitor);
+	if(parent_) {
+		visitor.visit(&parent_);
 	}
 
-	foreach(game_logic::formula_callable_suspended_ptr ptr, visitor.visitor->pointers()) {
-		if(dynamic_cast<const custom_object*>(ptr->value())) {
-			ptr->destroy_ref();
-		}
+	foreach(variant& var, vars_->values()) {
+		visitor.visit(&var);
 	}
 
-	v.push_back(visitor);
-}
-
-void custom_object::extract_gc_object_references(entity_ptr& e, std::vector<gc_object_reference>& v)
-{
-	if(!e) {
-		return;
+	foreach(variant& var, tmp_vars_->values()) {
+		visitor.visit(&var);
 	}
 
-	v.resize(v.size()+1);
-	gc_object_reference& ref = v.back();
-	ref.owner = this;
-	ref.target = e.get();
-	ref.from_variant = NULL;
-	ref.from_ptr = &e;
-
-	e.reset();
-}
-
-void custom_object::extract_gc_object_references(variant& var, std::vector<gc_object_reference>& v)
-{
-	if(var.is_callable()) {
-		if(var.try_convert<entity>()) {
-			v.resize(v.size()+1);
-			gc_object_reference& ref = v.back();
-			ref.owner = this;
-			ref.target = var.try_convert<entity>();
-			ref.from_variant = &var;
-			ref.from_ptr = NULL;
-
-			var = variant();
-		}
-	} else if(var.is_list()) {
-		for(int n = 0; n != var.num_elements(); ++n) {
-			extract_gc_object_references(*var.get_index_mutable(n), v);
-		}
-	} else if(var.is_map()) {
-		foreach(variant k, var.get_keys().as_list()) {
-			extract_gc_object_references(*var.get_attr_mutable(k), v);
-		}
+	foreach(variant& var, property_data_) {
+		visitor.visit(&var);
 	}
-}
 
-void custom_object::restore_gc_object_reference(gc_object_reference ref)
-{
-	if(ref.visitor) {
-		foreach(game_logic::formula_callable_suspended_ptr ptr, ref.visitor->pointers()) {
-			ptr->restore_ref();
+	if(cold_) {
+		foreach(gui::widget_ptr w, cold_->widgets) {
+			w->perform_visit_values(visitor);
 		}
-	} else if(ref.from_variant) {
-		*ref.from_variant = variant(ref.target);
-	} else {
-		ref.from_ptr->reset(ref.target);
 	}
 }
 
 void custom_object::add_particle_system(const std::string& key, const std::string& type)
 {
-	particle_systems_[key] = type_->get_particle_system_factory(type)->create(*this);
-	particle_systems_[key]->set_type(type);
+	cold().particle_systems[key] = type_->get_particle_system_factory(type)->create(*this);
+	cold().particle_systems[key]->set_type(type);
 }
 
 void custom_object::remove_particle_system(const std::string& key)
 {
-	particle_systems_.erase(key);
+	if(cold_) {
+		cold_->particle_systems.erase(key);
+	}
 }
 
 void custom_object::set_text(const std::string& text, const std::string& font, int size, int align)
@@ -5361,7 +6026,9 @@ bool custom_object::appears_at_difficulty(int difficulty) const
 void custom_object::set_parent(entity_ptr e, const std::string& pivot_point)
 {
 	parent_ = e;
-	parent_pivot_ = pivot_point;
+	if(cold_ || pivot_point.empty() == false) {
+		cold().parent_pivot = pivot_point;
+	}
 
 	const point pos = parent_position();
 	parent_prev_x_ = pos.x;
@@ -5446,13 +6113,31 @@ bool custom_object::solid_platform() const
 	return type_->solid_platform();
 }
 
+const std::vector<light_ptr>& custom_object::lights() const
+{
+	static const std::vector<light_ptr> empty;
+	return cold_ ? cold_->lights : empty;
+}
+
+const GLfloat* custom_object::model() const
+{
+	static const glm::mat4 identity(1.0f);
+	return glm::value_ptr(cold_ ? cold_->model : identity);
+}
+
+const std::string& custom_object::parent_pivot() const
+{
+	static const std::string empty;
+	return cold_ ? cold_->parent_pivot : empty;
+}
+
 point custom_object::parent_position() const
 {
 	if(parent_.get() == NULL) {
 		return point(0,0);
 	}
 
-	return parent_->pivot(parent_pivot_);
+	return parent_->pivot(parent_pivot());
 }
 
 void custom_object::update_type(const_custom_object_type_ptr old_type,
@@ -5468,6 +6153,7 @@ void custom_object::update_type(const_custom_object_type_ptr old_type,
 	} else {
 		type_ = base_type_->get_variation(current_variation_);
 	}
+	event_handlers_changed();
 
 	game_logic::formula_variable_storage_ptr old_vars = vars_;
 
@@ -5501,7 +6187,9 @@ void custom_object::update_type(const_custom_object_type_ptr old_type,
 	frame_.reset(&type_->get_frame(frame_name_));
 
 	std::map<std::string, particle_system_ptr> systems;
-	systems.swap(particle_systems_);
+	if(cold_) {
+		systems.swap(cold_->particle_systems);
+	}
 	for(std::map<std::string, particle_system_ptr>::const_iterator i = systems.begin(); i != systems.end(); ++i) {
 		add_particle_system(i->first, i->second->type());
 	}
@@ -5519,37 +6207,46 @@ void custom_object::update_type(const_custom_object_type_ptr old_type,
 std::vector<variant> custom_object::get_variant_widget_list() const
 {
 	std::vector<variant> v;
-	for(widget_list::iterator it = widgets_.begin(); it != widgets_.end(); ++it) {
-		v.push_back(variant(it->get()));
+	if(cold_) {
+		for(widget_list::iterator it = cold_->widgets.begin(); it != cold_->widgets.end(); ++it) {
+			v.push_back(variant(it->get()));
+		}
 	}
 	return v;
 }
 
 void custom_object::add_widget(const gui::widget_ptr& w)
 { 
-	widgets_.insert(w); 
+	cold().widgets.insert(w); 
 }
 
 void custom_object::add_widgets(std::vector<gui::widget_ptr>* widgets) 
 {
-	widgets_.clear();
-	std::copy(widgets->begin(), widgets->end(), std::inserter(widgets_, widgets_.end()));
+	cold().widgets.clear();
+	std::copy(widgets->begin(), widgets->end(), std::inserter(cold().widgets, cold().widgets.end()));
 }
 
 void custom_object::clear_widgets() 
 { 
-	widgets_.clear(); 
+	if(cold_) {
+		cold_->widgets.clear();
+	}
 }
 
 void custom_object::remove_widget(gui::widget_ptr w)
 {
-	widget_list::iterator it = widgets_.find(w);
-	ASSERT_LOG(it != widgets_.end(), "Tried to erase widget not in list.");
-	widgets_.erase(it);
+	widget_list& widgets = cold().widgets;
+	widget_list::iterator it = widgets.find(w);
+	ASSERT_LOG(it != widgets.end(), "Tried to erase widget not in list.");
+	widgets.erase(it);
 }
 
 bool custom_object::handle_sdl_event(const SDL_Event& event, bool claimed)
 {
+	if(!cold_ || cold_->widgets.empty()) {
+		return claimed;
+	}
+
 	SDL_Event ev(event);
 	if(event.type == SDL_MOUSEMOTION) {
 		ev.motion.x -= x();
@@ -5569,7 +6266,7 @@ bool custom_object::handle_sdl_event(const SDL_Event& event, bool claimed)
 
 	// XXX fix listener_container::process_event() to remain working in the case the iterator
 	// gets invalidated during process even, so we can remove this copy.
-	widget_list w = widgets_;
+	widget_list w = cold_->widgets;
 	widget_list::const_reverse_iterator ritor = w.rbegin();
 	while(ritor != w.rend()) {
 		claimed |= (*ritor++)->process_event(ev, claimed);
@@ -5584,10 +6281,12 @@ game_logic::formula_ptr custom_object::create_formula(const variant& v)
 
 gui::const_widget_ptr custom_object::get_widget_by_id(const std::string& id) const
 {
-	foreach(const gui::widget_ptr& w, widgets_) {
-		gui::widget_ptr wx = w->get_widget_by_id(id);
-		if(wx) {
-			return wx;
+	if(cold_) {
+		foreach(const gui::widget_ptr& w, cold_->widgets) {
+			gui::widget_ptr wx = w->get_widget_by_id(id);
+			if(wx) {
+				return wx;
+			}
 		}
 	}
 	return gui::const_widget_ptr();
@@ -5595,10 +6294,12 @@ gui::const_widget_ptr custom_object::get_widget_by_id(const std::string& id) con
 
 gui::widget_ptr custom_object::get_widget_by_id(const std::string& id)
 {
-	foreach(const gui::widget_ptr& w, widgets_) {
-		gui::widget_ptr wx = w->get_widget_by_id(id);
-		if(wx) {
-			return wx;
+	if(cold_) {
+		foreach(const gui::widget_ptr& w, cold_->widgets) {
+			gui::widget_ptr wx = w->get_widget_by_id(id);
+			if(wx) {
+				return wx;
+			}
 		}
 	}
 	return gui::widget_ptr();
@@ -5638,7 +6339,41 @@ BENCHMARK(custom_object_spike) {
 	}
 }
 
+BENCHMARK(custom_object_spike_pooled) {
+	//as custom_object_spike, with every type keeping its instances' storage.
+	const int pool_size = g_object_pool_size;
+	g_object_pool_size = 16;
+	BENCHMARK_custom_object_spike(benchmark_iterations);
+	g_object_pool_size = pool_size;
+}
+
+BENCHMARK(custom_object_process_many) {
+	//processes a crowd of plain objects, the case where the per-object
+	//footprint walked each cycle matters most.
+	static level* lvl = NULL;
+	static std::vector<entity_ptr> objects;
+	if(!lvl) {
+		lvl = new level("test.cfg");
+		static variant v(lvl);
+		lvl->finish_loading();
+		lvl->set_as_current_level();
+
+		for(int n = 0; n != 2000; ++n) {
+			custom_object* obj = new custom_object("chain_base", (n%50)*32, (n/50)*32, false);
+			objects.push_back(entity_ptr(obj));
+			obj->handle_event(OBJECT_EVENT_CREATE);
+		}
+	}
+
+	BENCHMARK_LOOP {
+		foreach(const entity_ptr& e, objects) {
+			e->process(*lvl);
+		}
+	}
+}
+
 int custom_object::events_handled_per_second = 0;
+std::vector<int> custom_object::events_dispatched_this_frame;
 
 BENCHMARK_ARG(custom_object_get_attr, const std::string& attr)
 {
@@ -59,13 +59,27 @@ public:
 	static std::set<custom_object*>& get_all(const std::string& type);
 	static void init();
 
+	//collects reference cycles among objects, abandoning any collection
+	//in progress, and runs it to completion.
 	static void run_garbage_collection();
 
+	//starts a collection whose work is spread over the following frames
+	//by process_garbage_collection(), a fixed number of objects at a time,
+	//or done at once by finish_garbage_collection().
+	static void start_garbage_collection();
+	static void process_garbage_collection();
+	static void finish_garbage_collection();
+
 	explicit custom_object(variant node);
 	custom_object(const std::string& type, int x, int y, bool face_right);
 	custom_object(const custom_object& o);
 	virtual ~custom_object();
 
+	//objects are allocated from memory of destroyed objects where it's
+	//available. See custom_object_type::pool_size().
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
+
 	void validate_properties();
 
 	bool is_a(const std::string& type) const;
@@ -136,6 +150,7 @@ public:
 	void die();
 	void die_with_no_event();
 	virtual bool is_active(const rect& screen_area) const;
+	bool get_activation_bounds(rect* bounds) const;
 	bool dies_on_inactive() const;
 	bool always_active() const;
 	bool move_to_standing(level& lvl, int max_displace=10000);
@@ -177,9 +192,9 @@ public:
 
 	void set_text(const std::string& text, const std::string& font, int size, int align);
 	void add_vector_text(const gui::vector_text_ptr& txtp) {
-		vector_text_.push_back(txtp);
+		cold().vector_text.push_back(txtp);
 	}
-	void clear_vector_text() { vector_text_.clear(); }
+	void clear_vector_text() { if(cold_) { cold_->vector_text.clear(); } }
 
 	virtual int hitpoints() const { return hitpoints_; }
 
@@ -205,6 +220,7 @@ public:
 	virtual bool handle_event(const std::string& event, const formula_callable* context=NULL);
 	virtual bool handle_event(int event, const formula_callable* context=NULL);
 	virtual bool handle_event_delay(int event, const formula_callable* context=NULL);
+	virtual bool handles_event(int event) const;
 
 	virtual void resolve_delayed_events();
 
@@ -223,8 +239,25 @@ public:
 	//statistic on how many FFL events are handled every second.
 	static int events_handled_per_second;
 
-	const std::vector<light_ptr>& lights() const { return lights_; }
-	void swap_lights(std::vector<light_ptr>& lights) { lights_.swap(lights); }
+	//how many times each event ID was dispatched to a handler since the
+	//counts were last reset. Reset once per frame by the level runner.
+	static std::vector<int> events_dispatched_this_frame;
+
+	//evaluates, on worker threads and ahead of processing, the on_process
+	//handlers of those objects whose types allow it. An object uses its
+	//result when it handles its process event if the values the handler
+	//read are unchanged by then, and evaluates the handler again otherwise,
+	//so the outcome is the same as processing serially.
+	static void speculate_process_events(const std::vector<entity_ptr>& chars);
+	static void clear_process_speculations();
+
+	//how many speculated process events were used and discarded, and how
+	//the time spent evaluating them compares to the time spent waiting for
+	//them, since the last call.
+	static std::string summarize_process_speculation();
+
+	const std::vector<light_ptr>& lights() const;
+	void swap_lights(std::vector<light_ptr>& lights) { cold().lights.swap(lights); }
 
 	void shift_position(int x, int y);
 
@@ -255,7 +288,7 @@ public:
 		return false;
 	}
 
-	const GLfloat* model() const { return glm::value_ptr(model_); }
+	const GLfloat* model() const;
 
 protected:
 	//components of per-cycle process() that can be done even on
@@ -308,18 +341,13 @@ private:
 	custom_object& operator=(const custom_object& o);
 	struct Accessor;
 
-	struct gc_object_reference {
-		entity* owner;
-		entity* target;
-		variant* from_variant;
-		entity_ptr* from_ptr;
-		boost::shared_ptr<game_logic::formula_callable_visitor> visitor;
-	};
+	//reuse the storage of a dead instance of our type, if there is one, and
+	//give ours back when we die.
+	bool take_pooled_storage();
+	void release_pooled_storage();
 
-	void extract_gc_object_references(std::vector<gc_object_reference>& v);
-	void extract_gc_object_references(entity_ptr& e, std::vector<gc_object_reference>& v);
-	void extract_gc_object_references(variant& var, std::vector<gc_object_reference>& v);
-	static void restore_gc_object_reference(gc_object_reference ref);
+	//exposes the objects we refer to, for the cycle collector.
+	void visit_values(game_logic::formula_callable_visitor& visitor);
 
 	bool move_to_standing_internal(level& lvl, int max_displace);
 
@@ -378,7 +406,7 @@ private:
 
 	//a stack of items that serve as the 'value' parameter, used in
 	//property setters.
-	mutable std::stack<variant> value_stack_;
+	mutable std::stack<variant, std::vector<variant> > value_stack_;
 
 	friend class active_property_scope;
 
@@ -412,13 +440,9 @@ private:
 	
 	bool can_interact_with_;
 
-	std::map<std::string, particle_system_ptr> particle_systems_;
-
 	typedef boost::shared_ptr<custom_object_text> custom_object_text_ptr;
 	custom_object_text_ptr text_;
 
-	std::vector<gui::vector_text_ptr> vector_text_;
-
 	entity_ptr driver_;
 
 	boost::shared_ptr<blur_info> blur_;
@@ -440,7 +464,7 @@ private:
 
 	bool always_active_;
 
-	std::stack<const formula_callable*> backup_callable_stack_;
+	std::stack<const formula_callable*, std::vector<const formula_callable*> > backup_callable_stack_;
 
 
 	int last_cycle_active_;
@@ -456,28 +480,17 @@ private:
 
 	boost::scoped_ptr<position_schedule> position_schedule_;
 
-	std::vector<light_ptr> lights_;
-
 	boost::scoped_ptr<rect> platform_area_;
 	const_solid_info_ptr platform_solid_info_;
 
 	point parent_position() const;
 
-	//storage of the parent object while we're loading the object still.
-	variant parent_loading_;
-
 	entity_ptr parent_;
-	std::string parent_pivot_;
 	int parent_prev_x_, parent_prev_y_;
 	bool parent_prev_facing_;
 
 	int min_difficulty_, max_difficulty_;
 
-	boost::shared_ptr<const std::vector<frame::CustomPoint> > custom_draw_;
-
-	std::vector<GLfloat> custom_draw_xy_;
-	std::vector<GLfloat> custom_draw_uv_;
-
 	void set_platform_area(const rect& area);
 
 	std::vector<int> platform_offsets_;
@@ -489,24 +502,53 @@ private:
 
 	int currently_handling_die_event_;
 
+	//index of our speculated process event, or -1.
+	int process_speculation_;
+	bool take_process_speculation(const game_logic::formula* handler, variant* result);
+
 	typedef std::set<gui::widget_ptr, gui::widget_sort_zorder> widget_list;
-	widget_list widgets_;
 
 	rect previous_water_bounds_;
 
 	mutable screen_position adjusted_draw_position_;
 
-#if defined(USE_SHADERS)
-	std::vector<graphics::draw_primitive_ptr> draw_primitives_;
-#endif
-
 	bool paused_;
 
-	glm::mat4 model_;
 	// XXX these are hacks.
 	mutable GLint vertex_location_;
 	mutable GLint texcoord_location_;
-	std::vector<int> properties_requiring_dynamic_initialization_;
+
+	//data that most objects never use, or only use rarely, kept apart so
+	//that the members used every cycle share fewer cache lines. It's only
+	//allocated once something is stored in it.
+	struct cold_data {
+		cold_data() : model(1.0f) {}
+
+		std::map<std::string, particle_system_ptr> particle_systems;
+		std::vector<gui::vector_text_ptr> vector_text;
+		std::vector<light_ptr> lights;
+
+		//storage of the parent object while we're loading the object still.
+		variant parent_loading;
+		std::string parent_pivot;
+
+		boost::shared_ptr<const std::vector<frame::CustomPoint> > custom_draw;
+		std::vector<GLfloat> custom_draw_xy;
+		std::vector<GLfloat> custom_draw_uv;
+
+		widget_list widgets;
+
+#if defined(USE_SHADERS)
+		std::vector<graphics::draw_primitive_ptr> draw_primitives;
+#endif
+
+		glm::mat4 model;
+		std::vector<int> properties_requiring_dynamic_initialization;
+	};
+
+	boost::scoped_ptr<cold_data> cold_;
+	cold_data& cold() { if(!cold_) { cold_.reset(new cold_data); } return *cold_; }
+	const std::string& parent_pivot() const;
 };
 
 #endif
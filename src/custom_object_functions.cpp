@@ -841,6 +841,12 @@ FUNCTION_ARGS_DEF
 RETURN_TYPE("commands")
 END_FUNCTION_DEF(preload_sound)
 
+FUNCTION_DEF(sound_memory, 0, 0, "sound_memory(): returns a map of how much memory sound effects use")
+	formula::fail_if_static_context();
+	return sound::memory_usage();
+RETURN_TYPE("map")
+END_FUNCTION_DEF(sound_memory)
+
 class screen_flash_command : public entity_command_callable
 {
 public:
@@ -2555,6 +2561,27 @@ FUNCTION_ARGS_DEF
 RETURN_TYPE("commands")
 END_FUNCTION_DEF(schedule)
 
+class sleep_command : public entity_command_callable {
+public:
+	explicit sleep_command(int cycles) : cycles_(cycles)
+	{}
+
+	virtual void execute(level& lvl, entity& ob) const {
+		lvl.sleep_object(entity_ptr(&ob), cycles_);
+	}
+private:
+	int cycles_;
+};
+
+FUNCTION_DEF(sleep, 1, 1, "sleep(int cycles): stops processing the current object until the given number of cycles have passed, or until it handles an event other than draw. The object still counts as active and is still drawn while it sleeps.")
+	sleep_command* cmd = (new sleep_command(args()[0]->evaluate(variables).as_int()));
+	cmd->set_expression(this);
+	return variant(cmd);
+FUNCTION_ARGS_DEF
+	ARG_TYPE("int")
+RETURN_TYPE("commands")
+END_FUNCTION_DEF(sleep)
+
 class add_water_command : public entity_command_callable
 {
 	rect r_;
@@ -28,6 +28,7 @@
 #include "formula_callable.hpp"
 #include "formula_callable_definition.hpp"
 #include "formula_function.hpp"
+#include "formula_variable_storage.hpp"
 #include "frame.hpp"
 #include "particle_system.hpp"
 #include "raster.hpp"
@@ -106,6 +107,7 @@ public:
 	const game_logic::const_formula_ptr& next_animation_formula() const { return next_animation_formula_; }
 
 	game_logic::const_formula_ptr get_event_handler(int event) const;
+	bool has_event_handler(int event) const { return size_t(event) < event_handlers_.size() && event_handlers_[event]; }
 	int parallax_scale_millis_x() const {
 		if(parallax_scale_millis_.get() == NULL){
 			return 1000;
@@ -242,6 +244,22 @@ public:
 	variant node() const { return node_; }
 
 	int activation_border() const { return activation_border_; }
+
+	//the storage of up to pool_size() dead instances of this type is kept
+	//and reused by new instances, saving the allocations.
+	int pool_size() const { return pool_size_; }
+
+	//true if the type opts in with parallel_process: true. Its on_process
+	//handler must only compute with numbers the object holds itself, so it
+	//may be evaluated on a worker thread.
+	bool parallel_process() const { return parallel_process_; }
+
+	struct pooled_storage {
+		game_logic::formula_variable_storage_ptr vars, tmp_vars;
+		std::vector<variant> property_data;
+	};
+
+	std::vector<pooled_storage>& instance_pool() const { return instance_pool_; }
 	const variant& available_frames() const { return available_frames_; }
 
 	bool editor_force_standing() const { return editor_force_standing_; }
@@ -364,6 +382,11 @@ private:
 
 	int activation_border_;
 
+	int pool_size_;
+	mutable std::vector<pooled_storage> instance_pool_;
+
+	bool parallel_process_;
+
 	std::map<std::string, game_logic::const_formula_ptr> variations_;
 	mutable std::map<std::vector<std::string>, const_custom_object_type_ptr> variations_cache_;
 
@@ -28,6 +28,7 @@
 #include "draw_primitive.hpp"
 #include "foreach.hpp"
 #include "geometry.hpp"
+#include "gl_state.hpp"
 #include "gles2.hpp"
 #include "level.hpp"
 #include "raster.hpp"
@@ -509,7 +510,7 @@ void wireframe_box_primitive::handle_draw() const
 void wireframe_box_primitive::handle_draw(const lighting_ptr& lighting, const camera_callable_ptr& camera) const
 {
 	shader_save_context save;
-	glUseProgram(shader_->get());
+	gl_state::use_program(shader_->get());
 
 	glm::mat4 model = glm::translate(glm::mat4(), translation_) 
 		* glm::translate(glm::mat4(), glm::vec3((b2_.x - b1_.x)/2.0f,(b2_.y - b1_.y)/2.0f,(b2_.z - b1_.z)/2.0f))
@@ -680,7 +681,7 @@ private:
 	void handle_draw(const lighting_ptr& lighting, const camera_callable_ptr& camera) const
 	{
 		shader_save_context save;
-		glUseProgram(shader_->get());
+		gl_state::use_program(shader_->get());
 
 		glm::mat4 model = glm::translate(glm::mat4(), translation_) 
 			* glm::translate(glm::mat4(), glm::vec3((b2_.x - b1_.x)/2.0f,(b2_.y - b1_.y)/2.0f,(b2_.z - b1_.z)/2.0f))
@@ -794,9 +795,9 @@ draw_primitive::draw_primitive(const variant& v)
 void draw_primitive::draw() const
 {
 	if(src_factor_ != GL_SRC_ALPHA || dst_factor_ != GL_ONE_MINUS_SRC_ALPHA) {
-		glBlendFunc(src_factor_, dst_factor_);
+		gl_state::blend_func(src_factor_, dst_factor_);
 		handle_draw();
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	} else {
 		handle_draw();
 	}
@@ -806,9 +807,9 @@ void draw_primitive::draw() const
 void draw_primitive::draw(const lighting_ptr& lighting, const camera_callable_ptr& camera) const
 {
 	if(src_factor_ != GL_SRC_ALPHA || dst_factor_ != GL_ONE_MINUS_SRC_ALPHA) {
-		glBlendFunc(src_factor_, dst_factor_);
+		gl_state::blend_func(src_factor_, dst_factor_);
 		handle_draw(lighting, camera);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	} else {
 		handle_draw(lighting, camera);
 	}
@@ -580,6 +580,9 @@ variant performance_data::get_value(const std::string& key) const
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(texture_binds);
+	PERF_ATTR(gl_calls_issued);
+	PERF_ATTR(gl_calls_filtered);
 #undef PERF_ATTR
 
 	return variant();
@@ -596,6 +599,9 @@ void performance_data::get_inputs(std::vector<game_logic::formula_input>* inputs
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(texture_binds);
+	PERF_ATTR(gl_calls_issued);
+	PERF_ATTR(gl_calls_filtered);
 #undef PERF_ATTR
 }
 
@@ -620,18 +626,36 @@ void draw_fps(const level& lvl, const performance_data& data)
 		return;
 	}
 	std::ostringstream s;
-	s << data.fps << "/" << data.cycles_per_second << "fps; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events";
+	s << data.fps << "/" << data.cycles_per_second << "fps; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events; " << data.texture_binds << " binds";
 
 	rect area = font->draw(10, 60, s.str());
 
+	if(data.gl_calls_issued || data.gl_calls_filtered) {
+		std::ostringstream s;
+		s << data.gl_calls_issued << " GL state calls issued; " << data.gl_calls_filtered << " filtered";
+		area = font->draw(10, area.y2() + 5, s.str());
+	}
+
 	if(controls::num_players() > 1) {
 		//draw networking stats
 		std::ostringstream s;
-		s << controls::packets_received() << " packets received; " << controls::num_errors() << " errors; " << controls::cycles_behind() << " behind; " << controls::their_highest_confirmed() << " remote cycles " << controls::last_packet_size() << " packet";
+		s << controls::packets_received() << " packets received; " << controls::num_errors() << " errors; " << controls::cycles_behind() << " behind; " << controls::their_highest_confirmed() << " remote cycles " << controls::last_packet_size() << " packet; " << controls::bytes_sent_per_second() << "/" << controls::bytes_received_per_second() << " bytes/s out/in; " << controls::cycles_resent_per_second() << " resent/s; " << lvl.num_rollbacks() << " rollbacks of " << lvl.num_rollback_cycles() << " cycles";
 
 		area = font->draw(10, area.y2() + 5, s.str());
 	}
 
+	if(!data.event_dispatch_info.empty()) {
+		area = font->draw(10, area.y2() + 5, data.event_dispatch_info);
+	}
+
+	if(!data.parallel_process_info.empty()) {
+		area = font->draw(10, area.y2() + 5, data.parallel_process_info);
+	}
+
+	if(!data.texture_upload_info.empty()) {
+		area = font->draw(10, area.y2() + 5, data.texture_upload_info);
+	}
+
 	if(!data.profiling_info.empty()) {
 		font->draw(10, area.y2() + 5, data.profiling_info);
 	}
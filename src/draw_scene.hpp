@@ -87,12 +87,29 @@ struct performance_data : public game_logic::formula_callable {
 	int cycle;
 	int nevents;
 
+	//textures bound while drawing the last frame.
+	int texture_binds;
+
+	//GL calls made while drawing the last frame, and calls skipped since
+	//they wouldn't have changed anything.
+	int gl_calls_issued, gl_calls_filtered;
+
 	std::string profiling_info;
 
+	//the events dispatched most often in the last frame.
+	std::string event_dispatch_info;
+
+	//how many on_process handlers were evaluated in parallel last second.
+	std::string parallel_process_info;
+
+	//how many textures were sent to the GPU last second, and how many
+	//had to wait for a later frame.
+	std::string texture_upload_info;
+
 	performance_data(int fps_, int cycles_per_second_, int delay_, int draw_, int process_, int flip_, int cycle_, int nevents_, const std::string& profiling_info_)
 	  : fps(fps_), cycles_per_second(cycles_per_second_), delay(delay_),
 	    draw(draw_), process(process_), flip(flip_), cycle(cycle_),
-		nevents(nevents_), profiling_info(profiling_info_)
+		nevents(nevents_), texture_binds(0), gl_calls_issued(0), gl_calls_filtered(0), profiling_info(profiling_info_)
 	{}
 
 	variant get_value(const std::string& key) const;
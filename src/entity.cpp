@@ -14,6 +14,7 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <iostream>
 #include <limits.h>
 
@@ -41,7 +42,9 @@ entity::entity(variant node)
 	platform_motion_x_(node["platform_motion_x"].as_int()),
 	mouse_over_entity_(false), being_dragged_(false), mouse_button_state_(0),
 	mouseover_delay_(0), mouseover_trigger_cycle_(INT_MAX),
-	true_z_(false), tx_(node["x"].as_decimal().as_float()), ty_(node["y"].as_decimal().as_float()), tz_(0.0f)
+	true_z_(false), tx_(node["x"].as_decimal().as_float()), ty_(node["y"].as_decimal().as_float()), tz_(0.0f),
+	dormant_level_(NULL), scheduled_cycle_(0), scheduled_seq_(0),
+	sleeping_until_(0)
 {
 	foreach(bool& b, controls_) {
 		b = false;
@@ -56,7 +59,9 @@ entity::entity(int x, int y, bool face_right)
 	weak_solid_dimensions_(0), weak_collide_dimensions_(0),	platform_motion_x_(0), 
 	mouse_over_entity_(false), being_dragged_(false), mouse_button_state_(0),
 	mouseover_delay_(0), mouseover_trigger_cycle_(INT_MAX),
-	true_z_(false), tx_(double(x)), ty_(double(y)), tz_(0.0f)
+	true_z_(false), tx_(double(x)), ty_(double(y)), tz_(0.0f),
+	dormant_level_(NULL), scheduled_cycle_(0), scheduled_seq_(0),
+	sleeping_until_(0)
 {
 	foreach(bool& b, controls_) {
 		b = false;
@@ -170,8 +175,24 @@ void entity::set_upside_down(bool facing)
 	upside_down_ = facing;
 }
 
+void entity::event_handlers_changed() const
+{
+	if(level* lvl = level::current_ptr()) {
+		lvl->update_event_subscriber(this);
+	}
+}
+
+void entity::wake()
+{
+	level* lvl = dormant_level_;
+	dormant_level_ = NULL;
+	lvl->object_woken(entity_ptr(this));
+}
+
 void entity::calculate_solid_rect()
 {
+	wake_if_dormant();
+
 	const frame& f = current_frame();
 
 	frame_rect_ = rect(x(), y(), f.width(), f.height());
@@ -280,22 +301,37 @@ void entity::generate_current(const entity& target, int* velocity_x, int* veloci
 	}
 }
 
+bool entity::scheduled_later(const ScheduledCommand& a, const ScheduledCommand& b)
+{
+	return a.due > b.due || a.due == b.due && a.seq > b.seq;
+}
+
 void entity::add_scheduled_command(int cycle, variant cmd)
 {
-	scheduled_commands_.push_back(ScheduledCommand(cycle, cmd));
+	//commands are returned by the cycle'th call to pop_scheduled_commands()
+	//from now, or the next call if cycle isn't positive. Commands returned
+	//by the same call come back in the order they were added.
+	ScheduledCommand c;
+	c.due = scheduled_cycle_ + std::max(cycle, 1);
+	c.seq = scheduled_seq_++;
+	c.cmd = cmd;
+	scheduled_commands_.push_back(c);
+	std::push_heap(scheduled_commands_.begin(), scheduled_commands_.end(), scheduled_later);
 }
 
 std::vector<variant> entity::pop_scheduled_commands()
 {
 	std::vector<variant> result;
-	std::vector<ScheduledCommand>::iterator i = scheduled_commands_.begin();
-	while(i != scheduled_commands_.end()) {
-		if(--(i->first) <= 0) {
-			result.push_back(i->second);
-			i = scheduled_commands_.erase(i);
-		} else {
-			++i;
-		}
+	if(scheduled_commands_.empty()) {
+		return result;
+	}
+
+	++scheduled_cycle_;
+
+	while(!scheduled_commands_.empty() && scheduled_commands_.front().due <= scheduled_cycle_) {
+		std::pop_heap(scheduled_commands_.begin(), scheduled_commands_.end(), scheduled_later);
+		result.push_back(scheduled_commands_.back().cmd);
+		scheduled_commands_.pop_back();
 	}
 
 	return result;
@@ -163,6 +163,24 @@ public:
 	virtual bool is_active(const rect& screen_area) const = 0;
 	virtual bool dies_on_inactive() const { return false; } 
 	virtual bool always_active() const { return false; } 
+
+	//false if whether the object is active depends on more than the screen
+	//area. Otherwise the object can only be active while the screen area
+	//intersects 'bounds'.
+	virtual bool get_activation_bounds(rect* bounds) const { return false; }
+
+	//a dormant object is inactive and filed by a level under its
+	//activation bounds, so it isn't examined every cycle. Moving or
+	//modifying a dormant object wakes it, and tells that level to examine
+	//it again.
+	bool is_dormant() const { return dormant_level_ != NULL; }
+	void set_dormant(level* lvl) { dormant_level_ = lvl; }
+
+	//the level cycle a sleeping object is due to wake up at, or 0 if the
+	//object is awake. Sleeping objects are not processed. See
+	//level::sleep_object().
+	int sleeping_until() const { return sleeping_until_; }
+	void set_sleeping_until(int cycle) { sleeping_until_ = cycle; }
 	
 	virtual formula_callable* vars() { return NULL; }
 	virtual const formula_callable* vars() const { return NULL; }
@@ -206,6 +224,14 @@ public:
 
 	virtual bool handle_event(const std::string& id, const formula_callable* context=NULL) { return false; }
 	virtual bool handle_event(int id, const formula_callable* context=NULL) { return false; }
+
+	//returns false only if handling the given event is certain to do
+	//nothing, so callers may skip dispatching it.
+	virtual bool handles_event(int id) const { return true; }
+
+	//called when the events this object handles may have changed, so the
+	//current level can update its lists of the objects handling each event.
+	void event_handlers_changed() const;
 	virtual bool handle_event_delay(int id, const formula_callable* context=NULL) { return false; }
 	virtual void resolve_delayed_events() = 0;
 
@@ -341,7 +367,11 @@ protected:
 	int prev_feet_x() const { return prev_feet_x_; }
 	int prev_feet_y() const { return prev_feet_y_; }
 
+	void wake_if_dormant() { if(dormant_level_) { wake(); } }
+
 private:
+	void wake();
+
 	std::string label_;
 
 	int x_, y_;
@@ -368,7 +398,14 @@ private:
 
 	current_generator_ptr current_generator_;
 
-	typedef std::pair<int, variant> ScheduledCommand;
+	//commands added by add_scheduled_command(), kept as a heap ordered by
+	//the call to pop_scheduled_commands() that returns them.
+	struct ScheduledCommand {
+		int due, seq;
+		variant cmd;
+	};
+
+	static bool scheduled_later(const ScheduledCommand& a, const ScheduledCommand& b);
 	std::vector<ScheduledCommand> scheduled_commands_;
 
 	bool controls_[controls::NUM_CONTROLS];	
@@ -394,6 +431,12 @@ private:
 
 	bool true_z_;
 	double tx_, ty_, tz_;
+
+	level* dormant_level_;
+
+	int scheduled_cycle_, scheduled_seq_;
+
+	int sleeping_until_;
 };
 
 bool zorder_compare(const entity_ptr& e1, const entity_ptr& e2);	
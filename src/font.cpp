@@ -26,6 +26,7 @@
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "module.hpp"
+#include "raster.hpp"
 #include "string_utils.hpp"
 #include "surface.hpp"
 
@@ -114,6 +115,84 @@ RenderCache& cache() {
 
 bool fonts_initialized = false;
 
+//a glyph rendered in white, to be tinted when drawn.
+struct glyph {
+	graphics::texture t;
+	int advance;
+};
+
+//the glyphs of one font at one size, by codepoint.
+typedef std::map<unsigned int, glyph> glyph_atlas;
+typedef std::map<std::pair<std::string, int>, glyph_atlas> glyph_atlas_map;
+glyph_atlas_map glyph_atlases;
+
+#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_HARMATTAN && !TARGET_OS_IPHONE
+const glyph& get_glyph(TTF_Font* font, glyph_atlas& atlas, unsigned int codepoint, const std::string& utf8)
+{
+	glyph_atlas::iterator itor = atlas.find(codepoint);
+	if(itor != atlas.end()) {
+		return itor->second;
+	}
+
+	SDL_Color white = {255, 255, 255, 255};
+	graphics::surface s(TTF_RenderUTF8_Blended(font, utf8.c_str(), white));
+
+	glyph g;
+	g.advance = s.get() ? s->w : 0;
+
+	int minx, maxx, miny, maxy, advance;
+	if(codepoint <= 0xFFFF && TTF_GlyphMetrics(font, Uint16(codepoint), &minx, &maxx, &miny, &maxy, &advance) == 0) {
+		g.advance = advance;
+	}
+
+	if(s.get() && s->w > 0 && s->h > 0) {
+		g.t = graphics::texture(graphics::texture::key(1, s), graphics::texture::ALLOW_ATLAS);
+	}
+
+	return atlas[codepoint] = g;
+}
+
+//how much closer 'codepoint' goes to 'prev' than their advances say,
+//as TTF_RenderUTF8_Blended() places them.
+int get_kerning(TTF_Font* font, unsigned int prev, unsigned int codepoint)
+{
+	if(prev == 0 || prev > 0xFFFF || codepoint > 0xFFFF || TTF_GetFontKerning(font) == 0) {
+		return 0;
+	}
+
+#if SDL_TTF_MAJOR_VERSION > 2 || SDL_TTF_MINOR_VERSION > 0 || SDL_TTF_PATCHLEVEL >= 14
+	return TTF_GetFontKerningSizeGlyphs(font, Uint16(prev), Uint16(codepoint));
+#else
+	//older versions take glyph indices, which TTF_GlyphIsProvided() gives.
+	return TTF_GetFontKerningSize(font, TTF_GlyphIsProvided(font, Uint16(prev)), TTF_GlyphIsProvided(font, Uint16(codepoint)));
+#endif
+}
+#endif
+
+std::vector<GLshort> text_varray;
+std::vector<GLfloat> text_tcarray;
+
+void flush_text(unsigned int id)
+{
+	if(text_varray.empty()) {
+		return;
+	}
+
+	graphics::texture::set_current_texture(id);
+#if defined(USE_SHADERS)
+	gles2::active_shader()->prepare_draw();
+	gles2::active_shader()->shader()->vertex_array(2, GL_SHORT, 0, 0, &text_varray.front());
+	gles2::active_shader()->shader()->texture_array(2, GL_FLOAT, 0, 0, &text_tcarray.front());
+#else
+	glVertexPointer(2, GL_SHORT, 0, &text_varray.front());
+	glTexCoordPointer(2, GL_FLOAT, 0, &text_tcarray.front());
+#endif
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, text_varray.size()/2);
+
+	text_varray.clear();
+	text_tcarray.clear();
+}
+
 }
 
 bool is_init() {
@@ -220,6 +299,142 @@ graphics::texture render_text(const std::string& text,
 	return res;
 }
 
+text_layout::text_layout() : width_(0), height_(0)
+{
+	color_.r = color_.g = color_.b = 255;
+}
+
+text_layout::text_layout(const std::string& text, const SDL_Color& color, int size, const std::string& font_name)
+  : color_(color), width_(0), height_(0)
+{
+#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_HARMATTAN && !TARGET_OS_IPHONE
+	TTF_Font* font = get_font(size, font_name);
+	glyph_atlas& atlas = glyph_atlases[std::pair<std::string, int>(font_name, size)];
+
+	//lines are split the way render_text() splits them, so text is laid
+	//out the same size as it would be rendered.
+	std::vector<std::string> lines;
+	if(std::find(text.begin(), text.end(), '\n') == text.end()) {
+		lines.push_back(text);
+	} else {
+		lines = util::split(text, '\n');
+	}
+
+	const int line_height = TTF_FontHeight(font);
+	foreach(const std::string& line, lines) {
+		int xpos = 0;
+		unsigned int prev = 0;
+		std::string::const_iterator i = line.begin();
+		while(i != line.end()) {
+			const std::string::const_iterator begin = i;
+			unsigned int codepoint = util::utf8_to_codepoint(i, line.end());
+			std::string utf8;
+			if(codepoint == 0) {
+				//a byte which isn't valid UTF-8 is drawn as a replacement
+				//character, and the rest of the line still drawn.
+				codepoint = 0xFFFD;
+				utf8 = "\xef\xbf\xbd";
+				i = begin + 1;
+			} else if(codepoint == 0xFFFD && (*i & 0xc0) != 0x80) {
+				//a sequence cut short by the start of the next character,
+				//which is still drawn.
+				utf8 = "\xef\xbf\xbd";
+			} else {
+				utf8.assign(begin, ++i);
+			}
+
+			xpos += get_kerning(font, prev, codepoint);
+			prev = codepoint;
+
+			const glyph& g = get_glyph(font, atlas, codepoint, utf8);
+			if(g.t.valid()) {
+				placed_glyph p;
+				p.t = g.t;
+				p.x = xpos;
+				p.y = height_;
+				p.w = g.t.width();
+				p.h = g.t.height();
+				p.u1 = g.t.translate_coord_x(0.0);
+				p.v1 = g.t.translate_coord_y(0.0);
+				p.u2 = g.t.translate_coord_x(1.0);
+				p.v2 = g.t.translate_coord_y(1.0);
+				glyphs_.push_back(p);
+
+				width_ = std::max<int>(width_, xpos + p.w);
+			}
+
+			xpos += g.advance;
+		}
+
+		width_ = std::max(width_, xpos);
+		height_ += line_height;
+	}
+
+	//without atlasing, such as with 16bpp textures or pretty scaling, or
+	//with glyphs too large for it, each glyph has a texture of its own and
+	//would need a draw call each. The text is rendered whole instead.
+	foreach(const placed_glyph& p, glyphs_) {
+		if(!p.t.in_atlas()) {
+			SDL_Color white = {255, 255, 255, 255};
+			placed_glyph whole;
+			whole.t = render_text(text, white, size, font_name);
+			whole.x = whole.y = 0;
+			whole.w = whole.t.width();
+			whole.h = whole.t.height();
+			whole.u1 = whole.t.translate_coord_x(0.0);
+			whole.v1 = whole.t.translate_coord_y(0.0);
+			whole.u2 = whole.t.translate_coord_x(1.0);
+			whole.v2 = whole.t.translate_coord_y(1.0);
+
+			glyphs_.assign(1, whole);
+			width_ = std::max<int>(width_, whole.w);
+			height_ = std::max<int>(height_, whole.h);
+			break;
+		}
+	}
+#endif
+}
+
+void text_layout::draw(int x, int y) const
+{
+	if(glyphs_.empty()) {
+		return;
+	}
+
+	GLfloat current_color[4];
+#if defined(USE_SHADERS)
+	memcpy(current_color, gles2::get_color(), sizeof(current_color));
+#else
+	glGetFloatv(GL_CURRENT_COLOR, current_color);
+#endif
+	glColor4f(current_color[0]*color_.r/255.0f, current_color[1]*color_.g/255.0f, current_color[2]*color_.b/255.0f, current_color[3]);
+
+	//glyphs are joined into one strip by repeating the first and last
+	//vertex of each; a glyph on a different texture starts a new draw.
+	unsigned int current_id = 0;
+	foreach(const placed_glyph& p, glyphs_) {
+		const unsigned int id = p.t.get_id();
+		if(id != current_id) {
+			flush_text(current_id);
+			current_id = id;
+		}
+
+		const GLshort x1 = (x + p.x)&preferences::xypos_draw_mask;
+		const GLshort y1 = (y + p.y)&preferences::xypos_draw_mask;
+		const GLshort x2 = x1 + p.w;
+		const GLshort y2 = y1 + p.h;
+
+		const GLshort v[] = { x1, y1, x1, y1, x1, y2, x2, y1, x2, y2, x2, y2 };
+		const GLfloat tc[] = { p.u1, p.v1, p.u1, p.v1, p.u1, p.v2, p.u2, p.v1, p.u2, p.v2, p.u2, p.v2 };
+		text_varray.insert(text_varray.end(), v, v + sizeof(v)/sizeof(*v));
+		text_tcarray.insert(text_tcarray.end(), tc, tc + sizeof(tc)/sizeof(*tc));
+	}
+
+	flush_text(current_id);
+
+	glColor4f(current_color[0], current_color[1], current_color[2], current_color[3]);
+}
+
 int char_width(int size, const std::string& fn)
 {
 	static std::map<int, int> size_cache;
@@ -40,6 +40,37 @@ graphics::texture render_text(const std::string& text,
 graphics::texture render_text_uncached(const std::string& text,
                                        const SDL_Color& color, int size, const std::string& font_name="");
 
+//text laid out from the glyphs of a font. Each glyph is rendered once for
+//its font and size and kept in the shared texture atlas, so laying out
+//new text -- a changing score or timer -- makes no new textures, and all
+//of it is drawn in one call when its glyphs share an atlas page. When the
+//glyphs can't be atlased the text is rendered as one texture instead.
+class text_layout
+{
+public:
+	text_layout();
+	text_layout(const std::string& text, const SDL_Color& color, int size, const std::string& font_name="");
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	bool empty() const { return glyphs_.empty(); }
+
+	//draws the text with its top-left corner at x, y, tinted by the
+	//current color.
+	void draw(int x, int y) const;
+
+private:
+	struct placed_glyph {
+		graphics::texture t;
+		GLshort x, y, w, h;
+		GLfloat u1, v1, u2, v2;
+	};
+
+	std::vector<placed_glyph> glyphs_;
+	SDL_Color color_;
+	int width_, height_;
+};
+
 int char_width(int size, const std::string& fn="");
 int char_height(int size, const std::string& fn="");
 
@@ -292,6 +292,16 @@ private:
 	std::vector<const_expression_ptr> get_children() const {
 		return std::vector<const_expression_ptr>(items_.begin(), items_.end());
 	}
+
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		foreach(const expression_ptr& item, items_) {
+			if(!item->can_evaluate_isolated(readable_slots)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
 	
 	std::vector<expression_ptr> items_;
 };
@@ -312,19 +322,20 @@ private:
 	}
 
 	variant execute(const formula_callable& variables) const {
-		std::vector<int> nelements;
-		std::vector<variant> lists;
-		for(std::map<std::string, expression_ptr>::const_iterator i = generators_.begin(); i != generators_.end(); ++i) {
-			lists.push_back(i->second->evaluate(variables));
-			nelements.push_back(lists.back().num_elements());
-			if(nelements.back() == 0) {
-				std::vector<variant> items;
-				return variant(&items);
-			}
-		}
-
 		std::vector<variant> result;
+		execute_stream(variables, [&result](const variant& item) {
+			result.push_back(item);
+			return true;
+		});
+
+		return variant(&result);
+	}
 
+	bool can_stream() const {
+		return true;
+	}
+
+	bool execute_stream(const formula_callable& variables, const sequence_visitor& visitor) const {
 		boost::intrusive_ptr<slot_formula_callable> callable(new slot_formula_callable);
 		callable->set_fallback(&variables);
 		callable->set_base_slot(base_slot_);
@@ -335,30 +346,57 @@ private:
 			args.push_back(&callable->back_direct_access());
 		}
 
+		//a single streamable generator is consumed lazily, so that e.g.
+		//head([x | x <- range(n), f(x)]) stops at the first match.
+		if(generators_.size() == 1 && generators_.begin()->second->can_stream()) {
+			return generators_.begin()->second->evaluate_stream(variables, [&](const variant& item) {
+				*args.front() = item;
+				if(passes_filters(*callable)) {
+					return visitor(expr_->evaluate(*callable));
+				}
+
+				return true;
+			});
+		}
+
+		std::vector<int> nelements;
+		std::vector<variant> lists;
+		for(std::map<std::string, expression_ptr>::const_iterator i = generators_.begin(); i != generators_.end(); ++i) {
+			lists.push_back(i->second->evaluate(variables));
+			nelements.push_back(lists.back().num_elements());
+			if(nelements.back() == 0) {
+				return true;
+			}
+		}
+
 		std::vector<int> indexes(lists.size());
 		for(;;) {
 			for(int n = 0; n != indexes.size(); ++n) {
 				*args[n] = lists[n][indexes[n]];
 			}
 
-			bool passes = true;
-			foreach(const expression_ptr& filter, filters_) {
-				if(filter->evaluate(*callable).as_bool() == false) {
-					passes = false;
-					break;
+			if(passes_filters(*callable)) {
+				if(!visitor(expr_->evaluate(*callable))) {
+					return false;
 				}
 			}
 
-			if(passes) {
-				result.push_back(expr_->evaluate(*callable));
-			}
-
 			if(!increment_vec(indexes, nelements)) {
 				break;
 			}
 		}
-		
-		return variant(&result);
+
+		return true;
+	}
+
+	bool passes_filters(const formula_callable& callable) const {
+		foreach(const expression_ptr& filter, filters_) {
+			if(filter->evaluate(callable).as_bool() == false) {
+				return false;
+			}
+		}
+
+		return true;
 	}
 
 	static bool increment_vec(std::vector<int>& v, const std::vector<int>& max_values) {
@@ -532,6 +570,10 @@ private:
 		return result;
 	}
 
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return (op_ == NOT || operand_->query_variant_type()->is_numeric()) && operand_->can_evaluate_isolated(readable_slots);
+	}
+
 	enum OP { NOT, OP_SUB };
 	OP op_;
 	expression_ptr operand_;
@@ -590,6 +632,10 @@ private:
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(v_.type());
 	}
+
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return v_.is_null() || v_.is_bool() || v_.is_int() || v_.is_decimal();
+	}
 	
 	variant v_;
 };
@@ -676,6 +722,10 @@ private:
 		ASSERT_LOG(entry->is_private() == false, "Identifier " << id_ << " is private " << debug_pinpoint_location());
 	}
 
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return size_t(slot_) < readable_slots.size() && readable_slots[slot_];
+	}
+
 	int slot_;
 	std::string id_;
 	const_formula_callable_definition_ptr callable_def_;
@@ -1295,6 +1345,10 @@ private:
 		return result;
 	}
 
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return left_->can_evaluate_isolated(readable_slots) && right_->can_evaluate_isolated(readable_slots);
+	}
+
 	expression_ptr left_, right_;
 };
 
@@ -1344,6 +1398,10 @@ private:
 		return result;
 	}
 
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return left_->can_evaluate_isolated(readable_slots) && right_->can_evaluate_isolated(readable_slots);
+	}
+
 	expression_ptr left_, right_;
 };
 
@@ -1358,6 +1416,10 @@ private:
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(variant::VARIANT_TYPE_NULL);
 	}
+
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return true;
+	}
 };
 
 class operator_expression : public formula_expression {
@@ -1679,6 +1741,38 @@ private:
 		result.push_back(right_);
 		return result;
 	}
+
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		if(!left_->can_evaluate_isolated(readable_slots) || !right_->can_evaluate_isolated(readable_slots)) {
+			return false;
+		}
+
+		const bool numeric_operands = left_->query_variant_type()->is_numeric() && right_->query_variant_type()->is_numeric();
+
+		switch(op_) {
+		case OP_AND:
+		case OP_OR:
+		case OP_EQ:
+		case OP_NEQ:
+			return true;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_LT:
+		case OP_GT:
+		case OP_LTE:
+		case OP_GTE:
+			return numeric_operands;
+		case OP_DIV:
+		case OP_MOD: {
+			//dividing by zero is an error, so only constant divisors.
+			variant divisor;
+			return numeric_operands && right_->can_reduce_to_variant(divisor) && (divisor.is_int() && divisor.as_int() != 0 || divisor.is_decimal() && divisor.as_decimal().value() != 0);
+		}
+		default:
+			return false;
+		}
+	}
 	
 	enum OP { OP_IN, OP_NOT_IN, OP_AND, OP_OR, OP_NEQ, OP_LTE, OP_GTE, OP_GT='>', OP_LT='<', OP_EQ='=',
 		OP_ADD='+', OP_SUB='-', OP_MUL='*', OP_DIV='/', OP_DICE='d', OP_POW='^', OP_MOD='%' };
@@ -1954,6 +2048,10 @@ private:
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(variant::VARIANT_TYPE_INT);
 	}
+
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return true;
+	}
 	
 	variant i_;
 };
@@ -1970,6 +2068,10 @@ private:
 	variant_type_ptr get_variant_type() const {
 		return variant_type::get_type(variant::VARIANT_TYPE_DECIMAL);
 	}
+
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return true;
+	}
 	
 	variant v_;
 };
@@ -2230,7 +2332,7 @@ void parse_args(const variant& formula_str, const std::string* function_name,
 		if(n+1 == args.size()) {
 			//Certain special functions take a special callable definition
 			//to evaluate their last argument. Discover what that is here.
-			static const std::string MapCallableFuncs[] = { "count", "filter", "find", "find_or_die", "choose", "map", "count" };
+			static const std::string MapCallableFuncs[] = { "count", "filter", "find", "find_or_die", "choose", "map", "count", "sort_by" };
 			if(args.size() >= 2 && function_name != NULL && std::count(MapCallableFuncs, MapCallableFuncs + sizeof(MapCallableFuncs)/sizeof(*MapCallableFuncs), *function_name)) {
 				std::string value_name = "value";
 
@@ -2524,6 +2626,111 @@ expression_ptr parse_expression(const variant& formula_str, const token* i1, con
 	return result;
 }
 
+namespace {
+//pure functions are only memoized automatically with --ffl_memoize; a
+//'def memoize' or 'def nomemoize' annotation overrides this per function.
+PREF_INT(ffl_memoize, 0);
+PREF_INT(ffl_memo_max_entries, 1024);
+
+enum MEMOIZE_MODE { MEMOIZE_DEFAULT, MEMOIZE_FORCE, MEMOIZE_NEVER };
+
+//true if values of this type are always plain data: numbers, strings,
+//bools, null, or lists and maps of those. 'any' doesn't qualify.
+bool is_plain_data_type(variant_type_ptr type)
+{
+	if(!type || type->is_any()) {
+		return false;
+	}
+
+	if(const std::vector<variant_type_ptr>* items = type->is_union()) {
+		foreach(const variant_type_ptr& item, *items) {
+			if(!is_plain_data_type(item)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	if(const std::vector<variant_type_ptr>* items = type->is_specific_list()) {
+		foreach(const variant_type_ptr& item, *items) {
+			if(!is_plain_data_type(item)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	if(type->is_list_of()) {
+		return is_plain_data_type(type->is_list_of());
+	}
+
+	if(const std::map<variant, variant_type_ptr>* items = type->is_specific_map()) {
+		for(std::map<variant, variant_type_ptr>::const_iterator i = items->begin(); i != items->end(); ++i) {
+			if(!is_plain_data_type(i->second)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	if(type->is_map_of().first) {
+		return is_plain_data_type(type->is_map_of().first) && is_plain_data_type(type->is_map_of().second);
+	}
+
+	return type->is_type(variant::VARIANT_TYPE_NULL) || type->is_type(variant::VARIANT_TYPE_BOOL) ||
+	       type->is_type(variant::VARIANT_TYPE_INT) || type->is_type(variant::VARIANT_TYPE_DECIMAL) ||
+	       type->is_type(variant::VARIANT_TYPE_STRING);
+}
+
+//a named function is pure if it can't create commands or reach mutable
+//object state. Named functions only see their own arguments, which are
+//checked to be plain data when called, so it is enough that the body
+//never calls a function value, never calls a user function that isn't
+//itself pure, and only calls builtins statically typed to return plain
+//data. Calls that turn out to use the rng are caught when executed.
+bool is_pure_function(const std::string& name, const_formula_ptr fml, const function_symbol_table* symbols)
+{
+	static const std::string ImpureBuiltins[] = { "set", "add", "refcount", "time", "get_cookie", "get_document", "get_files_in_dir", "get_all_files_under_dir" };
+
+	foreach(const const_expression_ptr& expr, fml->expr()->query_children_recursive()) {
+		if(expr->name() == NULL) {
+			return false;
+		}
+
+		const std::string expr_name = expr->name();
+		if(expr_name[0] == '_') {
+			if(expr_name == "_fn") {
+				return false;
+			}
+
+			continue;
+		}
+
+		if(expr_name == name) {
+			continue;
+		}
+
+		const formula_function* fn = symbols ? symbols->get_formula_function(expr_name) : NULL;
+		if(fn) {
+			if(!fn->is_pure()) {
+				return false;
+			}
+
+			continue;
+		}
+
+		if(std::count(ImpureBuiltins, ImpureBuiltins + sizeof(ImpureBuiltins)/sizeof(*ImpureBuiltins), expr_name) || !is_plain_data_type(expr->query_variant_type())) {
+			return false;
+		}
+	}
+
+	return is_plain_data_type(fml->query_variant_type());
+}
+}
+
 //only returns a value in the case of a lambda function, otherwise
 //returns NULL.
 expression_ptr parse_function_def(const variant& formula_str, const token*& i1, const token* i2, function_symbol_table* symbols, const_formula_callable_definition_ptr callable_def)
@@ -2532,6 +2739,16 @@ expression_ptr parse_function_def(const variant& formula_str, const token*& i1,
 
 	++i1;
 
+	//'def memoize name(...)' and 'def nomemoize name(...)' force or
+	//disable memoization of the function.
+	MEMOIZE_MODE memoize_mode = MEMOIZE_DEFAULT;
+	if(i1->type == TOKEN_IDENTIFIER && i1+1 != i2 && (i1+1)->type == TOKEN_IDENTIFIER) {
+		const std::string annotation(i1->begin, i1->end);
+		ASSERT_LOG(annotation == "memoize" || annotation == "nomemoize", "Unknown function annotation '" << annotation << "'\n" << pinpoint_location(formula_str, i1->begin, i1->end));
+		memoize_mode = annotation == "memoize" ? MEMOIZE_FORCE : MEMOIZE_NEVER;
+		++i1;
+	}
+
 	std::string formula_name;
 	if(i1->type == TOKEN_IDENTIFIER) {
 		formula_name = std::string(i1->begin, i1->end);
@@ -2607,7 +2824,19 @@ expression_ptr parse_function_def(const variant& formula_str, const token*& i1,
 	}
 
 	const_formula_ptr fml(new formula(function_var, &recursive_symbols, args_definition_ptr));
-	recursive_symbols.resolve_recursive_calls(fml);
+
+	bool pure = false;
+	function_memo_table_ptr memo;
+	if(formula_name.empty() == false) {
+		pure = is_pure_function(formula_name, fml, symbols);
+		if(memoize_mode == MEMOIZE_FORCE || memoize_mode == MEMOIZE_DEFAULT && pure && g_ffl_memoize) {
+			memo.reset(new function_memo_table(formula_name, g_ffl_memo_max_entries, memoize_mode == MEMOIZE_FORCE));
+		}
+	} else {
+		ASSERT_LOG(memoize_mode == MEMOIZE_DEFAULT, "Only named functions can be memoized\n" << pinpoint_location(formula_str, beg->begin, (i2-1)->end));
+	}
+
+	recursive_symbols.resolve_recursive_calls(fml, memo);
 	
 	if(formula_name.empty()) {
 		if(g_strict_formula_checking) {
@@ -2619,7 +2848,7 @@ expression_ptr parse_function_def(const variant& formula_str, const token*& i1,
 
 	const std::string precond = "";
 	symbols->add_formula_function(formula_name, fml,
-								  formula::create_optional_formula(variant(precond), symbols), args, default_args, variant_types);
+								  formula::create_optional_formula(variant(precond), symbols), args, default_args, variant_types, pure, memo);
 	return expression_ptr();
 }
 
@@ -3513,6 +3742,17 @@ UNIT_TEST(formula_test_recurse_sort) {
 	CHECK_EQ(f.execute(), formula(variant("[1,2,4,9,10]")).execute());
 }
 
+UNIT_TEST(formula_memoized_function) {
+	//without memoization this makes over a billion calls.
+	CHECK_EQ(formula(variant("def memoize fib(n) if(n < 2, n, fib(n-1) + fib(n-2)); fib(45)")).execute(), variant(1134903170));
+	CHECK_EQ(formula(variant("def nomemoize inc(x) x+1; inc(inc(1))")).execute(), variant(3));
+
+	//1 and 1.0 compare equal but aren't the same argument.
+	const variant halves = formula(variant("def memoize half(x) x/2; [half(1.0), half(1)]")).execute();
+	CHECK_EQ(halves[0].is_decimal(), true);
+	CHECK_EQ(halves[1].is_int(), true);
+}
+
 UNIT_TEST(formula_where_map) {
 	CHECK_EQ(formula(variant("{'a': a} where a = 4")).execute()["a"], variant(4));
 }
@@ -77,6 +77,7 @@ public:
 	void set_base_slot(int base) { base_slot_ = base; }
 
 	int num_args() const { return values_.size(); }
+	const std::vector<variant>& values() const { return values_; }
 
 private:
 	const std::vector<std::string>* value_names_;
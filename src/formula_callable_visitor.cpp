@@ -5,6 +5,8 @@
 namespace game_logic
 {
 
+void (*gc_node_destroyed)(const formula_callable* node) = NULL;
+
 formula_callable_suspended::~formula_callable_suspended()
 {
 }
@@ -36,7 +38,9 @@ void formula_callable_visitor::visit(variant* v)
 		}
 	} else if(v->is_callable()) {
 		ptr_.push_back(formula_callable_suspended_ptr(new formula_callable_suspended_variant(v)));
-		visit(*v->as_callable());
+		if(!shallow_) {
+			visit(*v->as_callable());
+		}
 	} else if(v->is_function()) {
 		std::vector<boost::intrusive_ptr<const formula_callable>*> items;
 		v->get_mutable_closure_ref(items);
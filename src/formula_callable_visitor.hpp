@@ -16,6 +16,11 @@ class formula_callable_suspended
 public:
 	virtual ~formula_callable_suspended();
 	virtual const formula_callable* value() const = 0;
+
+	//the address of the variable holding the reference. References held
+	//in a list shared between objects are seen once for each object, but
+	//have the same address.
+	virtual const void* ref_address() const = 0;
 	virtual void destroy_ref() = 0;
 	virtual void restore_ref() = 0;
 private:
@@ -32,6 +37,7 @@ public:
 	}
 
 	virtual const formula_callable* value() const { return value_; }
+	virtual const void* ref_address() const { return v_; }
 	virtual void destroy_ref() { *v_ = variant(); }
 	virtual void restore_ref() { *v_ = variant(value_); }
 private:
@@ -49,6 +55,7 @@ public:
 	}
 
 	virtual const formula_callable* value() const { return value_; }
+	virtual const void* ref_address() const { return ref_; }
 	virtual void destroy_ref() { if((*ref_)->refcount() == 1) { value_ = NULL; } ref_->reset(); }
 	virtual void restore_ref() { if(!*ref_) { ref_->reset(dynamic_cast<T*>(const_cast<formula_callable*>(value_))); } }
 private:
@@ -56,14 +63,28 @@ private:
 	boost::intrusive_ptr<T>* ref_;
 };
 
+//set while a cycle collection is in progress. The collector keeps raw
+//pointers to the objects it scans, which call this as they're destroyed.
+extern void (*gc_node_destroyed)(const formula_callable* node);
+
 class formula_callable_visitor
 {
 public:
+	formula_callable_visitor() : shallow_(false)
+	{}
+
+	//a shallow visitor records the callables an object refers to without
+	//going on to visit their values in turn.
+	explicit formula_callable_visitor(bool shallow) : shallow_(shallow)
+	{}
+
 	template<typename T>
 	void visit(boost::intrusive_ptr<T>* ref) {
 		ptr_.push_back(formula_callable_suspended_ptr(new formula_callable_suspended_impl<T>(ref)));
 
-		visit(**ref);
+		if(!shallow_) {
+			visit(**ref);
+		}
 	}
 
 	void visit(variant* v);
@@ -73,6 +94,7 @@ public:
 private:
 	std::vector<formula_callable_suspended_ptr> ptr_;
 	std::set<const void*> visited_;
+	bool shallow_;
 };
 
 }
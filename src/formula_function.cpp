@@ -55,6 +55,7 @@
 #include "level.hpp"
 #include "json_parser.hpp"
 #include "variant_utils.hpp"
+#include "thread.hpp"
 #include "voxel_model.hpp"
 
 #include "graphics.hpp"
@@ -100,6 +101,11 @@ namespace game_logic {
 formula_expression::formula_expression(const char* name) : name_(name), begin_str_(EmptyStr.begin()), end_str_(EmptyStr.end()), ntimes_called_(0)
 {}
 
+bool formula_expression::can_evaluate_isolated(const std::vector<bool>& readable_slots) const
+{
+	return is_isolated(readable_slots);
+}
+
 std::vector<const_expression_ptr> formula_expression::query_children() const {
 	std::vector<const_expression_ptr> result = get_children();
 	result.erase(std::remove(result.begin(), result.end(), const_expression_ptr()), result.end());
@@ -263,6 +269,31 @@ variant formula_expression::execute_member(const formula_callable& variables, st
 	return variant();
 }
 
+bool formula_expression::evaluate_stream(const formula_callable& variables, const sequence_visitor& visitor) const
+{
+	if(can_stream()) {
+#if !TARGET_OS_IPHONE
+		call_stack_manager manager(this, &variables);
+#endif
+		return execute_stream(variables, visitor);
+	}
+
+	const variant items = evaluate(variables);
+	for(size_t n = 0; n != items.num_elements(); ++n) {
+		if(!visitor(items[n])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool formula_expression::execute_stream(const formula_callable& variables, const sequence_visitor& visitor) const
+{
+	ASSERT_LOG(false, "Expression cannot be streamed: " << str_ << "\n" << debug_pinpoint_location());
+	return false;
+}
+
 namespace {
 
 variant split_variant_if_str(const variant& s)
@@ -430,6 +461,16 @@ END_FUNCTION_DEF(query_cache)
 			return args()[nargs-1]->evaluate(variables);
 		}
 
+		bool is_isolated(const std::vector<bool>& readable_slots) const {
+			foreach(const expression_ptr& arg, args()) {
+				if(!arg->can_evaluate_isolated(readable_slots)) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
 
 		variant_type_ptr get_variant_type() const {
 			std::vector<variant_type_ptr> types;
@@ -1885,7 +1926,160 @@ class map_callable : public formula_callable {
 		std::string value_name_;
 };
 
+namespace {
+//sort_by() compares keys from worker threads, so it only sorts in parallel
+//when comparing every key is a plain read that touches no reference counts.
+bool is_plain_sort_key(const variant& v)
+{
+	return v.is_null() || v.is_bool() || v.is_int() || v.is_decimal() || v.is_string();
+}
+
+const int ParallelSortThreshold = 8192;
+
+struct sort_key_compare {
+	explicit sort_key_compare(const std::vector<variant>& keys) : keys_(&keys)
+	{}
+
+	bool operator()(int a, int b) const {
+		return (*keys_)[a] < (*keys_)[b];
+	}
+private:
+	const std::vector<variant>* keys_;
+};
+
+void stable_sort_indexes(int* begin, int* end, sort_key_compare cmp)
+{
+	std::stable_sort(begin, end, cmp);
+}
+
+void merge_indexes(int* begin, int* middle, int* end, sort_key_compare cmp)
+{
+	std::inplace_merge(begin, middle, end, cmp);
+}
+
+boost::shared_ptr<threading::thread> start_sort_thread(boost::function<void()> fn)
+{
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	return boost::shared_ptr<threading::thread>(new threading::thread("sort_by", fn));
+#else
+	return boost::shared_ptr<threading::thread>(new threading::thread(fn));
+#endif
+}
+
+int num_sort_threads()
+{
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	return std::max(1, std::min(8, SDL_GetCPUCount()));
+#else
+	return 2;
+#endif
+}
+
+//a stable merge sort split across worker threads: chunks are stable sorted
+//concurrently, then adjacent chunks are merged pairwise, in order, until one
+//run remains. Since merging adjacent runs is stable this gives exactly the
+//same order as a single std::stable_sort.
+void parallel_stable_sort(std::vector<int>& indexes, const sort_key_compare& cmp)
+{
+	const int nchunks = num_sort_threads();
+	int* base = &indexes[0];
+
+	std::vector<int> bounds;
+	for(int n = 0; n <= nchunks; ++n) {
+		bounds.push_back(static_cast<int>((static_cast<int64_t>(indexes.size())*n)/nchunks));
+	}
+
+	{
+		std::vector<boost::shared_ptr<threading::thread> > threads;
+		for(int n = 1; n < nchunks; ++n) {
+			threads.push_back(start_sort_thread(boost::bind(stable_sort_indexes, base + bounds[n], base + bounds[n+1], cmp)));
+		}
+
+		stable_sort_indexes(base + bounds[0], base + bounds[1], cmp);
+		foreach(boost::shared_ptr<threading::thread>& t, threads) {
+			t->join();
+		}
+	}
+
+	while(bounds.size() > 2) {
+		std::vector<int> merged_bounds;
+		std::vector<boost::shared_ptr<threading::thread> > threads;
+		size_t n = 0;
+		for(; n+2 < bounds.size(); n += 2) {
+			threads.push_back(start_sort_thread(boost::bind(merge_indexes, base + bounds[n], base + bounds[n+1], base + bounds[n+2], cmp)));
+			merged_bounds.push_back(bounds[n]);
+		}
+
+		for(; n < bounds.size(); ++n) {
+			merged_bounds.push_back(bounds[n]);
+		}
+
+		foreach(boost::shared_ptr<threading::thread>& t, threads) {
+			t->join();
+		}
+
+		bounds.swap(merged_bounds);
+	}
+}
+}
+
+FUNCTION_DEF(sort_by, 2, 2, "sort_by(list, key_expr): Returns the list ordered by the key each item gives. key_expr is evaluated once per item, with 'value' and 'index' set, and the sort is stable, so items with equal keys keep their order.")
+	const variant items = args()[0]->evaluate(variables);
+	const int nitems = items.num_elements();
+
+	std::vector<variant> keys;
+	keys.reserve(nitems);
+
+	bool plain_keys = true;
+	boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+	for(int n = 0; n != nitems; ++n) {
+		callable->set(items[n], n);
+		keys.push_back(args()[1]->evaluate(*callable));
+		plain_keys = plain_keys && is_plain_sort_key(keys.back());
+	}
+
+	std::vector<int> indexes(nitems);
+	for(int n = 0; n != nitems; ++n) {
+		indexes[n] = n;
+	}
+
+	const sort_key_compare cmp(keys);
+	if(plain_keys && nitems >= ParallelSortThreshold && num_sort_threads() > 1) {
+		parallel_stable_sort(indexes, cmp);
+	} else {
+		std::stable_sort(indexes.begin(), indexes.end(), cmp);
+	}
+
+	std::vector<variant> result;
+	result.reserve(nitems);
+	foreach(int index, indexes) {
+		result.push_back(items[index]);
+	}
+
+	return variant(&result);
+FUNCTION_ARGS_DEF
+	ARG_TYPE("list");
+FUNCTION_TYPE_DEF
+	return args()[0]->query_variant_type();
+END_FUNCTION_DEF(sort_by)
+
 FUNCTION_DEF(count, 2, 2, "count(list, expr): Returns an integer count of how many items in the list 'expr' returns true for.")
+	if(args()[0]->can_stream()) {
+		int res = 0;
+		int index = 0;
+		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+		args()[0]->evaluate_stream(variables, [&](const variant& item) {
+			callable->set(item, index++);
+			if(args().back()->evaluate(*callable).as_bool()) {
+				++res;
+			}
+
+			return true;
+		});
+
+		return variant(res);
+	}
+
 	const variant items = split_variant_if_str(args()[0]->evaluate(variables));
 	if(items.is_map()) {
 		int res = 0;
@@ -1934,6 +2128,16 @@ public:
 private:
 	std::string identifier_;
 	variant execute(const formula_callable& variables) const {
+		if(can_stream()) {
+			std::vector<variant> vars;
+			execute_stream(variables, [&vars](const variant& item) {
+				vars.push_back(item);
+				return true;
+			});
+
+			return variant(&vars);
+		}
+
 		std::vector<variant> vars;
 		const variant items = args()[0]->evaluate(variables);
 		if(args().size() == 2) {
@@ -1980,6 +2184,29 @@ private:
 		return variant(&vars);
 	}
 
+	//filter() only streams when its input does, since filtering a map
+	//yields a map rather than a list.
+	bool can_stream() const {
+		return args()[0]->can_stream();
+	}
+
+	bool execute_stream(const formula_callable& variables, const sequence_visitor& visitor) const {
+		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+		if(args().size() == 3) {
+			callable->set_value_name(identifier_.empty() ? args()[1]->evaluate(variables).as_string() : identifier_);
+		}
+
+		int index = 0;
+		return args()[0]->evaluate_stream(variables, [&](const variant& item) {
+			callable->set(item, index++);
+			if(args().back()->evaluate(*callable).as_bool()) {
+				return visitor(item);
+			}
+
+			return true;
+		});
+	}
+
 	variant_type_ptr get_variant_type() const {
 		variant_type_ptr list_type = args()[0]->query_variant_type();
 		const_formula_callable_definition_ptr def = args()[1]->get_definition_used_by_expression();
@@ -2046,6 +2273,30 @@ FUNCTION_DEF(mapping, -1, -1, "mapping(x): Turns the args passed in into a map.
 	return variant(callable);
 END_FUNCTION_DEF(mapping)
 
+namespace {
+//finds the first item in a streamed list for which the last argument to
+//find() is true, without materializing the list. Returns false if there
+//is no such item.
+bool find_in_stream(const function_expression::args_list& args, const std::string& identifier, const formula_callable& variables, variant* result)
+{
+	boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+	if(args.size() == 3) {
+		callable->set_value_name(identifier.empty() ? args[1]->evaluate(variables).as_string() : identifier);
+	}
+
+	int index = 0;
+	return !args[0]->evaluate_stream(variables, [&](const variant& item) {
+		callable->set(item, index++);
+		if(args.back()->evaluate(*callable).as_bool()) {
+			*result = item;
+			return false;
+		}
+
+		return true;
+	});
+}
+}
+
 class find_function : public function_expression {
 public:
 	explicit find_function(const args_list& args)
@@ -2059,6 +2310,12 @@ public:
 private:
 	std::string identifier_;
 	variant execute(const formula_callable& variables) const {
+		if(args()[0]->can_stream()) {
+			variant result;
+			find_in_stream(args(), identifier_, variables, &result);
+			return result;
+		}
+
 		const variant items = args()[0]->evaluate(variables);
 
 		if(args().size() == 2) {
@@ -2136,6 +2393,13 @@ public:
 private:
 	std::string identifier_;
 	variant execute(const formula_callable& variables) const {
+		if(args()[0]->can_stream()) {
+			variant result;
+			const bool found = find_in_stream(args(), identifier_, variables, &result);
+			ASSERT_LOG(found, "Failed to find expected item in " << args()[0]->str() << " " << debug_pinpoint_location());
+			return result;
+		}
+
 		const variant items = args()[0]->evaluate(variables);
 
 		if(args().size() == 2) {
@@ -2288,6 +2552,31 @@ FUNCTION_DEF(choose, 1, 2, "choose(list, (optional)scoring_expr) -> value: choos
 		formula::fail_if_static_context();
 	}
 
+	if(args()[0]->can_stream()) {
+		variant result, max_value;
+		int index = 0;
+		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+		args()[0]->evaluate_stream(variables, [&](const variant& item) {
+			variant val;
+			if(args().size() >= 2) {
+				callable->set(item, index);
+				val = args().back()->evaluate(*callable);
+			} else {
+				val = variant(rand());
+			}
+
+			if(index == 0 || val > max_value) {
+				result = item;
+				max_value = val;
+			}
+
+			++index;
+			return true;
+		});
+
+		return result;
+	}
+
 	const variant items = args()[0]->evaluate(variables);
 	if(items.num_elements() == 0) {
 		return variant();
@@ -2332,9 +2621,21 @@ private:
 	std::string identifier_;
 
 	variant execute(const formula_callable& variables) const {
-		std::vector<variant> vars;
-		const variant items = args()[0]->evaluate(variables);
+		if(args()[0]->can_stream()) {
+			std::vector<variant> vars;
+			execute_stream(variables, [&vars](const variant& item) {
+				vars.push_back(item);
+				return true;
+			});
 
+			return variant(&vars);
+		}
+
+		return map_items(args()[0]->evaluate(variables), variables);
+	}
+
+	variant map_items(const variant& items, const formula_callable& variables) const {
+		std::vector<variant> vars;
 		vars.reserve(items.num_elements());
 
 		if(args().size() == 2) {
@@ -2379,6 +2680,48 @@ private:
 		return variant(&vars);
 	}
 
+	bool can_stream() const {
+		return true;
+	}
+
+	bool execute_stream(const formula_callable& variables, const sequence_visitor& visitor) const {
+		boost::intrusive_ptr<map_callable> callable(new map_callable(variables));
+		if(args().size() == 3) {
+			callable->set_value_name(identifier_.empty() ? args()[1]->evaluate(variables).as_string() : identifier_);
+		}
+
+		int index = 0;
+		const sequence_visitor map_item = [&](const variant& item) {
+			callable->set(item, index++);
+			return visitor(args().back()->evaluate(*callable));
+		};
+
+		if(args()[0]->can_stream()) {
+			return args()[0]->evaluate_stream(variables, map_item);
+		}
+
+		const variant items = args()[0]->evaluate(variables);
+		if(items.is_list()) {
+			for(size_t n = 0; n != items.num_elements(); ++n) {
+				if(!map_item(items[n])) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		//maps and strings are mapped eagerly and the result visited.
+		const variant result = map_items(items, variables);
+		for(size_t n = 0; n != result.num_elements(); ++n) {
+			if(!visitor(result[n])) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
 	variant_type_ptr get_variant_type() const {
 		variant_type_ptr spec_type = args()[0]->query_variant_type();
 		if(spec_type->is_specific_list()) {
@@ -2412,6 +2755,19 @@ private:
 
 FUNCTION_DEF(sum, 1, 2, "sum(list[, counter]): Adds all elements of the list together. If counter is supplied, all elements of the list are added to the counter instead of to 0.")
 	variant res(0);
+	if(args()[0]->can_stream()) {
+		if(args().size() >= 2) {
+			res = args()[1]->evaluate(variables);
+		}
+
+		args()[0]->evaluate_stream(variables, [&res](const variant& item) {
+			res = res + item;
+			return true;
+		});
+
+		return res;
+	}
+
 	const variant items = args()[0]->evaluate(variables);
 	if(args().size() >= 2) {
 		res = args()[1]->evaluate(variables);
@@ -2435,19 +2791,31 @@ FUNCTION_TYPE_DEF
 
 END_FUNCTION_DEF(sum)
 
-FUNCTION_DEF(range, 1, 3, "range([start, ]finish[, step]): Returns a list containing all numbers smaller than the finish value and and larger than or equal to the start value. The start value defaults to 0.")
-	int start = args().size() > 1 ? args()[0]->evaluate(variables).as_int() : 0;
-	int end = args()[args().size() > 1 ? 1 : 0]->evaluate(variables).as_int();
-	int step = args().size() < 3 ? 1 : args()[2]->evaluate(variables).as_int();
-	ASSERT_LOG(step > 0, "ILLEGAL STEP VALUE IN RANGE: " << step);
-	bool reverse = false;
-	if(end < start) {
-		std::swap(start, end);
-		++start;
+namespace {
+//works out the elements range() yields: start, start+step, ... up to but
+//not including start+nelem, in reverse order if reverse is set.
+void calculate_range(const function_expression::args_list& args, const formula_callable& variables, int* start, int* nelem, int* step, bool* reverse)
+{
+	*start = args.size() > 1 ? args[0]->evaluate(variables).as_int() : 0;
+	int end = args[args.size() > 1 ? 1 : 0]->evaluate(variables).as_int();
+	*step = args.size() < 3 ? 1 : args[2]->evaluate(variables).as_int();
+	ASSERT_LOG(*step > 0, "ILLEGAL STEP VALUE IN RANGE: " << *step);
+	*reverse = false;
+	if(end < *start) {
+		std::swap(*start, end);
+		++*start;
 		++end;
-		reverse = true;
+		*reverse = true;
 	}
-	const int nelem = end - start;
+
+	*nelem = end - *start;
+}
+}
+
+FUNCTION_DEF(range, 1, 3, "range([start, ]finish[, step]): Returns a list containing all numbers smaller than the finish value and and larger than or equal to the start value. The start value defaults to 0.")
+	int start, nelem, step;
+	bool reverse;
+	calculate_range(args(), variables, &start, &nelem, &step, &reverse);
 
 	std::vector<variant> v;
 
@@ -2464,6 +2832,29 @@ FUNCTION_DEF(range, 1, 3, "range([start, ]finish[, step]): Returns a list contai
 	}
 
 	return variant(&v);
+FUNCTION_STREAM_DEF
+	int start, nelem, step;
+	bool reverse;
+	calculate_range(args(), variables, &start, &nelem, &step, &reverse);
+	if(nelem <= 0) {
+		return true;
+	}
+
+	if(reverse) {
+		for(int n = ((nelem-1)/step)*step; n >= 0; n -= step) {
+			if(!visitor(variant(start+n))) {
+				return false;
+			}
+		}
+	} else {
+		for(int n = 0; n < nelem; n += step) {
+			if(!visitor(variant(start+n))) {
+				return false;
+			}
+		}
+	}
+
+	return true;
 FUNCTION_TYPE_DEF
 	return variant_type::get_list(variant_type::get_type(variant::VARIANT_TYPE_INT));
 END_FUNCTION_DEF(range)
@@ -2484,6 +2875,16 @@ FUNCTION_TYPE_DEF
 END_FUNCTION_DEF(reverse)
 
 FUNCTION_DEF(head, 1, 1, "head(list): gives the first element of a list, or null for an empty list")
+	if(args()[0]->can_stream()) {
+		variant result;
+		args()[0]->evaluate_stream(variables, [&result](const variant& item) {
+			result = item;
+			return false;
+		});
+
+		return result;
+	}
+
 	const variant items = args()[0]->evaluate(variables);
 	if(items.num_elements() >= 1) {
 		return items[0];
@@ -3252,6 +3653,12 @@ private:
 		return variant_type::get_commands();
 	}
 
+	//only a write to 'me' builds a command of its own for each call; the
+	//other forms share a cached command or hold on to this expression.
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return me_slot_ != -1 && (slot_ != -1 || !key_.empty()) && args()[1]->can_evaluate_isolated(readable_slots);
+	}
+
 	void static_error_analysis() const {
 		variant_type_ptr target_type = args()[0]->query_mutable_type();
 		if(!target_type) {
@@ -3351,6 +3758,12 @@ private:
 		return variant_type::get_commands();
 	}
 
+	//only a write to 'me' builds a command of its own for each call; the
+	//other forms share a cached command or hold on to this expression.
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return me_slot_ != -1 && (slot_ != -1 || !key_.empty()) && args()[1]->can_evaluate_isolated(readable_slots);
+	}
+
 	void static_error_analysis() const {
 		variant_type_ptr target_type = args()[0]->query_mutable_type();
 		if(!target_type) {
@@ -3709,6 +4122,189 @@ void function_expression::check_arg_type(int narg, const std::string& type_str)
 	ASSERT_LOG(variant_types_compatible(type, provided), "Function call argument " << (narg+1) << " does not match. Function expects " << type_str << " provided " << provided->to_string() << " " << debug_pinpoint_location())
 }
 
+namespace {
+std::set<const function_memo_table*>& all_memo_tables() {
+	static std::set<const function_memo_table*>* instance = new std::set<const function_memo_table*>;
+	return *instance;
+}
+
+//functions are defined, and their tables made, on any thread that parses.
+threading::mutex& all_memo_tables_mutex() {
+	static threading::mutex* instance = new threading::mutex;
+	return *instance;
+}
+
+//the main thread, which runs static initializers.
+const SDL_threadID memo_thread = SDL_ThreadID();
+}
+
+function_memo_table::function_memo_table(const std::string& name, int max_entries, bool forced)
+  : name_(name), max_entries_(std::max(1, max_entries)), forced_(forced), disabled_(false),
+    hits_(0), misses_(0), evictions_(0)
+{
+	threading::lock lck(all_memo_tables_mutex());
+	all_memo_tables().insert(this);
+}
+
+function_memo_table::~function_memo_table()
+{
+	threading::lock lck(all_memo_tables_mutex());
+	all_memo_tables().erase(this);
+}
+
+bool function_memo_table::can_use()
+{
+	return SDL_ThreadID() == memo_thread;
+}
+
+bool function_memo_table::key_less::operator()(const std::vector<variant>& a, const std::vector<variant>& b) const
+{
+	return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), less);
+}
+
+bool function_memo_table::key_less::less(const variant& a, const variant& b)
+{
+	if(a.type() != b.type()) {
+		return a.type() < b.type();
+	}
+
+	if(a.is_list()) {
+		if(a.num_elements() != b.num_elements()) {
+			return a.num_elements() < b.num_elements();
+		}
+
+		for(size_t n = 0; n != a.num_elements(); ++n) {
+			if(less(a[n], b[n])) {
+				return true;
+			} else if(less(b[n], a[n])) {
+				return false;
+			}
+		}
+
+		return false;
+	}
+
+	if(a.is_map()) {
+		const std::map<variant,variant>& ma = a.as_map();
+		const std::map<variant,variant>& mb = b.as_map();
+		if(ma.size() != mb.size()) {
+			return ma.size() < mb.size();
+		}
+
+		for(std::map<variant,variant>::const_iterator i = ma.begin(), j = mb.begin(); i != ma.end(); ++i, ++j) {
+			if(less(i->first, j->first)) {
+				return true;
+			} else if(less(j->first, i->first)) {
+				return false;
+			}
+
+			if(less(i->second, j->second)) {
+				return true;
+			} else if(less(j->second, i->second)) {
+				return false;
+			}
+		}
+
+		return false;
+	}
+
+	return a < b;
+}
+
+bool function_memo_table::is_memoizable_value(const variant& v)
+{
+	if(v.is_null() || v.is_bool() || v.is_int() || v.is_decimal() || v.is_string()) {
+		return true;
+	}
+
+	if(v.is_list()) {
+		for(size_t n = 0; n != v.num_elements(); ++n) {
+			if(!is_memoizable_value(v[n])) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	if(v.is_map()) {
+		foreach(const variant_pair& p, v.as_map()) {
+			if(!is_memoizable_value(p.first) || !is_memoizable_value(p.second)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+const variant* function_memo_table::get(const std::vector<variant>& args)
+{
+	std::map<std::vector<variant>, entry_list::iterator, key_less>::iterator i = index_.find(args);
+	if(i == index_.end()) {
+		++misses_;
+		return NULL;
+	}
+
+	++hits_;
+	entries_.splice(entries_.begin(), entries_, i->second);
+	return &i->second->second;
+}
+
+void function_memo_table::store(const std::vector<variant>& args, const variant& result)
+{
+	std::map<std::vector<variant>, entry_list::iterator, key_less>::iterator i = index_.find(args);
+	if(i != index_.end()) {
+		i->second->second = result;
+		entries_.splice(entries_.begin(), entries_, i->second);
+		return;
+	}
+
+	entries_.push_front(std::pair<std::vector<variant>, variant>(args, result));
+	index_[args] = entries_.begin();
+
+	if(index_.size() > max_entries_) {
+		index_.erase(entries_.back().first);
+		entries_.pop_back();
+		++evictions_;
+	}
+}
+
+void function_memo_table::disable()
+{
+	disabled_ = true;
+	index_.clear();
+	entries_.clear();
+}
+
+std::string function_memo_table::get_stats_report()
+{
+	std::ostringstream s;
+	threading::lock lck(all_memo_tables_mutex());
+	foreach(const function_memo_table* table, all_memo_tables()) {
+		const int calls = table->hits_ + table->misses_;
+		s << table->name_ << ": " << table->hits_ << "/" << calls << " hits";
+		if(calls) {
+			s << " (" << (100*table->hits_)/calls << "%)";
+		}
+
+		s << ", " << table->entries_.size() << "/" << table->max_entries_ << " entries, " << table->evictions_ << " evictions";
+		if(table->forced_) {
+			s << ", forced";
+		}
+
+		if(table->disabled_) {
+			s << ", disabled (not pure)";
+		}
+
+		s << "\n";
+	}
+
+	return s.str();
+}
+
 formula_function_expression::formula_function_expression(const std::string& name, const args_list& args, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& arg_names, const std::vector<variant_type_ptr>& variant_types)
 : function_expression(name, args, arg_names.size(), arg_names.size()),
 	formula_(formula), precondition_(precondition), arg_names_(arg_names), variant_types_(variant_types), star_arg_(-1), has_closure_(false), base_slot_(0)
@@ -3794,6 +4390,17 @@ variant formula_function_expression::execute(const formula_callable& variables)
 		}
 	}
 
+	const bool use_memo = memo_ && function_memo_table::can_use() && memo_->enabled() && std::find_if(tmp_callable->values().begin(), tmp_callable->values().end(), [](const variant& v) { return !function_memo_table::is_memoizable_value(v); }) == tmp_callable->values().end();
+	if(use_memo) {
+		const variant* memoized = memo_->get(tmp_callable->values());
+		if(memoized) {
+			const variant result = *memoized;
+			callable_ = tmp_callable;
+			callable_->clear();
+			return result;
+		}
+	}
+
 	if(!is_calculating_recursion && formula_->has_guards() && !formula_fn_stack.empty() && formula_fn_stack.top() == this) {
 		const recursion_calculation_scope recursion_scope;
 
@@ -3819,8 +4426,19 @@ variant formula_function_expression::execute(const formula_callable& variables)
 	}
 
 	formula_function_scope scope(this);
+	const unsigned int rng_seed = rng::get_seed();
 	variant res = formula_->execute(*tmp_callable);
 
+	if(use_memo) {
+		//a function the parser thought pure which used the rng or
+		//returned an object isn't really pure, so stop memoizing it.
+		if(!memo_->forced() && (rng_seed != rng::get_seed() || !function_memo_table::is_memoizable_value(res))) {
+			memo_->disable();
+		} else {
+			memo_->store(tmp_callable->values(), res);
+		}
+	}
+
 	callable_ = tmp_callable;
 	callable_->clear();
 
@@ -3839,12 +4457,14 @@ variant formula_function_expression::execute(const formula_callable& variables)
 			}
 		}
 
-		return formula_function_expression_ptr(new formula_function_expression(name_, args, formula_, precondition_, args_, variant_types_));
+		formula_function_expression_ptr result(new formula_function_expression(name_, args, formula_, precondition_, args_, variant_types_));
+		result->set_memo_table(memo_);
+		return result;
 	}
 
-	void function_symbol_table::add_formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types)
+	void function_symbol_table::add_formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types, bool pure, function_memo_table_ptr memo)
 	{
-		custom_formulas_[name] = formula_function(name, formula, precondition, args, default_args, variant_types);
+		custom_formulas_[name] = formula_function(name, formula, precondition, args, default_args, variant_types, pure, memo);
 	}
 
 	expression_ptr function_symbol_table::create_function(const std::string& fn, const std::vector<expression_ptr>& args, const_formula_callable_definition_ptr callable_def) const
@@ -3905,10 +4525,11 @@ variant formula_function_expression::execute(const formula_callable& variables)
 		return expression_ptr();
 	}
 
-	void recursive_function_symbol_table::resolve_recursive_calls(const_formula_ptr f)
+	void recursive_function_symbol_table::resolve_recursive_calls(const_formula_ptr f, function_memo_table_ptr memo)
 	{
 		foreach(formula_function_expression_ptr& fn, expr_) {
 			fn->set_formula(f);
+			fn->set_memo_table(memo);
 		}
 	}
 
@@ -4398,11 +5019,11 @@ class gc_command : public game_logic::command_callable
 public:
 	virtual void execute(game_logic::formula_callable& ob) const 
 	{
-		custom_object::run_garbage_collection();
+		custom_object::start_garbage_collection();
 	}
 };
 
-FUNCTION_DEF(trigger_garbage_collection, 0, 0, "trigger_garbage_collection(): trigger an FFL garbage collection")
+FUNCTION_DEF(trigger_garbage_collection, 0, 0, "trigger_garbage_collection(): trigger an FFL garbage collection. The collection runs incrementally over the following frames.")
 	return variant(new gc_command);
 END_FUNCTION_DEF(trigger_garbage_collection)
 
@@ -4564,6 +5185,25 @@ UNIT_TEST(map_function) {
 	CHECK_EQ(game_logic::formula(variant("map([2,3,4], value+index)")).execute(), game_logic::formula(variant("[2,4,6]")).execute());
 }
 
+UNIT_TEST(streamed_list_functions) {
+	CHECK_EQ(game_logic::formula(variant("map(range(10, 0, 3), value)")).execute(), game_logic::formula(variant("[10,7,4,1]")).execute());
+	CHECK_EQ(game_logic::formula(variant("filter(map(range(6), value*value), value > 5)")).execute(), game_logic::formula(variant("[9,16,25]")).execute());
+	CHECK_EQ(game_logic::formula(variant("head(filter(map(range(100000), value*2), value > 10))")).execute(), variant(12));
+	CHECK_EQ(game_logic::formula(variant("count(map(range(10), value*value), value > 20)")).execute(), variant(5));
+	CHECK_EQ(game_logic::formula(variant("find([x*2 | x <- range(100)], value > 7)")).execute(), variant(8));
+	CHECK_EQ(game_logic::formula(variant("sum(map(range(5), value), 10)")).execute(), variant(20));
+	CHECK_EQ(game_logic::formula(variant("head(filter(range(3), value > 5))")).execute(), variant());
+}
+
+UNIT_TEST(sort_by_function) {
+	CHECK_EQ(game_logic::formula(variant("sort_by([5,3,8,1], -value)")).execute(), game_logic::formula(variant("[8,5,3,1]")).execute());
+	CHECK_EQ(game_logic::formula(variant("sort_by(['bb','a','ccc','dd'], size(value))")).execute(), game_logic::formula(variant("['a','bb','dd','ccc']")).execute());
+
+	//large enough to take the parallel path; must match the stable serial sort.
+	CHECK_EQ(game_logic::formula(variant("sort_by(range(20000), (value*7919)%1000)")).execute(),
+	         game_logic::formula(variant("sort(range(20000), (a*7919)%1000 < (b*7919)%1000 or (a*7919)%1000 = (b*7919)%1000 and a < b)")).execute());
+}
+
 UNIT_TEST(where_scope_function) {
 	CHECK(game_logic::formula(variant("{'val': num} where num = 5")).execute() == game_logic::formula(variant("{'val': 5}")).execute(), "map where test failed");
 	CHECK(game_logic::formula(variant("'five: ${five}' where five = 5")).execute() == game_logic::formula(variant("'five: 5'")).execute(), "string where test failed");
@@ -4596,6 +5236,13 @@ BENCHMARK(map_function) {
 	}
 }
 
+BENCHMARK(streamed_list_functions) {
+	static game_logic::formula f(variant("head(filter(map(range(100000), value*2), value > 1000))"));
+	BENCHMARK_LOOP {
+		f.execute();
+	}
+}
+
 namespace game_logic {
 
 const_formula_callable_definition_ptr get_map_callable_definition(const_formula_callable_definition_ptr base_def, variant_type_ptr key_type, variant_type_ptr value_type, const std::string& value_name)
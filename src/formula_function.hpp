@@ -17,6 +17,7 @@
 #ifndef FORMULA_FUNCTION_HPP_INCLUDED
 #define FORMULA_FUNCTION_HPP_INCLUDED
 
+#include <boost/function.hpp>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
@@ -24,6 +25,7 @@
 #include <assert.h>
 
 #include <iostream>
+#include <list>
 #include <map>
 
 #include "formula_callable_definition_fwd.hpp"
@@ -42,6 +44,10 @@ struct PinpointedLoc {
 	int begin_line, end_line, begin_col, end_col;
 };
 
+//receives the elements of a streamed list one at a time. Returns false
+//to stop the stream early.
+typedef boost::function<bool (const variant&)> sequence_visitor;
+
 std::string pinpoint_location(variant v, std::string::const_iterator begin);
 std::string pinpoint_location(variant v, std::string::const_iterator begin,
                                          std::string::const_iterator end,
@@ -65,7 +71,6 @@ public:
 
 	variant evaluate(const formula_callable& variables) const {
 #if !TARGET_OS_IPHONE
-		++ntimes_called_;
 		call_stack_manager manager(this, &variables);
 #endif
 		return execute(variables);
@@ -78,6 +83,17 @@ public:
 		return execute_member(variables, id, variant_id);
 	}
 
+	//true if this expression always yields a list whose elements can be
+	//produced one at a time, without materializing the list.
+	virtual bool can_stream() const {
+		return false;
+	}
+
+	//visits each element of the list this expression yields. Streamable
+	//expressions produce elements lazily; others are evaluated and their
+	//elements visited. Returns false if the visitor stopped the stream.
+	bool evaluate_stream(const formula_callable& variables, const sequence_visitor& visitor) const;
+
 	void perform_static_error_analysis() const {
 		static_error_analysis();
 	}
@@ -110,6 +126,10 @@ public:
 
 	int ntimes_called() const { return ntimes_called_; }
 
+	//counted as the expression is pushed on the call stack, which doesn't
+	//happen while formulas are evaluated on worker threads.
+	void count_call() const { ++ntimes_called_; }
+
 	variant_type_ptr query_variant_type() const { variant_type_ptr res = get_variant_type(); if(res) { return res; } else { return variant_type::get_any(); } }
 
 	variant_type_ptr query_mutable_type() const { return get_mutable_type(); }
@@ -119,6 +139,13 @@ public:
 	std::vector<const_expression_ptr> query_children() const;
 	std::vector<const_expression_ptr> query_children_recursive() const;
 
+	//true if this expression may be evaluated on a worker thread while the
+	//main thread waits. Such an expression only reads numbers from the slots
+	//of its callable flagged in 'readable_slots', computes with them and
+	//builds commands, so it touches no reference count or cache that other
+	//threads could be using, and can't fail on unexpected values.
+	bool can_evaluate_isolated(const std::vector<bool>& readable_slots) const;
+
 	void set_definition_used_by_expression(const_formula_callable_definition_ptr def) { definition_used_ = def; }
 	const_formula_callable_definition_ptr get_definition_used_by_expression() const { return definition_used_; }
 
@@ -128,10 +155,12 @@ protected:
 	virtual variant execute_member(const formula_callable& variables, std::string& id, variant* variant_id) const;
 private:
 	virtual variant execute(const formula_callable& variables) const = 0;
+	virtual bool execute_stream(const formula_callable& variables, const sequence_visitor& visitor) const;
 	virtual void static_error_analysis() const {}
 	virtual const_formula_callable_definition_ptr get_modified_definition_based_on_result(bool result, const_formula_callable_definition_ptr current_def, variant_type_ptr expression_is_this_type) const { return NULL; }
 
 	virtual std::vector<const_expression_ptr> get_children() const { return std::vector<const_expression_ptr>(); }
+	virtual bool is_isolated(const std::vector<bool>& readable_slots) const { return false; }
 
 	const char* name_;
 
@@ -172,12 +201,64 @@ private:
 	int min_args_, max_args_;
 };
 
+//a bounded table of the results of a pure formula function, keyed by its
+//argument values. The least recently used entry is evicted when full.
+class function_memo_table {
+public:
+	function_memo_table(const std::string& name, int max_entries, bool forced);
+	~function_memo_table();
+
+	//only plain data -- numbers, strings, bools, null and lists and maps of
+	//those -- can be memoized, since objects may change between calls.
+	static bool is_memoizable_value(const variant& v);
+
+	//tables are only used by the main thread; calls from other threads,
+	//such as those preloading levels, aren't memoized.
+	static bool can_use();
+
+	const variant* get(const std::vector<variant>& args);
+	void store(const std::vector<variant>& args, const variant& result);
+
+	//stop memoizing; used if a call turns out not to be pure.
+	void disable();
+
+	bool enabled() const { return !disabled_; }
+	bool forced() const { return forced_; }
+
+	//a summary of hits and misses for every memoized function.
+	static std::string get_stats_report();
+private:
+	function_memo_table(const function_memo_table&);
+	void operator=(const function_memo_table&);
+
+	typedef std::list<std::pair<std::vector<variant>, variant> > entry_list;
+
+	//orders arguments by type before value, since variants compare ints
+	//and decimals as equal and f(1) and f(1.0) may have different results.
+	struct key_less {
+		bool operator()(const std::vector<variant>& a, const std::vector<variant>& b) const;
+		static bool less(const variant& a, const variant& b);
+	};
+
+	std::string name_;
+	size_t max_entries_;
+	bool forced_, disabled_;
+
+	entry_list entries_;
+	std::map<std::vector<variant>, entry_list::iterator, key_less> index_;
+
+	int hits_, misses_, evictions_;
+};
+
+typedef boost::shared_ptr<function_memo_table> function_memo_table_ptr;
+
 class formula_function_expression : public function_expression {
 public:
 	explicit formula_function_expression(const std::string& name, const args_list& args, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& arg_names, const std::vector<variant_type_ptr>& variant_types);
 	virtual ~formula_function_expression() {}
 
 	void set_formula(const_formula_ptr f) { formula_ = f; }
+	void set_memo_table(function_memo_table_ptr memo) { memo_ = memo; }
 	void set_has_closure(int base_slot) { has_closure_ = true; base_slot_ = base_slot; }
 private:
 	boost::intrusive_ptr<slot_formula_callable> calculate_args_callable(const formula_callable& variables) const;
@@ -197,6 +278,8 @@ private:
 	bool has_closure_;
 	int base_slot_;
 
+	function_memo_table_ptr memo_;
+
 };
 
 typedef boost::intrusive_ptr<function_expression> function_expression_ptr;
@@ -209,9 +292,11 @@ class formula_function {
 	std::vector<std::string> args_;
 	std::vector<variant> default_args_;
 	std::vector<variant_type_ptr> variant_types_;
+	bool pure_;
+	function_memo_table_ptr memo_;
 public:
-	formula_function() {}
-	formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types) : name_(name), formula_(formula), precondition_(precondition), args_(args), default_args_(default_args), variant_types_(variant_types)
+	formula_function() : pure_(false) {}
+	formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types, bool pure=false, function_memo_table_ptr memo=function_memo_table_ptr()) : name_(name), formula_(formula), precondition_(precondition), args_(args), default_args_(default_args), variant_types_(variant_types), pure_(pure), memo_(memo)
 	{}
 
 	formula_function_expression_ptr generate_function_expression(const std::vector<expression_ptr>& args) const;
@@ -220,6 +305,10 @@ public:
 	const std::vector<variant> default_args() const { return default_args_; }
 	const_formula_ptr get_formula() const { return formula_; }
 	const std::vector<variant_type_ptr>& variant_types() const { return variant_types_; }
+
+	//true if the parser found the function creates no commands and
+	//doesn't reach mutable object state.
+	bool is_pure() const { return pure_; }
 };	
 
 class function_symbol_table {
@@ -229,7 +318,7 @@ public:
 	function_symbol_table() : backup_(0) {}
 	virtual ~function_symbol_table() {}
 	void set_backup(const function_symbol_table* backup) { backup_ = backup; }
-	virtual void add_formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types);
+	virtual void add_formula_function(const std::string& name, const_formula_ptr formula, const_formula_ptr precondition, const std::vector<std::string>& args, const std::vector<variant>& default_args, const std::vector<variant_type_ptr>& variant_types, bool pure=false, function_memo_table_ptr memo=function_memo_table_ptr());
 	virtual expression_ptr create_function(const std::string& fn,
 					                       const std::vector<expression_ptr>& args,
 										   const_formula_callable_definition_ptr callable_def) const;
@@ -252,7 +341,7 @@ public:
 	virtual expression_ptr create_function(const std::string& fn,
 					                       const std::vector<expression_ptr>& args,
 										   const_formula_callable_definition_ptr callable_def) const;
-	void resolve_recursive_calls(const_formula_ptr f);
+	void resolve_recursive_calls(const_formula_ptr f, function_memo_table_ptr memo=function_memo_table_ptr());
 };
 
 expression_ptr create_function(const std::string& fn,
@@ -282,6 +371,10 @@ private:
 		return v_;
 	}
 
+	bool is_isolated(const std::vector<bool>& readable_slots) const {
+		return v_.is_null() || v_.is_bool() || v_.is_int() || v_.is_decimal();
+	}
+
 	virtual variant_type_ptr get_variant_type() const;
 	
 	variant v_;
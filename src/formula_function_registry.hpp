@@ -63,6 +63,8 @@ private: \
 
 #define FUNCTION_OPTIMIZE } expression_ptr optimize() const {
 
+#define FUNCTION_STREAM_DEF } bool can_stream() const { return true; } bool execute_stream(const formula_callable& variables, const sequence_visitor& visitor) const {
+
 #define EVAL_ARG(n) (args()[n]->evaluate(variables))
 #define NUM_ARGS (args().size())
 
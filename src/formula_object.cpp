@@ -24,6 +24,7 @@
 #include "formula.hpp"
 #include "formula_callable.hpp"
 #include "formula_callable_definition.hpp"
+#include "formula_callable_visitor.hpp"
 #include "formula_object.hpp"
 #include "json_parser.hpp"
 #include "module.hpp"
@@ -1053,7 +1054,11 @@ formula_object::formula_object(variant data)
 }
 
 formula_object::~formula_object()
-{}
+{
+	if(gc_node_destroyed) {
+		gc_node_destroyed(this);
+	}
+}
 
 boost::intrusive_ptr<formula_object> formula_object::clone() const
 {
@@ -1288,6 +1293,15 @@ void formula_object::validate() const
 #endif
 }
 
+void formula_object::visit_values(formula_callable_visitor& visitor)
+{
+	foreach(variant& v, variables_) {
+		visitor.visit(&v);
+	}
+
+	visitor.visit(&tmp_value_);
+}
+
 void formula_object::get_inputs(std::vector<formula_input>* inputs) const
 {
 	foreach(const property_entry& entry, class_->slots()) {
@@ -79,6 +79,8 @@ private:
 
 	void get_inputs(std::vector<formula_input>* inputs) const;
 
+	void visit_values(formula_callable_visitor& visitor);
+
 	int id_;
 	bool new_in_update_;
 	bool orphaned_;
@@ -37,6 +37,7 @@
 #include "filesystem.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
+#include "formula_function.hpp"
 #include "formula_profiler.hpp"
 #include "object_events.hpp"
 #include "variant.hpp"
@@ -308,6 +309,11 @@ void end_profiling()
 			s << (100*cum_sorted_samples[n].first)/total_expr_samples << "% (" << cum_sorted_samples[n].first << ") " << cum_sorted_samples[n].second << "\n";
 		}
 
+		const std::string memo_report = game_logic::function_memo_table::get_stats_report();
+		if(!memo_report.empty()) {
+			s << "\n\nMEMOIZED FUNCTIONS:\n" << memo_report;
+		}
+
 		if(!output_fname.empty()) {
 			sys::write_file(output_fname, s.str());
 			std::cerr << "WROTE PROFILE TO " << output_fname << "\n";
@@ -342,6 +348,25 @@ bool custom_object_event_frame::operator<(const custom_object_event_frame& f) co
 	       type == f.type && event_id == f.event_id && executing_commands < f.executing_commands;
 }
 
+namespace {
+struct gc_record {
+	gc_record() : ncollections(0), total_pause_ms(0), max_pause_ms(0), nreclaimed(0)
+	{}
+	int ncollections, total_pause_ms, max_pause_ms, nreclaimed;
+};
+
+gc_record gc_since_summary;
+}
+
+void record_garbage_collection(int total_pause_ms, int max_pause_ms, int nreclaimed)
+{
+	gc_record& r = gc_since_summary;
+	++r.ncollections;
+	r.total_pause_ms += total_pause_ms;
+	r.max_pause_ms = std::max(r.max_pause_ms, max_pause_ms);
+	r.nreclaimed += nreclaimed;
+}
+
 std::string get_profile_summary()
 {
 	if(!profiler_on) {
@@ -380,6 +405,11 @@ std::string get_profile_summary()
 		s << samples[n].second << " " << samples[n].first << " ";
 	}
 
+	if(gc_since_summary.ncollections) {
+		s << "GC: " << gc_since_summary.ncollections << " collections, " << gc_since_summary.total_pause_ms << "ms paused, longest pause " << gc_since_summary.max_pause_ms << "ms, " << gc_since_summary.nreclaimed << " objects reclaimed ";
+		gc_since_summary = gc_record();
+	}
+
 	last_empty_samples = empty_samples;
 	last_num_samples = num_samples;
 
@@ -49,6 +49,8 @@ class suspend_scope
 
 inline std::string get_profile_summary() { return ""; }
 
+inline void record_garbage_collection(int total_pause_ms, int max_pause_ms, int nreclaimed) {}
+
 }
 
 #else
@@ -113,6 +115,10 @@ private:
 
 std::string get_profile_summary();
 
+//records a finished collection of reference cycles, to be included in the
+//next profile summary.
+void record_garbage_collection(int total_pause_ms, int max_pause_ms, int nreclaimed);
+
 }
 
 #endif
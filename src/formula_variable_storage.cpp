@@ -93,6 +93,28 @@ void formula_variable_storage::add(const formula_variable_storage& value)
 	}
 }
 
+bool formula_variable_storage::reset_values(const std::map<std::string, variant>& m)
+{
+	if(m.size() != strings_to_values_.size()) {
+		return false;
+	}
+
+	std::map<std::string, variant>::const_iterator i = m.begin();
+	std::map<std::string, int>::const_iterator j = strings_to_values_.begin();
+	for(; i != m.end(); ++i, ++j) {
+		if(i->first != j->first) {
+			return false;
+		}
+	}
+
+	for(i = m.begin(), j = strings_to_values_.begin(); i != m.end(); ++i, ++j) {
+		values_[j->second] = i->second;
+	}
+
+	disallow_new_keys_ = false;
+	return true;
+}
+
 variant formula_variable_storage::get_value(const std::string& key) const
 {
 	std::map<std::string,int>::const_iterator i = strings_to_values_.find(key);
@@ -38,6 +38,11 @@ public:
 	void add(const std::string& key, const variant& value);
 	void add(const formula_variable_storage& value);
 
+	//sets the values back to those in m, keeping the storage already
+	//allocated. Returns false, changing nothing, unless the keys are
+	//exactly those of m.
+	bool reset_values(const std::map<std::string, variant>& m);
+
 	std::vector<variant>& values() { return values_; }
 	const std::vector<variant>& values() const { return values_; }
 
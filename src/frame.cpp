@@ -96,14 +96,15 @@ frame::frame(variant node)
 	 no_remove_alpha_borders_(node["no_remove_alpha_borders"].as_bool(false)),
 	 collision_areas_inside_frame_(true),
 	 current_palette_(-1), 
-	 back_face_culling_(node["cull"].as_bool(false))
+	 back_face_culling_(node["cull"].as_bool(false)),
+	 texture_options_(node.has_key("texcoords") == false && node.has_key("palettes") == false && node["atlas"].as_bool(true) ? graphics::texture::ALLOW_ATLAS : 0)
 {
 	if(node.has_key("obj") == false) {
 		image_ = node["image"].as_string();
 		if(node.has_key("fbo")) {
 			texture_ = node["fbo"].convert_to<texture_object>()->texture();
 		} else {
-			texture_ = graphics::texture::get(image_, node["image_formula"].as_string_default());
+			texture_ = graphics::texture::get(image_, node["image_formula"].as_string_default(), texture_options_);
 		}
 	}
 
@@ -414,7 +415,7 @@ void frame::set_palettes(unsigned int palettes)
 
 	if(palettes == 0) {
 		if(current_palette_ != -1) {
-			texture_ = graphics::texture::get(image_);
+			texture_ = graphics::texture::get(image_, texture_options_);
 			current_palette_ = -1;
 		}
 		return;
@@ -207,6 +207,15 @@ private:
 	variant get_value(const std::string& key) const;
 
 	bool back_face_culling_;
+
+	//options the frame's image is loaded with. Frames whose texture
+	//coordinates are given directly, or which say atlas: false, get a
+	//texture of their own rather than a place in an atlas page. So do
+	//frames with palettes: palette textures are never atlased, and 3D
+	//frames bake their texture coordinates in when they load, so they
+	//must be the same in the palette textures as in the image.
+	int texture_options_;
+
 	struct draw_data_3d
 	{
 		size_t num_vertices;
@@ -57,7 +57,7 @@ const_framed_gui_element_ptr framed_gui_element::get(const std::string& key)
 framed_gui_element::framed_gui_element(variant node)
 : area_(node["rect"]),
 corner_height_(node["corner_height"].as_int()),
-texture_(graphics::texture::get(node["image"].as_string()))
+texture_(graphics::texture::get(node["image"].as_string(), graphics::texture::ALLOW_ATLAS))
 {
 	top_left_corner_ = rect(area_.x(),area_.y(),corner_height_,corner_height_);
 	top_right_corner_ = rect(area_.x2() - corner_height_,area_.y(),corner_height_,corner_height_);
@@ -0,0 +1,111 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gl_state.hpp"
+
+namespace gl_state
+{
+
+namespace {
+bool program_known = false;
+GLuint program_in_use = 0;
+
+bool blend_known = false;
+GLenum blend_src = GL_ONE, blend_dst = GL_ZERO;
+
+int nissued = 0, nfiltered = 0;
+}
+
+void use_program(GLuint program)
+{
+	if(program_known && program == program_in_use) {
+		++nfiltered;
+		return;
+	}
+
+	glUseProgram(program);
+	program_in_use = program;
+	program_known = true;
+	++nissued;
+}
+
+GLuint current_program()
+{
+	if(!program_known) {
+		GLint program = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		program_in_use = program;
+		program_known = true;
+	}
+
+	return program_in_use;
+}
+
+void blend_func(GLenum sfactor, GLenum dfactor)
+{
+	if(blend_known && sfactor == blend_src && dfactor == blend_dst) {
+		++nfiltered;
+		return;
+	}
+
+	glBlendFunc(sfactor, dfactor);
+	blend_src = sfactor;
+	blend_dst = dfactor;
+	blend_known = true;
+	++nissued;
+}
+
+void get_blend_func(GLenum* sfactor, GLenum* dfactor)
+{
+	if(!blend_known) {
+		GLint src = GL_ONE, dst = GL_ZERO;
+		glGetIntegerv(GL_BLEND_SRC, &src);
+		glGetIntegerv(GL_BLEND_DST, &dst);
+		blend_src = src;
+		blend_dst = dst;
+		blend_known = true;
+	}
+
+	*sfactor = blend_src;
+	*dfactor = blend_dst;
+}
+
+void invalidate()
+{
+	program_known = false;
+	blend_known = false;
+}
+
+void count_call(bool issued)
+{
+	if(issued) {
+		++nissued;
+	} else {
+		++nfiltered;
+	}
+}
+
+int calls_issued()
+{
+	return nissued;
+}
+
+int calls_filtered()
+{
+	return nfiltered;
+}
+
+}
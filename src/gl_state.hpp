@@ -0,0 +1,48 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GL_STATE_HPP_INCLUDED
+#define GL_STATE_HPP_INCLUDED
+
+#include "graphics.hpp"
+
+//Keeps track of GL state so that calls which wouldn't change it can be
+//skipped. Call these instead of the GL functions they wrap; calling GL
+//directly leaves what's tracked out of date.
+namespace gl_state
+{
+
+void use_program(GLuint program);
+GLuint current_program();
+
+void blend_func(GLenum sfactor, GLenum dfactor);
+void get_blend_func(GLenum* sfactor, GLenum* dfactor);
+
+//forgets everything tracked, such as when the GL context is recreated.
+void invalidate();
+
+//records a GL call being made, or being skipped since it would change
+//nothing. Other caches of GL state -- uniforms, texture binds -- use this
+//so all of them are counted together.
+void count_call(bool issued);
+
+//running totals of calls made and skipped.
+int calls_issued();
+int calls_filtered();
+
+}
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "asserts.hpp"
 #include "filesystem.hpp"
+#include "gl_state.hpp"
 #include "graphics.hpp"
 #include "gles2.hpp"
 #include "json_parser.hpp"
@@ -578,11 +579,10 @@ namespace gles2 {
 		// Reset errors, so we can track errors that happened here.
 		glGetError();
 
-		GLint blend_src_mode;
-		GLint blend_dst_mode;
+		GLenum blend_src_mode;
+		GLenum blend_dst_mode;
 		// Save current blend mode
-		glGetIntegerv(GL_BLEND_SRC, &blend_src_mode);
-		glGetIntegerv(GL_BLEND_DST, &blend_dst_mode);
+		gl_state::get_blend_func(&blend_src_mode, &blend_dst_mode);
 		blend_stack.push(blend_mode(blend_src_mode, blend_dst_mode, glIsEnabled(GL_BLEND) != 0));
 
 		GLint atu;
@@ -614,7 +614,7 @@ namespace gles2 {
 		} else {
 			glDisable(GL_BLEND);
 		}
-		glBlendFunc(bm.blend_src_mode, bm.blend_dst_mode);
+		gl_state::blend_func(bm.blend_src_mode, bm.blend_dst_mode);
 		glActiveTexture(active_texture_unit.top());
 		active_texture_unit.pop();
 
@@ -625,7 +625,7 @@ namespace gles2 {
 		} else {
 			active_shader_program = tex_shader_program;
 		}
-		glUseProgram(active_shader_program->shader()->get());
+		gl_state::use_program(active_shader_program->shader()->get());
 	}
 }
 
@@ -19,6 +19,7 @@
 #include "foreach.hpp"
 #include "graphical_font.hpp"
 #include "raster.hpp"
+#include "string_utils.hpp"
 #include "variant_utils.hpp"
 #include "filesystem.hpp"
 #include "module.hpp"
@@ -27,80 +28,6 @@
 namespace {
 typedef std::map<std::string, graphical_font_ptr> cache_map;
 cache_map cache;
-
-unsigned int utf8_to_codepoint(std::string::const_iterator& i, std::string::const_iterator end) {
-	unsigned int codepoint = 0;
-
-	if((*i & 0xc0) == 0x80) {
-		//*i is an unexpected following byte
-		return 0;
-	}
-	if((*i & 0xc0) == 0xc0) {
-		//*i is the leading byte of an UTF-8 encoded multi-byte character.
-		if ((*i & 0xe0) == 0xc0) {
-			//two byte sequence: 110xxxyy 10yyyyyy
-			codepoint = (*i & 0x1f) << 6;
-			if (++i == end) {
-				return 0;
-			}
-			if ((*i & 0xc0) == 0x80) {
-				codepoint |= *i & 0x3f;
-			} else {
-				codepoint = 0xfffd; // U+FFFD is the replacement character
-			}
-		} else if ((*i & 0xf0) == 0xe0) {
-			//three byte sequence: 1110xxxx 10xxxxyy 10yyyyyy
-			codepoint = (*i & 0x0f) << 12;
-			if (++i == end) {
-				return 0;
-			}
-			if ((*i & 0xc0) == 0x80) {
-				codepoint |= (*i & 0x3f) << 6;
-				if (++i == end) {
-					return 0;
-				}
-				if ((*i & 0xc0) == 0x80) {
-					codepoint |= *i & 0x3f;
-				} else {
-					codepoint = 0xfffd;
-				}
-			} else {
-				codepoint = 0xfffd;
-			}
-		} else if ((*i & 0xf8) == 0xf0) {
-			//four byte sequence: 11110xxx 10xxyyyy 10yyyyzz 10zzzzzz
-			codepoint = (*i & 0x07) << 18;
-			if (++i == end) {
-				return 0;
-			}
-			if ((*i & 0xc0) == 0x80) {
-				codepoint |= (*i & 0x3f) << 12;
-				if (++i == end) {
-					return 0;
-				}
-				if ((*i & 0xc0) == 0x80) {
-					codepoint |= (*i & 0x3f) << 6;
-					if (++i == end) {
-						return 0;
-					}
-					if ((*i & 0xc0) == 0x80) {
-						codepoint |= *i & 0x3f;
-					} else {
-						codepoint = 0xfffd;
-					}
-				} else {
-					codepoint = 0xfffd;
-				}
-			} else {
-				codepoint = 0xfffd;
-			}
-		}
-	} else {
-		//c is an ASCII character
-		codepoint = *i;
-	}
-	return codepoint;	
-}
 }
 
 void graphical_font::init(variant node)
@@ -122,7 +49,7 @@ const_graphical_font_ptr graphical_font::get(const std::string& id)
 }
 
 graphical_font::graphical_font(variant node)
-  : id_(node["id"].as_string()), texture_(graphics::texture::get(node["texture"].as_string())),
+  : id_(node["id"].as_string()), texture_(graphics::texture::get(node["texture"].as_string(), graphics::texture::ALLOW_ATLAS)),
     kerning_(node["kerning"].as_int(2))
 {
 	int pad = 2;
@@ -145,7 +72,7 @@ graphical_font::graphical_font(variant node)
 			current_rect = rect(char_node["rect"].as_list_int());
 		}
 		for(std::string::const_iterator i = chars.begin(); i != chars.end(); ++i) {
-			unsigned int codepoint = utf8_to_codepoint(i, chars.end());
+			unsigned int codepoint = util::utf8_to_codepoint(i, chars.end());
 			if (codepoint == 0)
 				break;
 
@@ -191,7 +118,7 @@ rect graphical_font::do_draw(int x, int y, const std::string& text, bool draw_te
 			continue;
 		}
 
-		unsigned int codepoint = utf8_to_codepoint(i, text.end());
+		unsigned int codepoint = util::utf8_to_codepoint(i, text.end());
 		if (codepoint == 0)
 			break;
 
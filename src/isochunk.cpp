@@ -1,11 +1,13 @@
 #if defined(USE_ISOMAP)
 
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/regex.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
 #include <limits>
 #include <sstream>
 #include <utility>
@@ -14,6 +16,7 @@
 #include <glm/gtc/random.hpp>
 
 #include "base64.hpp"
+#include "color_chart.hpp"
 #include "compress.hpp"
 #include "foreach.hpp"
 #include "isochunk.hpp"
@@ -24,6 +27,7 @@
 #include "profile_timer.hpp"
 #include "simplex_noise.hpp"
 #include "texture.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant_utils.hpp"
 
@@ -264,11 +268,39 @@ namespace voxel{
 			static colored_terrain_info res;
 			return res;
 		}
+
+		// terrain.cfg is read by the first chunk made; after that chunks only
+		// look tiles up, which they may do from worker threads.
+		void load_terrain_info()
+		{
+			static bool loaded = false;
+			if(loaded) {
+				return;
+			}
+
+			const variant terrain = json::parse_from_file("data/terrain.cfg");
+			get_textured_terrain_info().clear();
+			get_textured_terrain_info().load(terrain);
+			get_colored_terrain_info().clear();
+			get_colored_terrain_info().load(terrain);
+			loaded = true;
+		}
+
+		graphics::color get_face_color(int face, const variant& col)
+		{
+			if(col.is_string()) {
+				auto it = get_colored_terrain_info().find(col.as_string());
+				if(it != get_colored_terrain_info().end()) {
+					return it->second.faces & (1 << face) ? it->second.color[face] : it->second.color[0];
+				}
+			}
+			return graphics::color(col);
+		}
 	}
 
 	bool operator==(position const& p1, position const& p2)
 	{
-		return p1.x == p1.x && p1.y == p2.y && p1.z == p2.z;
+		return p1.x == p2.x && p1.y == p2.y && p1.z == p2.z;
 	}
 
 	std::size_t hash_value(position const& p)
@@ -282,7 +314,7 @@ namespace voxel{
 
 	chunk::chunk()
 		: u_mvp_matrix_(-1), u_normal_(-1), a_position_(-1), textured_(true), 
-		worldspace_position_(0.0f)
+		worldspace_position_(0.0f), lod_(0)
 	{
 		// Call init *before* doing anything else
 		init();
@@ -290,8 +322,8 @@ namespace voxel{
 
 	chunk::chunk(gles2::program_ptr shader, logical_world_ptr logic, const variant& node)
 		: u_mvp_matrix_(-1), u_normal_(-1), a_position_(-1), textured_(true), 
-		worldspace_position_(0.0f), scale_x_(logic->scale_x()), scale_y_(logic->scale_y()), 
-		scale_z_(logic->scale_z())
+		worldspace_position_(0.0f), scale_x_(logic ? logic->scale_x() : 1), scale_y_(logic ? logic->scale_y() : 1), 
+		scale_z_(logic ? logic->scale_z() : 1), lod_(node["lod"].as_int(0))
 	{
 		// Call init *before* doing anything else
 		init();
@@ -304,21 +336,15 @@ namespace voxel{
 		if(node.has_key("worldspace_position")) {
 			const variant& wp = node["worldspace_position"];
 			ASSERT_LOG(wp.is_list() && wp.num_elements() == 3, "'worldspace_position' attribute must be a list of 3 integers");
-			worldspace_position_.x = float(wp[0].as_decimal().as_float()) * logic->scale_x();
-			worldspace_position_.y = float(wp[1].as_decimal().as_float()) * logic->scale_y();
-			worldspace_position_.z = float(wp[2].as_decimal().as_float()) * logic->scale_z();
+			worldspace_position_.x = float(wp[0].as_decimal().as_float()) * scale_x();
+			worldspace_position_.y = float(wp[1].as_decimal().as_float()) * scale_y();
+			worldspace_position_.z = float(wp[2].as_decimal().as_float()) * scale_z();
 		}
 	}
 
 	void chunk::init()
 	{
-		vbos_ = boost::shared_array<GLuint>(new GLuint[2], [](GLuint* id) {glDeleteBuffers(2,id); delete [] id;});
-		glGenBuffers(2, &vbos_[0]);
-
-		get_textured_terrain_info().clear();
-		get_textured_terrain_info().load(json::parse_from_file("data/terrain.cfg"));
-		get_colored_terrain_info().clear();
-		get_colored_terrain_info().load(json::parse_from_file("data/terrain.cfg"));
+		load_terrain_info();
 
 		normals_.clear();
 		normals_.push_back(glm::vec3(0,0,1));	// front
@@ -361,73 +387,108 @@ namespace voxel{
 	}
 
 	void chunk::build()
+	{
+		build_geometry();
+		upload_geometry();
+	}
+
+	void chunk::build_geometry()
 	{
 		varray_.clear();
+		varray_.resize(MAX_FACES);
+
+		handle_build();
+	}
+
+	void chunk::upload_geometry()
+	{
+		if(!vbos_) {
+			vbos_ = boost::shared_array<GLuint>(new GLuint[2], [](GLuint* id) {glDeleteBuffers(2,id); delete [] id;});
+			glGenBuffers(2, &vbos_[0]);
+		}
+
 		vattrib_offsets_.clear();
 		num_vertices_.clear();
-
-		varray_.resize(MAX_FACES);
 		vattrib_offsets_.resize(MAX_FACES);
 		num_vertices_.resize(MAX_FACES);
 
-		handle_build();
+		add_vertex_vbo_data();
+		handle_upload();
+		clear_vertex_data();
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	int chunk::num_triangles() const
+	{
+		size_t vertices = 0;
+		foreach(size_t n, num_vertices_) {
+			vertices += n;
+		}
+		return int(vertices/3);
 	}
 
 	void chunk::add_vertex_data(int face, GLfloat x, GLfloat y, GLfloat z, GLfloat s, std::vector<GLfloat>& varray)
+	{
+		add_box_face(face, x, y, z, GLfloat(scale_x()), GLfloat(scale_y()), GLfloat(scale_z()), varray);
+	}
+
+	// adds the given face of the box at x,y,z with sides sx,sy,sz.
+	void chunk::add_box_face(int face, GLfloat x, GLfloat y, GLfloat z, GLfloat sx, GLfloat sy, GLfloat sz, std::vector<GLfloat>& varray)
 	{
 		switch(face) {
 		case FRONT_FACE:
-			varray.push_back(x); varray.push_back(y); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
+			varray.push_back(x); varray.push_back(y); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z+sz);
 
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
-			varray.push_back(x); varray.push_back(y); varray.push_back(z+scale_z());
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z+sz);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z+sz);
+			varray.push_back(x); varray.push_back(y); varray.push_back(z+sz);
 			break;
 		case RIGHT_FACE:
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z);
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z);
 
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z);
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z);
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z);
 			break;
 		case TOP_FACE:
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z);
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z+sz);
 
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z);
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z);
 			break;
 		case BACK_FACE:
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z);
 			varray.push_back(x); varray.push_back(y); varray.push_back(z);
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z);
 
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z);
-			varray.push_back(x+scale_x()); varray.push_back(y+scale_y()); varray.push_back(z);
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z);
+			varray.push_back(x+sx); varray.push_back(y+sy); varray.push_back(z);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z);
 			break;
 		case LEFT_FACE:
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z+scale_z());
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z);
-			varray.push_back(x); varray.push_back(y); varray.push_back(z+scale_z());
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z+sz);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y); varray.push_back(z+sz);
 
-			varray.push_back(x); varray.push_back(y); varray.push_back(z+scale_z());
-			varray.push_back(x); varray.push_back(y+scale_y()); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y); varray.push_back(z+sz);
+			varray.push_back(x); varray.push_back(y+sy); varray.push_back(z);
 			varray.push_back(x); varray.push_back(y); varray.push_back(z);
 			break;
 		case BOTTOM_FACE:
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z+scale_z());
-			varray.push_back(x); varray.push_back(y); varray.push_back(z+scale_z());
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z+sz);
+			varray.push_back(x); varray.push_back(y); varray.push_back(z+sz);
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z);
 
-			varray.push_back(x+scale_x()); varray.push_back(y); varray.push_back(z);
-			varray.push_back(x); varray.push_back(y); varray.push_back(z+scale_z());
+			varray.push_back(x+sx); varray.push_back(y); varray.push_back(z);
+			varray.push_back(x); varray.push_back(y); varray.push_back(z+sz);
 			varray.push_back(x); varray.push_back(y); varray.push_back(z);
 			break;
 		default: ASSERT_LOG(false, "isomap::add_vertex_data unexpected facing value: " << face);
@@ -445,7 +506,9 @@ namespace voxel{
 		glBindBuffer(GL_ARRAY_BUFFER, vbos_[0]);
 		glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_STATIC_DRAW);
 		for(int n = FRONT_FACE; n != MAX_FACES; ++n) {
-			glBufferSubData(GL_ARRAY_BUFFER, vattrib_offsets_[n], varray_[n].size()*sizeof(GLfloat), &varray_[n][0]);
+			if(varray_[n].empty() == false) {
+				glBufferSubData(GL_ARRAY_BUFFER, vattrib_offsets_[n], varray_[n].size()*sizeof(GLfloat), &varray_[n][0]);
+			}
 		}
 	}
 
@@ -486,7 +549,7 @@ namespace voxel{
 
 	///////////////////////////////////////////////////////////////
 	// Colored chunk functions
-	chunk_colored::chunk_colored() : chunk()
+	chunk_colored::chunk_colored() : chunk(), random_pending_(false)
 	{
 	}
 
@@ -502,7 +565,8 @@ namespace voxel{
 	{
 	}
 
-	chunk_colored::chunk_colored(gles2::program_ptr shader, logical_world_ptr logic, const variant& node) : chunk(shader, logic, node)
+	chunk_colored::chunk_colored(gles2::program_ptr shader, logical_world_ptr logic, const variant& node) 
+		: chunk(shader, logic, node), random_pending_(false)
 	{
 		a_color_ = shader->get_fixed_attribute("color");
 		ASSERT_LOG(a_color_ != -1, "chunk_colored: color == -1");	
@@ -514,7 +578,7 @@ namespace voxel{
 			int size_z = node["random"]["depth"].as_int(32);
 			set_size(size_x, size_y, size_z);
 
-			int noise_height = node["noise_height"].as_int(size_y);
+			noise_height_ = node["noise_height"].as_int(size_y);
 
 			uint32_t seed = node["random"]["seed"].as_int(0);
 			noise::simplex::init(seed);
@@ -527,37 +591,11 @@ namespace voxel{
 			} else {
 				color = graphics::color(dist(rng), dist(rng), dist(rng), 255);
 			}
+			random_color_ = color.write();
 
-			float x_smooth = node["random"]["x_smoothness"].as_decimal(decimal(128.0)).as_float();
-			float z_smooth = node["random"]["z_smoothness"].as_decimal(decimal(128.0)).as_float();
-
-			//profile::manager pmain("loop");
-			float vec[2];
-			std::vector<std::vector<int> > heightmap;
-			heightmap.resize(size_x);
-			for(int x = 0; x != size_x; ++x) {
-				heightmap[x].resize(size_z);
-				vec[0] = float(worldspace_position().x+x)/x_smooth;
-				for(int z = 0; z != size_z; ++z) {
-					vec[1] = float(+worldspace_position().z+z)/z_smooth;
-					heightmap[x][z] = int(glm::simplex(glm::vec2(vec[0], vec[1])) * noise_height/2.0f) + 64;
-				}
-			}
-
-			for(int x = 0; x != size_x; ++x) {
-				for(int z = 0; z != size_z; ++z) {
-					if(heightmap[x][z] < int(worldspace_position().y)) {
-						continue;
-					}
-					int h = heightmap[x][z] - int(worldspace_position().y);
-					if(heightmap[x][z] >= int(worldspace_position().y) + size_y) {
-						h = size_y;
-					} 
-					for(int y = 0; y < h; ++y) {
-						tiles_[position(x,y,z)] = color.write();
-					}
-				}
-			}
+			x_smoothness_ = node["random"]["x_smoothness"].as_decimal(decimal(128.0)).as_float();
+			z_smoothness_ = node["random"]["z_smoothness"].as_decimal(decimal(128.0)).as_float();
+			random_pending_ = true;
 		} else {
 			ASSERT_LOG(node.has_key("voxels"), "'voxels' attribute must exist.");
 			ASSERT_LOG(node["voxels"].is_map(), "'voxels' must be a map.");
@@ -598,8 +636,37 @@ namespace voxel{
 			}
 			set_size(max_x - min_x + 1, max_y - min_y + 1, max_z - min_z + 1);
 		}
+	}
 
-		build();
+	void chunk_colored::generate_random()
+	{
+		//profile::manager pmain("loop");
+		float vec[2];
+		std::vector<std::vector<int> > heightmap;
+		heightmap.resize(size_x());
+		for(int x = 0; x != size_x(); ++x) {
+			heightmap[x].resize(size_z());
+			vec[0] = float(worldspace_position().x+x)/x_smoothness_;
+			for(int z = 0; z != size_z(); ++z) {
+				vec[1] = float(+worldspace_position().z+z)/z_smoothness_;
+				heightmap[x][z] = int(glm::simplex(glm::vec2(vec[0], vec[1])) * noise_height_/2.0f) + 64;
+			}
+		}
+
+		for(int x = 0; x != size_x(); ++x) {
+			for(int z = 0; z != size_z(); ++z) {
+				if(heightmap[x][z] < int(worldspace_position().y)) {
+					continue;
+				}
+				int h = heightmap[x][z] - int(worldspace_position().y);
+				if(heightmap[x][z] >= int(worldspace_position().y) + size_y()) {
+					h = size_y();
+				} 
+				for(int y = 0; y < h; ++y) {
+					tiles_[position(x,y,z)] = random_color_;
+				}
+			}
+		}
 	}
 
 	chunk_textured::chunk_textured(gles2::program_ptr shader, logical_world_ptr logic, const variant& node) : chunk(shader, logic, node)
@@ -680,77 +747,188 @@ namespace voxel{
 		}
 
 		ASSERT_LOG(tiles_.empty() == false, "ISOMAP: No tiles found");
-
-		build();
 	}
 	
+	namespace
+	{
+		bool compare_tile_height(const std::pair<const position, variant>* a, const std::pair<const position, variant>* b)
+		{
+			return a->first.y < b->first.y;
+		}
+	}
+
 	void chunk_colored::handle_build()
 	{
 		//profile::manager pman("chunk_colored::handle_build");
 
+		if(random_pending_) {
+			generate_random();
+			random_pending_ = false;
+		}
+
 		carray_.clear();
 		carray_.resize(MAX_FACES);
-		cattrib_offsets_.clear();
-		cattrib_offsets_.resize(MAX_FACES);
 
+		if(tiles_.empty()) {
+			return;
+		}
+
+		// Copy the tiles into a dense grid covering them, with the color of
+		// each face worked out once per voxel. At coarser levels of detail
+		// each cell of the grid stands for a cube of 2^lod voxels per side,
+		// and is filled if any of them are.
+		const int shift = lod();
+		int lo[3], hi[3];
+		lo[0] = lo[1] = lo[2] = std::numeric_limits<int>::max();
+		hi[0] = hi[1] = hi[2] = std::numeric_limits<int>::min();
 		for(auto& t : tiles_) {
-			int x = t.first.x;
-			int y = t.first.y;
-			int z = t.first.z;
-			GLfloat xf = GLfloat(x * scale_x());
-			GLfloat zf = GLfloat(z * scale_z());
-			GLfloat sx = GLfloat(scale_x());
-			GLfloat sy = GLfloat(scale_y());
-			GLfloat sz = GLfloat(scale_z());
-
-			for(int h = 0; h <= y; ++h) {
-				GLfloat yf = GLfloat(h * scale_y());
-				if(x > 0) {
-					if(is_solid(x-1, h, z) == false) {
-						add_face_left(xf,yf,zf,sx,t.second);
-					}
-				} else {
-					add_face_left(xf,yf,zf,sx,t.second);
-				}
-				if(x < size_x() - 1) {
-					if(is_solid(x+1, h, z) == false) {
-						add_face_right(xf,yf,zf,sx,t.second);
-					}
-				} else {
-					add_face_right(xf,yf,zf,sx,t.second);
+			const int p[3] = { t.first.x >> shift, t.first.y >> shift, t.first.z >> shift };
+			for(int a = 0; a != 3; ++a) {
+				lo[a] = std::min(lo[a], p[a]);
+				hi[a] = std::max(hi[a], p[a]);
+			}
+		}
+
+		// each tile stands on a column reaching down to the bottom of the
+		// chunk.
+		lo[1] = std::min(lo[1], 0);
+
+		const int dim[3] = { hi[0] - lo[0] + 1, hi[1] - lo[1] + 1, hi[2] - lo[2] + 1 };
+		const int stride[3] = { dim[1]*dim[2], dim[2], 1 };
+		const int nvoxels = dim[0]*dim[1]*dim[2];
+		std::vector<char> present(nvoxels), solid(nvoxels);
+		std::vector<graphics::color> colors(nvoxels*MAX_FACES);
+		std::vector<const std::pair<const position, variant>*> by_height;
+		for(auto& t : tiles_) {
+			const int index = ((t.first.x >> shift) - lo[0])*stride[0] + ((t.first.y >> shift) - lo[1])*stride[1] + ((t.first.z >> shift) - lo[2])*stride[2];
+			by_height.push_back(&t);
+			if(present[index]) {
+				continue;
+			}
+			present[index] = true;
+			solid[index] = is_solid(t.first.x, t.first.y, t.first.z);
+			for(int face = FRONT_FACE; face != MAX_FACES; ++face) {
+				colors[index*MAX_FACES + face] = get_face_color(face, t.second);
+			}
+		}
+
+		// fill the columns below the tiles, lowest tiles first, so each
+		// voxel of a column takes after the nearest tile above it.
+		std::sort(by_height.begin(), by_height.end(), compare_tile_height);
+		for(auto t : by_height) {
+			const int column = ((t->first.x >> shift) - lo[0])*stride[0] + ((t->first.z >> shift) - lo[2])*stride[2];
+			const bool column_solid = is_solid(t->first.x, t->first.y, t->first.z);
+			for(int h = (t->first.y >> shift) - lo[1] - 1; h >= 0; --h) {
+				const int index = column + h*stride[1];
+				if(present[index]) {
+					continue;
 				}
-				if(y > 0) {
-					if(is_solid(x, h-1, z) == false) {
-						add_face_bottom(xf,yf,zf,sy,t.second);
-					}
-				} else {
-					add_face_bottom(xf,yf,zf,sy,t.second);
+				present[index] = true;
+				solid[index] = column_solid;
+				for(int face = FRONT_FACE; face != MAX_FACES; ++face) {
+					colors[index*MAX_FACES + face] = get_face_color(face, t->second);
 				}
-				if(y < size_y() - 1) {
-					if(is_solid(x, h+1, z) == false) {
-						add_face_top(xf,yf,zf,sy,t.second);
+			}
+		}
+
+		const int cell = 1 << shift;
+		const int size[3] = { (size_x() + cell - 1) >> shift, (size_y() + cell - 1) >> shift, (size_z() + cell - 1) >> shift };
+		const GLfloat scale[3] = { GLfloat(scale_x()*cell), GLfloat(scale_y()*cell), GLfloat(scale_z()*cell) };
+
+		// axis each face is perpendicular to, and which way it faces along it.
+		static const int face_axis[MAX_FACES] = { 2, 0, 1, 2, 0, 1 };
+		static const int face_dir[MAX_FACES] = { 1, 1, 1, -1, -1, -1 };
+
+		std::vector<int> mask;
+		for(int face = FRONT_FACE; face != MAX_FACES; ++face) {
+			const int a = face_axis[face];
+			const int u = (a+1)%3;
+			const int v = (a+2)%3;
+			mask.resize(dim[u]*dim[v]);
+
+			for(int slice = 0; slice != dim[a]; ++slice) {
+				// mark the voxels in this slice whose face is exposed. As
+				// before, faces on the edge of the chunk are always drawn.
+				bool any = false;
+				for(int j = 0; j != dim[v]; ++j) {
+					for(int i = 0; i != dim[u]; ++i) {
+						const int index = slice*stride[a] + i*stride[u] + j*stride[v];
+						int& m = mask[i + j*dim[u]];
+						m = -1;
+						if(!present[index]) {
+							continue;
+						}
+
+						const int coord = lo[a] + slice;
+						const int neighbor = slice + face_dir[face];
+						if(face_dir[face] < 0 ? coord <= 0 : coord >= size[a] - 1) {
+							m = index;
+						} else if(neighbor < 0 || neighbor >= dim[a] || !solid[index + face_dir[face]*stride[a]]) {
+							m = index;
+						}
+						any = any || m != -1;
 					}
-				} else {
-					add_face_top(xf,yf,zf,sy,t.second);
 				}
-				if(z > 0) {
-					if(is_solid(x, h, z-1) == false) {
-						add_face_back(xf,yf,zf,sz,t.second);
-					}
-				} else {
-					add_face_back(xf,yf,zf,sz,t.second);
+
+				if(!any) {
+					continue;
 				}
-				if(z < size_z() - 1) {
-					if(is_solid(x, h, z+1) == false) {
-						add_face_front(xf,yf,zf,sz,t.second);
+
+				// merge runs of exposed faces of the same color into
+				// rectangles, first along u then along v.
+				for(int j = 0; j != dim[v]; ++j) {
+					for(int i = 0; i != dim[u]; ) {
+						const int index = mask[i + j*dim[u]];
+						if(index == -1) {
+							++i;
+							continue;
+						}
+
+						const graphics::color& color = colors[index*MAX_FACES + face];
+						int w = 1;
+						while(i + w < dim[u] && mask[i + w + j*dim[u]] != -1 && colors[mask[i + w + j*dim[u]]*MAX_FACES + face] == color) {
+							++w;
+						}
+
+						int h = 1;
+						for(; j + h < dim[v]; ++h) {
+							bool row_matches = true;
+							for(int k = 0; k != w && row_matches; ++k) {
+								const int other = mask[i + k + (j + h)*dim[u]];
+								row_matches = other != -1 && colors[other*MAX_FACES + face] == color;
+							}
+							if(!row_matches) {
+								break;
+							}
+						}
+
+						for(int y = 0; y != h; ++y) {
+							std::fill(mask.begin() + i + (j + y)*dim[u], mask.begin() + i + w + (j + y)*dim[u], -1);
+						}
+
+						int origin[3], extent[3];
+						origin[a] = lo[a] + slice;
+						origin[u] = lo[u] + i;
+						origin[v] = lo[v] + j;
+						extent[a] = 1;
+						extent[u] = w;
+						extent[v] = h;
+
+						add_box_face(face, origin[0]*scale[0], origin[1]*scale[1], origin[2]*scale[2],
+							extent[0]*scale[0], extent[1]*scale[1], extent[2]*scale[2], get_vertex_data()[face]);
+						add_carray_data(face, color, carray_[face]);
+
+						i += w;
 					}
-				} else {
-					add_face_front(xf,yf,zf,sz,t.second);
 				}
 			}
 		}
-		
-		add_vertex_vbo_data();
+	}
+
+	void chunk_colored::handle_upload()
+	{
+		cattrib_offsets_.clear();
+		cattrib_offsets_.resize(MAX_FACES);
 
 		size_t total_size = 0;
 		for(int n = FRONT_FACE; n != MAX_FACES; ++n) {
@@ -760,12 +938,11 @@ namespace voxel{
 		glBindBuffer(GL_ARRAY_BUFFER, vbo()[1]);
 		glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_STATIC_DRAW);
 		for(int n = FRONT_FACE; n != MAX_FACES; ++n) {
-			glBufferSubData(GL_ARRAY_BUFFER, cattrib_offsets_[n], carray_[n].size()*sizeof(uint8_t), &carray_[n][0]);
+			if(carray_[n].empty() == false) {
+				glBufferSubData(GL_ARRAY_BUFFER, cattrib_offsets_[n], carray_[n].size()*sizeof(uint8_t), &carray_[n][0]);
+			}
 		}
-		clear_vertex_data();
 		carray_.clear();
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
 	void chunk_textured::handle_build()
@@ -774,8 +951,6 @@ namespace voxel{
 
 		tarray_.clear();
 		tarray_.resize(MAX_FACES);
-		tattrib_offsets_.clear();
-		tattrib_offsets_.resize(MAX_FACES);
 
 		for(auto& t : tiles_) {
 			int x = t.first.x;
@@ -828,8 +1003,12 @@ namespace voxel{
 				add_face_front(xf,yf,zf,1,t.second);
 			}
 		}
-		
-		add_vertex_vbo_data();
+	}
+
+	void chunk_textured::handle_upload()
+	{
+		tattrib_offsets_.clear();
+		tattrib_offsets_.resize(MAX_FACES);
 
 		size_t total_size = 0;
 		for(int n = FRONT_FACE; n != MAX_FACES; ++n) {
@@ -839,12 +1018,11 @@ namespace voxel{
 		glBindBuffer(GL_ARRAY_BUFFER, vbo()[1]);
 		glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_STATIC_DRAW);
 		for(int n = FRONT_FACE; n != MAX_FACES; ++n) {
-			glBufferSubData(GL_ARRAY_BUFFER, tattrib_offsets_[n], tarray_[n].size()*sizeof(GLfloat), &tarray_[n][0]);
+			if(tarray_[n].empty() == false) {
+				glBufferSubData(GL_ARRAY_BUFFER, tattrib_offsets_[n], tarray_[n].size()*sizeof(GLfloat), &tarray_[n][0]);
+			}
 		}
-		clear_vertex_data();
 		tarray_.clear();
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
 	void chunk_colored::add_carray_data(int face, const graphics::color& color, std::vector<uint8_t>& carray)
@@ -918,90 +1096,6 @@ namespace voxel{
 		}
 	}
 
-	void chunk_colored::add_face_left(GLfloat x, GLfloat y, GLfloat z, GLfloat s, const variant& col)
-	{
-		add_vertex_data(LEFT_FACE, x, y, z, s, get_vertex_data()[LEFT_FACE]);
-		if(col.is_string()) {
-			auto it = get_colored_terrain_info().find(col.as_string());
-			if(it != get_colored_terrain_info().end()) {
-				const graphics::color color = it->second.faces & LEFT ? it->second.color[4] : it->second.color[0];
-				add_carray_data(LEFT_FACE, color, carray_[LEFT_FACE]);
-				return;
-			}
-		}
-		add_carray_data(LEFT_FACE, graphics::color(col), carray_[LEFT_FACE]);
-	}
-
-	void chunk_colored::add_face_right(GLfloat x, GLfloat y, GLfloat z, GLfloat s, const variant& col)
-	{
-		add_vertex_data(RIGHT_FACE, x, y, z, s, get_vertex_data()[RIGHT_FACE]);
-		if(col.is_string()) {
-			auto it = get_colored_terrain_info().find(col.as_string());
-			if(it != get_colored_terrain_info().end()) {
-				const graphics::color color = it->second.faces & RIGHT ? it->second.color[1] : it->second.color[0];
-				add_carray_data(RIGHT_FACE, color, carray_[RIGHT_FACE]);
-				return;
-			}
-		}
-		add_carray_data(RIGHT_FACE, graphics::color(col), carray_[RIGHT_FACE]);
-	}
-
-	void chunk_colored::add_face_front(GLfloat x, GLfloat y, GLfloat z, GLfloat s, const variant& col)
-	{
-		add_vertex_data(FRONT_FACE, x, y, z, s, get_vertex_data()[FRONT_FACE]);
-		if(col.is_string()) {
-			auto it = get_colored_terrain_info().find(col.as_string());
-			if(it != get_colored_terrain_info().end()) {
-				const graphics::color color = it->second.color[0];
-				add_carray_data(FRONT_FACE, color, carray_[FRONT_FACE]);
-				return;
-			}
-		}
-		add_carray_data(FRONT_FACE, graphics::color(col), carray_[FRONT_FACE]);
-	}
-
-	void chunk_colored::add_face_back(GLfloat x, GLfloat y, GLfloat z, GLfloat s, const variant& col)
-	{
-		add_vertex_data(BACK_FACE, x, y, z, s, get_vertex_data()[BACK_FACE]);
-		if(col.is_string()) {
-			auto it = get_colored_terrain_info().find(col.as_string());
-			if(it != get_colored_terrain_info().end()) {
-				const graphics::color color = it->second.faces & BACK ? it->second.color[3] : it->second.color[0];
-				add_carray_data(BACK_FACE, color, carray_[BACK_FACE]);
-				return;
-			}
-		}
-		add_carray_data(BACK_FACE, graphics::color(col), carray_[BACK_FACE]);
-	}
-
-	void chunk_colored::add_face_top(GLfloat x, GLfloat y, GLfloat z, GLfloat s, const variant& col)
-	{
-		add_vertex_data(TOP_FACE, x, y, z, s, get_vertex_data()[TOP_FACE]);
-		if(col.is_string()) {
-			auto it = get_colored_terrain_info().find(col.as_string());
-			if(it != get_colored_terrain_info().end()) {
-				const graphics::color color = it->second.faces & TOP ? it->second.color[2] : it->second.color[0];
-				add_carray_data(TOP_FACE, color, carray_[TOP_FACE]);
-				return;
-			}
-		}
-		add_carray_data(TOP_FACE, graphics::color(col), carray_[TOP_FACE]);
-	}
-
-	void chunk_colored::add_face_bottom(GLfloat x, GLfloat y, GLfloat z, GLfloat s, const variant& col)
-	{
-		add_vertex_data(BOTTOM_FACE, x, y, z, s, get_vertex_data()[BOTTOM_FACE]);
-		if(col.is_string()) {
-			auto it = get_colored_terrain_info().find(col.as_string());
-			if(it != get_colored_terrain_info().end()) {
-				const graphics::color color = it->second.faces & BOTTOM ? it->second.color[5] : it->second.color[0];
-				add_carray_data(BOTTOM_FACE, color, carray_[BOTTOM_FACE]);
-				return;
-			}
-		}
-		add_carray_data(BOTTOM_FACE, graphics::color(col), carray_[BOTTOM_FACE]);
-	}
-
 	void chunk_textured::add_face_left(GLfloat x, GLfloat y, GLfloat z, GLfloat s, const std::string& bid)
 	{
 		add_vertex_data(LEFT_FACE, x, y, z, s, get_vertex_data()[LEFT_FACE]);
@@ -1243,13 +1337,36 @@ namespace voxel{
 	
 	namespace chunk_factory 
 	{
-		chunk_ptr create(gles2::program_ptr shader, logical_world_ptr logic, const variant& v)
+		namespace
 		{
-			if(v.is_callable()) {
-				chunk_ptr c = v.try_convert<chunk>();
-				ASSERT_LOG(c != NULL, "Error converting chunk from callable.");
-				return c;
+			int num_build_threads()
+			{
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+				return std::max(1, std::min(8, SDL_GetCPUCount()));
+#else
+				return 2;
+#endif
 			}
+
+			// builds every nstep'th chunk starting at first. Only raw pointers
+			// are used here, since intrusive_ptr reference counts aren't
+			// thread safe.
+			void build_chunk_geometry(const std::vector<chunk*>* chunks, std::vector<int>* build_ms, int first, int nstep, std::string* error)
+			{
+				try {
+					for(int n = first; n < chunks->size(); n += nstep) {
+						const int start = SDL_GetTicks();
+						(*chunks)[n]->build_geometry();
+						(*build_ms)[n] = SDL_GetTicks() - start;
+					}
+				} catch(validation_failure_exception& e) {
+					*error = e.msg;
+				}
+			}
+		}
+
+		chunk_ptr create_unbuilt(gles2::program_ptr shader, logical_world_ptr logic, const variant& v)
+		{
 			ASSERT_LOG(v.has_key("type"), "No 'type' attribute found in definition.");
 			const std::string& type = v["type"].as_string();
 			if(type == "textured") {
@@ -1261,6 +1378,83 @@ namespace voxel{
 			}
 			return chunk_ptr();
 		}
+
+		chunk_ptr create(gles2::program_ptr shader, logical_world_ptr logic, const variant& v)
+		{
+			if(v.is_callable()) {
+				chunk_ptr c = v.try_convert<chunk>();
+				ASSERT_LOG(c != NULL, "Error converting chunk from callable.");
+				return c;
+			}
+			chunk_ptr c = create_unbuilt(shader, logic, v);
+			if(c) {
+				c->build();
+			}
+			return c;
+		}
+
+		std::vector<chunk_ptr> create_list(gles2::program_ptr shader, logical_world_ptr logic, const std::vector<variant>& nodes)
+		{
+			std::vector<chunk_ptr> res;
+			std::vector<chunk*> unbuilt;
+			foreach(const variant& v, nodes) {
+				if(v.is_callable()) {
+					res.push_back(create(shader, logic, v));
+					continue;
+				}
+				res.push_back(create_unbuilt(shader, logic, v));
+				if(res.back()) {
+					unbuilt.push_back(res.back().get());
+				}
+			}
+
+			if(unbuilt.empty()) {
+				return res;
+			}
+
+			// tiles may name colors, whose table is filled on first use; fill
+			// it now rather than from several workers at once.
+			graphics::get_color_from_name("black");
+
+			const int start = SDL_GetTicks();
+			const int nthreads = std::min<int>(num_build_threads(), unbuilt.size());
+			std::vector<int> build_ms(unbuilt.size());
+			std::vector<std::string> errors(nthreads);
+			{
+				std::vector<boost::shared_ptr<threading::thread> > threads;
+				for(int n = 1; n < nthreads; ++n) {
+					boost::function<void()> fn = boost::bind(build_chunk_geometry, &unbuilt, &build_ms, n, nthreads, &errors[n]);
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+					threads.push_back(boost::shared_ptr<threading::thread>(new threading::thread("build_chunks", fn)));
+#else
+					threads.push_back(boost::shared_ptr<threading::thread>(new threading::thread(fn)));
+#endif
+				}
+
+				build_chunk_geometry(&unbuilt, &build_ms, 0, nthreads, &errors[0]);
+				foreach(boost::shared_ptr<threading::thread>& t, threads) {
+					t->join();
+				}
+			}
+
+			foreach(const std::string& error, errors) {
+				ASSERT_LOG(error.empty(), error);
+			}
+
+			const int built = SDL_GetTicks();
+			int triangles = 0, max_triangles = 0, max_ms = 0;
+			for(int n = 0; n != unbuilt.size(); ++n) {
+				unbuilt[n]->upload_geometry();
+				triangles += unbuilt[n]->num_triangles();
+				max_triangles = std::max(max_triangles, unbuilt[n]->num_triangles());
+				max_ms = std::max(max_ms, build_ms[n]);
+			}
+
+			std::cerr << "Built " << unbuilt.size() << " voxel chunks on " << nthreads << " threads in " << (built - start) << "ms"
+				<< " (slowest chunk " << max_ms << "ms), uploaded in " << (SDL_GetTicks() - built) << "ms; "
+				<< triangles << " triangles, " << (triangles/int(unbuilt.size())) << " per chunk on average, " << max_triangles << " at most" << std::endl;
+			return res;
+		}
 	}
 }
 
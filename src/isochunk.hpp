@@ -69,6 +69,12 @@ namespace voxel
 		
 		void init();
 		void build();
+		// generates the chunk's triangles without touching GL, so it may be
+		// run on a worker thread; upload_geometry() must then be called on
+		// the main thread before the chunk is drawn.
+		void build_geometry();
+		void upload_geometry();
+		int num_triangles() const;
 		void draw(const graphics::lighting_ptr lighting, const camera_callable_ptr& camera) const;
 		variant write();
 
@@ -89,6 +95,10 @@ namespace voxel
 		size_t scale_y() const { return scale_y_; }
 		size_t scale_z() const { return scale_z_; }
 
+		// level of detail the chunk is meshed at; each level halves the
+		// resolution. Only colored chunks have coarser meshes.
+		int lod() const { return lod_; }
+
 		static const std::vector<textured_tile_editor_info>& get_textured_editor_tiles();
 		static const std::vector<colored_tile_editor_info>& get_colored_editor_tiles();
 	protected:
@@ -103,12 +113,14 @@ namespace voxel
 		};
 
 		virtual void handle_build() = 0;
+		virtual void handle_upload() = 0;
 		virtual void handle_draw(const graphics::lighting_ptr lighting, const camera_callable_ptr& camera) const = 0;
 		virtual void handle_set_tile(int x, int y, int z, const variant& type) = 0;
 		virtual void handle_del_tile(int x, int y, int z) = 0;
 		virtual variant handle_write() = 0;
 
 		void add_vertex_data(int face, GLfloat x, GLfloat y, GLfloat z, GLfloat size, std::vector<GLfloat>& varray);
+		void add_box_face(int face, GLfloat x, GLfloat y, GLfloat z, GLfloat sx, GLfloat sy, GLfloat sz, std::vector<GLfloat>& varray);
 		std::vector<std::vector<GLfloat> >& get_vertex_data() { return varray_; }
 		void add_vertex_vbo_data();
 		void clear_vertex_data() { varray_.clear(); }
@@ -151,6 +163,8 @@ namespace voxel
 		std::vector<glm::vec3> normals_;
 
 		glm::vec3 worldspace_position_;
+
+		int lod_;
 	};
 
 	class chunk_colored : public chunk
@@ -163,17 +177,13 @@ namespace voxel
 		variant get_tile_type(int x, int y, int z) const;
 	protected:
 		void handle_build();
+		void handle_upload();
 		void handle_draw(const graphics::lighting_ptr lighting, const camera_callable_ptr& camera) const;
 		variant handle_write();
 		void handle_set_tile(int x, int y, int z, const variant& type);
 		void handle_del_tile(int x, int y, int z);
 	private:
-		void add_face_left(GLfloat x, GLfloat y, GLfloat z, GLfloat size, const variant& col);
-		void add_face_right(GLfloat x, GLfloat y, GLfloat z, GLfloat size, const variant& col);
-		void add_face_front(GLfloat x, GLfloat y, GLfloat z, GLfloat size, const variant& col);
-		void add_face_back(GLfloat x, GLfloat y, GLfloat z, GLfloat size, const variant& col);
-		void add_face_top(GLfloat x, GLfloat y, GLfloat z, GLfloat size, const variant& col);
-		void add_face_bottom(GLfloat x, GLfloat y, GLfloat z, GLfloat size, const variant& col);
+		void generate_random();
 
 		void add_carray_data(int face, const graphics::color& color, std::vector<uint8_t>& carray);
 
@@ -181,6 +191,14 @@ namespace voxel
 		std::vector<size_t> cattrib_offsets_;
 		boost::unordered_map<position, variant> tiles_;
 
+		// random terrain is generated by build_geometry() rather than in the
+		// constructor, so that it can be done on a worker thread.
+		bool random_pending_;
+		int noise_height_;
+		float x_smoothness_;
+		float z_smoothness_;
+		variant random_color_;
+
 		GLuint a_color_;
 	};
 
@@ -194,6 +212,7 @@ namespace voxel
 		variant get_tile_type(int x, int y, int z) const;
 	protected:
 		void handle_build();
+		void handle_upload();
 		void handle_draw(const graphics::lighting_ptr lighting, const camera_callable_ptr& camera) const;
 		variant handle_write();
 		void handle_set_tile(int x, int y, int z, const variant& type);
@@ -222,6 +241,12 @@ namespace voxel
 	namespace chunk_factory 
 	{
 		chunk_ptr create(gles2::program_ptr shader, logical_world_ptr logic, const variant& v);
+		// creates a chunk without building it; build_geometry() and then
+		// upload_geometry() must be called before it is drawn.
+		chunk_ptr create_unbuilt(gles2::program_ptr shader, logical_world_ptr logic, const variant& v);
+		// creates a chunk for each definition, generating and meshing them
+		// on worker threads, then filling their buffers on this thread.
+		std::vector<chunk_ptr> create_list(gles2::program_ptr shader, logical_world_ptr logic, const std::vector<variant>& nodes);
 	}
 }
 
@@ -1,5 +1,7 @@
 #if defined(USE_ISOMAP)
 
+#include <boost/bind.hpp>
+
 #if defined(_MSC_VER)
 #include <boost/math/special_functions/round.hpp>
 #define bmround	boost::math::round
@@ -9,9 +11,13 @@
 
 #include <vector>
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
+#include "gl_state.hpp"
 #include "isoworld.hpp"
 #include "level.hpp"
+#include "preferences.hpp"
 #include "profile_timer.hpp"
+#include "unit_test.hpp"
 #include "user_voxel_object.hpp"
 #include "variant_utils.hpp"
 #include "voxel_object.hpp"
@@ -20,10 +26,196 @@
 namespace voxel
 {
 	const int chunk_size = 32;
-	const int initial_chunks = 16;
+	// chunks stacked vertically in an infinite world.
+	const int infinite_layers = 4;
 
 	const int default_view_distance = 5;
 
+	namespace
+	{
+		// number of rings of chunks around the camera meshed at each level of
+		// detail before dropping to the next, coarser, one. 0 turns LOD off.
+		PREF_INT(voxel_lod_distance, 2);
+
+		// most chunks of an infinite world that may be building in the
+		// background at once.
+		PREF_INT(voxel_chunk_builds, 4);
+
+		const int max_chunk_lod = 2;
+
+		int chunk_lod(int ring)
+		{
+			if(g_voxel_lod_distance <= 0) {
+				return 0;
+			}
+			return std::min(max_chunk_lod, ring/g_voxel_lod_distance);
+		}
+
+		int floor_div(int a, int b)
+		{
+			return a >= 0 ? a/b : -((-a + b - 1)/b);
+		}
+	}
+
+	chunk_octree::chunk_octree(int leaf_size) : leaf_size_(leaf_size)
+	{
+	}
+
+	bool chunk_octree::contains(const node& n, const position& p) const
+	{
+		return p.x >= n.origin.x && p.x < n.origin.x + n.size
+			&& p.y >= n.origin.y && p.y < n.origin.y + n.size
+			&& p.z >= n.origin.z && p.z < n.origin.z + n.size;
+	}
+
+	int chunk_octree::child_index(const node& n, const position& p) const
+	{
+		const int half = n.size/2;
+		return (p.x >= n.origin.x + half ? 1 : 0) | (p.y >= n.origin.y + half ? 2 : 0) | (p.z >= n.origin.z + half ? 4 : 0);
+	}
+
+	void chunk_octree::insert(const position& p, const chunk_ptr& c)
+	{
+		if(!root_) {
+			root_.reset(new node(glm::ivec3(floor_div(p.x, leaf_size_), floor_div(p.y, leaf_size_), floor_div(p.z, leaf_size_)) * leaf_size_, leaf_size_));
+		}
+
+		// grow the root towards the point until it's covered, keeping the old
+		// root as one of the new root's children.
+		while(!contains(*root_, p)) {
+			glm::ivec3 origin = root_->origin;
+			if(p.x < origin.x) { origin.x -= root_->size; }
+			if(p.y < origin.y) { origin.y -= root_->size; }
+			if(p.z < origin.z) { origin.z -= root_->size; }
+			node_ptr parent(new node(origin, root_->size*2));
+			parent->count = root_->count;
+			const position old_origin(root_->origin.x, root_->origin.y, root_->origin.z);
+			parent->children[child_index(*parent, old_origin)] = root_;
+			root_ = parent;
+		}
+
+		std::vector<node*> path;
+		node* n = root_.get();
+		while(n->size > leaf_size_) {
+			path.push_back(n);
+			node_ptr& child = n->children[child_index(*n, p)];
+			if(!child) {
+				const int half = n->size/2;
+				const int index = child_index(*n, p);
+				child.reset(new node(n->origin + glm::ivec3(index & 1 ? half : 0, index & 2 ? half : 0, index & 4 ? half : 0), half));
+			}
+			n = child.get();
+		}
+
+		for(auto& entry : n->chunks) {
+			if(entry.first == p) {
+				entry.second = c;
+				return;
+			}
+		}
+
+		n->chunks.push_back(std::make_pair(p, c));
+		++n->count;
+		foreach(node* parent, path) {
+			++parent->count;
+		}
+	}
+
+	bool chunk_octree::erase(node& n, const position& p)
+	{
+		if(n.size <= leaf_size_) {
+			for(auto it = n.chunks.begin(); it != n.chunks.end(); ++it) {
+				if(it->first == p) {
+					n.chunks.erase(it);
+					--n.count;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		node_ptr& child = n.children[child_index(n, p)];
+		if(!child || !erase(*child, p)) {
+			return false;
+		}
+
+		if(child->count == 0) {
+			child.reset();
+		}
+		--n.count;
+		return true;
+	}
+
+	void chunk_octree::erase(const position& p)
+	{
+		if(!root_ || !contains(*root_, p) || !erase(*root_, p)) {
+			return;
+		}
+
+		if(root_->count == 0) {
+			root_.reset();
+			return;
+		}
+
+		// shrink the root while all its chunks are under one child.
+		while(root_->size > leaf_size_) {
+			node_ptr only;
+			int nchildren = 0;
+			for(int n = 0; n != 8; ++n) {
+				if(root_->children[n]) {
+					only = root_->children[n];
+					++nchildren;
+				}
+			}
+			if(nchildren != 1) {
+				break;
+			}
+			root_ = only;
+		}
+	}
+
+	void chunk_octree::clear()
+	{
+		root_.reset();
+	}
+
+	int chunk_octree::size() const
+	{
+		return root_ ? root_->count : 0;
+	}
+
+	void chunk_octree::get_visible(const graphics::frustum& frustum, std::vector<chunk_ptr>& res) const
+	{
+		if(root_) {
+			get_visible(*root_, frustum, res);
+		}
+	}
+
+	void chunk_octree::get_visible(const node& n, const graphics::frustum& frustum, std::vector<chunk_ptr>& res) const
+	{
+		// chunks reach up to leaf_size_ past their origins, so the box tested
+		// for a node is that much larger than the origins it holds.
+		const float extent = float(n.size + leaf_size_);
+		if(!frustum.cube_inside(glm::vec3(n.origin), extent, extent, extent)) {
+			return;
+		}
+
+		if(n.size <= leaf_size_) {
+			for(auto& entry : n.chunks) {
+				if(frustum.cube_inside(glm::vec3(entry.first.x, entry.first.y, entry.first.z), float(leaf_size_), float(leaf_size_), float(leaf_size_))) {
+					res.push_back(entry.second);
+				}
+			}
+			return;
+		}
+
+		for(int i = 0; i != 8; ++i) {
+			if(n.children[i]) {
+				get_visible(*n.children[i], frustum, res);
+			}
+		}
+	}
+
 	logical_world::logical_world(const variant& node)
 		:size_x_(0), size_y_(0), size_z_(0), 
 		scale_x_(node["scale_x"].as_int(1)), scale_y_(node["scale_y"].as_int(1)), scale_z_(node["scale_z"].as_int(1)),
@@ -90,7 +282,8 @@ namespace voxel
 
 	world::world(const variant& node)
 		: view_distance_(node["view_distance"].as_int(default_view_distance)), 
-		seed_(node["seed"].as_int(0))
+		seed_(node["seed"].as_int(0)), octree_(chunk_size), infinite_(false),
+		x_smoothness_(0), z_smoothness_(0), chunk_builds_running_(0), self_(new world*(this))
 	{
 		ASSERT_LOG(node.has_key("shader"), "Must have 'shader' attribute");
 		ASSERT_LOG(node["shader"].is_string(), "'shader' attribute must be a string");
@@ -179,64 +372,185 @@ namespace voxel
 
 	void world::build_fixed(const variant& node)
 	{
+		std::vector<variant> nodes;
+		for(int n = 0; n != node.num_elements(); ++n) {
+			nodes.push_back(node[n]);
+		}
+
+		const std::vector<chunk_ptr> chunks = voxel::chunk_factory::create_list(shader_, logic_, nodes);
 		for(int n = 0; n != node.num_elements(); ++n) {
-			chunk_ptr cp = voxel::chunk_factory::create(shader_, logic_, node[n]);
+			chunk_ptr cp = chunks[n];
 			int wpx = node[n]["worldspace_position"][0].as_int() * logic_->scale_x();
 			int wpy = node[n]["worldspace_position"][1].as_int() * logic_->scale_y();
 			int wpz = node[n]["worldspace_position"][2].as_int() * logic_->scale_z();
 			chunks_[position(wpx,wpy,wpz)] = cp;
+			octree_.insert(position(wpx,wpy,wpz), cp);
 		}
 	}
 
+	variant world::make_chunk_node(const glm::ivec3& worldspace_pos, int lod) const
+	{
+		std::map<variant,variant> m;
+		variant_builder rnd;
+
+		rnd.add("width", chunk_size);
+		rnd.add("height", chunk_size);
+		rnd.add("depth", chunk_size);
+		//rnd.add("noise_height", rand() % chunk_size*2);
+		rnd.add("noise_height", 128);
+		rnd.add("type", graphics::color("medium_sea_green").write());
+		rnd.add("seed", seed_);
+		rnd.add("x_smoothness", x_smoothness_);		// 32 is very spiky, 512 is very flat
+		rnd.add("z_smoothness", z_smoothness_);
+
+		m[variant("type")] = variant("colored");
+		m[variant("shader")] = variant(shader_->name());
+		std::vector<variant> v;
+		v.push_back(variant(worldspace_pos.x));
+		v.push_back(variant(worldspace_pos.y));
+		v.push_back(variant(worldspace_pos.z));
+		m[variant("worldspace_position")] = variant(&v);
+		m[variant("random")] = rnd.build();
+		if(lod > 0) {
+			m[variant("lod")] = variant(lod);
+		}
+		return variant(&m);
+	}
+
 	void world::build_infinite()
 	{
 		profile::manager pman("Built voxel::world in");
 
-		int x_smoothness = rand() % 480 + 32;
-		int z_smoothness = rand() % 480 + 32;
-
-		// Generates initial chunks
-		for(int x = 0; x != initial_chunks; ++x) {
-			for(int y = 0; y != 4; y++) {
-				for(int z = 0; z != initial_chunks; ++z) {
-					std::cerr << "Generating chunk: " << x << "," << y << "," << z << std::endl;
-					std::map<variant,variant> m;
-					variant_builder rnd;
-
-					glm::ivec3 worldspace_pos(x * chunk_size, y * chunk_size, z * chunk_size);
-				
-					rnd.add("width", chunk_size);
-					rnd.add("height", chunk_size);
-					rnd.add("depth", chunk_size);
-					//rnd.add("noise_height", rand() % chunk_size*2);
-					rnd.add("noise_height", 128);
-					rnd.add("type", graphics::color("medium_sea_green").write());
-					rnd.add("seed", seed_);
-					rnd.add("x_smoothness", x_smoothness);		// 32 is very spiky, 512 is very flat
-					rnd.add("z_smoothness", z_smoothness);
-
-					m[variant("type")] = variant("colored");
-					m[variant("shader")] = variant(shader_->name());
-					std::vector<variant> v;
-					v.push_back(variant(worldspace_pos.x));
-					v.push_back(variant(worldspace_pos.y));
-					v.push_back(variant(worldspace_pos.z));
-					m[variant("worldspace_position")] = variant(&v);
-					m[variant("random")] = rnd.build();
-
-					chunk_ptr cp = voxel::chunk_factory::create(shader_, logical_world_ptr(), variant(&m));
-					chunks_[position(worldspace_pos.x,worldspace_pos.y,worldspace_pos.z)] = cp;
-					active_chunks_.push_back(cp);
+		infinite_ = true;
+		x_smoothness_ = rand() % 480 + 32;
+		z_smoothness_ = rand() % 480 + 32;
+
+		// Generates the chunks in view of the origin; the rest are streamed
+		// in around the camera as it moves.
+		std::vector<variant> nodes;
+		std::vector<glm::ivec3> positions;
+		for(int x = -view_distance_; x <= view_distance_; ++x) {
+			for(int z = -view_distance_; z <= view_distance_; ++z) {
+				const int lod = chunk_lod(std::max(abs(x), abs(z)));
+				for(int y = 0; y != infinite_layers; ++y) {
+					positions.push_back(glm::ivec3(x * chunk_size, y * chunk_size, z * chunk_size));
+					nodes.push_back(make_chunk_node(positions.back(), lod));
 				}
 			}
 		}
+
+		const std::vector<chunk_ptr> chunks = voxel::chunk_factory::create_list(shader_, logical_world_ptr(), nodes);
+		for(int n = 0; n != chunks.size(); ++n) {
+			const position p(positions[n].x, positions[n].y, positions[n].z);
+			chunks_[p] = chunks[n];
+			octree_.insert(p, chunks[n]);
+			active_chunks_.push_back(chunks[n]);
+		}
 		//get_active_chunks();
 	}
 
+	void world::stream_chunks()
+	{
+		const glm::vec3& camera_pos = level::current().camera()->position();
+		const int cx = floor_div(int(floor(camera_pos.x)), chunk_size);
+		const int cz = floor_div(int(floor(camera_pos.z)), chunk_size);
+
+		// rings are counted in chunks, as the larger of the x and z distance
+		// from the camera's chunk. Chunks are kept until they're a ring past
+		// the view distance, so those on the edge aren't dropped and loaded
+		// again as the camera moves back and forth.
+		for(auto it = chunks_.begin(); it != chunks_.end(); ) {
+			const int ring = std::max(abs(it->first.x/chunk_size - cx), abs(it->first.z/chunk_size - cz));
+			if(ring > view_distance_ + 1) {
+				octree_.erase(it->first);
+				building_chunks_.erase(it->first);
+				it = chunks_.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		for(auto it = building_chunks_.begin(); it != building_chunks_.end(); ) {
+			const int ring = std::max(abs(it->first.x/chunk_size - cx), abs(it->first.z/chunk_size - cz));
+			if(ring > view_distance_ + 1) {
+				it = building_chunks_.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		// load missing chunks, and rebuild those at the wrong level of
+		// detail, nearest first.
+		for(int ring = 0; ring <= view_distance_; ++ring) {
+			const int lod = chunk_lod(ring);
+			for(int x = cx - ring; x <= cx + ring; ++x) {
+				for(int z = cz - ring; z <= cz + ring; ++z) {
+					if(std::max(abs(x - cx), abs(z - cz)) != ring) {
+						continue;
+					}
+
+					for(int y = 0; y != infinite_layers; ++y) {
+						const position p(x * chunk_size, y * chunk_size, z * chunk_size);
+						if(building_chunks_.count(p)) {
+							continue;
+						}
+
+						auto it = chunks_.find(p);
+						if(it != chunks_.end() && it->second->lod() == lod) {
+							continue;
+						}
+
+						if(chunk_builds_running_ >= g_voxel_chunk_builds) {
+							return;
+						}
+
+						start_chunk_build(p, lod);
+					}
+				}
+			}
+		}
+	}
+
+	void world::start_chunk_build(const position& p, int lod)
+	{
+		chunk_ptr c = voxel::chunk_factory::create_unbuilt(shader_, logical_world_ptr(), make_chunk_node(glm::ivec3(p.x, p.y, p.z), lod));
+		building_chunks_[p] = c;
+		++chunk_builds_running_;
+
+		// the job only gets a plain pointer, as intrusive_ptr's reference
+		// count isn't thread safe. The completion handler keeps the chunk
+		// alive until then.
+		background_task_pool::submit(boost::bind(&chunk::build_geometry, c.get()), boost::bind(&world::on_chunk_built, boost::weak_ptr<world*>(self_), p, c));
+	}
+
+	void world::on_chunk_built(boost::weak_ptr<world*> w, position p, chunk_ptr c)
+	{
+		boost::shared_ptr<world*> self = w.lock();
+		if(self) {
+			(*self)->finish_chunk_build(p, c);
+		}
+	}
+
+	void world::finish_chunk_build(const position& p, chunk_ptr c)
+	{
+		--chunk_builds_running_;
+
+		auto it = building_chunks_.find(p);
+		if(it == building_chunks_.end() || it->second != c) {
+			// the chunk went out of range while it was being built.
+			return;
+		}
+
+		building_chunks_.erase(it);
+		c->upload_geometry();
+		chunks_[p] = c;
+		octree_.insert(p, c);
+	}
+
 	void world::draw(const camera_callable_ptr& camera) const
 	{
 		//profile::manager pman("world::draw");
-		glUseProgram(shader_->get());
+		gl_state::use_program(shader_->get());
 		glClear(GL_DEPTH_BUFFER_BIT);
 
 		// skybox should be drawn last
@@ -305,6 +619,9 @@ namespace voxel
 
 	void world::process()
 	{
+		if(infinite_) {
+			stream_chunks();
+		}
 		get_active_chunks();
 		for(auto obj : objects_) {
 			obj->process(level::current());
@@ -316,11 +633,7 @@ namespace voxel
 		//profile::manager pman("get_active_chunks");
 		const graphics::frustum& frustum = level::current().camera()->frustum();
 		active_chunks_.clear();
-		for(auto chnk : chunks_) {
-			if(frustum.cube_inside(glm::vec3(chnk.first.x, chnk.first.y, chnk.first.z), float(chunk_size),float(chunk_size), float(chunk_size))) {
-				active_chunks_.push_back(chnk.second);
-			}
-		}
+		octree_.get_visible(frustum, active_chunks_);
 	}
 
 	REGISTER_SERIALIZABLE_CALLABLE(logical_world, "@logical_world");
@@ -565,4 +878,22 @@ namespace voxel
 	END_DEFINE_CALLABLE(world)
 }
 
+UNIT_TEST(chunk_octree)
+{
+	voxel::chunk_octree tree(32);
+	tree.insert(voxel::position(0, 0, 0), voxel::chunk_ptr());
+	tree.insert(voxel::position(-64, 32, 256), voxel::chunk_ptr());
+	tree.insert(voxel::position(96, 0, -32), voxel::chunk_ptr());
+	tree.insert(voxel::position(96, 0, -32), voxel::chunk_ptr());
+	CHECK_EQ(tree.size(), 3);
+
+	tree.erase(voxel::position(-64, 32, 256));
+	tree.erase(voxel::position(32, 0, 0));
+	CHECK_EQ(tree.size(), 2);
+
+	tree.erase(voxel::position(0, 0, 0));
+	tree.erase(voxel::position(96, 0, -32));
+	CHECK_EQ(tree.size(), 0);
+}
+
 #endif
@@ -6,7 +6,9 @@
 #endif
 
 #include <boost/intrusive_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/weak_ptr.hpp>
 
 #include <vector>
 #include <set>
@@ -16,6 +18,7 @@
 #include "draw_primitive.hpp"
 #include "formula_callable.hpp"
 #include "formula_callable_definition.hpp"
+#include "frustum.hpp"
 #include "geometry.hpp"
 #include "graphics.hpp"
 #include "isochunk.hpp"
@@ -78,6 +81,43 @@ namespace voxel
 
 	typedef boost::intrusive_ptr<logical_world> logical_world_ptr;
 
+	// an octree over the origins of a world's chunks, so that finding the
+	// chunks in the view frustum only tests the parts of the world near it.
+	// The root grows to take in new chunks and shrinks as they're removed,
+	// so it only ever covers the chunks currently loaded.
+	class chunk_octree
+	{
+	public:
+		explicit chunk_octree(int leaf_size);
+
+		void insert(const position& p, const chunk_ptr& c);
+		void erase(const position& p);
+		void clear();
+
+		void get_visible(const graphics::frustum& frustum, std::vector<chunk_ptr>& res) const;
+		int size() const;
+	private:
+		struct node
+		{
+			node(const glm::ivec3& o, int s) : origin(o), size(s), count(0) {}
+			glm::ivec3 origin;
+			int size;
+			int count;
+			boost::shared_ptr<node> children[8];
+			// only leaves hold chunks.
+			std::vector<std::pair<position, chunk_ptr> > chunks;
+		};
+		typedef boost::shared_ptr<node> node_ptr;
+
+		bool contains(const node& n, const position& p) const;
+		int child_index(const node& n, const position& p) const;
+		bool erase(node& n, const position& p);
+		void get_visible(const node& n, const graphics::frustum& frustum, std::vector<chunk_ptr>& res) const;
+
+		int leaf_size_;
+		node_ptr root_;
+	};
+
 	class world : public game_logic::formula_callable
 	{
 	public:
@@ -116,6 +156,24 @@ namespace voxel
 
 		std::vector<chunk_ptr> active_chunks_;
 		boost::unordered_map<position, chunk_ptr> chunks_;
+		chunk_octree octree_;
+
+		// infinite worlds load chunks in rings around the camera as it moves
+		// and unload those that fall out of range. Chunks are built in the
+		// background and swapped in when ready; a chunk whose level of detail
+		// should change is rebuilt the same way.
+		bool infinite_;
+		int x_smoothness_;
+		int z_smoothness_;
+		boost::unordered_map<position, chunk_ptr> building_chunks_;
+		int chunk_builds_running_;
+		boost::shared_ptr<world*> self_;
+
+		variant make_chunk_node(const glm::ivec3& worldspace_pos, int lod) const;
+		void stream_chunks();
+		void start_chunk_build(const position& p, int lod);
+		void finish_chunk_build(const position& p, chunk_ptr c);
+		static void on_chunk_built(boost::weak_ptr<world*> w, position p, chunk_ptr c);
 
 		std::set<user_voxel_object_ptr> objects_;
 
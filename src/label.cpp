@@ -165,11 +165,13 @@ void label::reformat_text()
 
 void label::recalculate_texture()
 {
-	texture_ = font::render_text(current_text(), color_, size_, font_);
-	inner_set_dim(texture_.width(),texture_.height());
+	text_layout_ = font::text_layout(current_text(), color_, size_, font_);
+	inner_set_dim(text_layout_.width(),text_layout_.height());
 
 	if(border_color_.get()) {
-		border_texture_ = font::render_text(current_text(), *border_color_, size_, font_);
+		border_layout_ = font::text_layout(current_text(), *border_color_, size_, font_);
+	} else {
+		border_layout_ = font::text_layout();
 	}
 }
 
@@ -184,17 +186,17 @@ void label::handle_draw() const
 #endif
 	}
 
-	if(border_texture_.valid()) {
-		graphics::blit_texture(border_texture_, x() - border_size_, y());
-		graphics::blit_texture(border_texture_, x() + border_size_, y());
-		graphics::blit_texture(border_texture_, x(), y() - border_size_);
-		graphics::blit_texture(border_texture_, x(), y() + border_size_);
+	if(!border_layout_.empty()) {
+		border_layout_.draw(x() - border_size_, y());
+		border_layout_.draw(x() + border_size_, y());
+		border_layout_.draw(x(), y() - border_size_);
+		border_layout_.draw(x(), y() + border_size_);
 	}
-	graphics::blit_texture(texture_, x(), y());
+	text_layout_.draw(x(), y());
 }
 
-void label::set_texture(graphics::texture t) {
-	texture_ = t;
+void label::set_text_layout(const font::text_layout& t) {
+	text_layout_ = t;
 }
 
 bool label::in_label(int xloc, int yloc) const
@@ -380,9 +382,9 @@ void dialog_label::recalculate_texture()
 	std::string txt = current_text().substr(0, prog);
 
 	if(prog > 0) {
-		set_texture(font::render_text(txt, color(), size(), font()));
+		set_text_layout(font::text_layout(txt, color(), size(), font()));
 	} else {
-		set_texture(graphics::texture());
+		set_text_layout(font::text_layout());
 	}
 }
 
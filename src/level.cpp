@@ -15,6 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <boost/bind.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <algorithm>
 #include <iostream>
@@ -32,6 +33,7 @@
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "formula_profiler.hpp"
+#include "gl_state.hpp"
 #include "gui_formula_functions.hpp"
 #include "hex_map.hpp"
 #include "hex_object.hpp"
@@ -140,6 +142,9 @@ void level::set_as_current_level()
 	current_level = this;
 	frame::set_color_palette(palettes_used_);
 
+	//objects only report handler changes to the current level.
+	invalidate_event_subscribers();
+
 #if SDL_VERSION_ATLEAST(2, 0, 0)
 	if(false && preferences::auto_size_window()) {
 		static bool auto_sized = false;
@@ -210,6 +215,7 @@ level::level(const std::string& level_cfg, variant node)
 	  num_compiled_tiles_(0),
 	  entered_portal_active_(false), save_point_x_(-1), save_point_y_(-1),
 	  editor_(false), show_foreground_(true), show_background_(true), dark_(false), dark_color_(graphics::color_transform(0, 0, 0, 255)), air_resistance_(0), water_resistance_(7), end_game_(false),
+	  nrollbacks_(0), nrollback_cycles_(0),
       editor_tile_updates_frozen_(0), editor_dragging_objects_(false),
 	  zoom_level_(decimal::from_int(1)),
 	  palettes_used_(0),
@@ -218,7 +224,8 @@ level::level(const std::string& level_cfg, variant node)
 #if defined(USE_ISOMAP)
 	  mouselook_enabled_(false), mouselook_inverted_(false),
 #endif
-	  allow_touch_controls_(true)
+	  allow_touch_controls_(true),
+	  rebuild_activation_(true)
 {
 #ifndef NO_EDITOR
 	get_all_levels_set().insert(this);
@@ -565,6 +572,13 @@ level::~level()
 	if(before_pause_controls_backup_) {
 		before_pause_controls_backup_->cancel();
 	}
+
+	//objects may outlive the level, and mustn't try to wake in it.
+	for(std::map<std::pair<int, int>, std::vector<entity_ptr> >::iterator i = activation_grid_.begin(); i != activation_grid_.end(); ++i) {
+		foreach(const entity_ptr& e, i->second) {
+			e->set_dormant(NULL);
+		}
+	}
 }
 
 void level::read_compiled_tiles(variant node, std::vector<level_tile>::iterator& out)
@@ -613,6 +627,7 @@ void level::read_compiled_tiles(variant node, std::vector<level_tile>::iterator&
 void level::load_character(variant c)
 {
 	chars_.push_back(entity::build(c));
+	chars_changed();
 	custom_object* co = dynamic_cast<custom_object*>(chars_.back().get());
 	if(co) {
 		co->validate_properties();
@@ -2047,7 +2062,7 @@ void level::draw(int x, int y, int w, int h) const
 		// XX hackity hack
 		gles2::shader_program_ptr active = gles2::active_shader();
 		iso_world_->draw(camera_);
-		glUseProgram(active->shader()->get());
+		gl_state::use_program(active->shader()->get());
 	}
 #endif
 
@@ -2167,12 +2182,12 @@ void level::draw(int x, int y, int w, int h) const
 			if(!obj->allow_level_collisions() && entity_collides_with_level(*this, *obj, MOVE_NONE)) {
 				//if the entity is colliding with the level, then draw
 				//it in red to mark as 'bad'.
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+				gl_state::blend_func(GL_SRC_ALPHA, GL_ONE);
 				const GLfloat alpha = 0.5 + sin(draw_count/5.0)*0.5;
 				glColor4f(1.0, 0.0, 0.0, alpha);
 				obj->draw(x, y);
 				glColor4f(1.0, 1.0, 1.0, 1.0);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 			}
 		}
 	}
@@ -2188,7 +2203,7 @@ void level::draw(int x, int y, int w, int h) const
 			}
 		}
 
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE);
 		const GLfloat alpha = 0.5 + sin(draw_count/5.0)*0.5;
 		glColor4f(1.0, 1.0, 1.0, alpha);
 
@@ -2208,7 +2223,7 @@ void level::draw(int x, int y, int w, int h) const
 		}
 
 		glColor4f(1.0, 1.0, 1.0, 1.0);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	}
 
 	draw_debug_solid(x, y, w, h);
@@ -2361,7 +2376,7 @@ void level::calculate_lighting(int x, int y, int w, int h) const
 	}
 
 	{
-		glBlendFunc(GL_ONE, GL_ONE);
+		gl_state::blend_func(GL_ONE, GL_ONE);
 		rect screen_area(x, y, w, h);
 		const texture_frame_buffer::render_scope scope;
 
@@ -2392,9 +2407,9 @@ void level::calculate_lighting(int x, int y, int w, int h) const
 	glTexCoordPointer(2, GL_FLOAT, 0,
 	               preferences::screen_rotated() ? tcarray_rotated : tcarray);
 #endif
-	glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+	gl_state::blend_func(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	glPopMatrix();
 }
@@ -2526,6 +2541,8 @@ void level::draw_background(int x, int y, int rotation) const
 void level::process()
 {
 	formula_profiler::instrument instrumentation("LEVEL_PROCESS");
+	controls::start_cycle();
+
 	if(!gui_algorithm_.empty()) {
 		foreach(gui_algorithm_ptr g, gui_algorithm_) {
 			g->process(*this);
@@ -2566,7 +2583,18 @@ void level::process()
 
 void level::process_draw()
 {
-	std::vector<entity_ptr> chars = active_chars_;
+	const std::vector<entity_ptr>& subscribers = event_subscribers(OBJECT_EVENT_DRAW);
+	if(subscribers.empty()) {
+		return;
+	}
+
+	std::vector<entity_ptr> chars;
+	foreach(const entity_ptr& e, active_chars_) {
+		if(std::binary_search(subscribers.begin(), subscribers.end(), e)) {
+			chars.push_back(e);
+		}
+	}
+
 	foreach(const entity_ptr& e, chars) {
 		e->handle_event(OBJECT_EVENT_DRAW);
 	}
@@ -2583,9 +2611,248 @@ bool compare_entity_num_parents(const entity_ptr& a, const entity_ptr& b) {
 
 	const bool standa = a->standing_on().get() ? true : false;
 	const bool standb = b->standing_on().get() ? true : false;
-	return deptha < depthb || deptha == depthb && standa < standb ||
-	     deptha == depthb && standa == standb && a->is_human() < b->is_human();
+	if(deptha != depthb) {
+		return deptha < depthb;
+	}
+
+	if(standa != standb) {
+		return standa < standb;
+	}
+
+	if(a->is_human() != b->is_human()) {
+		return a->is_human() < b->is_human();
+	}
+
+	//ties are broken by zorder and then by label, so the order only
+	//depends on the objects and not on the order earlier cycles left
+	//them in.
+	if(zorder_compare(a, b)) {
+		return true;
+	} else if(zorder_compare(b, a)) {
+		return false;
+	}
+
+	return a->label() < b->label();
+}
+}
+
+namespace {
+PREF_INT(spatial_activation, 1);
+
+//the size of the grid cells dormant objects are filed under.
+const int ActivationCellSize = 512;
+
+int activation_cell(int n)
+{
+	return n >= 0 ? n/ActivationCellSize : (n+1)/ActivationCellSize - 1;
+}
+
+//restores the order of a nearly sorted sequence, in time linear in its
+//length plus the distance elements have to move.
+template<typename Compare>
+void insertion_sort(std::vector<entity_ptr>& v, Compare cmp)
+{
+	for(int n = 1; n < v.size(); ++n) {
+		if(!cmp(v[n], v[n-1])) {
+			continue;
+		}
+
+		entity_ptr e = v[n];
+		int m = n;
+		while(m > 0 && cmp(e, v[m-1])) {
+			v[m] = v[m-1];
+			--m;
+		}
+
+		v[m] = e;
+	}
+}
+
+//makes 'order' hold the entities in 'members', which may have duplicates,
+//sorted by 'cmp'. Entities which were already in 'order' keep their places
+//unless their keys changed, and new entities are merged in, so nothing is
+//sorted from scratch.
+template<typename Compare>
+void update_sorted_order(std::vector<entity_ptr>& order, const std::vector<entity_ptr>& members, Compare cmp)
+{
+	//each member's first index, and whether it's already in the order.
+	boost::unordered_map<const entity*, std::pair<int, bool> > index;
+	index.rehash(members.size());
+	int nmembers = 0;
+	for(int n = 0; n != members.size(); ++n) {
+		nmembers += index.insert(std::make_pair(members[n].get(), std::make_pair(n, false))).second;
+	}
+
+	std::vector<entity_ptr> result;
+	result.reserve(nmembers);
+	foreach(const entity_ptr& e, order) {
+		boost::unordered_map<const entity*, std::pair<int, bool> >::iterator i = index.find(e.get());
+		if(i != index.end() && !i->second.second) {
+			i->second.second = true;
+			result.push_back(e);
+		}
+	}
+
+	insertion_sort(result, cmp);
+
+	if(result.size() != nmembers) {
+		std::vector<entity_ptr> added;
+		for(int n = 0; n != members.size(); ++n) {
+			std::pair<int, bool>& entry = index[members[n].get()];
+			if(entry.first == n && !entry.second) {
+				added.push_back(members[n]);
+			}
+		}
+
+		std::sort(added.begin(), added.end(), cmp);
+
+		std::vector<entity_ptr> merged;
+		merged.reserve(members.size());
+		std::merge(result.begin(), result.end(), added.begin(), added.end(), std::back_inserter(merged), cmp);
+		result.swap(merged);
+	}
+
+	order.swap(result);
+}
+}
+
+void level::rebuild_activation()
+{
+	for(std::map<std::pair<int, int>, std::vector<entity_ptr> >::iterator i = activation_grid_.begin(); i != activation_grid_.end(); ++i) {
+		foreach(const entity_ptr& e, i->second) {
+			e->set_dormant(NULL);
+		}
+	}
+
+	activation_grid_.clear();
+	dormant_bounds_.clear();
+	awake_chars_ = chars_;
+	rebuild_activation_ = false;
+}
+
+void level::chars_changed()
+{
+	rebuild_activation_ = true;
+	invalidate_event_subscribers();
+}
+
+namespace {
+bool entity_address_less(const entity_ptr& a, const entity* b)
+{
+	return a.get() < b;
+}
+}
+
+const std::vector<entity_ptr>& level::event_subscribers(int event)
+{
+	if(event >= event_subscribers_.size()) {
+		event_subscribers_.resize(event+1);
+	}
+
+	event_subscriber_list& list = event_subscribers_[event];
+	if(!list.built) {
+		list.built = true;
+		list.subscribers.clear();
+		foreach(const entity_ptr& e, chars_) {
+			if(e->handles_event(event)) {
+				list.subscribers.push_back(e);
+			}
+		}
+
+		std::sort(list.subscribers.begin(), list.subscribers.end());
+	}
+
+	return list.subscribers;
 }
+
+void level::invalidate_event_subscribers()
+{
+	foreach(event_subscriber_list& list, event_subscribers_) {
+		list.built = false;
+		list.subscribers.clear();
+	}
+}
+
+void level::add_event_subscriber(const entity_ptr& e)
+{
+	for(int event = 0; event != event_subscribers_.size(); ++event) {
+		event_subscriber_list& list = event_subscribers_[event];
+		if(!list.built || !e->handles_event(event)) {
+			continue;
+		}
+
+		std::vector<entity_ptr>::iterator i = std::lower_bound(list.subscribers.begin(), list.subscribers.end(), e.get(), entity_address_less);
+		if(i == list.subscribers.end() || i->get() != e.get()) {
+			list.subscribers.insert(i, e);
+		}
+	}
+}
+
+void level::remove_event_subscriber(const entity* e)
+{
+	foreach(event_subscriber_list& list, event_subscribers_) {
+		std::vector<entity_ptr>::iterator i = std::lower_bound(list.subscribers.begin(), list.subscribers.end(), e, entity_address_less);
+		if(i != list.subscribers.end() && i->get() == e) {
+			list.subscribers.erase(i);
+		}
+	}
+}
+
+void level::update_event_subscriber(const entity* e)
+{
+	foreach(const entity_ptr& c, chars_) {
+		if(c.get() == e) {
+			remove_event_subscriber(e);
+			add_event_subscriber(c);
+			return;
+		}
+	}
+}
+
+void level::make_dormant(const entity_ptr& e, const rect& bounds)
+{
+	dormant_bounds_[e.get()] = bounds;
+	for(int x = activation_cell(bounds.x()); x <= activation_cell(bounds.x2()); ++x) {
+		for(int y = activation_cell(bounds.y()); y <= activation_cell(bounds.y2()); ++y) {
+			activation_grid_[std::pair<int, int>(x, y)].push_back(e);
+		}
+	}
+
+	e->set_dormant(this);
+}
+
+void level::remove_dormant(const entity_ptr& e)
+{
+	std::map<const entity*, rect>::iterator itor = dormant_bounds_.find(e.get());
+	if(itor == dormant_bounds_.end()) {
+		return;
+	}
+
+	const rect& bounds = itor->second;
+	for(int x = activation_cell(bounds.x()); x <= activation_cell(bounds.x2()); ++x) {
+		for(int y = activation_cell(bounds.y()); y <= activation_cell(bounds.y2()); ++y) {
+			std::map<std::pair<int, int>, std::vector<entity_ptr> >::iterator cell = activation_grid_.find(std::pair<int, int>(x, y));
+			if(cell != activation_grid_.end()) {
+				cell->second.erase(std::remove(cell->second.begin(), cell->second.end(), e), cell->second.end());
+				if(cell->second.empty()) {
+					activation_grid_.erase(cell);
+				}
+			}
+		}
+	}
+
+	dormant_bounds_.erase(itor);
+	e->set_dormant(NULL);
+}
+
+void level::remove_from_activation(const entity_ptr& e)
+{
+	remove_event_subscriber(e.get());
+	if(dormant_bounds_.count(e.get())) {
+		remove_dormant(e);
+	} else {
+		awake_chars_.erase(std::remove(awake_chars_.begin(), awake_chars_.end(), e), awake_chars_.end());
+	}
 }
 
 void level::set_active_chars()
@@ -2598,35 +2865,96 @@ void level::set_active_chars()
 	const int screen_bottom = last_draw_position().y/100 + graphics::screen_height() + zoom_buffer;
 
 	const rect screen_area(screen_left, screen_top, screen_right - screen_left, screen_bottom - screen_top);
-	active_chars_.clear();
-	foreach(entity_ptr& c, chars_) {
+
+	//in multiplayer all objects are active, so there's nothing to index.
+	const bool spatial = g_spatial_activation && controls::num_players() <= 1;
+	if(awake_chars_.size() + dormant_bounds_.size() != chars_.size()) {
+		//chars_ was changed behind our back.
+		chars_changed();
+	}
+
+	if(!spatial || rebuild_activation_) {
+		rebuild_activation();
+	}
+
+	//wake the dormant objects which were changed and those in the cells
+	//the screen area covers.
+	std::vector<entity_ptr> woken;
+	woken.swap(woken_objects_);
+	if(!dormant_bounds_.empty()) {
+		for(int x = activation_cell(screen_area.x()); x <= activation_cell(screen_area.x2()); ++x) {
+			for(int y = activation_cell(screen_area.y()); y <= activation_cell(screen_area.y2()); ++y) {
+				std::map<std::pair<int, int>, std::vector<entity_ptr> >::const_iterator cell = activation_grid_.find(std::pair<int, int>(x, y));
+				if(cell != activation_grid_.end()) {
+					woken.insert(woken.end(), cell->second.begin(), cell->second.end());
+				}
+			}
+		}
+	}
+
+	foreach(const entity_ptr& e, woken) {
+		if(dormant_bounds_.count(e.get())) {
+			remove_dormant(e);
+			awake_chars_.push_back(e);
+		}
+	}
+
+	std::vector<entity_ptr> active, died;
+	foreach(entity_ptr& c, awake_chars_) {
 		const bool is_active = c->is_active(screen_area) || c->use_absolute_screen_coordinates();
 
 		if(is_active) {
 			if(c->group() >= 0) {
 				assert(c->group() < groups_.size());
 				const entity_group& group = groups_[c->group()];
-				active_chars_.insert(active_chars_.end(), group.begin(), group.end());
+				active.insert(active.end(), group.begin(), group.end());
 			} else {
-				active_chars_.push_back(c);
+				active.push_back(c);
 			}
 		} else { //char is inactive
+			rect bounds;
 			if( c->dies_on_inactive() ){
 				if(c->label().empty() == false) {
 					c->die_with_no_event();
 					chars_by_label_.erase(c->label());
 				}
 				
+				died.push_back(c);
 				c = entity_ptr(); //can't delete it while iterating over the container, so we null it for later removal
+			} else if(spatial && c->get_activation_bounds(&bounds)) {
+				make_dormant(c, bounds);
+				c = entity_ptr();
 			}
 		}
 	}
 
-	chars_.erase(std::remove(chars_.begin(), chars_.end(), entity_ptr()), chars_.end());
+	awake_chars_.erase(std::remove(awake_chars_.begin(), awake_chars_.end(), entity_ptr()), awake_chars_.end());
 
-	std::sort(active_chars_.begin(), active_chars_.end());
-	active_chars_.erase(std::unique(active_chars_.begin(), active_chars_.end()), active_chars_.end());
-	std::sort(active_chars_.begin(), active_chars_.end(), zorder_compare);
+	if(died.empty() == false) {
+		std::sort(died.begin(), died.end());
+		for(std::vector<entity_ptr>::iterator i = chars_.begin(); i != chars_.end(); ++i) {
+			if(std::binary_search(died.begin(), died.end(), *i)) {
+				*i = entity_ptr();
+			}
+		}
+
+		chars_.erase(std::remove(chars_.begin(), chars_.end(), entity_ptr()), chars_.end());
+		foreach(const entity_ptr& e, died) {
+			remove_event_subscriber(e.get());
+		}
+	}
+
+	update_sorted_order(active_chars_, active, zorder_compare);
+}
+
+int level::checksum() const
+{
+	int result = 0;
+	foreach(const entity_ptr& e, chars_) {
+		result += e->x() + e->y();
+	}
+
+	return result;
 }
 
 void level::do_processing()
@@ -2643,6 +2971,8 @@ void level::do_processing()
 		++cycle_;
 	}
 
+	wake_sleeping_objects();
+
 	if(!player_) {
 		return;
 	}
@@ -2661,26 +2991,23 @@ void level::do_processing()
 	std::cerr << "\n";
 	*/
 
-	int checksum = 0;
-	foreach(const entity_ptr& e, chars_) {
-		checksum += e->x() + e->y();
-	}
-
-	controls::set_checksum(cycle_, checksum);
+	controls::set_checksum(cycle_, checksum());
 
 	const int ActivationDistance = 700;
 
-	std::vector<entity_ptr> active_chars = active_chars_;
-	std::sort(active_chars.begin(), active_chars.end(), compare_entity_num_parents);
+	update_sorted_order(process_order_, active_chars_, compare_entity_num_parents);
+	std::vector<entity_ptr> active_chars = process_order_;
 	if(time_freeze_ >= 1000) {
 		time_freeze_ -= 1000;
 		active_chars = chars_immune_from_time_freeze_;
 	}
 
+	custom_object::speculate_process_events(active_chars);
+
 	while(!active_chars.empty()) {
 		new_chars_.clear();
 		foreach(const entity_ptr& c, active_chars) {
-			if(!c->destroyed() && (chars_by_label_.count(c->label()) || c->is_human())) {
+			if(!c->destroyed() && !c->sleeping_until() && (chars_by_label_.count(c->label()) || c->is_human())) {
 				c->process(*this);
 			}
 	
@@ -2693,6 +3020,7 @@ void level::do_processing()
 			}
 		}
 
+		custom_object::clear_process_speculations();
 		active_chars = new_chars_;
 		active_chars_.insert(active_chars_.end(), new_chars_.begin(), new_chars_.end());
 	}
@@ -2711,6 +3039,7 @@ void level::erase_char(entity_ptr c)
 		chars_by_label_.erase(c->label());
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), c), chars_.end());
+	remove_from_activation(c);
 	if(c->group() >= 0) {
 		assert(c->group() < groups_.size());
 		entity_group& group = groups_[c->group()];
@@ -3365,6 +3694,7 @@ void level::remove_character(entity_ptr e)
 		chars_by_label_.erase(e->label());
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), e), chars_.end());
+	remove_from_activation(e);
 	solid_chars_.erase(std::remove(solid_chars_.begin(), solid_chars_.end(), e), solid_chars_.end());
 	active_chars_.erase(std::remove(active_chars_.begin(), active_chars_.end(), e), active_chars_.end());
 }
@@ -3535,6 +3865,7 @@ void level::add_multi_player(entity_ptr p)
 	p->get_player_info()->set_player_slot(players_.size());
 	players_.push_back(p);
 	chars_.push_back(p);
+	chars_changed();
 	if(p->label().empty() == false) {
 		chars_by_label_[p->label()] = p;
 	}
@@ -3544,6 +3875,7 @@ void level::add_multi_player(entity_ptr p)
 void level::add_player(entity_ptr p)
 {
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), player_), chars_.end());
+	chars_changed();
 	last_touched_player_ = player_ = p;
 	if(players_.empty()) {
 		player_->get_player_info()->set_player_slot(players_.size());
@@ -3607,6 +3939,9 @@ void level::add_character(entity_ptr p)
 		add_player(p);
 	} else {
 		chars_.push_back(p);
+		awake_chars_.push_back(p);
+		p->set_dormant(NULL);
+		add_event_subscriber(p);
 	}
 
 	p->add_to_level();
@@ -3625,6 +3960,29 @@ void level::add_character(entity_ptr p)
 	p->being_added();
 }
 
+void level::sleep_object(entity_ptr e, int cycles)
+{
+	ASSERT_LOG(!e->is_human(), "Cannot put the player to sleep: " << e->debug_description());
+	if(cycles <= 0) {
+		e->set_sleeping_until(0);
+		return;
+	}
+
+	e->set_sleeping_until(cycle_ + cycles);
+	sleep_wheel_.insert(cycle_ + cycles, e);
+}
+
+void level::wake_sleeping_objects()
+{
+	std::vector<entity_ptr> woken;
+	sleep_wheel_.advance(cycle_, &woken);
+	foreach(const entity_ptr& e, woken) {
+		if(e->sleeping_until() != 0 && e->sleeping_until() <= cycle_) {
+			e->set_sleeping_until(0);
+		}
+	}
+}
+
 void level::add_draw_character(entity_ptr p)
 {
 	active_chars_.push_back(p);
@@ -4205,19 +4563,42 @@ void level::replay_from_cycle(int ncycle)
 		return;
 	}
 
-	int index = static_cast<int>(backups_.size()) - cycles_ago;
-	ASSERT_GE(index, 0);
+	//backups may be taken only every few cycles, so play from the latest
+	//one which isn't after the cycle.
+	int index = static_cast<int>(backups_.size()) - 1;
+	while(index >= 0 && backups_[index]->cycle > ncycle) {
+		--index;
+	}
+
+	ASSERT_LOG(index >= 0, "Cannot go back to cycle " << ncycle << ": the earliest backup is of cycle " << earliest_backup_cycle());
 
 	const int cycle_to_play_until = cycle_;
 	restore_from_backup(*backups_[index]);
-	ASSERT_EQ(cycle_, ncycle);
 	backups_.erase(backups_.begin() + index, backups_.end());
+
+	++nrollbacks_;
+	nrollback_cycles_ += cycle_to_play_until - cycle_;
 	while(cycle_ < cycle_to_play_until) {
-		backup();
+		backup_for_rollback();
 		do_processing();
 	}
 }
 
+namespace {
+//how often a multiplayer game is backed up to roll back to when a remote
+//player's controls turn out to differ from what we guessed. Rolling back
+//plays from the latest backup, so sparser backups cost less to take but
+//more to roll back.
+PREF_INT(rollback_backup_interval, 1);
+}
+
+void level::backup_for_rollback()
+{
+	if(g_rollback_backup_interval <= 1 || cycle_%g_rollback_backup_interval == 0) {
+		backup();
+	}
+}
+
 void level::backup()
 {
 	if(backups_.empty() == false && backups_.back()->cycle == cycle_) {
@@ -4318,6 +4699,7 @@ void level::restore_from_backup(backup_snapshot& snapshot)
 	rng::set_seed(snapshot.rng_seed);
 	cycle_ = snapshot.cycle;
 	chars_ = snapshot.chars;
+	chars_changed();
 	players_ = snapshot.players;
 	player_ = snapshot.player;
 	groups_ = snapshot.groups;
@@ -4332,6 +4714,15 @@ void level::restore_from_backup(backup_snapshot& snapshot)
 			chars_by_label_[e->label()] = e;
 		}
 	}
+
+	sleep_wheel_.reset(cycle_);
+	foreach(const entity_ptr& e, chars_) {
+		if(e->sleeping_until() > cycle_) {
+			sleep_wheel_.insert(e->sleeping_until(), e);
+		} else {
+			e->set_sleeping_until(0);
+		}
+	}
 }
 
 std::vector<entity_ptr> level::trace_past(entity_ptr e, int ncycle)
@@ -4884,6 +5275,41 @@ UTILITY(compile_levels)
 	level_object::write_compiled();
 }
 
+UNIT_TEST(timing_wheel)
+{
+	//values come out on the cycle they're due, across cascades of the
+	//outer wheels and the overflow list.
+	const int due[] = { 1, 5, 63, 64, 65, 200, 4095, 4096, 5000, 300000, 20000000 };
+	timing_wheel<int> wheel(0);
+	for(int n = sizeof(due)/sizeof(*due) - 1; n >= 0; --n) {
+		wheel.insert(due[n], due[n]);
+	}
+
+	wheel.insert(-5, 1);
+	CHECK_EQ(wheel.size(), sizeof(due)/sizeof(*due) + 1);
+
+	int cycle = 0;
+	std::vector<int> fired;
+	for(int n = 0; n != sizeof(due)/sizeof(*due); ++n) {
+		while(fired.empty()) {
+			wheel.advance(++cycle, &fired);
+		}
+
+		CHECK_EQ(cycle, due[n]);
+		foreach(int value, fired) {
+			CHECK_EQ(value, due[n]);
+		}
+
+		fired.clear();
+	}
+
+	CHECK_EQ(wheel.empty(), true);
+
+	wheel.insert(cycle + 10, 7);
+	wheel.advance(cycle + 1000, &fired);
+	CHECK_EQ(fired.size(), 1);
+}
+
 BENCHMARK(level_solid)
 {
 	//benchmark which tells us how long level::solid takes.
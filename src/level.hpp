@@ -51,6 +51,7 @@
 #include "raster.hpp"
 #include "speech_dialog.hpp"
 #include "tile_map.hpp"
+#include "timing_wheel.hpp"
 #include "variant.hpp"
 #include "water.hpp"
 #include "color_utils.hpp"
@@ -167,6 +168,13 @@ public:
 
 	const level_tile* get_tile_at(int x, int y) const;
 	void remove_character(entity_ptr e);
+
+	//updates which events the given object is listed as handling, if it's
+	//in this level.
+	void update_event_subscriber(const entity* e);
+
+	//called by a dormant object of this level when it's woken.
+	void object_woken(const entity_ptr& e) { woken_objects_.push_back(e); }
 	std::vector<entity_ptr> get_characters_in_rect(const rect& r, int screen_xpos, int screen_ypos) const;
 	std::vector<entity_ptr> get_characters_at_point(int x, int y, int screen_xpos, int screen_ypos) const;
 	entity_ptr get_next_character_at_point(int x, int y, int screen_xpos, int screen_ypos) const;
@@ -178,6 +186,10 @@ public:
 	void add_player(entity_ptr p);
 	void add_character(entity_ptr p);
 
+	//stops processing the object until the given number of cycles have
+	//passed, or until it handles an event.
+	void sleep_object(entity_ptr e, int cycles);
+
 	//add a character that will be drawn on the scene. It will be removed
 	//from the level next time set_active_chars() is called.
 	void add_draw_character(entity_ptr p);
@@ -308,7 +320,7 @@ public:
 	const std::vector<entity_ptr>& get_active_chars() const { return active_chars_; }
 	const std::vector<entity_ptr>& get_chars() const { return chars_; }
 	const std::vector<entity_ptr>& get_solid_chars() const;
-	void swap_chars(std::vector<entity_ptr>& v) { chars_.swap(v); solid_chars_.clear(); }
+	void swap_chars(std::vector<entity_ptr>& v) { chars_.swap(v); solid_chars_.clear(); chars_changed(); }
 	int num_active_chars() const { return active_chars_.size(); }
 
 	void begin_movement_script(const std::string& name, entity& e);
@@ -319,9 +331,20 @@ public:
 	//pressing up will talk to someone or enter a door etc.
 	bool can_interact(const rect& body) const;
 
+	//a sum of the objects' positions, which diverges when a game played
+	//with the same controls plays out differently.
+	int checksum() const;
+
 	int earliest_backup_cycle() const;
 	void replay_from_cycle(int ncycle);
 	void backup();
+
+	//takes a backup if one is due for rolling back a multiplayer game to.
+	void backup_for_rollback();
+
+	//how many times the game was rolled back and the cycles played again.
+	int num_rollbacks() const { return nrollbacks_; }
+	int num_rollback_cycles() const { return nrollback_cycles_; }
 	void reverse_one_cycle();
 	void reverse_to_cycle(int ncycle);
 
@@ -654,6 +677,7 @@ private:
 	typedef boost::shared_ptr<backup_snapshot> backup_snapshot_ptr;
 
 	std::deque<backup_snapshot_ptr> backups_;
+	int nrollbacks_, nrollback_cycles_;
 
 	int editor_tile_updates_frozen_;
 	bool editor_dragging_objects_;
@@ -708,6 +732,50 @@ private:
 	bool allow_touch_controls_;
 
 	boost::intrusive_ptr<level> suspended_level_;
+
+	//the objects set_active_chars() examines every cycle: all of chars_
+	//except dormant objects, which are filed in activation_grid_ under the
+	//cells their activation bounds cover and only examined once the screen
+	//reaches those cells.
+	std::vector<entity_ptr> awake_chars_;
+	std::map<std::pair<int, int>, std::vector<entity_ptr> > activation_grid_;
+	std::map<const entity*, rect> dormant_bounds_;
+	bool rebuild_activation_;
+
+	void rebuild_activation();
+	void chars_changed();
+	void make_dormant(const entity_ptr& e, const rect& bounds);
+	void remove_dormant(const entity_ptr& e);
+	void remove_from_activation(const entity_ptr& e);
+
+	//active_chars_ in the order do_processing() processes them.
+	std::vector<entity_ptr> process_order_;
+
+	//dormant objects which were changed since the last set_active_chars().
+	std::vector<entity_ptr> woken_objects_;
+
+	//for each event ID, the objects in chars_ which handle it, sorted by
+	//address. A list is built when first requested, then kept up to date
+	//as objects are added, removed or change their handlers. Changes to
+	//chars_ as a whole make the lists be built again.
+	struct event_subscriber_list {
+		event_subscriber_list() : built(false) {}
+		bool built;
+		std::vector<entity_ptr> subscribers;
+	};
+
+	std::vector<event_subscriber_list> event_subscribers_;
+	const std::vector<entity_ptr>& event_subscribers(int event);
+	void invalidate_event_subscribers();
+	void add_event_subscriber(const entity_ptr& e);
+	void remove_event_subscriber(const entity* e);
+
+	//the sleeping objects, due at the cycle they're to wake up at. An
+	//object which was woken early and put back to sleep may have stale
+	//entries, which are recognized by entity::sleeping_until() no longer
+	//matching.
+	timing_wheel<entity_ptr> sleep_wheel_;
+	void wake_sleeping_objects();
 };
 
 bool entity_in_current_level(const entity* e);
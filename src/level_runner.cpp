@@ -40,6 +40,7 @@
 #include "formatter.hpp"
 #include "formula_profiler.hpp"
 #include "formula_callable.hpp"
+#include "gl_state.hpp"
 #include "http_client.hpp"
 #if defined(TARGET_OS_HARMATTAN) || defined(TARGET_BLACKBERRY) || defined(__ANDROID__) || TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
 #include "iphone_controls.hpp"
@@ -86,6 +87,82 @@ public:
 	}
 };
 
+//file to save a replay of the level being played to when play ends, which
+//the replay_level utility can play back.
+PREF_STRING(record_replay, "");
+
+//milliseconds a frame may spend sending new textures to the GPU. Textures
+//that don't fit are drawn transparent until a later frame sends them.
+PREF_INT(texture_upload_budget_ms, 4);
+
+//if set, frames are drawn between cycles with objects and the camera part
+//way between where they were and where they are, so motion is smooth on displays which
+//refresh faster than the game runs. Everything is shown a cycle late.
+PREF_INT(interpolate_frames, 0);
+
+//objects which moved further than this in a cycle, in centi-pixels, are
+//taken to have teleported and aren't interpolated.
+const int MaxInterpolatedMove = 200*100;
+
+//moves the objects and camera in a snapshot part way back towards where
+//they were when it was taken, and puts them back when destroyed.
+class interpolation_scope {
+public:
+	interpolation_scope(const std::vector<std::pair<entity_ptr, point> >& snapshot, const point& camera, screen_position& pos, float alpha) : pos_(pos), camera_(pos.x, pos.y)
+	{
+		typedef std::pair<entity_ptr, point> snapshot_entry;
+		foreach(const snapshot_entry& entry, snapshot) {
+			const entity_ptr& e = entry.first;
+			const point cur(e->centi_x(), e->centi_y());
+			if(cur == entry.second || abs(cur.x - entry.second.x) > MaxInterpolatedMove || abs(cur.y - entry.second.y) > MaxInterpolatedMove) {
+				continue;
+			}
+
+			moved_.push_back(snapshot_entry(e, cur));
+			e->set_centi_x(entry.second.x + int((cur.x - entry.second.x)*alpha));
+			e->set_centi_y(entry.second.y + int((cur.y - entry.second.y)*alpha));
+		}
+
+		if(abs(pos.x - camera.x) <= MaxInterpolatedMove && abs(pos.y - camera.y) <= MaxInterpolatedMove) {
+			pos.x = camera.x + int((pos.x - camera.x)*alpha);
+			pos.y = camera.y + int((pos.y - camera.y)*alpha);
+		}
+	}
+
+	~interpolation_scope()
+	{
+		typedef std::pair<entity_ptr, point> snapshot_entry;
+		foreach(const snapshot_entry& entry, moved_) {
+			entry.first->set_centi_x(entry.second.x);
+			entry.first->set_centi_y(entry.second.y);
+		}
+
+		pos_.x = camera_.x;
+		pos_.y = camera_.y;
+	}
+
+private:
+	std::vector<std::pair<entity_ptr, point> > moved_;
+	screen_position& pos_;
+	point camera_;
+};
+
+class record_replay_scope {
+public:
+	explicit record_replay_scope(const boost::intrusive_ptr<level>& lvl) : lvl_(lvl)
+	{}
+
+	~record_replay_scope() {
+		if(g_record_replay.empty() == false) {
+			std::vector<char> replay;
+			controls::write_replay(replay, lvl_ ? lvl_->checksum() : 0);
+			sys::write_file(g_record_replay, std::string(replay.begin(), replay.end()));
+		}
+	}
+private:
+	const boost::intrusive_ptr<level>& lvl_;
+};
+
 struct upload_screenshot_info {
 	upload_screenshot_info() : error(false), done(false)
 	{}
@@ -721,6 +798,7 @@ level_runner::level_runner(boost::intrusive_ptr<level>& lvl, std::string& level_
 	current_events_ = 0;
 
 	nskip_draw_ = 0;
+	interpolation_start_ = 0;
 
 	cycle = 0;
 	die_at = -1;
@@ -780,6 +858,7 @@ void level_runner::close_editor()
 bool level_runner::play_level()
 {
 	const current_level_runner_scope current_level_runner_setter(this);
+	const record_replay_scope replay_recorder(lvl_);
 
 	sound::stop_looped_sounds(NULL);
 
@@ -828,6 +907,38 @@ bool level_runner::play_level()
 }
 
 namespace {
+//formats the events dispatched most often since the last call, and resets
+//the counts.
+std::string summarize_event_dispatches()
+{
+	std::vector<std::pair<int, int> > counts;
+	for(int n = 0; n != custom_object::events_dispatched_this_frame.size(); ++n) {
+		if(custom_object::events_dispatched_this_frame[n]) {
+			counts.push_back(std::pair<int, int>(-custom_object::events_dispatched_this_frame[n], n));
+			custom_object::events_dispatched_this_frame[n] = 0;
+		}
+	}
+
+	std::sort(counts.begin(), counts.end());
+
+	std::ostringstream s;
+	for(int n = 0; n < counts.size() && n < 8; ++n) {
+		s << (n ? "; " : "events/frame: ") << get_object_event_str(counts[n].second) << " " << -counts[n].first;
+	}
+
+	return s.str();
+}
+
+//if we received controls for a remote player which differ from what we
+//guessed they would be, goes back and plays again from where they differ.
+void roll_back_mispredictions(level& lvl)
+{
+	if(controls::first_invalid_cycle() >= 0) {
+		lvl.replay_from_cycle(controls::first_invalid_cycle());
+		controls::mark_valid();
+	}
+}
+
 void load_level_thread(const std::string& lvl, level** res) {
 	try {
 		*res = load_level(lvl);
@@ -849,10 +960,7 @@ bool level_runner::play_cycle()
 	static settings_dialog settings_dialog;
 
 	const preferences::alt_frame_time_scope alt_frame_time_scoper(preferences::has_alt_frame_time() && SDL_GetModState()&KMOD_ALT);
-	if(controls::first_invalid_cycle() >= 0) {
-		lvl_->replay_from_cycle(controls::first_invalid_cycle());
-		controls::mark_valid();
-	}
+	roll_back_mispredictions(*lvl_);
 
 	background_task_pool::pump();
 
@@ -863,7 +971,7 @@ bool level_runner::play_cycle()
 	}
 
 	if(controls::num_players() > 1) {
-		lvl_->backup();
+		lvl_->backup_for_rollback();
 	}
 	
 #if defined(USE_BOX2D)
@@ -943,6 +1051,9 @@ bool level_runner::play_cycle()
 
 	const bool is_multiplayer = controls::num_players() > 1;
 
+	//multiplayer games and the editor draw exactly what was simulated.
+	const bool interpolate = g_interpolate_frames && !is_multiplayer && !editor_ && !is_skipping_game();
+
 	int desired_end_time = start_time_ + pause_time_ + global_pause_time + cycle*preferences::frame_time_millis() + preferences::frame_time_millis();
 
 	if(!is_multiplayer) {
@@ -1520,6 +1631,9 @@ bool level_runner::play_cycle()
 		}
 	}
 
+	//only a cycle that is processed gets a snapshot to interpolate from.
+	interpolation_snapshot_.clear();
+
 	if(message_dialog::get()) {
 		message_dialog::get()->process();
 		pause_time_ += preferences::frame_time_millis();
@@ -1527,6 +1641,10 @@ bool level_runner::play_cycle()
 		if (!paused && pause_stack == 0) {
 			const int start_process = SDL_GetTicks();
 
+			if(interpolate) {
+				capture_interpolation_snapshot();
+			}
+
 			try {
 				debug_console::process_graph();
 				lvl_->process();
@@ -1534,6 +1652,10 @@ bool level_runner::play_cycle()
 				handle_pause_game_result(e.result);
 			}
 
+			//corrections which came in while processing are played
+			//before the cycle is drawn.
+			roll_back_mispredictions(*lvl_);
+
 			const int process_time = SDL_GetTicks() - start_process;
 			next_process_ += process_time;
 			current_perf.process = process_time;
@@ -1552,6 +1674,9 @@ bool level_runner::play_cycle()
 	const int MaxSkips = 3;
 
 	const int start_draw = SDL_GetTicks();
+	const int start_binds = graphics::texture::num_binds();
+	const int start_gl_issued = gl_state::calls_issued();
+	const int start_gl_filtered = gl_state::calls_filtered();
 	if(start_draw < desired_end_time || nskip_draw_ >= MaxSkips) {
 		bool should_draw = true;
 		
@@ -1630,7 +1755,9 @@ bool level_runner::play_cycle()
 					}
 				}
 #endif
-				render_scene(*lvl_, last_draw_position());
+				const graphics::texture::upload_budget_scope upload_budget(g_texture_upload_budget_ms);
+				interpolation_start_ = start_draw;
+				render_interpolated_scene();
 #ifndef NO_EDITOR
 				int index = 0;
 				if(!history_trails_.empty()) {
@@ -1667,6 +1794,12 @@ bool level_runner::play_cycle()
 #endif
 
 		performance_data perf(current_fps_, current_cycles_, current_delay_, current_draw_, current_process_, current_flip_, cycle, current_events_, profiling_summary_);
+		perf.event_dispatch_info = event_dispatch_summary_;
+		perf.parallel_process_info = parallel_process_summary_;
+		perf.texture_upload_info = texture_upload_summary_;
+		perf.texture_binds = graphics::texture::num_binds() - start_binds;
+		perf.gl_calls_issued = gl_state::calls_issued() - start_gl_issued;
+		perf.gl_calls_filtered = gl_state::calls_filtered() - start_gl_filtered;
 
 #if TARGET_IPHONE_SIMULATOR || TARGET_OS_HARMATTAN || TARGET_OS_IPHONE
 		if( ! is_achievement_displayed() ){
@@ -1699,6 +1832,8 @@ bool level_runner::play_cycle()
 	++next_cycles_;
 	current_perf.cycle = next_cycles_;
 
+	event_dispatch_summary_ = summarize_event_dispatches();
+
 	static int prev_events_per_second = 0;
 	current_perf.nevents = custom_object::events_handled_per_second - prev_events_per_second;
 	prev_events_per_second = custom_object::events_handled_per_second;
@@ -1722,16 +1857,27 @@ bool level_runner::play_cycle()
 		prev_events_per_second = custom_object::events_handled_per_second = 0;
 
 		profiling_summary_ = formula_profiler::get_profile_summary();
+		parallel_process_summary_ = custom_object::summarize_process_speculation();
+		texture_upload_summary_ = graphics::texture::summarize_uploads();
 	}
 
 	formula_profiler::pump();
 
+	custom_object::process_garbage_collection();
+
 	const int raw_wait_time = desired_end_time - SDL_GetTicks();
 	const int wait_time = std::max<int>(1, desired_end_time - SDL_GetTicks());
 	next_delay_ += wait_time;
 	current_perf.delay = wait_time;
 	if (wait_time != 1 && !is_skipping_game()) {
-		SDL_Delay(wait_time);
+		if(interpolation_snapshot_.empty() == false) {
+			draw_interpolated_frames(desired_end_time);
+		}
+
+		const int remaining_time = desired_end_time - SDL_GetTicks();
+		if(remaining_time > 0) {
+			SDL_Delay(remaining_time);
+		}
 	}
 
 	performance_data::set_current(current_perf);
@@ -1757,6 +1903,59 @@ bool level_runner::play_cycle()
 	return !quit_;
 }
 
+void level_runner::capture_interpolation_snapshot()
+{
+	interpolation_snapshot_.clear();
+	foreach(const entity_ptr& e, lvl_->get_active_chars()) {
+		interpolation_snapshot_.push_back(std::pair<entity_ptr, point>(e, point(e->centi_x(), e->centi_y())));
+	}
+
+	interpolation_camera_ = point(last_draw_position().x, last_draw_position().y);
+}
+
+void level_runner::render_interpolated_scene()
+{
+	if(interpolation_snapshot_.empty()) {
+		render_scene(*lvl_, last_draw_position());
+		return;
+	}
+
+	const float alpha = std::min(1.0f, std::max(0.0f, float(SDL_GetTicks() - interpolation_start_)/preferences::frame_time_millis()));
+	interpolation_scope scope(interpolation_snapshot_, interpolation_camera_, last_draw_position(), alpha);
+	render_scene(*lvl_, last_draw_position());
+}
+
+void level_runner::draw_interpolated_frames(int end_time)
+{
+	//frames are drawn while there looks to be time for another before
+	//the next cycle is due. Swapping buffers waits for the display, so
+	//with vsync on this draws at the display's refresh rate.
+	int frame_time = 0;
+	while(SDL_GetTicks() + frame_time < end_time) {
+		const int start_frame = SDL_GetTicks();
+
+		{
+			const graphics::texture::upload_budget_scope upload_budget(g_texture_upload_budget_ms);
+			render_interpolated_scene();
+		}
+
+#ifndef NO_EDITOR
+		if(console_) {
+			console_->draw();
+		}
+#endif
+
+		if(preferences::show_fps() && performance_data::current()) {
+			draw_fps(*lvl_, *performance_data::current());
+		}
+
+		graphics::swap_buffers();
+		++next_fps_;
+
+		frame_time = SDL_GetTicks() - start_frame;
+	}
+}
+
 void level_runner::toggle_pause()
 {
 	paused = !paused;
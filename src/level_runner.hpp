@@ -86,8 +86,21 @@ private:
 	    current_draw_, next_draw_, current_process_, next_process_,
 		current_flip_, next_flip_, current_events_;
 	std::string profiling_summary_;
+	std::string event_dispatch_summary_;
+	std::string parallel_process_summary_;
+	std::string texture_upload_summary_;
 	int nskip_draw_;
 
+	//where the active objects and the camera were, in centi-pixels, before
+	//the last cycle was processed. Frames drawn while waiting for the next
+	//cycle place them part way between there and where they are now.
+	std::vector<std::pair<entity_ptr, point> > interpolation_snapshot_;
+	point interpolation_camera_;
+	int interpolation_start_;
+	void capture_interpolation_snapshot();
+	void render_interpolated_scene();
+	void draw_interpolated_frames(int end_time);
+
 #if !SDL_VERSION_ATLEAST(2, 0, 0)
 	CKey key;
 #endif
@@ -18,6 +18,7 @@
 
 #include <glm/gtc/matrix_inverse.hpp>
 
+#include "gl_state.hpp"
 #include "lighting.hpp"
 #include "variant_utils.hpp"
 
@@ -33,14 +34,14 @@ namespace graphics
 		{
 			manager(gles2::program_ptr shader) 
 			{
-				glGetIntegerv(GL_CURRENT_PROGRAM, &old_program);
-				glUseProgram(shader->get());
+				old_program = gl_state::current_program();
+				gl_state::use_program(shader->get());
 			}
 			~manager()
 			{
-				glUseProgram(old_program);
+				gl_state::use_program(old_program);
 			}
-			GLint old_program;
+			GLuint old_program;
 		};
 	}
 
@@ -53,6 +53,7 @@
 #include "formula_object.hpp"
 #include "formula_profiler.hpp"
 #include "framed_gui_element.hpp"
+#include "gl_state.hpp"
 #include "graphical_font.hpp"
 #include "gui_section.hpp"
 #include "i18n.hpp"
@@ -915,7 +916,7 @@ extern "C" int main(int argcount, char* argvec[])
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 #endif
 
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	std::cerr << "JOYSTICKS: " << SDL_NumJoysticks() << "\n";
 
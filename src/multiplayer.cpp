@@ -186,6 +186,15 @@ void send_confirm_packet(int nplayer, std::vector<char>& msg, bool has_confirm)
 }
 }
 
+namespace {
+//the delay before controls take effect, which the host decides for all
+//players. By default it's enough to cover the latency between players.
+//Controls which arrive late are corrected by rolling the game back, so a
+//lower delay makes the game more responsive at the cost of rolling back
+//more often.
+PREF_INT(input_delay_frames, -1);
+}
+
 void sync_start_time(const level& lvl, boost::function<bool()> idle_fn)
 {
 	if(!tcp_socket) {
@@ -374,7 +383,8 @@ void sync_start_time(const level& lvl, boost::function<bool()> idle_fn)
 		std::map<int, int> player_nresponses;
 		std::map<int, int> player_latency;
 
-		int delay = 0;
+		int delay = g_input_delay_frames;
+		bool delay_set = false;
 		int last_send = -1;
 
 		const int game_start = SDL_GetTicks() + 1000;
@@ -383,7 +393,7 @@ void sync_start_time(const level& lvl, boost::function<bool()> idle_fn)
 			const int ticks = SDL_GetTicks();
 			const int start_in = game_start - ticks;
 
-			if(start_in < 500 && delay == 0) {
+			if(start_in < 500 && delay == -1) {
 				//calculate what the delay should be
 				for(int n = 0; n != nplayers; ++n) {
 					if(n == player_slot) {
@@ -398,11 +408,12 @@ void sync_start_time(const level& lvl, boost::function<bool()> idle_fn)
 						}
 					}
 				}
+			}
 
-				if(delay) {
-					std::cerr << "SET DELAY TO " << delay << "\n";
-					controls::set_delay(delay);
-				}
+			if(start_in < 500 && delay != -1 && !delay_set) {
+				std::cerr << "SET DELAY TO " << delay << "\n";
+				controls::set_delay(delay);
+				delay_set = true;
 			}
 
 			if(last_send == -1 || ticks >= last_send+10) {
@@ -488,7 +499,7 @@ void sync_start_time(const level& lvl, boost::function<bool()> idle_fn)
 						start_time.erase(start_time.begin());
 					}
 
-					if(delay) {
+					if(delay != -1) {
 						std::cerr << "SET DELAY TO " << delay << "\n";
 						controls::set_delay(delay);
 					}
@@ -532,12 +543,6 @@ void send_and_receive()
 
 	static std::deque<QueuedMessages> message_queue;
 
-	//send our ID followed by the send packet.
-	std::vector<char> send_buf(5);
-	send_buf[0] = 'C';
-	memcpy(&send_buf[1], &id, 4);
-	controls::write_control_packet(send_buf);
-
 	if(message_queue.empty() == false) {
 		QueuedMessages& msg = message_queue.front();
 		for(const std::function<void()>& fn : msg.send_fn) {
@@ -552,6 +557,13 @@ void send_and_receive()
 			continue;
 		}
 
+		//send our ID followed by the packet, which only has what this
+		//player hasn't acknowledged.
+		std::vector<char> send_buf(5);
+		send_buf[0] = 'C';
+		memcpy(&send_buf[1], &id, 4);
+		controls::write_control_packet(send_buf, n);
+
 		if(g_udp_send_delay_frames == 0) {
 			udp_socket->send_to(boost::asio::buffer(send_buf), *udp_endpoint_peers[n]);
 		} else {
@@ -19,6 +19,7 @@
 #include "asserts.hpp"
 #include "camera.hpp"
 #include "foreach.hpp"
+#include "gl_state.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
 #include "raster.hpp"
@@ -71,6 +72,9 @@ flip_draw_scope::~flip_draw_scope()
 
 void reset_opengl_state()
 {
+	//this may be a new context, which has none of the state we knew of.
+	gl_state::invalidate();
+
 	glShadeModel(GL_SMOOTH);
 	glEnable(GL_BLEND);
 	glEnable(GL_TEXTURE_2D);
@@ -80,7 +84,7 @@ void reset_opengl_state()
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 #endif
 
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 #if defined(USE_SHADERS)
     glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
@@ -32,6 +32,7 @@
 #include "color_chart.hpp"
 #include "color_utils.hpp"
 #include "geometry.hpp"
+#include "gl_state.hpp"
 #include "texture.hpp"
 
 namespace preferences
@@ -60,15 +61,15 @@ struct shader_save_context
 {
 	shader_save_context()
 	{
-		glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
+		current_program = gl_state::current_program();
 	}
 
 	~shader_save_context()
 	{
-		glUseProgram(current_program);
+		gl_state::use_program(current_program);
 	}
 
-	GLint current_program;
+	GLuint current_program;
 };
 
 
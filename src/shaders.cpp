@@ -17,12 +17,15 @@
 #if defined(USE_SHADERS)
 #include <boost/regex.hpp>
 
+#include <algorithm>
+
 #include "array_callable.hpp"
 #include "asserts.hpp"
 #include "custom_object.hpp"
 #include "foreach.hpp"
 #include "formula.hpp"
 #include "formula_profiler.hpp"
+#include "gl_state.hpp"
 #include "graphics.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
@@ -154,6 +157,7 @@ bool program::link()
 		glDeleteProgram(object_);
 		object_ = 0;
 	}
+	uniform_shadow_.clear();
 	object_ = glCreateProgram();
 	ASSERT_LOG(object_ != 0, "Unable to create program object.");
 	glAttachShader(object_, vs_.get());
@@ -189,7 +193,7 @@ GLuint program::get_attribute(const std::string& attr) const
 	return it->second.location;
 }
 
-GLint program::get_uniform(const std::string& attr) const
+GLint program::find_uniform(const std::string& attr) const
 {
 	std::map<std::string, actives>::const_iterator it = uniforms_.find(attr);
 	//ASSERT_LOG(it != uniforms_.end(), "Uniform \"" << attr << "\" not found in list.");
@@ -199,6 +203,21 @@ GLint program::get_uniform(const std::string& attr) const
 	return it->second.location;
 }
 
+GLint program::get_uniform(const std::string& attr) const
+{
+	const GLint location = find_uniform(attr);
+	if(location != -1) {
+		unshadowed_uniforms_.insert(location);
+	}
+	return location;
+}
+
+GLint program::mvp_matrix_uniform() const
+{
+	unshadowed_uniforms_.insert(u_mvp_matrix_);
+	return u_mvp_matrix_;
+}
+
 bool program::queryAttributes()
 {
 	GLint active_attribs;
@@ -255,9 +274,44 @@ variant program::get_uniform_value(const std::string& key) const
 	return it->second.last_value;
 }
 
+bool program::uniform_changed(GLint location, const GLfloat* v, int n)
+{
+	if(unshadowed_uniforms_.count(location)) {
+		gl_state::count_call(true);
+		return true;
+	}
+
+	std::vector<GLfloat>& shadow = uniform_shadow_[location];
+	if(shadow.size() == n && std::equal(v, v + n, shadow.begin())) {
+		gl_state::count_call(false);
+		return false;
+	}
+
+	shadow.assign(v, v + n);
+	gl_state::count_call(true);
+	return true;
+}
+
 void program::set_uniform(const actives_map_iterator& it, const GLsizei count, const GLfloat* fv)
 {
-	const actives& u = it->second;
+	actives& u = it->second;
+	int nfloats = count;
+	switch(u.type) {
+	case GL_FLOAT_VEC2: nfloats *= 2; break;
+	case GL_FLOAT_VEC3: nfloats *= 3; break;
+	case GL_FLOAT_VEC4: nfloats *= 4; break;
+	case GL_FLOAT_MAT2: nfloats *= 4; break;
+	case GL_FLOAT_MAT3: nfloats *= 9; break;
+	case GL_FLOAT_MAT4: nfloats *= 16; break;
+	default: break;
+	}
+
+	//this bypasses the variant copy, so that no longer says what GL has.
+	u.sent_value = variant();
+	if(!uniform_changed(u.location, fv, nfloats)) {
+		return;
+	}
+
 	switch(u.type) {
 	case GL_FLOAT: {
 		glUniform1fv(u.location, count, fv);
@@ -295,7 +349,16 @@ void program::set_uniform(const actives_map_iterator& it, const GLsizei count, c
 
 void program::set_uniform(const actives_map_iterator& it, const variant& value)
 {
-	const actives& u = it->second;
+	actives& u = it->second;
+	if(!u.sent_value.is_null() && u.sent_value == value && !unshadowed_uniforms_.count(u.location)) {
+		gl_state::count_call(false);
+		return;
+	}
+
+	u.sent_value = value;
+	uniform_shadow_.erase(u.location);
+	gl_state::count_call(true);
+
 	switch(u.type) {
 	case GL_FLOAT: {
 		glUniform1f(u.location, GLfloat(value.as_decimal().as_float()));
@@ -410,10 +473,10 @@ void program::set_uniform_or_defer(actives_map_iterator& it, const variant& valu
 {
 	it->second.last_value = value;
 
-	GLint cur_prog;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &cur_prog);
-	if(cur_prog != get()) {
-		uniforms_to_update_.push_back(it);
+	if(gl_state::current_program() != get()) {
+		if(std::find(uniforms_to_update_.begin(), uniforms_to_update_.end(), it) == uniforms_to_update_.end()) {
+			uniforms_to_update_.push_back(it);
+		}
 		return;
 	}
 	set_uniform(it, value);
@@ -728,7 +791,7 @@ namespace {
 		virtual void execute(formula_callable& ob) const
 		{
 			glEnable(GL_BLEND);
-			glBlendFunc(src_, dst_);
+			gl_state::blend_func(src_, dst_);
 		}
 	private:
 		GLenum src_;
@@ -993,44 +1056,44 @@ void program::set_fixed_attributes()
 
 void program::set_fixed_uniforms(const variant& node)
 {
-	u_discard_ = get_uniform("u_anura_discard");
+	u_discard_ = find_uniform("u_anura_discard");
 
 	if(node.has_key("mvp_matrix")) {
-		u_mvp_matrix_ = GLint(get_uniform(node["mvp_matrix"].as_string()));
+		u_mvp_matrix_ = GLint(find_uniform(node["mvp_matrix"].as_string()));
 		ASSERT_LOG(u_mvp_matrix_ != -1, "mvp_matrix uniform given but nothing in corresponding shader.");
 	} else {
 		u_mvp_matrix_ = -1;
 	}
 
 	if(node.has_key("sprite_area")) {
-		u_sprite_area_ = GLint(get_uniform(node["sprite_area"].as_string()));
+		u_sprite_area_ = GLint(find_uniform(node["sprite_area"].as_string()));
 		ASSERT_LOG(u_mvp_matrix_ != -1, "sprite_area uniform given but nothing in corresponding shader.");
 	} else {
 		u_sprite_area_ = -1;
 	}
 
 	if(node.has_key("draw_area")) {
-		u_draw_area_ = GLint(get_uniform(node["draw_area"].as_string()));
+		u_draw_area_ = GLint(find_uniform(node["draw_area"].as_string()));
 		ASSERT_LOG(u_mvp_matrix_ != -1, "draw_area uniform given but nothing in corresponding shader.");
 	} else {
 		u_draw_area_ = -1;
 	}
 
 	if(node.has_key("cycle")) {
-		u_cycle_ = GLint(get_uniform(node["cycle"].as_string()));
+		u_cycle_ = GLint(find_uniform(node["cycle"].as_string()));
 		ASSERT_LOG(u_mvp_matrix_ != -1, "cycle uniform given but nothing in corresponding shader.");
 	} else {
 		u_cycle_ = -1;
 	}
 
 	if(node.has_key("color")) {
-		u_color_ = GLint(get_uniform(node["color"].as_string()));
+		u_color_ = GLint(find_uniform(node["color"].as_string()));
 		ASSERT_LOG(u_color_ != -1, "color uniform given but nothing in corresponding shader.");
 	} else {
 		u_color_ = -1;
 	}
 	if(node.has_key("point_size")) {
-		u_point_size_ = GLint(get_uniform(node["point_size"].as_string()));
+		u_point_size_ = GLint(find_uniform(node["point_size"].as_string()));
 		ASSERT_LOG(u_point_size_ != -1, "point size uniform given but nothing in corresponding shader.");
 	} else {
 		u_point_size_ = -1;
@@ -1203,19 +1266,24 @@ void program::set_known_uniforms()
 #if defined(USE_SHADERS)
 	if(u_discard_ >= 0) {
 		int value = gles2::get_alpha_test() ? 1 : 0;
-		glUniform1i(u_discard_, value);
+		const GLfloat fvalue = GLfloat(value);
+		if(uniform_changed(u_discard_, &fvalue, 1)) {
+			glUniform1i(u_discard_, value);
+		}
 	}
 
-	if(u_mvp_matrix_ != -1) {
+	if(u_mvp_matrix_ != -1 && uniform_changed(u_mvp_matrix_, glm::value_ptr(gles2::get_mvp_matrix()), 16)) {
 		glUniformMatrix4fv(u_mvp_matrix_, 1, GL_FALSE, glm::value_ptr(gles2::get_mvp_matrix()));
 	}
-	if(u_color_ != -1) {
+	if(u_color_ != -1 && uniform_changed(u_color_, gles2::get_color(), 4)) {
 		glUniform4fv(u_color_, 1, gles2::get_color());
 	}
 	if(u_point_size_ != -1) {
 		GLfloat pt_size;
 		glGetFloatv(GL_POINT_SIZE, &pt_size);
-		glUniform1f(u_point_size_, pt_size);
+		if(uniform_changed(u_point_size_, &pt_size, 1)) {
+			glUniform1f(u_point_size_, pt_size);
+		}
 	}
 #endif
 }
@@ -1223,7 +1291,7 @@ void program::set_known_uniforms()
 void program::set_sprite_area(const GLfloat* fl)
 {
 #if defined(USE_SHADERS)
-	if(u_sprite_area_ != -1) {
+	if(u_sprite_area_ != -1 && uniform_changed(u_sprite_area_, fl, 4)) {
 		glUniform4fv(u_sprite_area_, 1, fl);
 	}
 #endif
@@ -1232,7 +1300,7 @@ void program::set_sprite_area(const GLfloat* fl)
 void program::set_draw_area(const GLfloat* fl)
 {
 #if defined(USE_SHADERS)
-	if(u_draw_area_ != -1) {
+	if(u_draw_area_ != -1 && uniform_changed(u_draw_area_, fl, 4)) {
 		glUniform4fv(u_draw_area_, 1, fl);
 	}
 #endif
@@ -1241,8 +1309,9 @@ void program::set_draw_area(const GLfloat* fl)
 void program::set_cycle(int cycle)
 {
 #if defined(USE_SHADERS)
-	if(u_cycle_ != -1) {
-		glUniform1f(u_cycle_, static_cast<GLfloat>(cycle));
+	const GLfloat fcycle = static_cast<GLfloat>(cycle);
+	if(u_cycle_ != -1 && uniform_changed(u_cycle_, &fcycle, 1)) {
+		glUniform1f(u_cycle_, fcycle);
 	}
 #endif
 }
@@ -1378,13 +1447,12 @@ void shader_program::init(entity* obj)
 	ASSERT_LOG(name_.empty() != true, "Configure not run, before calling init");
 	game_logic::formula_callable_ptr e(this);
 	parent_ = obj;
-	GLint current_program;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
-	glUseProgram(program_object_->get());
+	const GLuint current_program = gl_state::current_program();
+	gl_state::use_program(program_object_->get());
 	for(size_t n = 0; n < create_formulas_.size(); ++n) {
 		e->execute_command(create_formulas_[n]->execute(*e));
 	}
-	glUseProgram(current_program);
+	gl_state::use_program(current_program);
 }
 
 variant shader_program::write()
@@ -1431,7 +1499,7 @@ void shader_program::prepare_draw()
 	glGetError();
 	ASSERT_LOG(glGetError() == GL_NONE, "Error in shader");
 	ASSERT_LOG(glIsProgram(program_object_->get()), "NOT A PROGRAM");
-	glUseProgram(program_object_->get());
+	gl_state::use_program(program_object_->get());
 	ASSERT_LOG(glGetError() == GL_NONE, "Error in shader");
 	program_object_->set_deferred_uniforms();
 	program_object_->set_known_uniforms();
@@ -18,6 +18,7 @@
 #if defined(USE_SHADERS)
 
 #include <map>
+#include <set>
 #include <vector>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/shared_ptr.hpp>
@@ -65,6 +66,8 @@ struct actives
 	GLint location;
 	// Last value
 	variant last_value;
+	// Value last sent to GL, or null if GL's copy isn't known.
+	variant sent_value;
 };
 
 class program;
@@ -100,7 +103,7 @@ public:
 	variant get_attributes_value(const std::string& key) const;
 	game_logic::formula_callable* get_environment() { return environ_; }
 	void set_deferred_uniforms();
-	GLint mvp_matrix_uniform() const { return u_mvp_matrix_; }
+	GLint mvp_matrix_uniform() const;
 	GLint vertex_attribute() const { return vertex_location_; }
 	GLint texcoord_attribute() const { return texcoord_location_; }
 	GLuint get_fixed_attribute(const std::string& name) const;
@@ -138,9 +141,15 @@ public:
 	const shader& fragment_shader() const { return fs_; }
 private:
 	bool link();
+	GLint find_uniform(const std::string& attr) const;
 	bool queryUniforms();
 	bool queryAttributes();
 
+	//compares the values with what was last sent to the uniform at the
+	//given location, remembering them if they differ. Returns true if
+	//they need sending.
+	bool uniform_changed(GLint location, const GLfloat* v, int n);
+
 	std::vector<GLint> active_attributes_;
 	variant stored_attributes_;
 	variant stored_uniforms_;
@@ -163,6 +172,13 @@ private:
 
 	std::vector<std::map<std::string, actives>::iterator> uniforms_to_update_;
 
+	//copies of float uniforms as last sent, keyed by location.
+	std::map<GLint, std::vector<GLfloat> > uniform_shadow_;
+
+	//locations handed out to callers, who may set them with GL directly.
+	//What GL has for these isn't known, so they're always sent.
+	mutable std::set<GLint> unshadowed_uniforms_;
+
 	GLint u_tex_map_;
 	GLint u_mvp_matrix_;
 	GLint u_sprite_area_;
@@ -25,6 +25,7 @@
 #include <vector>
 
 #include "asserts.hpp"
+#include "gl_state.hpp"
 #include "surface.hpp"
 #include "surface_cache.hpp"
 #include "skybox.hpp"
@@ -110,7 +111,7 @@ namespace graphics
 	{
 		// Lighting isn't used.
 		shader_save_context ctx;
-		glUseProgram(shader_->get());
+		gl_state::use_program(shader_->get());
 
 		glBindTexture(GL_TEXTURE_CUBE_MAP, *tex_id_);
 
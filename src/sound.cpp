@@ -14,8 +14,11 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <set>
 #include <vector>
 
 #include <boost/bind.hpp>
@@ -290,17 +293,41 @@ int sdl_play_sound (sound *s, int loops)
 
 #endif
 	
+//how much memory decoded sound effects may use. Past this the least
+//recently played sounds that aren't playing are freed.
+PREF_INT(sound_cache_budget_kb, 32768);
+
+//sounds which decode to more than this, such as ambient loops and voice
+//lines, are freed as soon as they finish playing.
+PREF_INT(sound_transient_size_kb, 1024);
+
+//how many threads decode sound effects.
+PREF_INT(sound_decode_threads, 2);
+
 #if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
-typedef std::map<std::string, Mix_Chunk*> cache_map;
+typedef Mix_Chunk* decoded_sound;
 #else
-typedef std::map<std::string, sound> cache_map;
+typedef sound decoded_sound;
 #endif
+
+struct cache_entry {
+	cache_entry() : data(), bytes(0), last_used(0), played(false) {}
+	decoded_sound data;
+	int bytes;
+	int last_used;
+	bool played;
+};
+
+typedef std::map<std::string, cache_entry> cache_map;
 cache_map cache;
+int cache_bytes = 0, cache_use_count = 0;
+int nevictions = 0, ntransient_evictions = 0;
 
-cache_map threaded_cache;
+//sounds decoded by the decode threads, waiting for process() to move
+//them into the cache.
+std::map<std::string, decoded_sound> threaded_cache;
 threading::mutex cache_mutex;
 
-
 bool sound_init = false;
 
 void thread_load(const std::string& file)
@@ -315,12 +342,10 @@ void thread_load(const std::string& file)
 		threading::lock l(cache_mutex);
 		threaded_cache[file] = chunk;
 	}
-
 #else
 	std::string wav_file = file;
 	wav_file.replace(wav_file.length()-3, wav_file.length(), "wav");
 	sound s("sounds_wav/" + wav_file);
-
 	{
 		threading::lock l(cache_mutex);
 		threaded_cache[file] = s;
@@ -328,7 +353,113 @@ void thread_load(const std::string& file)
 #endif
 }
 
-std::map<std::string, boost::shared_ptr<threading::thread> > loading_threads;
+//files waiting for a decode thread, guarded by cache_mutex.
+std::deque<std::string> decode_queue;
+threading::condition decode_queue_cond;
+bool decode_threads_exit = false;
+std::vector<boost::shared_ptr<threading::thread> > decode_threads;
+
+//files queued or being decoded. Only used from the main thread.
+std::set<std::string> decoding_files;
+
+void decode_thread()
+{
+	for(;;) {
+		std::string file;
+		{
+			threading::lock l(cache_mutex);
+			while(decode_queue.empty() && !decode_threads_exit) {
+				decode_queue_cond.wait(cache_mutex);
+			}
+
+			if(decode_threads_exit) {
+				return;
+			}
+
+			file = decode_queue.front();
+			decode_queue.pop_front();
+		}
+
+		thread_load(file);
+	}
+}
+
+int decoded_bytes(const decoded_sound& data)
+{
+#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
+	return data ? data->alen : 0;
+#else
+	return data.length;
+#endif
+}
+
+void free_decoded(decoded_sound& data)
+{
+#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
+	if(data) {
+		Mix_FreeChunk(data);
+		data = NULL;
+	}
+#else
+	data = sound();
+#endif
+}
+
+bool sound_in_use(const std::string& file, const cache_entry& entry)
+{
+	for(int n = 0; n != channels_to_sounds_playing.size(); ++n) {
+#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
+		if(channels_to_sounds_playing[n].file == file && Mix_Playing(n)) {
+			return true;
+		}
+#else
+		if(n < NumChannels && mixer.channels[n].position != NULL && mixer.channels[n].s == &entry.data) {
+			return true;
+		}
+#endif
+	}
+
+	return false;
+}
+
+void erase_cache_entry(cache_map::iterator i)
+{
+	cache_bytes -= i->second.bytes;
+	free_decoded(i->second.data);
+	cache.erase(i);
+}
+
+//frees long sounds that have finished playing, then the least recently
+//played sounds until the cache is back within its budget.
+void trim_cache()
+{
+	const int transient_bytes = g_sound_transient_size_kb*1024;
+	for(cache_map::iterator i = cache.begin(); i != cache.end(); ) {
+		if(i->second.played && i->second.bytes > transient_bytes && !sound_in_use(i->first, i->second)) {
+			++ntransient_evictions;
+			erase_cache_entry(i++);
+		} else {
+			++i;
+		}
+	}
+
+	while(cache_bytes > g_sound_cache_budget_kb*1024) {
+		cache_map::iterator oldest = cache.end();
+		for(cache_map::iterator i = cache.begin(); i != cache.end(); ++i) {
+			if((oldest == cache.end() || i->second.last_used < oldest->second.last_used) && !sound_in_use(i->first, i->second)) {
+				oldest = i;
+			}
+		}
+
+		if(oldest == cache.end()) {
+			//everything left is playing.
+			break;
+		}
+
+		++nevictions;
+		erase_cache_entry(oldest);
+	}
+}
 
 }
 
@@ -392,7 +523,14 @@ manager::~manager()
 		return;
 	}
 
-	loading_threads.clear();
+	{
+		threading::lock l(cache_mutex);
+		decode_threads_exit = true;
+		decode_queue_cond.notify_all();
+	}
+
+	//the threads are joined as they're destroyed.
+	decode_threads.clear();
 
 #if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
 	Mix_HookMusicFinished(NULL);
@@ -428,16 +566,26 @@ void preload(const std::string& file)
 		return;
 	}
 
-	if(loading_threads.count(file)) {
+	if(cache.count(file) || decoding_files.count(file)) {
 		return;
 	}
 
+	if(decode_threads.empty()) {
+		const int nthreads = std::max<int>(1, g_sound_decode_threads);
+		for(int n = 0; n != nthreads; ++n) {
 #if SDL_VERSION_ATLEAST(2, 0, 0)
-	boost::shared_ptr<threading::thread> t(new threading::thread("sounds", boost::bind(thread_load, file)));
+			decode_threads.push_back(boost::shared_ptr<threading::thread>(new threading::thread("sounds", decode_thread)));
 #else
-	boost::shared_ptr<threading::thread> t(new threading::thread(boost::bind(thread_load, file)));
+			decode_threads.push_back(boost::shared_ptr<threading::thread>(new threading::thread(decode_thread)));
 #endif
-	loading_threads[file] = t;
+		}
+	}
+
+	decoding_files.insert(file);
+
+	threading::lock l(cache_mutex);
+	decode_queue.push_back(file);
+	decode_queue_cond.notify_one();
 }
 
 namespace {
@@ -448,7 +596,8 @@ int play_internal(const std::string& file, int loops, const void* object, float
 		return -1;
 	}
 
-	if(!cache.count(file)) {
+	cache_map::iterator entry = cache.find(file);
+	if(entry == cache.end()) {
 		preload(file);
 		queued_sounds.push_back(sound_playing());
 		queued_sounds.back().file = file;
@@ -460,8 +609,11 @@ int play_internal(const std::string& file, int loops, const void* object, float
 		return -1;
 	}
 
+	entry->second.last_used = ++cache_use_count;
+	entry->second.played = true;
+
 #if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
-	Mix_Chunk* chunk = cache[file];
+	Mix_Chunk* chunk = entry->second.data;
 	if(chunk == NULL) {
 		return -1;
 	}
@@ -472,7 +624,7 @@ int play_internal(const std::string& file, int loops, const void* object, float
 	}
 
 #else
-	sound& s = cache[file];
+	sound& s = entry->second.data;
 	if(s == NULL) {
 		return -1;
 	}
@@ -512,10 +664,14 @@ void process()
 	bool has_items = false;
 	{
 		threading::lock l(cache_mutex);
-		for(cache_map::const_iterator i = threaded_cache.begin(); i != threaded_cache.end(); ++i) {
-			cache.insert(*i);
+		for(std::map<std::string, decoded_sound>::const_iterator i = threaded_cache.begin(); i != threaded_cache.end(); ++i) {
+			cache_entry& entry = cache[i->first];
+			entry.data = i->second;
+			entry.bytes = decoded_bytes(i->second);
+			entry.last_used = ++cache_use_count;
+			cache_bytes += entry.bytes;
 			has_items = true;
-			loading_threads.erase(i->first);
+			decoding_files.erase(i->first);
 		}
 
 		threaded_cache.clear();
@@ -529,6 +685,8 @@ void process()
 		}
 	}
 
+	trim_cache();
+
 	for(int n = 0; n != channels_to_sounds_playing.size(); ++n) {
 #if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_IPHONE
 		sound_playing& snd = channels_to_sounds_playing[n];
@@ -559,6 +717,26 @@ void process()
 #endif
 }
 
+variant memory_usage()
+{
+	int playing_bytes = 0;
+	for(cache_map::const_iterator i = cache.begin(); i != cache.end(); ++i) {
+		if(sound_in_use(i->first, i->second)) {
+			playing_bytes += i->second.bytes;
+		}
+	}
+
+	variant_builder result;
+	result.add("cached_sounds", static_cast<int>(cache.size()));
+	result.add("cached_kb", cache_bytes/1024);
+	result.add("playing_kb", playing_bytes/1024);
+	result.add("budget_kb", g_sound_cache_budget_kb);
+	result.add("decoding", static_cast<int>(decoding_files.size()));
+	result.add("evictions", nevictions);
+	result.add("transient_evictions", ntransient_evictions);
+	return result.build();
+}
+
 void play(const std::string& file, const void* object, float volume, float fade_in_time)
 {
 	if(preferences::no_sound() || mute_) {
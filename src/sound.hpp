@@ -39,6 +39,10 @@ void process();
 //preload a sound effect in the cache.
 void preload(const std::string& file);
 
+//a map of how much memory decoded sound effects use, for the debug console.
+//Music isn't counted, since it's streamed as it plays.
+variant memory_usage();
+
 //play a sound. 'object' is the object that is playing the sound. It can be
 //used later in stop_sound to specify which object is stopping playing
 //the sound.
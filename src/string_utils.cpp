@@ -258,6 +258,81 @@ bool string_starts_with(const std::string& target, const std::string& prefix) {
 	return target_pfx == prefix;
 }
 
+unsigned int utf8_to_codepoint(std::string::const_iterator& i, std::string::const_iterator end) {
+	unsigned int codepoint = 0;
+
+	if((*i & 0xc0) == 0x80) {
+		//*i is an unexpected following byte
+		return 0;
+	}
+	if((*i & 0xc0) == 0xc0) {
+		//*i is the leading byte of an UTF-8 encoded multi-byte character.
+		if ((*i & 0xe0) == 0xc0) {
+			//two byte sequence: 110xxxyy 10yyyyyy
+			codepoint = (*i & 0x1f) << 6;
+			if (++i == end) {
+				return 0;
+			}
+			if ((*i & 0xc0) == 0x80) {
+				codepoint |= *i & 0x3f;
+			} else {
+				codepoint = 0xfffd; // U+FFFD is the replacement character
+			}
+		} else if ((*i & 0xf0) == 0xe0) {
+			//three byte sequence: 1110xxxx 10xxxxyy 10yyyyyy
+			codepoint = (*i & 0x0f) << 12;
+			if (++i == end) {
+				return 0;
+			}
+			if ((*i & 0xc0) == 0x80) {
+				codepoint |= (*i & 0x3f) << 6;
+				if (++i == end) {
+					return 0;
+				}
+				if ((*i & 0xc0) == 0x80) {
+					codepoint |= *i & 0x3f;
+				} else {
+					codepoint = 0xfffd;
+				}
+			} else {
+				codepoint = 0xfffd;
+			}
+		} else if ((*i & 0xf8) == 0xf0) {
+			//four byte sequence: 11110xxx 10xxyyyy 10yyyyzz 10zzzzzz
+			codepoint = (*i & 0x07) << 18;
+			if (++i == end) {
+				return 0;
+			}
+			if ((*i & 0xc0) == 0x80) {
+				codepoint |= (*i & 0x3f) << 12;
+				if (++i == end) {
+					return 0;
+				}
+				if ((*i & 0xc0) == 0x80) {
+					codepoint |= (*i & 0x3f) << 6;
+					if (++i == end) {
+						return 0;
+					}
+					if ((*i & 0xc0) == 0x80) {
+						codepoint |= *i & 0x3f;
+					} else {
+						codepoint = 0xfffd;
+					}
+				} else {
+					codepoint = 0xfffd;
+				}
+			} else {
+				codepoint = 0xfffd;
+			}
+		}
+	} else {
+		//c is an ASCII character
+		codepoint = *i;
+	}
+	return codepoint;
+}
+
+
 std::string strip_string_prefix(const std::string& target, const std::string& prefix) {
 	if(target.length() < prefix.length()) {
 		return "";
@@ -288,3 +363,19 @@ UNIT_TEST(test_split_into_ints)
 	CHECK_EQ(buf[0], 4);
 	CHECK_EQ(buf[1], 0);
 }
+
+UNIT_TEST(test_utf8_to_codepoint)
+{
+	const std::string s = "a\xc3\xa9\xe2\x82\xac";
+	std::string::const_iterator i = s.begin();
+	CHECK_EQ(util::utf8_to_codepoint(i, s.end()), 'a');
+	++i;
+	CHECK_EQ(util::utf8_to_codepoint(i, s.end()), 0xe9);
+	++i;
+	CHECK_EQ(util::utf8_to_codepoint(i, s.end()), 0x20ac);
+	CHECK_EQ(i - s.begin(), s.size() - 1);
+
+	const std::string truncated = "\xe2\x82";
+	i = truncated.begin();
+	CHECK_EQ(util::utf8_to_codepoint(i, truncated.end()), 0);
+}
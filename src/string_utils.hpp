@@ -65,6 +65,11 @@ std::string join_ints(const int* buf, int size);
 bool string_starts_with(const std::string& target, const std::string& prefix);
 std::string strip_string_prefix(const std::string& target, const std::string& prefix);
 
+//decodes the UTF-8 character at i, leaving i at its last byte. Returns 0
+//if the string ends in the middle of a character, and U+FFFD if the
+//character is malformed.
+unsigned int utf8_to_codepoint(std::string::const_iterator& i, std::string::const_iterator end);
+
 template<typename To, typename From>
 std::vector<To> vector_lexical_cast(const std::vector<From>& v) {
 	std::vector<To> result;
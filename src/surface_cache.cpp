@@ -28,6 +28,7 @@
 #endif
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <map>
 
@@ -45,15 +46,40 @@ struct CacheEntry {
 	int64_t mod_time;
 };
 
+//the memory cached surfaces may use. Surfaces nothing else is using are
+//dropped, least recently used first, to stay within it.
+PREF_INT(surface_cache_budget_mb, 256);
+
+cache_budget& surface_budget() {
+	static cache_budget budget(size_t(std::max(0, g_surface_cache_budget_mb)) << 20);
+	return budget;
+}
+
+bool surface_unused(const CacheEntry& entry) {
+	return entry.surf.null() || entry.surf->refcount == 1;
+}
+
 typedef concurrent_cache<std::string,CacheEntry> surface_map;
+
+surface_map* new_surface_map() {
+	surface_map* result = new surface_map;
+	result->set_budget(&surface_budget(), surface_unused);
+	return result;
+}
+
 surface_map& cache() {
-	static surface_map c;
-	return c;
+	static surface_map* c = new_surface_map();
+	return *c;
 }
 
 const std::string path = "./images/";
 }
 
+void init()
+{
+	cache();
+}
+
 void invalidate_modified(std::vector<std::string>* keys_modified)
 {
 	std::vector<std::string> keys = cache().get_keys();
@@ -79,7 +105,7 @@ surface get(const std::string& key)
 			entry.mod_time = sys::file_mod_time(entry.fname);
 		}
 
-		cache().put(key,entry);
+		cache().put(key, entry, surf->h*surf->pitch);
 	}
 
 	return surf;
@@ -144,20 +170,13 @@ surface get_no_cache(const std::string& key, std::string* full_filename)
 
 void clear_unused()
 {
-	surface_map::lock lck(cache());
-	std::map<std::string, CacheEntry>& map = lck.map();
-	std::map<std::string, CacheEntry>::iterator i = map.begin();
-	while(i != map.end()) {
-		//std::cerr << "CACHE REF " << i->first << " -> " << i->second->refcount << "\n";
-		if(i->second.surf->refcount == 1) {
-			//std::cerr << "CACHE FREE " << i->first << "\n";
-			map.erase(i++);
-		} else {
-			++i;
-		}
-	}
+	cache().evict_unused();
+}
 
-	//std::cerr << "CACHE ITEMS: " << map.size() << "\n";
+void write_stats(std::ostream& s)
+{
+	s << "surfaces: " << surface_budget().used()/1024 << "/" << surface_budget().limit()/1024 << "KB\n";
+	write_cache_stats(s, "surface", cache());
 }
 
 void clear()
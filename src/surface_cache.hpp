@@ -18,6 +18,7 @@
 #define SURFACE_CACHE_HPP_INCLUDED
 
 #include <stdint.h>
+#include <ostream>
 #include <string>
 #include <vector>
 
@@ -34,6 +35,9 @@ struct load_image_error
 namespace surface_cache
 {
 
+//sets up the cache and its budget from the prefs. Called once at startup.
+void init();
+
 surface get(const std::string& key);
 surface get_no_cache(const std::string& key, std::string* fname=0);
 surface get_no_cache(data_blob_ptr blob);
@@ -41,6 +45,9 @@ void invalidate_modified(std::vector<std::string>* keys);
 void clear_unused();
 void clear();
 
+//writes the memory used and hits, misses and evictions of the cache.
+void write_stats(std::ostream& s);
+
 }
 
 }
@@ -25,6 +25,7 @@
 #include "formula.hpp"
 #include "formula_callable.hpp"
 #include "formula_function.hpp"
+#include "gl_state.hpp"
 #include "hi_res_timer.hpp"
 #include "module.hpp"
 #include "surface.hpp"
@@ -266,7 +267,7 @@ GLuint get_gl_shader(const std::vector<std::string>& vertex_shader_file,
 
 	shader_cache[std::make_pair(vertex_shader_file, fragment_shader_file)] = program_id;
 
-	glUseProgram(0);
+	gl_state::use_program(0);
 
 	return program_id;
 #else
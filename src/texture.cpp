@@ -20,21 +20,27 @@
 
 #include "IMG_savepng.h"
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
 #include "concurrent_cache.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
+#include "gl_state.hpp"
 #include "preferences.hpp"
 #include "raster.hpp"
 #include "surface_cache.hpp"
 #include "surface_formula.hpp"
 #include "surface_palette.hpp"
 #include "texture.hpp"
+#include "texture_atlas.hpp"
 #include "thread.hpp"
 #include "unit_test.hpp"
+#include <algorithm>
 #include <map>
 #include <set>
 #include <iostream>
+#include <sstream>
+#include <cstdlib>
 #include <cstring>
 
 #include <SDL_thread.h>
@@ -84,21 +90,62 @@ namespace {
 		}
 	};
 
+	//the video memory cached textures may use. Textures nothing else is
+	//using are dropped, least recently used first, to stay within it.
+	PREF_INT(texture_cache_budget_mb, 512);
+
+	cache_budget& texture_budget() {
+		static cache_budget budget(size_t(std::max(0, g_texture_cache_budget_mb)) << 20);
+		return budget;
+	}
+
+	//a texture may only go once nothing else is using it, and only in the
+	//main thread, since deleting it deletes the GL texture.
+	bool texture_evictable(const CacheEntry& entry) {
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+		return (!entry.t.valid() || entry.t.unique()) && SDL_ThreadID() == graphics_thread_id;
+#else
+		return (!entry.t.valid() || entry.t.unique()) && SDL_GetThreadID(NULL) == graphics_thread_id;
+#endif
+	}
+
+	size_t texture_bytes(const texture& t) {
+		if(!t.valid()) {
+			return 0;
+		}
+
+		if(texture::allows_npot()) {
+			return t.width()*t.height()*4;
+		}
+
+		return texture::next_power_of_2(t.width())*texture::next_power_of_2(t.height())*4;
+	}
+
+	template<typename Cache>
+	Cache* new_budgeted_cache() {
+		Cache* cache = new Cache;
+		cache->set_budget(&texture_budget(), texture_evictable);
+		return cache;
+	}
+
+	template<typename Cache>
+	Cache& budgeted_cache() {
+		static Cache* cache = new_budgeted_cache<Cache>();
+		return *cache;
+	}
+
 	typedef concurrent_cache<std::string,CacheEntry> texture_map;
 	texture_map& texture_cache() {
-		static texture_map cache;
-		return cache;
+		return budgeted_cache<texture_map>();
 	}
 	typedef concurrent_cache<std::pair<std::string,std::string>,CacheEntry> algorithm_texture_map;
 	algorithm_texture_map& algorithm_texture_cache() {
-		static algorithm_texture_map cache;
-		return cache;
+		return budgeted_cache<algorithm_texture_map>();
 	}
 
 	typedef concurrent_cache<std::pair<std::string,int>,CacheEntry> palette_texture_map;
 	palette_texture_map& palette_texture_cache() {
-		static palette_texture_map cache;
-		return cache;
+		return budgeted_cache<palette_texture_map>();
 	}
 
 	const size_t TextureBufSize = 128;
@@ -116,6 +163,13 @@ namespace {
 	GLfloat width_multiplier = -1.0;
 	GLfloat height_multiplier = -1.0;
 
+	//where the current texture is in its atlas page, if it's in one.
+	bool current_texture_atlased = false;
+	GLfloat width_offset = 0.0;
+	GLfloat height_offset = 0.0;
+
+	int nbinds = 0;
+
 	bool is_npot_allowed()
     {
 		static bool once = false;
@@ -223,6 +277,13 @@ texture::manager::manager() {
 #else
 	graphics_thread_id = SDL_GetThreadID(NULL);
 #endif
+
+	//make the caches and their budgets now, after the prefs are read and
+	//before any loading thread uses them.
+	texture_cache();
+	algorithm_texture_cache();
+	palette_texture_cache();
+	surface_cache::init();
 }
 
 texture::manager::~manager() {
@@ -480,6 +541,10 @@ void texture::initialize(const key& k, int options)
 
 	id_->s = s;
 
+	if((options&ALLOW_ATLAS) && !id_->atlas_page && !preferences::use_16bpp_textures() && !preferences::use_pretty_scaling()) {
+		place_in_texture_atlas(s->w, s->h, &id_->atlas_page, &id_->atlas_x, &id_->atlas_y);
+	}
+
 	current_texture = 0;
 }
 
@@ -495,6 +560,57 @@ int next_pot (int n)
 
 namespace {
 threading::mutex id_to_build_mutex;
+
+//how many milliseconds of uploads textures drawn in the main thread may
+//use this frame, or -1 if there is no budget, and how much of it and how
+//many uploads have been used so far.
+int upload_budget = -1, upload_budget_spent = 0, upload_budget_uploads = 0;
+
+int nuploads = 0, upload_ms = 0, ndeferred_uploads = 0;
+
+//what textures that haven't been sent to the GPU yet draw as.
+unsigned int transparent_texture_id()
+{
+	static unsigned int id = 0;
+	if(id == 0) {
+		const unsigned int pixel = 0;
+		id = get_texture_id();
+		glBindTexture(GL_TEXTURE_2D, id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixel);
+		glBindTexture(GL_TEXTURE_2D, current_texture);
+	}
+
+	return id;
+}
+}
+
+texture::upload_budget_scope::upload_budget_scope(int ms) : old_budget_(upload_budget), old_spent_(upload_budget_spent), old_uploads_(upload_budget_uploads)
+{
+	if(ms > 0) {
+		upload_budget = ms;
+		upload_budget_spent = upload_budget_uploads = 0;
+	}
+}
+
+texture::upload_budget_scope::~upload_budget_scope()
+{
+	upload_budget = old_budget_;
+	upload_budget_spent = old_spent_;
+	upload_budget_uploads = old_uploads_;
+}
+
+std::string texture::summarize_uploads()
+{
+	if(nuploads == 0 && ndeferred_uploads == 0) {
+		return "";
+	}
+
+	std::ostringstream s;
+	s << nuploads << " textures uploaded in " << upload_ms << "ms; " << ndeferred_uploads << " uploads deferred";
+	nuploads = upload_ms = ndeferred_uploads = 0;
+	return s.str();
 }
 
 unsigned int texture::get_id() const
@@ -504,20 +620,34 @@ unsigned int texture::get_id() const
 	}
 
 	if(id_->init() == false) {
-		id_->id = get_texture_id();
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+		const bool main_thread = graphics_thread_id == SDL_ThreadID();
+#else
+		const bool main_thread = graphics_thread_id == SDL_GetThreadID(NULL);
+#endif
+		//at least one upload is always allowed, so deferred textures
+		//always get uploaded eventually.
+		if(main_thread && upload_budget != -1 && upload_budget_uploads > 0 && upload_budget_spent >= upload_budget) {
+			++ndeferred_uploads;
+			return transparent_texture_id();
+		}
+
+		const int start_upload = SDL_GetTicks();
+		id_->id = id_->atlas_page ? id_->atlas_page->id() : get_texture_id();
 		if(preferences::use_pretty_scaling()) {
 			id_->s = scale_surface(id_->s);
 		}
 
-#if SDL_VERSION_ATLEAST(2, 0, 0)
-		if(graphics_thread_id != SDL_ThreadID()) {
-#else
-		if(graphics_thread_id != SDL_GetThreadID(NULL)) {
-#endif
+		if(!main_thread) {
 			threading::lock lck(id_to_build_mutex);
 			id_to_build_.push_back(id_);
 		} else {
 			id_->build_id();
+			const int ms = SDL_GetTicks() - start_upload;
+			++nuploads;
+			upload_ms += ms;
+			++upload_budget_uploads;
+			upload_budget_spent += ms;
 		}
 	}
 
@@ -541,27 +671,50 @@ void texture::build_textures_from_worker_threads()
 
 void texture::set_current_texture(unsigned int id)
 {
-	if(!id || current_texture == id) {
+	if(!id) {
+		return;
+	}
+
+	if(current_texture == id) {
+		gl_state::count_call(false);
 		return;
 	}
 
 	glBindTexture(GL_TEXTURE_2D,id);
 	current_texture = id;
+	++nbinds;
+	gl_state::count_call(true);
 }
 
 void texture::set_as_current_texture() const
 {
-	width_multiplier = ratio_w_;
-	height_multiplier = ratio_h_;
+	current_texture_atlased = id_ && id_->atlas_page;
+	if(current_texture_atlased) {
+		const GLfloat page_size = id_->atlas_page->size();
+		width_offset = id_->atlas_x/page_size;
+		height_offset = id_->atlas_y/page_size;
+		width_multiplier = width_/page_size;
+		height_multiplier = height_/page_size;
+	} else {
+		width_multiplier = ratio_w_;
+		height_multiplier = ratio_h_;
+	}
 
 	const unsigned int id = get_id();
-	if(!id || current_texture == id) {
+	if(!id) {
+		return;
+	}
+
+	if(current_texture == id) {
+		gl_state::count_call(false);
 		return;
 	}
 
 	current_texture = id;
 
 	glBindTexture(GL_TEXTURE_2D,id);
+	++nbinds;
+	gl_state::count_call(true);
 }
 
 unsigned int texture::get_current_texture()
@@ -569,6 +722,11 @@ unsigned int texture::get_current_texture()
 	return current_texture;
 }
 
+int texture::num_binds()
+{
+	return nbinds;
+}
+
 texture texture::get(data_blob_ptr blob)
 {
 	ASSERT_LOG(blob != NULL, "NULL data_blob passed to texture::get()");
@@ -583,11 +741,95 @@ texture texture::get(data_blob_ptr blob)
 		entry.t = result = texture(surfs, 0);
 		result.id_->info = (*blob)();
 
-		texture_cache().put((*blob)(), entry);
+		texture_cache().put((*blob)(), entry, texture_bytes(result));
 	}
 	return result;
 }
 
+namespace {
+struct preloaded_image {
+	std::string name, path;
+	surface surf;
+};
+
+//images decoded by preload() which haven't been made into textures yet.
+threading::mutex preloaded_images_mutex;
+std::map<std::string, preloaded_image> preloaded_images;
+
+void decode_images(boost::shared_ptr<std::vector<preloaded_image> > images)
+{
+	foreach(preloaded_image& img, *images) {
+		try {
+			img.surf = surface_cache::get_no_cache(img.name, &img.path);
+		} catch(load_image_error&) {
+		}
+	}
+}
+
+void finish_preloading(boost::shared_ptr<std::vector<preloaded_image> > images)
+{
+	foreach(const preloaded_image& img, *images) {
+		if(img.surf.null()) {
+			continue;
+		}
+
+		{
+			threading::lock lck(preloaded_images_mutex);
+			preloaded_images[img.name] = img;
+		}
+
+		texture::get(img.name);
+
+		//if the texture was already in the cache get() didn't use it.
+		threading::lock lck(preloaded_images_mutex);
+		preloaded_images.erase(img.name);
+	}
+}
+
+//gets a surface decoded by preload() if there is one, otherwise decodes it.
+surface take_decoded_image(const std::string& str, std::string* path)
+{
+	{
+		threading::lock lck(preloaded_images_mutex);
+		std::map<std::string, preloaded_image>::iterator i = preloaded_images.find(str);
+		if(i != preloaded_images.end()) {
+			const surface result = i->second.surf;
+			*path = i->second.path;
+			preloaded_images.erase(i);
+			return result;
+		}
+	}
+
+	return surface_cache::get_no_cache(str, path);
+}
+}
+
+void texture::preload(const std::vector<std::string>& images)
+{
+	//background tasks can only be started from the main thread; images
+	//asked for elsewhere are just decoded when they're first used.
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	if(graphics_thread_id != SDL_ThreadID()) {
+#else
+	if(graphics_thread_id != SDL_GetThreadID(NULL)) {
+#endif
+		return;
+	}
+
+	boost::shared_ptr<std::vector<preloaded_image> > decoding(new std::vector<preloaded_image>);
+	foreach(const std::string& str, images) {
+		if(texture_cache().get(str).t.valid() == false) {
+			preloaded_image img;
+			img.name = str;
+			decoding->push_back(img);
+		}
+	}
+
+	if(decoding->empty() == false) {
+		background_task_pool::submit(boost::bind(decode_images, decoding), boost::bind(finish_preloading, decoding));
+	}
+}
+
 texture texture::get(const std::string& str, int options)
 {
 	ASSERT_LOG(str.empty() == false, "Empty string passed to texture::get()");
@@ -605,24 +847,24 @@ texture texture::get(const std::string& str, int options)
 	if(!result.valid()) {
 		key surfs;
 		CacheEntry entry;
-		surfs.push_back(surface_cache::get_no_cache(str, &entry.path));
+		surfs.push_back(take_decoded_image(str, &entry.path));
 		if(entry.path.empty() == false) {
 			entry.mod_time = sys::file_mod_time(entry.path);
 		}
 		entry.t = result = texture(surfs, options);
 		result.id_->info = str;
 
-		texture_cache().put(str_key, entry);
+		texture_cache().put(str_key, entry, texture_bytes(result));
 		//std::cerr << (next_power_of_2(result.width())*next_power_of_2(result.height())*2)/1024 << "KB TEXTURE " << str << ": " << result.width() << "x" << result.height() << "\n";
 	}
 
 	return result;
 }
 
-texture texture::get(const std::string& str, const std::string& algorithm)
+texture texture::get(const std::string& str, const std::string& algorithm, int options)
 {
 	if(algorithm.empty()) {
-		return get(str);
+		return get(str, options);
 	}
 
 	std::pair<std::string,std::string> k(str, algorithm);
@@ -635,7 +877,7 @@ texture texture::get(const std::string& str, const std::string& algorithm)
 			entry.mod_time = sys::file_mod_time(entry.path);
 		}
 		entry.t = result = texture(surfs);
-		algorithm_texture_cache().put(k, entry);
+		algorithm_texture_cache().put(k, entry, texture_bytes(result));
 	}
 
 	return result;
@@ -660,7 +902,7 @@ texture texture::get_palette_mapped(const std::string& str, int palette)
 			std::cerr << "COULD NOT FIND IMAGE FOR PALETTE MAPPING: '" << str << "'\n";
 		}
 
-		palette_texture_cache().put(k, entry);
+		palette_texture_cache().put(k, entry, texture_bytes(result));
 	}
 
 	return result;
@@ -678,21 +920,37 @@ texture texture::get_no_cache(const surface& surf)
 
 GLfloat texture::get_coord_x(GLfloat x)
 {
+	if(current_texture_atlased) {
+		return width_offset + x*width_multiplier;
+	}
+
 	return npot_allowed ? x : x*width_multiplier;
 }
 
 GLfloat texture::get_coord_y(GLfloat y)
 {
+	if(current_texture_atlased) {
+		return height_offset + y*height_multiplier;
+	}
+
 	return npot_allowed ? y : y*height_multiplier;
 }
 
 GLfloat texture::translate_coord_x(GLfloat x) const
 {
+	if(id_ && id_->atlas_page) {
+		return (id_->atlas_x + x*width_)/GLfloat(id_->atlas_page->size());
+	}
+
 	return npot_allowed ? x : x*ratio_w_;
 }
 
 GLfloat texture::translate_coord_y(GLfloat y) const
 {
+	if(id_ && id_->atlas_page) {
+		return (id_->atlas_y + y*height_)/GLfloat(id_->atlas_page->size());
+	}
+
 	return npot_allowed ? y : y*ratio_h_;
 }
 
@@ -740,14 +998,17 @@ void texture::clear_modified_files_from_cache()
 
 			try {
 				texture_cache().erase(k);
-				texture new_texture = get(k);
+
+				//keys of textures loaded with options look like 'image ~~ options'.
+				const std::string::size_type options_pos = k.find(" ~~ ");
+				texture new_texture = options_pos == std::string::npos ? get(k) : get(k.substr(0, options_pos), atoi(k.c_str() + options_pos + 4));
 				foreach(texture* t, texture_registry()) {
 					if(t->id_ == id) {
 						*t = new_texture;
 					}
 				}
 			} catch(graphics::load_image_error&) {
-				texture_cache().put(k, old_entry);
+				texture_cache().put(k, old_entry, texture_bytes(old_entry.t));
 				error_paths.insert(path);
 			}
 		}
@@ -776,7 +1037,7 @@ void texture::clear_modified_files_from_cache()
 					}
 				}
 			} catch(graphics::load_image_error&) {
-				algorithm_texture_cache().put(k, old_entry);
+				algorithm_texture_cache().put(k, old_entry, texture_bytes(old_entry.t));
 				error_paths.insert(path);
 			}
 		}
@@ -805,7 +1066,7 @@ void texture::clear_modified_files_from_cache()
 					}
 				}
 			} catch(graphics::load_image_error&) {
-				palette_texture_cache().put(k, old_entry);
+				palette_texture_cache().put(k, old_entry, texture_bytes(old_entry.t));
 				error_paths.insert(path);
 			}
 		}
@@ -863,6 +1124,16 @@ void texture::unbuild_all()
 
 void texture::debug_dump_textures(const char* path, const std::string* info_name)
 {
+	std::ostringstream stats;
+	stats << "textures: " << texture_budget().used()/1024 << "/" << texture_budget().limit()/1024 << "KB\n";
+	write_cache_stats(stats, "texture", texture_cache());
+	write_cache_stats(stats, "algorithm texture", algorithm_texture_cache());
+	write_cache_stats(stats, "palette texture", palette_texture_cache());
+	surface_cache::write_stats(stats);
+
+	std::cerr << stats.str();
+	sys::write_file(std::string(path) + "/cache-stats.txt", stats.str());
+
 	for(std::set<texture::ID*>::iterator i = texture_id_registry().begin();
 	    i != texture_id_registry().end(); ++i) {
 		if(info_name && (*i)->info != *info_name) {
@@ -877,7 +1148,7 @@ void texture::debug_dump_textures(const char* path, const std::string* info_name
 	}
 }
 
-texture::ID::ID() : id(static_cast<unsigned int>(-1)), width(0), height(0) {
+texture::ID::ID() : id(static_cast<unsigned int>(-1)), width(0), height(0), atlas_x(0), atlas_y(0) {
 	texture_id_registry().insert(this);
 }
 
@@ -935,6 +1206,14 @@ unsigned int map_color_to_16bpp(unsigned int color)
 
 void texture::ID::build_id()
 {
+	if(atlas_page) {
+		atlas_page->upload(s, atlas_x, atlas_y);
+		id = atlas_page->id();
+		width = s->w;
+		height = s->h;
+		return;
+	}
+
 	glBindTexture(GL_TEXTURE_2D,id);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -1061,6 +1340,15 @@ void texture::ID::unbuild_id()
 
 void texture::ID::destroy()
 {
+	if(atlas_page) {
+		//the page's GL texture goes with the last texture on it.
+		atlas_page->release(atlas_x, atlas_y, s->w, s->h);
+		atlas_page.reset();
+		id = static_cast<unsigned int>(-1);
+		s = surface();
+		return;
+	}
+
 	if(graphics_initialized && init()) {
 		glDeleteTextures(1, &id);
 	}
@@ -29,6 +29,8 @@
 namespace graphics
 {
 
+class texture_atlas_page;
+
 class texture
 {
 public:
@@ -36,7 +38,10 @@ public:
 	static bool allows_npot();
 	static void debug_dump_textures(const char* path, const std::string* info_name=NULL);
 
-	enum {NO_STRIP_SPRITESHEET_ANNOTATIONS = 1};
+	//ALLOW_ATLAS lets a small texture share a GL texture with others. Only
+	//use it for textures drawn with translate_coord_x/y() or get_coord_x/y(),
+	//as its coordinates are remapped into the shared texture.
+	enum {NO_STRIP_SPRITESHEET_ANNOTATIONS = 1, ALLOW_ATLAS = 2};
 	//error thrown if an operation is done from a worker thread that
 	//must be completed by the main graphics thread.
 	struct worker_thread_error {};
@@ -55,6 +60,28 @@ public:
 	//in the main thread.
 	static void build_textures_from_worker_threads();
 
+	//while one of these exists, textures which haven't been sent to the GPU
+	//yet are only sent until uploading has taken the given number of
+	//milliseconds, though at least one is always sent. Any drawn after that
+	//show as transparent until a later frame has time to send them. Without
+	//one, or with a budget of 0, textures are always sent when first drawn.
+	struct upload_budget_scope {
+		explicit upload_budget_scope(int ms);
+		~upload_budget_scope();
+	private:
+		int old_budget_, old_spent_, old_uploads_;
+	};
+
+	//a summary of the textures sent to the GPU and deferred to a later
+	//frame since the last call.
+	static std::string summarize_uploads();
+
+	//starts decoding the given images in a background thread. Once they
+	//are done -- in background_task_pool::pump() -- they're put in the cache,
+	//so get() finds them there instead of decoding them itself. Does nothing
+	//outside the main thread.
+	static void preload(const std::vector<std::string>& images);
+
 	texture();
 	texture(const texture& t);
 	texture(unsigned int id, int width, int height);
@@ -66,12 +93,21 @@ public:
 	unsigned int get_id() const;
 	static void set_current_texture(unsigned int id);
 	static unsigned int get_current_texture();
+
+	//how many times a texture has been bound, for counting binds per frame.
+	static int num_binds();
 	void set_as_current_texture() const;
 	bool valid() const { return id_ != NULL; }
 
+	//true if no other texture shares this one's GL texture.
+	bool unique() const { return id_.unique(); }
+
+	//true if this texture was packed into an atlas page.
+	bool in_atlas() const { return id_ && id_->atlas_page; }
+
 	static texture get(data_blob_ptr blob);
 	static texture get(const std::string& str, int options=0);
-	static texture get(const std::string& str, const std::string& algorithm);
+	static texture get(const std::string& str, const std::string& algorithm, int options=0);
 	static texture get_palette_mapped(const std::string& str, int palette);
 	static texture get_no_cache(const surface& surf);
 	static GLfloat get_coord_x(GLfloat x);
@@ -120,6 +156,12 @@ public:
 		surface s;
 
 		int width, height;
+
+		//if this texture was packed into an atlas page, the page and where
+		//in it the texture is. id is then the page's, and the surface is
+		//kept so the page can be rebuilt.
+		boost::shared_ptr<texture_atlas_page> atlas_page;
+		int atlas_x, atlas_y;
 	};
 
 	static texture get_no_cache(const key& k);
@@ -0,0 +1,222 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/weak_ptr.hpp>
+
+#include "graphics.hpp"
+
+#include "asserts.hpp"
+#include "foreach.hpp"
+#include "preferences.hpp"
+#include "texture_atlas.hpp"
+#include "unit_test.hpp"
+
+namespace graphics
+{
+
+namespace {
+//how big atlas pages are; 0 turns atlasing off.
+PREF_INT(texture_atlas_page_size, 2048);
+
+//images larger than this on either side get a texture of their own.
+PREF_INT(texture_atlas_max_image_size, 512);
+
+//space left between images on a page, so they never bleed into each other.
+const int AtlasPadding = 1;
+
+threading::mutex atlas_pages_mutex;
+std::vector<boost::weak_ptr<texture_atlas_page> > atlas_pages;
+}
+
+rect_packer::rect_packer(int size) : used_(0)
+{
+	free_.push_back(rect(0, 0, size, size));
+}
+
+bool rect_packer::allocate(int w, int h, int* x, int* y)
+{
+	int best = -1;
+	for(int n = 0; n != free_.size(); ++n) {
+		const rect& r = free_[n];
+		if(r.w() >= w && r.h() >= h && (best == -1 || r.w()*r.h() < free_[best].w()*free_[best].h())) {
+			best = n;
+		}
+	}
+
+	if(best == -1) {
+		return false;
+	}
+
+	const rect r = free_[best];
+	free_.erase(free_.begin() + best);
+
+	//split what's left along the shorter leftover side, which keeps the
+	//larger of the two free rectangles as big as possible.
+	rect right, below;
+	if(r.w() - w < r.h() - h) {
+		right = rect(r.x() + w, r.y(), r.w() - w, h);
+		below = rect(r.x(), r.y() + h, r.w(), r.h() - h);
+	} else {
+		right = rect(r.x() + w, r.y(), r.w() - w, r.h());
+		below = rect(r.x(), r.y() + h, w, r.h() - h);
+	}
+
+	if(right.w() > 0 && right.h() > 0) {
+		free_.push_back(right);
+	}
+
+	if(below.w() > 0 && below.h() > 0) {
+		free_.push_back(below);
+	}
+
+	*x = r.x();
+	*y = r.y();
+	used_ += w*h;
+	return true;
+}
+
+void rect_packer::release(const rect& r)
+{
+	used_ -= r.w()*r.h();
+	free_.push_back(r);
+
+	bool merged = true;
+	while(merged) {
+		merged = false;
+		for(int i = 0; i < free_.size() && !merged; ++i) {
+			for(int j = i+1; j < free_.size() && !merged; ++j) {
+				const rect& a = free_[i];
+				const rect& b = free_[j];
+				if(a.y() == b.y() && a.h() == b.h() && (a.x2() == b.x() || b.x2() == a.x())) {
+					free_[i] = rect(std::min(a.x(), b.x()), a.y(), a.w() + b.w(), a.h());
+					merged = true;
+				} else if(a.x() == b.x() && a.w() == b.w() && (a.y2() == b.y() || b.y2() == a.y())) {
+					free_[i] = rect(a.x(), std::min(a.y(), b.y()), a.w(), a.h() + b.h());
+					merged = true;
+				}
+
+				if(merged) {
+					free_.erase(free_.begin() + j);
+				}
+			}
+		}
+	}
+}
+
+texture_atlas_page::texture_atlas_page(int size) : size_(size), id_(0), allocated_(false), packer_(size)
+{}
+
+texture_atlas_page::~texture_atlas_page()
+{
+	if(id_) {
+		glDeleteTextures(1, &id_);
+	}
+}
+
+unsigned int texture_atlas_page::id()
+{
+	threading::lock lck(mutex_);
+	if(id_ == 0) {
+		glGenTextures(1, &id_);
+	}
+
+	return id_;
+}
+
+void texture_atlas_page::upload(const surface& s, int x, int y)
+{
+	const unsigned int page_id = id();
+
+	//the page's storage is made on first use, and again if the GL context
+	//was lost, since all its images are uploaded again after that.
+	const bool has_storage = allocated_ && glIsTexture(page_id);
+	glBindTexture(GL_TEXTURE_2D, page_id);
+	if(!has_storage) {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		const std::vector<unsigned char> blank(size_*size_*4);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size_, size_, 0, GL_RGBA, GL_UNSIGNED_BYTE, &blank[0]);
+		allocated_ = true;
+	}
+
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, s->w, s->h, GL_RGBA, GL_UNSIGNED_BYTE, s->pixels);
+}
+
+bool texture_atlas_page::allocate(int w, int h, int* x, int* y)
+{
+	threading::lock lck(mutex_);
+	return packer_.allocate(w + AtlasPadding, h + AtlasPadding, x, y);
+}
+
+void texture_atlas_page::release(int x, int y, int w, int h)
+{
+	threading::lock lck(mutex_);
+	packer_.release(rect(x, y, w + AtlasPadding, h + AtlasPadding));
+}
+
+bool place_in_texture_atlas(int w, int h, boost::shared_ptr<texture_atlas_page>* page, int* x, int* y)
+{
+	if(g_texture_atlas_page_size <= 0 || w > g_texture_atlas_max_image_size || h > g_texture_atlas_max_image_size || w + AtlasPadding > g_texture_atlas_page_size || h + AtlasPadding > g_texture_atlas_page_size) {
+		return false;
+	}
+
+	threading::lock lck(atlas_pages_mutex);
+	for(int n = 0; n < atlas_pages.size(); ) {
+		boost::shared_ptr<texture_atlas_page> p = atlas_pages[n].lock();
+		if(!p) {
+			//every texture on this page has gone, and with them the page.
+			atlas_pages.erase(atlas_pages.begin() + n);
+			continue;
+		}
+
+		if(p->allocate(w, h, x, y)) {
+			*page = p;
+			return true;
+		}
+
+		++n;
+	}
+
+	boost::shared_ptr<texture_atlas_page> p(new texture_atlas_page(g_texture_atlas_page_size));
+	const bool placed = p->allocate(w, h, x, y);
+	ASSERT_LOG(placed, "Could not place " << w << "x" << h << " image in an empty atlas page");
+	atlas_pages.push_back(p);
+	*page = p;
+	return true;
+}
+
+}
+
+UNIT_TEST(rect_packer)
+{
+	graphics::rect_packer packer(64);
+	int x, y;
+	CHECK_EQ(packer.allocate(32, 32, &x, &y), true);
+	CHECK_EQ(x, 0);
+	CHECK_EQ(y, 0);
+
+	int x2, y2;
+	CHECK_EQ(packer.allocate(32, 64, &x2, &y2), true);
+	CHECK_EQ(packer.allocate(32, 32, &x, &y), true);
+	CHECK_EQ(packer.allocate(1, 1, &x, &y), false);
+
+	//giving space back lets an image that needs all of it fit again.
+	packer.release(rect(x2, y2, 32, 64));
+	CHECK_EQ(packer.allocate(32, 64, &x, &y), true);
+	CHECK_EQ(x, x2);
+	CHECK_EQ(y, y2);
+	CHECK_EQ(packer.used(), 64*64);
+}
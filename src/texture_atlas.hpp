@@ -0,0 +1,89 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TEXTURE_ATLAS_HPP_INCLUDED
+#define TEXTURE_ATLAS_HPP_INCLUDED
+
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "surface.hpp"
+#include "thread.hpp"
+
+namespace graphics
+{
+
+//hands out rectangles from a square area, guillotine style: each rectangle
+//is cut from the free rectangle it fits best, and what's left is split in
+//two. Rectangles given back are merged with free neighbors so the space can
+//be used for something else.
+class rect_packer
+{
+public:
+	explicit rect_packer(int size);
+
+	bool allocate(int w, int h, int* x, int* y);
+	void release(const rect& r);
+
+	//the area handed out and not yet given back.
+	int used() const { return used_; }
+
+private:
+	std::vector<rect> free_;
+	int used_;
+};
+
+//a large GL texture which small textures are packed into, so drawing
+//several of them doesn't need a texture bind for each.
+class texture_atlas_page
+{
+public:
+	explicit texture_atlas_page(int size);
+	~texture_atlas_page();
+
+	int size() const { return size_; }
+
+	//the GL texture of the page; may be called from any thread.
+	unsigned int id();
+
+	//sends the given surface to the page at x, y. Must be called from
+	//the main thread.
+	void upload(const surface& s, int x, int y);
+
+	void release(int x, int y, int w, int h);
+
+private:
+	bool allocate(int w, int h, int* x, int* y);
+
+	friend bool place_in_texture_atlas(int w, int h, boost::shared_ptr<texture_atlas_page>* page, int* x, int* y);
+
+	int size_;
+	unsigned int id_;
+	bool allocated_;
+	threading::mutex mutex_;
+	rect_packer packer_;
+};
+
+//finds room for an image of the given size in an atlas page, creating a new
+//page if none has room. Returns false if the image shouldn't be atlased,
+//such as when it's too large or atlasing is turned off.
+bool place_in_texture_atlas(int w, int h, boost::shared_ptr<texture_atlas_page>* page, int* x, int* y);
+
+}
+
+#endif
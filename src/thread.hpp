@@ -25,6 +25,14 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/smart_ptr.hpp>
 
+//declares a variable of which each thread has its own copy. Only for
+//plain data with a constant initializer.
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 // Threading primitives wrapper for SDL_Thread.
 //
 // This module defines primitives for wrapping C++ around SDL's threading
@@ -0,0 +1,157 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TIMING_WHEEL_HPP_INCLUDED
+#define TIMING_WHEEL_HPP_INCLUDED
+
+#include <vector>
+
+//A timing_wheel holds values which become due at some cycle in the future.
+//Inserting a value and advancing by a cycle are both constant time, no
+//matter how many values are waiting or how far ahead they are due.
+//
+//Values are kept in a hierarchy of wheels of 64 slots each: the first
+//wheel has a slot for each of the next 64 cycles, the second a slot for
+//each of the next 64 blocks of 64 cycles and so forth. When the first
+//wheel wraps around the next slot of the second wheel is spread out over
+//it, and so on up the hierarchy.
+template<typename T>
+class timing_wheel
+{
+public:
+	explicit timing_wheel(int cycle=0) : cycle_(cycle), size_(0)
+	{}
+
+	int cycle() const { return cycle_; }
+	bool empty() const { return size_ == 0; }
+	int size() const { return size_; }
+
+	//removes all values and makes 'cycle' the current cycle.
+	void reset(int cycle) {
+		for(int level = 0; level != NumLevels; ++level) {
+			for(int slot = 0; slot != NumSlots; ++slot) {
+				slots_[level][slot].clear();
+			}
+		}
+
+		overflow_.clear();
+		cycle_ = cycle;
+		size_ = 0;
+	}
+
+	//adds a value which becomes due at the given cycle. Values due at or
+	//before the current cycle become due on the next cycle.
+	void insert(int due, const T& value) {
+		item i = { due > cycle_ ? due : cycle_ + 1, value };
+		place(i);
+		++size_;
+	}
+
+	//advances to the given cycle, appending the values which became due
+	//on the way to 'result' in the order they became due.
+	void advance(int cycle, std::vector<T>* result) {
+		if(cycle < cycle_) {
+			//time went backwards; everything waiting is still waiting.
+			std::vector<item> items;
+			collect(&items);
+			reset(cycle);
+			for(int n = 0; n != items.size(); ++n) {
+				insert(items[n].due, items[n].value);
+			}
+			return;
+		}
+
+		while(cycle_ < cycle) {
+			if(size_ == 0) {
+				cycle_ = cycle;
+				return;
+			}
+
+			++cycle_;
+			cascade();
+
+			std::vector<item>& slot = slots_[0][cycle_&SlotMask];
+			for(int n = 0; n != slot.size(); ++n) {
+				result->push_back(slot[n].value);
+			}
+
+			size_ -= slot.size();
+			slot.clear();
+		}
+	}
+
+private:
+	enum { SlotBits = 6, NumSlots = 1 << SlotBits, SlotMask = NumSlots - 1, NumLevels = 4 };
+
+	struct item {
+		int due;
+		T value;
+	};
+
+	void place(const item& i) {
+		const int delta = i.due - cycle_;
+		for(int level = 0; level != NumLevels; ++level) {
+			if(delta < (1 << (SlotBits*(level+1)))) {
+				slots_[level][(i.due >> (SlotBits*level))&SlotMask].push_back(i);
+				return;
+			}
+		}
+
+		overflow_.push_back(i);
+	}
+
+	//spreads out the slots of the outer wheels which begin on the current
+	//cycle over the wheels below them.
+	void cascade() {
+		int level = 1;
+		while(level != NumLevels && (cycle_ & ((1 << (SlotBits*level)) - 1)) == 0) {
+			++level;
+		}
+
+		for(int n = level-1; n >= 1; --n) {
+			if(n == NumLevels-1 && (cycle_ & ((1 << (SlotBits*NumLevels)) - 1)) == 0) {
+				std::vector<item> items;
+				items.swap(overflow_);
+				for(int m = 0; m != items.size(); ++m) {
+					place(items[m]);
+				}
+			}
+
+			std::vector<item> items;
+			items.swap(slots_[n][(cycle_ >> (SlotBits*n))&SlotMask]);
+			for(int m = 0; m != items.size(); ++m) {
+				place(items[m]);
+			}
+		}
+	}
+
+	void collect(std::vector<item>* items) const {
+		for(int level = 0; level != NumLevels; ++level) {
+			for(int slot = 0; slot != NumSlots; ++slot) {
+				items->insert(items->end(), slots_[level][slot].begin(), slots_[level][slot].end());
+			}
+		}
+
+		items->insert(items->end(), overflow_.begin(), overflow_.end());
+	}
+
+	std::vector<item> slots_[NumLevels][NumSlots];
+	std::vector<item> overflow_;
+	int cycle_;
+	int size_;
+};
+
+#endif
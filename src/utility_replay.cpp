@@ -0,0 +1,106 @@
+/*
+	Copyright (C) 2003-2013 by David White <davewx7@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/intrusive_ptr.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if !defined( _WINDOWS )
+#include <sys/time.h>
+#endif
+
+#include "asserts.hpp"
+#include "controls.hpp"
+#include "custom_object.hpp"
+#include "filesystem.hpp"
+#include "foreach.hpp"
+#include "level.hpp"
+#include "load_level.hpp"
+#include "pause_game_dialog.hpp"
+#include "unit_test.hpp"
+#include "utils.hpp"
+
+namespace {
+int time_us(const struct timeval& begin, const struct timeval& end)
+{
+	return (end.tv_sec - begin.tv_sec)*1000000 + (end.tv_usec - begin.tv_usec);
+}
+}
+
+//plays a level with the controls from a replay saved with --record-replay,
+//as fast as it will go and without drawing anything, then reports how long
+//the cycles took and the checksum of the final state. It fails if that
+//isn't the checksum the replay was recorded with, or the one given.
+UTILITY(replay_level)
+{
+	if(args.size() != 2 && args.size() != 3) {
+		std::cerr << "replay_level usage: <level> <replay file> [expected checksum]\n";
+		return;
+	}
+
+	const std::string replay = sys::read_file(args[1]);
+	ASSERT_LOG(replay.empty() == false, "Could not read replay " << args[1]);
+
+	boost::intrusive_ptr<level> lvl(load_level(args[0]));
+	lvl->set_as_current_level();
+
+	controls::play_replay(replay.c_str(), replay.size());
+
+	std::vector<int> cycle_times;
+	cycle_times.reserve(controls::replay_cycles_remaining());
+
+	struct timeval start_tv;
+	gettimeofday(&start_tv, NULL);
+
+	while(controls::replay_cycles_remaining() > 0 && !lvl->end_game()) {
+		struct timeval begin_tv, end_tv;
+		gettimeofday(&begin_tv, NULL);
+
+		try {
+			lvl->process();
+		} catch(interrupt_game_exception&) {
+			break;
+		}
+
+		custom_object::process_garbage_collection();
+
+		gettimeofday(&end_tv, NULL);
+		cycle_times.push_back(time_us(begin_tv, end_tv));
+	}
+
+	struct timeval finish_tv;
+	gettimeofday(&finish_tv, NULL);
+
+	const int checksum = lvl->checksum();
+
+	std::cout << "replay_level: " << cycle_times.size() << " cycles in " << time_us(start_tv, finish_tv)/1000 << "ms";
+	if(cycle_times.empty() == false) {
+		std::sort(cycle_times.begin(), cycle_times.end());
+		const int percentiles[] = { 50, 90, 99, 100 };
+		foreach(int p, percentiles) {
+			std::cout << "; p" << p << " " << cycle_times[((cycle_times.size()-1)*p)/100] << "us";
+		}
+	}
+
+	std::cout << "; final cycle " << lvl->cycle() << "; checksum " << checksum << "\n";
+
+	const int expected = args.size() == 3 ? atoi(args[2].c_str()) : controls::replay_checksum();
+	ASSERT_LOG(checksum == expected, "Replay checksum " << checksum << " does not match expected checksum " << expected);
+}
@@ -35,6 +35,7 @@
 #include "formula_object.hpp"
 
 #include "i18n.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant.hpp"
 #include "variant_type.hpp"
@@ -63,6 +64,9 @@ namespace {
 std::set<variant*> callable_variants_loading, delayed_variants_loading;
 
 std::vector<CallStackEntry> call_stack;
+//suspended per thread, so that threads evaluating formulas alongside the
+//main thread leave its call stack alone.
+THREAD_LOCAL int call_stack_suspended = 0;
 
 variant last_failed_query_map, last_failed_query_key;
 variant last_query_map;
@@ -81,6 +85,14 @@ void swap_variants_loading(std::set<variant*>& v)
 
 void push_call_stack(const game_logic::formula_expression* frame, const game_logic::formula_callable* callable)
 {
+	if(call_stack_suspended) {
+		return;
+	}
+
+	if(frame) {
+		frame->count_call();
+	}
+
 	call_stack.resize(call_stack.size()+1);
 	call_stack.back().expression = frame;
 	call_stack.back().callable = callable;
@@ -88,9 +100,23 @@ void push_call_stack(const game_logic::formula_expression* frame, const game_log
 
 void pop_call_stack()
 {
+	if(call_stack_suspended) {
+		return;
+	}
+
 	call_stack.pop_back();
 }
 
+suspend_call_stack_scope::suspend_call_stack_scope()
+{
+	++call_stack_suspended;
+}
+
+suspend_call_stack_scope::~suspend_call_stack_scope()
+{
+	--call_stack_suspended;
+}
+
 std::string get_call_stack()
 {
 	variant current_frame;
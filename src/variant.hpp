@@ -67,6 +67,13 @@ struct call_stack_manager {
 	}
 };
 
+//while one of these is alive formula calls aren't recorded on the call
+//stack, which is shared, so that formulas may be evaluated on worker threads.
+struct suspend_call_stack_scope {
+	suspend_call_stack_scope();
+	~suspend_call_stack_scope();
+};
+
 class variant;
 void swap_variants_loading(std::set<variant*>& v);
 
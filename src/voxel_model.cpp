@@ -23,7 +23,9 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include "gl_state.hpp"
 #include "json_parser.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 #include "voxel_model.hpp"
 
@@ -59,6 +61,30 @@ namespace
 		}
 		return res;
 	}
+
+	// models are read once per file and shared, along with the meshes made
+	// from their layers. The parsed file is cached by its contents, so a
+	// model file that has changed gives a new node and is read again.
+	struct CachedModel {
+		variant node;
+		Model model;
+		VoxelMeshCache meshes;
+	};
+
+	boost::shared_ptr<CachedModel> get_cached_model(const std::string& fname)
+	{
+		static std::map<std::string, boost::shared_ptr<CachedModel> > cache;
+
+		const variant node = json::parse_from_file(fname);
+		boost::shared_ptr<CachedModel>& entry = cache[fname];
+		if(!entry || entry->node.get_addr() != node.get_addr()) {
+			entry.reset(new CachedModel);
+			entry->node = node;
+			entry->model = read_model(node);
+		}
+
+		return entry;
+	}
 }
 
 bool operator==(VoxelPos const& p1, VoxelPos const& p2)
@@ -76,6 +102,62 @@ bool VoxelPosLess::operator()(const VoxelPos& p1, const VoxelPos& p2) const
 	return p1 < p2;
 }
 
+VoxelGrid::VoxelGrid(const VoxelMap& map) : origin_(0), size_(0)
+{
+	if(map.empty()) {
+		return;
+	}
+
+	VoxelPos top = map.begin()->first, bot = map.begin()->first;
+	for(const VoxelPair& p : map) {
+		top = glm::min(top, p.first);
+		bot = glm::max(bot, p.first);
+	}
+
+	origin_ = top;
+	size_ = bot - top + VoxelPos(1);
+	cells_.resize(size_.x*size_.y*size_.z);
+
+	std::map<uint32_t, int> palette_index;
+	for(const VoxelPair& p : map) {
+		int& index = palette_index[p.second.color.value()];
+		if(index == 0) {
+			palette_.push_back(p.second.color);
+			index = palette_.size();
+			ASSERT_LOG(index <= std::numeric_limits<uint16_t>::max(), "Too many colors in voxel layer");
+		}
+
+		const VoxelPos pos = p.first - origin_;
+		cells_[(pos.x*size_.y + pos.y)*size_.z + pos.z] = index;
+	}
+}
+
+int VoxelGrid::get(const VoxelPos& p) const
+{
+	const VoxelPos pos = p - origin_;
+	if(pos.x < 0 || pos.y < 0 || pos.z < 0 || pos.x >= size_.x || pos.y >= size_.y || pos.z >= size_.z) {
+		return 0;
+	}
+
+	return cells_[(pos.x*size_.y + pos.y)*size_.z + pos.z];
+}
+
+VoxelMesh::VoxelMesh() : vbo_id(0)
+{
+	for(int n = 0; n != 6; ++n) {
+		vattrib_offsets[n] = cattrib_offsets[n] = num_vertices[n] = 0;
+	}
+	aabb[0] = glm::vec3(std::numeric_limits<float>::max(),std::numeric_limits<float>::max(),std::numeric_limits<float>::max());
+	aabb[1] = glm::vec3(std::numeric_limits<float>::min(),std::numeric_limits<float>::min(),std::numeric_limits<float>::min());
+}
+
+VoxelMesh::~VoxelMesh()
+{
+	if(vbo_id) {
+		glDeleteBuffers(1, &vbo_id);
+	}
+}
+
 bool VoxelArea::voxel_in_area(const VoxelPos& pos) const
 {
 	bool result = true;
@@ -404,7 +486,8 @@ voxel_model::voxel_model(const variant& node)
 {
 	aabb_[0] = glm::vec3(std::numeric_limits<float>::max(),std::numeric_limits<float>::max(),std::numeric_limits<float>::max());
 	aabb_[1] = glm::vec3(std::numeric_limits<float>::min(),std::numeric_limits<float>::min(),std::numeric_limits<float>::min());
-	Model base(read_model(json::parse_from_file(name_)));
+	const boost::shared_ptr<CachedModel> cached = get_cached_model(name_);
+	const Model& base = cached->model;
 
 	attachment_points_ = base.attachment_points;
 
@@ -431,13 +514,13 @@ voxel_model::voxel_model(const variant& node)
 				}
 			}
 
-			children_.push_back(voxel_model_ptr(new voxel_model(left, layer_type)));
+			children_.push_back(voxel_model_ptr(new voxel_model(left, layer_type, &cached->meshes, "left_" + layer_type.name + ":" + left.name)));
 			children_.back()->name_ = "left_" + layer_type.name;
-			children_.push_back(voxel_model_ptr(new voxel_model(right, layer_type)));
+			children_.push_back(voxel_model_ptr(new voxel_model(right, layer_type, &cached->meshes, "right_" + layer_type.name + ":" + right.name)));
 			children_.back()->name_ = "right_" + layer_type.name;
 
 		} else {
-			children_.push_back(voxel_model_ptr(new voxel_model(variation_itor->second, layer_type)));
+			children_.push_back(voxel_model_ptr(new voxel_model(variation_itor->second, layer_type, &cached->meshes, layer_type.name + ":" + variation_itor->second.name)));
 		}
 	}
 
@@ -455,52 +538,87 @@ voxel_model::voxel_model(const variant& node)
 	}
 }
 
-voxel_model::voxel_model(const Layer& layer, const LayerType& layer_type)
+voxel_model::voxel_model(const Layer& layer, const LayerType& layer_type, VoxelMeshCache* mesh_cache, const std::string& mesh_key)
   : name_(layer_type.name), invalidated_(false), model_(1.0f), proto_model_(1.0f)
 {
-	aabb_[0] = glm::vec3(std::numeric_limits<float>::max(),std::numeric_limits<float>::max(),std::numeric_limits<float>::max());
-	aabb_[1] = glm::vec3(std::numeric_limits<float>::min(),std::numeric_limits<float>::min(),std::numeric_limits<float>::min());
-
 	for(const std::pair<std::string, VoxelPos>& pivot : layer_type.pivots) {
 		glm::vec3 point = glm::vec3(pivot.second) + glm::vec3(0.5f);
 
 		pivots_.push_back(std::pair<std::string, glm::vec3>(pivot.first, point));
 	}
 
-	vbo_id_.reset(new GLuint, [](GLuint* id){glDeleteBuffers(1, id); delete id;});
-	glGenBuffers(1, vbo_id_.get());
+	if(mesh_cache) {
+		auto itor = mesh_cache->find(mesh_key);
+		if(itor != mesh_cache->end()) {
+			mesh_ = itor->second.lock();
+		}
+	}
+
+	if(!mesh_) {
+		aabb_[0] = glm::vec3(std::numeric_limits<float>::max(),std::numeric_limits<float>::max(),std::numeric_limits<float>::max());
+		aabb_[1] = glm::vec3(std::numeric_limits<float>::min(),std::numeric_limits<float>::min(),std::numeric_limits<float>::min());
+
+		boost::shared_ptr<VoxelMesh> mesh(new VoxelMesh);
+		glGenBuffers(1, &mesh->vbo_id);
+
+		std::vector<GLfloat> varray[6];
+		std::vector<GLubyte> carray[6];
+
+		const VoxelGrid grid(layer.map);
+		VoxelPair p;
+		for(p.first.x = grid.origin().x; p.first.x != grid.origin().x + grid.size().x; ++p.first.x) {
+			for(p.first.y = grid.origin().y; p.first.y != grid.origin().y + grid.size().y; ++p.first.y) {
+				for(p.first.z = grid.origin().z; p.first.z != grid.origin().z + grid.size().z; ++p.first.z) {
+					const int index = grid.get(p.first);
+					if(index == 0) {
+						continue;
+					}
 
-	std::vector<GLfloat> varray[6];
-	std::vector<GLubyte> carray[6];
+					p.second.color = grid.color(index);
+					for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
+						if(grid.get(glm::ivec3(normal_vectors()[n]) + p.first) == 0) {
+							add_face(n, p, varray[n], carray[n]);
+						}
+					}
+				}
+			}
+		}
 
-	for(auto p : layer.map) {
+		size_t total_size = 0;
+		for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
+			mesh->vattrib_offsets[n] = total_size;
+			total_size += varray[n].size() * sizeof(GLfloat);
+			mesh->num_vertices[n] = varray[n].size() / 3;
+		}
 		for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
-			glm::ivec3 pos = glm::ivec3(normal_vectors()[n]) + p.first;
-			if(layer.map.find(pos) == layer.map.end()) {
-				add_face(n, p, varray[n], carray[n]);
+			mesh->cattrib_offsets[n] = total_size;
+			total_size += carray[n].size() * sizeof(uint8_t);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo_id);
+		glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_STATIC_DRAW);
+		for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
+			if(varray[n].empty() == false) {
+				glBufferSubData(GL_ARRAY_BUFFER, mesh->vattrib_offsets[n], varray[n].size()*sizeof(GLfloat), &varray[n][0]);
 			}
 		}
-	}
+		for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
+			if(carray[n].empty() == false) {
+				glBufferSubData(GL_ARRAY_BUFFER, mesh->cattrib_offsets[n], carray[n].size()*sizeof(uint8_t), &carray[n][0]);
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	size_t total_size = 0;
-	for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
-		vattrib_offsets_[n] = total_size;
-		total_size += varray[n].size() * sizeof(GLfloat);
-		num_vertices_[n] = varray[n].size() / 3;
-	}
-	for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
-		cattrib_offsets_[n] = total_size;
-		total_size += carray[n].size() * sizeof(uint8_t);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, *vbo_id_);
-	glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_STATIC_DRAW);
-	for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
-		glBufferSubData(GL_ARRAY_BUFFER, vattrib_offsets_[n], varray[n].size()*sizeof(GLfloat), &varray[n][0]);
-	}
-	for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
-		glBufferSubData(GL_ARRAY_BUFFER, cattrib_offsets_[n], carray[n].size()*sizeof(uint8_t), &carray[n][0]);
+		mesh->aabb[0] = aabb_[0];
+		mesh->aabb[1] = aabb_[1];
+		mesh_ = mesh;
+
+		if(mesh_cache) {
+			(*mesh_cache)[mesh_key] = mesh_;
+		}
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	aabb_[0] = mesh_->aabb[0];
+	aabb_[1] = mesh_->aabb[1];
 }
 
 void voxel_model::get_bounding_box(glm::vec3& b1, glm::vec3& b2)
@@ -820,17 +938,16 @@ void voxel_model::draw(graphics::lighting_ptr lighting, camera_callable_ptr came
 	for(auto child : children_) {
 		child->draw(lighting, camera, model);
 	}
-	if(vbo_id_) {
-		GLint cur_program;
-		glGetIntegerv(GL_CURRENT_PROGRAM, &cur_program);
+	if(mesh_) {
+		const GLuint cur_program = gl_state::current_program();
 
 		static GLuint u_mvp = -1;
 		if(u_mvp == -1) {
-			u_mvp = glGetUniformLocation(cur_program, "mvp_matrix");
+			u_mvp = gles2::active_shader()->shader()->get_uniform("mvp_matrix");
 		}
 		static GLuint u_normal = -1;
 		if(u_normal == -1) {
-			u_normal = glGetUniformLocation(cur_program, "u_normal");
+			u_normal = gles2::active_shader()->shader()->get_uniform("u_normal");
 		}
 		static GLuint a_position = -1;
 		if(a_position == -1) {
@@ -849,16 +966,16 @@ void voxel_model::draw(graphics::lighting_ptr lighting, camera_callable_ptr came
 			lighting->set_modelview_matrix(mdl, camera->view_mat());
 		}
 
-		glBindBuffer(GL_ARRAY_BUFFER, *vbo_id_);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh_->vbo_id);
 		glEnableVertexAttribArray(a_position);
 		glEnableVertexAttribArray(a_color);
 		for(int n = FACE_LEFT; n != MAX_FACES; ++n) {
 			if(u_normal != -1) {
 				glUniform3fv(u_normal, 1, glm::value_ptr(normal_vectors()[n]));
 			}
-			glVertexAttribPointer(a_position, 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const GLfloat*>(vattrib_offsets_[n]));
-			glVertexAttribPointer(a_color, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, reinterpret_cast<const GLfloat*>(cattrib_offsets_[n]));
-			glDrawArrays(GL_TRIANGLES, 0, num_vertices_[n]);
+			glVertexAttribPointer(a_position, 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const GLfloat*>(mesh_->vattrib_offsets[n]));
+			glVertexAttribPointer(a_color, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, reinterpret_cast<const GLfloat*>(mesh_->cattrib_offsets[n]));
+			glDrawArrays(GL_TRIANGLES, 0, mesh_->num_vertices[n]);
 		}
 		glDisableVertexAttribArray(a_color);
 		glDisableVertexAttribArray(a_position);
@@ -936,4 +1053,25 @@ END_DEFINE_CALLABLE(voxel_model)
 
 }
 
+UNIT_TEST(voxel_grid)
+{
+	voxel::VoxelMap map;
+	voxel::Voxel red, blue;
+	red.color = graphics::color(255, 0, 0);
+	blue.color = graphics::color(0, 0, 255);
+	map[voxel::VoxelPos(-2, 0, 1)] = red;
+	map[voxel::VoxelPos(1, 3, 1)] = blue;
+	map[voxel::VoxelPos(0, 0, 2)] = red;
+
+	const voxel::VoxelGrid grid(map);
+	CHECK_EQ(grid.palette_size(), 2);
+	CHECK_EQ(grid.size().x, 4);
+	CHECK_EQ(grid.size().y, 4);
+	CHECK_EQ(grid.size().z, 2);
+	CHECK_EQ(grid.get(voxel::VoxelPos(-2, 0, 1)), grid.get(voxel::VoxelPos(0, 0, 2)));
+	CHECK_EQ(grid.color(grid.get(voxel::VoxelPos(1, 3, 1))) == blue.color, true);
+	CHECK_EQ(grid.get(voxel::VoxelPos(0, 0, 1)), 0);
+	CHECK_EQ(grid.get(voxel::VoxelPos(5, 0, 1)), 0);
+}
+
 #endif
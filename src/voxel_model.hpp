@@ -32,6 +32,8 @@
 #include <boost/array.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/intrusive_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 
 #include <glm/glm.hpp>
 
@@ -79,6 +81,28 @@ struct VoxelPosHash
 typedef std::map<VoxelPos, Voxel, VoxelPosLess> VoxelMap;
 typedef std::pair<VoxelPos, Voxel> VoxelPair;
 
+// a dense copy of a voxel map covering just the box around its voxels, with
+// each voxel stored as an index into a palette of the colors used. Looking a
+// position up is a single array access rather than a search of the map.
+class VoxelGrid
+{
+public:
+	explicit VoxelGrid(const VoxelMap& map);
+
+	// one more than the palette index of the voxel at pos, or 0 if there
+	// isn't one.
+	int get(const VoxelPos& pos) const;
+	const graphics::color& color(int n) const { return palette_[n-1]; }
+
+	const VoxelPos& origin() const { return origin_; }
+	const VoxelPos& size() const { return size_; }
+	int palette_size() const { return palette_.size(); }
+private:
+	VoxelPos origin_, size_;
+	std::vector<graphics::color> palette_;
+	std::vector<uint16_t> cells_;
+};
+
 variant write_voxels(const std::vector<VoxelPos>& positions, const Voxel& voxel);
 void read_voxels(const variant& v, VoxelMap* out);
 
@@ -133,6 +157,21 @@ struct Model {
 	decimal scale;
 };
 
+// the geometry of one layer variation, uploaded to a VBO. Every model made
+// from the same file shares the meshes of the variations it uses.
+struct VoxelMesh {
+	VoxelMesh();
+	~VoxelMesh();
+	GLuint vbo_id;
+	size_t vattrib_offsets[6];
+	size_t cattrib_offsets[6];
+	size_t num_vertices[6];
+	glm::vec3 aabb[2];
+};
+
+typedef boost::shared_ptr<const VoxelMesh> VoxelMeshPtr;
+typedef std::map<std::string, boost::weak_ptr<const VoxelMesh> > VoxelMeshCache;
+
 LayerType read_layer_type(const variant& v);
 
 Model read_model(const variant& v);
@@ -146,7 +185,7 @@ class voxel_model : public game_logic::formula_callable
 {
 public:
 	explicit voxel_model(const variant& node);
-	voxel_model(const Layer& layer, const LayerType& layer_type);
+	voxel_model(const Layer& layer, const LayerType& layer_type, VoxelMeshCache* mesh_cache=NULL, const std::string& mesh_key="");
 
 	voxel_model_ptr get_child(const std::string& id) const;
 
@@ -216,11 +255,7 @@ private:
 
 	bool invalidated_;
 
-	typedef boost::shared_ptr<GLuint> vbo_ptr;
-	vbo_ptr vbo_id_;
-	size_t vattrib_offsets_[6];
-	size_t cattrib_offsets_[6];
-	size_t num_vertices_[6];
+	VoxelMeshPtr mesh_;
 
 	glm::vec3 aabb_[2];
 
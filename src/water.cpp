@@ -25,6 +25,7 @@
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "formula.hpp"
+#include "gl_state.hpp"
 #include "level.hpp"
 #include "raster.hpp"
 #include "string_utils.hpp"
@@ -223,7 +224,7 @@ bool water::draw_area(const water::area& a, int x, int y, int w, int h) const
 #else
 	glVertexPointer(2, GL_FLOAT, 0, vertices);
 #endif
-	glBlendFunc(GL_ONE, GL_ONE);
+	gl_state::blend_func(GL_ONE, GL_ONE);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, sizeof(vertices)/sizeof(GLfloat)/2);
 #if defined(TARGET_OS_HARMATTAN) || defined(TARGET_PANDORA) || defined(TARGET_TEGRA) || defined(TARGET_BLACKBERRY)
 	if (glBlendEquationOES) {
@@ -238,7 +239,7 @@ bool water::draw_area(const water::area& a, int x, int y, int w, int h) const
 		glBlendEquation(GL_FUNC_ADD);
 	}
 #endif
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	glLineWidth(2.0);
 
@@ -18,6 +18,7 @@
 
 #include "asserts.hpp"
 #include "foreach.hpp"
+#include "gl_state.hpp"
 #include "preferences.hpp"
 #include "raster.hpp"
 #include "tooltip.hpp"
@@ -306,13 +307,12 @@ void widget::draw() const
 	if(visible_) {
 		color_save_context color_saver;
 
-		GLint src = 0;
-		GLint dst = 0;
+		GLenum src = 0;
+		GLenum dst = 0;
 #if !defined(USE_SHADERS)
-			glGetIntegerv(GL_BLEND_SRC, &src);
-			glGetIntegerv(GL_BLEND_DST, &dst);
+			gl_state::get_blend_func(&src, &dst);
 #endif
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		if(disabled_) {
 			glColor4ub(255, 255, 255, disabled_opacity_);
 		} else if(display_alpha_ < 256) {
@@ -332,7 +332,7 @@ void widget::draw() const
 			handle_draw();
 		}
 #if !defined(USE_SHADERS)
-		glBlendFunc(src, dst);
+		gl_state::blend_func(src, dst);
 #endif
 	}
 }